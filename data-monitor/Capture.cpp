@@ -0,0 +1,123 @@
+#include "Capture.h"
+
+#include <cerrno>
+#include <cstring>
+#include "Clock.h"
+
+CaptureWriter::CaptureWriter(const char *path) : _path(path), _failed(false), _frames(0) {
+}
+
+CaptureWriter::~CaptureWriter() {
+    if (_file != NULL) {
+        fclose(_file);
+    }
+}
+
+bool CaptureWriter::open(void) {
+    _file = fopen(_path.c_str(), "wb");
+    if (_file == NULL) {
+        printf("Could not create capture file %s: %s\n", _path.c_str(), strerror(errno));
+        return false;
+    }
+    setvbuf(_file, NULL, _IOFBF, 64 * 1024);
+
+    CaptureHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CAPTURE_MAGIC, sizeof(header.magic));
+    header.version = CAPTURE_VERSION;
+    header.start_wall_ms = wallClockMillis();
+    header.start_mono_ns = monotonicNanos();
+    if (fwrite(&header, sizeof(header), 1, _file) != 1 || fflush(_file) != 0) {
+        printf("Could not write capture file %s: %s\n", _path.c_str(), strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void CaptureWriter::append(uint64_t time_ns, uint8_t pipe, const void *data, uint8_t len) {
+    uint8_t record[CAPTURE_RECORD_HEADER_SIZE + CAPTURE_FRAME_MAX];
+
+    if (_failed.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (len > CAPTURE_FRAME_MAX) {
+        len = CAPTURE_FRAME_MAX;
+    }
+
+    memcpy(record, &time_ns, sizeof(time_ns));
+    record[8] = pipe;
+    record[9] = len;
+    memcpy(record + CAPTURE_RECORD_HEADER_SIZE, data, len);
+
+    // The stdio buffer takes this without a syscall almost every time
+    if (fwrite(record, CAPTURE_RECORD_HEADER_SIZE + len, 1, _file) != 1) {
+        printf("Could not write capture file %s, capture stopped: %s\n", _path.c_str(), strerror(errno));
+        _failed.store(true, std::memory_order_relaxed);
+        return;
+    }
+    _frames.fetch_add(1, std::memory_order_relaxed);
+}
+
+void CaptureWriter::flush(void) {
+    if (_failed.load(std::memory_order_relaxed)) {
+        return;
+    }
+    if (fflush(_file) != 0) {
+        printf("Could not write capture file %s, capture stopped: %s\n", _path.c_str(), strerror(errno));
+        _failed.store(true, std::memory_order_relaxed);
+    }
+}
+
+uint64_t CaptureWriter::frames(void) {
+    return _frames.load(std::memory_order_relaxed);
+}
+
+CaptureReader::CaptureReader(const char *path) : _path(path) {
+    memset(&_header, 0, sizeof(_header));
+}
+
+CaptureReader::~CaptureReader() {
+    if (_file != NULL) {
+        fclose(_file);
+    }
+}
+
+bool CaptureReader::open(void) {
+    _file = fopen(_path.c_str(), "rb");
+    if (_file == NULL) {
+        printf("Could not open capture file %s: %s\n", _path.c_str(), strerror(errno));
+        return false;
+    }
+    setvbuf(_file, NULL, _IOFBF, 64 * 1024);
+
+    if (fread(&_header, sizeof(_header), 1, _file) != 1 ||
+        memcmp(_header.magic, CAPTURE_MAGIC, sizeof(_header.magic)) != 0) {
+        printf("%s is not a capture file\n", _path.c_str());
+        return false;
+    }
+    if (_header.version != CAPTURE_VERSION) {
+        printf("Capture file %s is version %d, expected %d\n", _path.c_str(), _header.version, CAPTURE_VERSION);
+        return false;
+    }
+    return true;
+}
+
+bool CaptureReader::next(CaptureRecord *record) {
+    uint8_t header[CAPTURE_RECORD_HEADER_SIZE];
+
+    if (fread(header, sizeof(header), 1, _file) != 1) {
+        return false;
+    }
+    memcpy(&record->time_ns, header, sizeof(record->time_ns));
+    record->pipe = header[8];
+    record->len = header[9];
+    if (record->len > CAPTURE_FRAME_MAX) {
+        printf("Capture file %s has a %d byte frame, stopping there\n", _path.c_str(), record->len);
+        return false;
+    }
+    return record->len == 0 || fread(record->data, record->len, 1, _file) == 1;
+}
+
+uint64_t CaptureReader::wallMillis(const CaptureRecord &record) {
+    return _header.start_wall_ms + (int64_t) (record.time_ns - _header.start_mono_ns) / 1000000;
+}
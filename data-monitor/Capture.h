@@ -0,0 +1,75 @@
+#ifndef CAPTURE_H_
+#define CAPTURE_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <stdio.h>
+#include <string>
+
+#define CAPTURE_MAGIC "PMCAP"
+#define CAPTURE_VERSION 1
+
+// Largest frame the radio can deliver
+#define CAPTURE_FRAME_MAX 32
+
+// Records are buffered and written out at least this often
+#define CAPTURE_FLUSH_MS 1000
+
+struct CaptureHeader {
+    char magic[6];
+    uint16_t version;
+    // The wall clock and monotonic clock when the capture started, to turn the
+    // monotonic timestamps of the records back into the times they were received
+    uint64_t start_wall_ms;
+    uint64_t start_mono_ns;
+};
+
+// Each record is written as its timestamp, pipe and length followed by just the bytes
+// received, so a compact frame takes 10 bytes plus its length
+struct CaptureRecord {
+    // Monotonic clock, in nanoseconds
+    uint64_t time_ns;
+    uint8_t pipe;
+    uint8_t len;
+    uint8_t data[CAPTURE_FRAME_MAX];
+};
+
+#define CAPTURE_RECORD_HEADER_SIZE 10
+
+// Appends every frame the collector receives to a capture file, as it came off the
+// radio, for replaying through the collector later (see ReplayRadio).  Writes go
+// through a stdio buffer; flush() is called from another thread so the radio thread
+// never waits on the disk.  A capture cut short by a crash reads back up to the last
+// complete record.
+class CaptureWriter {
+  public:
+    CaptureWriter(const char *path);
+    ~CaptureWriter();
+    bool open(void);
+    void append(uint64_t time_ns, uint8_t pipe, const void *data, uint8_t len);
+    void flush(void);
+    uint64_t frames(void);
+  private:
+    std::string _path;
+    FILE *_file = NULL;
+    std::atomic<bool> _failed;
+    std::atomic<uint64_t> _frames;
+};
+
+// Reads a capture back, one record at a time
+class CaptureReader {
+  public:
+    CaptureReader(const char *path);
+    ~CaptureReader();
+    bool open(void);
+    // False at the end of the capture
+    bool next(CaptureRecord *record);
+    // Wall clock time a record was received at
+    uint64_t wallMillis(const CaptureRecord &record);
+  private:
+    std::string _path;
+    FILE *_file = NULL;
+    CaptureHeader _header;
+};
+
+#endif /* CAPTURE_H_ */
@@ -0,0 +1,49 @@
+#ifndef CLOCK_H_
+#define CLOCK_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <time.h>
+
+// While a capture is being replayed, the wall clock is held at the time each frame was
+// captured, so readings come out with the same timestamps at any replay speed.  Zero
+// the rest of the time.
+inline std::atomic<uint64_t> &replayClockMillis(void) {
+    static std::atomic<uint64_t> replay_ms(0);
+    return replay_ms;
+}
+
+// Wall clock time, used to timestamp readings
+inline uint64_t wallClockMillis(void) {
+    uint64_t replay_ms = replayClockMillis().load(std::memory_order_relaxed);
+    if (replay_ms != 0) {
+        return replay_ms;
+    }
+
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Monotonic time, used for timeouts and flush intervals
+inline uint64_t monotonicMillis(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+// Monotonic time in microseconds, for timing the hot path
+inline uint64_t monotonicMicros(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Monotonic time in nanoseconds, for timestamping captured frames
+inline uint64_t monotonicNanos(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+#endif /* CLOCK_H_ */
@@ -0,0 +1,33 @@
+#ifndef CRC32_H_
+#define CRC32_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct Crc32Table {
+    uint32_t entries[256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+// Standard (zlib/ethernet) CRC-32, table driven
+inline uint32_t crc32(const void *data, size_t len, uint32_t crc = 0) {
+    static const Crc32Table table;
+
+    const uint8_t *p = (const uint8_t *) data;
+    crc = ~crc;
+    while (len--) {
+        crc = table.entries[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    }
+    return ~crc;
+}
+
+#endif /* CRC32_H_ */
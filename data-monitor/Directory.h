@@ -0,0 +1,22 @@
+#ifndef DIRECTORY_H_
+#define DIRECTORY_H_
+
+#include <errno.h>
+#include <string>
+#include <sys/stat.h>
+
+// Create a directory and any of its parents that are missing, like mkdir -p.  Returns
+// false with errno set if one couldn't be created.
+inline bool createDirectories(const std::string &path) {
+    for (size_t i = 1; i <= path.size(); i++) {
+        if (i < path.size() && path[i] != '/') {
+            continue;
+        }
+        if (mkdir(path.substr(0, i).c_str(), 0755) < 0 && errno != EEXIST) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#endif /* DIRECTORY_H_ */
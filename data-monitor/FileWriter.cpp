@@ -0,0 +1,76 @@
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include "FileWriter.h"
+#include "InfluxWriter.h"
+
+FileWriter::FileWriter(const char *path) {
+    _path = path;
+    _csv = _path.size() >= 4 && _path.compare(_path.size() - 4, 4, ".csv") == 0;
+}
+
+FileWriter::~FileWriter() {
+    if (_file != NULL) {
+        fclose(_file);
+    }
+}
+
+bool FileWriter::open(void) {
+    _file = fopen(_path.c_str(), "a");
+    if (_file == NULL) {
+        printf("Could not open %s: %s\n", _path.c_str(), strerror(errno));
+        return false;
+    }
+
+    // A new CSV file starts with its header
+    if (_csv && ftell(_file) == 0) {
+        _out = FILE_WRITER_CSV_HEADER;
+    }
+    return true;
+}
+
+void FileWriter::add(const Reading &reading) {
+    char line[INFLUX_LINE_MAX];
+    int len;
+
+    if (_csv) {
+        len = snprintf(line, sizeof(line), "%llu,%04x,%d,%u,%u,%u,%u,%d,%d\n",
+                       (unsigned long long) reading.timestamp_ms, reading.sensor_id, reading.temperature,
+                       reading.moisture, reading.vcc, reading.cycles, reading.retries,
+                       reading.flags & READING_HEARTBEAT ? 1 : 0, reading.flags & READING_FILLED ? 1 : 0);
+    } else {
+        len = influxLine(reading, line, sizeof(line));
+    }
+    _out.append(line, len);
+}
+
+void FileWriter::addRollup(const Rollup &rollup) {
+    char line[INFLUX_LINE_MAX];
+
+    if (!_csv) {
+        _out.append(line, influxRollupLine(rollup, line, sizeof(line)));
+    }
+}
+
+bool FileWriter::flush(void) {
+    if (_out.empty()) {
+        return true;
+    }
+
+    if (fwrite(_out.data(), _out.size(), 1, _file) != 1 || fflush(_file) != 0 || fdatasync(fileno(_file)) != 0) {
+        printf("Could not write %s: %s\n", _path.c_str(), strerror(errno));
+        clearerr(_file);
+        return false;
+    }
+    _out.clear();
+    return true;
+}
+
+void FileWriter::discard(void) {
+    // Keep a new file's header for the retry
+    if (_csv && _out.compare(0, strlen(FILE_WRITER_CSV_HEADER), FILE_WRITER_CSV_HEADER) == 0) {
+        _out.resize(strlen(FILE_WRITER_CSV_HEADER));
+        return;
+    }
+    _out.clear();
+}
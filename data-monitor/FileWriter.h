@@ -0,0 +1,31 @@
+#ifndef FILE_WRITER_H_
+#define FILE_WRITER_H_
+
+#include <stdio.h>
+#include <string>
+#include "Reading.h"
+#include "Sink.h"
+
+#define FILE_WRITER_CSV_HEADER "time_ms,plant_id,temperature,moisture,battery,cycles,retries,heartbeat,filled\n"
+
+// Archives readings to a local file, appending to it across restarts.  Files ending in
+// .csv get one CSV row per reading (and no rollups); anything else gets the same line
+// protocol InfluxDB is sent, rollups included, so it can be loaded into one later.  Each
+// flush is synced to disk before it counts as written.
+class FileWriter : public Sink {
+  public:
+    FileWriter(const char *path);
+    ~FileWriter();
+    bool open(void);
+    void add(const Reading &reading);
+    void addRollup(const Rollup &rollup);
+    bool flush(void);
+    void discard(void);
+  private:
+    std::string _path;
+    bool _csv;
+    FILE *_file = NULL;
+    std::string _out;
+};
+
+#endif /* FILE_WRITER_H_ */
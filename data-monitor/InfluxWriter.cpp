@@ -0,0 +1,314 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "Clock.h"
+#include "InfluxWriter.h"
+
+InfluxWriter::InfluxWriter(const char *host, int port, const char *db) {
+    char buf[255];
+
+    _host = host;
+    _port = port;
+
+    // Timestamps are sent with each record since a batch can sit for a while before
+    // it is written
+    snprintf(buf, sizeof(buf), "/write?db=%s&precision=ms", db);
+    _path = buf;
+
+    snprintf(buf, sizeof(buf), "POST %s HTTP/1.1\r\nHost: %s:%d\r\nContent-Type: text/plain\r\n",
+             _path.c_str(), host, port);
+    _header_prefix = buf;
+
+    _body.reserve(INFLUX_FLUSH_BYTES + 512);
+}
+
+InfluxWriter::~InfluxWriter() {
+    _disconnect();
+}
+
+// Filled forward readings are marked so they can be told from ones the sensor sent.  The
+// link stats ride along with every reading rather than costing writes of their own.
+int influxLine(const Reading &reading, char *line, size_t size) {
+    return snprintf(line, size,
+                    INFLUX_MEASUREMENT ",plant_id=%04x temperature=%d,moisture=%u,cycles=%u,battery=%u,retries=%u,"
+                    "lost=%u,dups=%u,gaps=%u,loss_pct=%u,dup_pct=%u%s %llu\n",
+                    reading.sensor_id, reading.temperature, reading.moisture, reading.cycles, reading.vcc,
+                    reading.retries, reading.lost, reading.duplicates, reading.gaps, reading.loss_pct, reading.dup_pct,
+                    reading.flags & READING_FILLED ? ",filled=1" : "", (unsigned long long) reading.timestamp_ms);
+}
+
+// Timestamped with the start of the window
+int influxRollupLine(const Rollup &rollup, char *line, size_t size) {
+    static const char *measurements[ROLLUP_RESOLUTIONS] = INFLUX_ROLLUP_MEASUREMENTS;
+    static const char *fields[ROLLUP_FIELDS] = {"battery", "moisture", "temperature"};
+    const RollupWindow &window = rollup.window;
+    int len;
+
+    len = snprintf(line, size, "%s,plant_id=%04x count=%u", measurements[rollup.resolution], rollup.sensor_id,
+                   window.count);
+    for (int i = 0; i < ROLLUP_FIELDS; i++) {
+        const RollupStats &stats = window.fields[i];
+        len += snprintf(line + len, size - len, ",%s_min=%d,%s_max=%d,%s_mean=%.2f,%s_last=%d", fields[i],
+                        stats.min, fields[i], stats.max, fields[i], (double) stats.sum / window.count, fields[i],
+                        stats.last);
+    }
+    len += snprintf(line + len, size - len, " %llu\n", (unsigned long long) window.start_ms);
+    return len;
+}
+
+void InfluxWriter::add(const Reading &reading) {
+    char line[INFLUX_LINE_MAX];
+    int len = influxLine(reading, line, sizeof(line));
+
+    if (_records == 0) {
+        _oldest_ms = monotonicMillis();
+    }
+    _body.append(line, len);
+    _records++;
+}
+
+void InfluxWriter::addRollup(const Rollup &rollup) {
+    char line[INFLUX_LINE_MAX];
+    int len = influxRollupLine(rollup, line, sizeof(line));
+
+    if (_records == 0) {
+        _oldest_ms = monotonicMillis();
+    }
+    _body.append(line, len);
+    _records++;
+}
+
+// Whether the current batch should be sent now
+bool InfluxWriter::due(uint64_t now_ms) {
+    if (_records == 0) {
+        return false;
+    }
+    return _body.size() >= INFLUX_FLUSH_BYTES || now_ms - _oldest_ms >= INFLUX_FLUSH_MS;
+}
+
+size_t InfluxWriter::pending(void) {
+    return _records;
+}
+
+// Send the current batch.  On failure the batch is kept to be retried with the next
+// flush, unless it has grown too big to hold on to.
+bool InfluxWriter::flush(void) {
+    if (_records == 0) {
+        return true;
+    }
+
+    // A kept-alive connection may have been closed by the server while idle, so give a
+    // failure on a reused connection one more try on a fresh one
+    bool reused = _fd >= 0;
+    bool sent = _post();
+    if (!sent && reused && _fd < 0) {
+        sent = _post();
+    }
+
+    if (sent) {
+        _body.clear();
+        _records = 0;
+        return true;
+    }
+
+    if (_body.size() > INFLUX_MAX_PENDING_BYTES) {
+        printf("InfluxDB unreachable, dropping %zu records\n", _records);
+        _body.clear();
+        _records = 0;
+    }
+    return false;
+}
+
+// Throw away the current batch, for callers that keep their own copy to retry with
+void InfluxWriter::discard(void) {
+    _body.clear();
+    _records = 0;
+}
+
+bool InfluxWriter::_connect(void) {
+    struct addrinfo hints, *res, *ai;
+    char port[8];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", _port);
+
+    if (getaddrinfo(_host.c_str(), port, &hints, &res) != 0) {
+        printf("Could not resolve InfluxDB host %s\n", _host.c_str());
+        return false;
+    }
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        _fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (_fd < 0) {
+            continue;
+        }
+
+        struct timeval tv = {INFLUX_IO_TIMEOUT_MS / 1000, (INFLUX_IO_TIMEOUT_MS % 1000) * 1000};
+        setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        int one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (connect(_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(_fd);
+        _fd = -1;
+    }
+    freeaddrinfo(res);
+
+    _rlen = 0;
+    return _fd >= 0;
+}
+
+void InfluxWriter::_disconnect(void) {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+    _rlen = 0;
+}
+
+// Write the whole batch as one request, then wait for the server's answer
+bool InfluxWriter::_post(void) {
+    char length[64];
+    int status;
+
+    if (_fd < 0 && !_connect()) {
+        return false;
+    }
+
+    snprintf(length, sizeof(length), "Content-Length: %zu\r\n\r\n", _body.size());
+
+    struct iovec iov[3];
+    iov[0].iov_base = (void *) _header_prefix.data();
+    iov[0].iov_len = _header_prefix.size();
+    iov[1].iov_base = length;
+    iov[1].iov_len = strlen(length);
+    iov[2].iov_base = (void *) _body.data();
+    iov[2].iov_len = _body.size();
+
+    int idx = 0;
+    while (idx < 3) {
+        ssize_t n = writev(_fd, &iov[idx], 3 - idx);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _disconnect();
+            return false;
+        }
+        while (idx < 3 && (size_t) n >= iov[idx].iov_len) {
+            n -= iov[idx].iov_len;
+            idx++;
+        }
+        if (idx < 3) {
+            iov[idx].iov_base = (char *) iov[idx].iov_base + n;
+            iov[idx].iov_len -= n;
+        }
+    }
+
+    if (!_readResponse(&status)) {
+        _disconnect();
+        return false;
+    }
+
+    if (status < 200 || status >= 300) {
+        // 4xx means the batch itself was rejected; retrying it won't help
+        printf("InfluxDB write failed with HTTP %d\n", status);
+        return status >= 400 && status < 500;
+    }
+
+    return true;
+}
+
+bool InfluxWriter::_readMore(void) {
+    if (_rlen == sizeof(_rbuf)) {
+        return false;
+    }
+
+    ssize_t n;
+    do {
+        n = read(_fd, _rbuf + _rlen, sizeof(_rbuf) - _rlen);
+    } while (n < 0 && errno == EINTR);
+
+    if (n <= 0) {
+        return false;
+    }
+    _rlen += n;
+    return true;
+}
+
+// Read the status line and headers, then skip over the body so the connection is
+// ready for the next request
+bool InfluxWriter::_readResponse(int *status) {
+    char *end;
+
+    while ((end = (char *) memmem(_rbuf, _rlen, "\r\n\r\n", 4)) == NULL) {
+        if (!_readMore()) {
+            return false;
+        }
+    }
+
+    size_t header_len = end + 4 - _rbuf;
+    long content_length = -1;
+    bool keep_alive = true;
+
+    *end = '\0';
+    if (sscanf(_rbuf, "HTTP/1.%*d %d", status) != 1) {
+        return false;
+    }
+
+    for (char *line = strstr(_rbuf, "\r\n"); line != NULL; line = strstr(line, "\r\n")) {
+        line += 2;
+        if (strncasecmp(line, "Content-Length:", 15) == 0) {
+            content_length = strtol(line + 15, NULL, 10);
+        } else if (strncasecmp(line, "Connection:", 11) == 0 && strcasestr(line + 11, "close") != NULL) {
+            keep_alive = false;
+        }
+    }
+
+    if (content_length < 0) {
+        // Without a length there is no telling where this response ends
+        content_length = 0;
+        if (*status != 204) {
+            keep_alive = false;
+        }
+    }
+
+    // Drop the headers and body from the buffer, reading the rest of the body if needed
+    size_t remaining = content_length;
+    size_t buffered = _rlen - header_len;
+    if (buffered >= remaining) {
+        memmove(_rbuf, _rbuf + header_len + remaining, buffered - remaining);
+        _rlen = buffered - remaining;
+    } else {
+        remaining -= buffered;
+        _rlen = 0;
+        while (remaining > 0) {
+            if (!_readMore()) {
+                return false;
+            }
+            size_t take = _rlen < remaining ? _rlen : remaining;
+            memmove(_rbuf, _rbuf + take, _rlen - take);
+            _rlen -= take;
+            remaining -= take;
+        }
+    }
+
+    if (!keep_alive) {
+        _disconnect();
+    }
+    return true;
+}
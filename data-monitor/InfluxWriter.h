@@ -0,0 +1,64 @@
+#ifndef INFLUX_WRITER_H_
+#define INFLUX_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "Reading.h"
+#include "Sink.h"
+
+// Measurement all reading fields are written to
+#define INFLUX_MEASUREMENT "plant"
+// and the rollups at each resolution, with min, max, mean and last of each field
+#define INFLUX_ROLLUP_MEASUREMENTS {INFLUX_MEASUREMENT "_1m", INFLUX_MEASUREMENT "_1h", INFLUX_MEASUREMENT "_1d"}
+
+// Longest line a reading or rollup formats to
+#define INFLUX_LINE_MAX 512
+
+// Flush a batch once it grows past this many bytes of line protocol ...
+#define INFLUX_FLUSH_BYTES 16384
+// ... or once the oldest record in it has waited this long
+#define INFLUX_FLUSH_MS 1000
+
+// If the server stays unreachable, give up on a batch once it gets this big
+#define INFLUX_MAX_PENDING_BYTES (1024 * 1024)
+
+// Socket send/receive timeout
+#define INFLUX_IO_TIMEOUT_MS 5000
+
+// Writes readings to InfluxDB's /write endpoint over a single keep-alive HTTP/1.1
+// connection.  Readings are formatted as one line protocol record each and batched
+// into a single POST, sent when the batch is big enough or old enough.
+class InfluxWriter : public Sink {
+  public:
+    InfluxWriter(const char *host, int port, const char *db);
+    ~InfluxWriter();
+    void add(const Reading &reading);
+    void addRollup(const Rollup &rollup);
+    bool due(uint64_t now_ms);
+    bool flush(void);
+    void discard(void);
+    size_t pending(void);
+  private:
+    bool _connect(void);
+    void _disconnect(void);
+    bool _post(void);
+    bool _readResponse(int *status);
+    bool _readMore(void);
+    std::string _host;
+    int _port;
+    std::string _path;
+    std::string _header_prefix;
+    std::string _body;
+    size_t _records = 0;
+    uint64_t _oldest_ms = 0;
+    int _fd = -1;
+    char _rbuf[4096];
+    size_t _rlen = 0;
+};
+
+// One line of line protocol for a reading or rollup, also used for archiving to a file
+int influxLine(const Reading &reading, char *line, size_t size);
+int influxRollupLine(const Rollup &rollup, char *line, size_t size);
+
+#endif /* INFLUX_WRITER_H_ */
@@ -0,0 +1,87 @@
+#include <cstdio>
+#include "Metrics.h"
+
+Histogram::Histogram(const uint32_t *bounds_us, size_t count) : _sum_us(0) {
+    _count = count < METRICS_MAX_BUCKETS ? count : METRICS_MAX_BUCKETS;
+    for (size_t i = 0; i < _count; i++) {
+        _bounds[i] = bounds_us[i];
+    }
+    for (size_t i = 0; i <= METRICS_MAX_BUCKETS; i++) {
+        _buckets[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+void Histogram::observe(uint64_t us) {
+    // Only a handful of bounds, so a straight scan beats a search
+    size_t i = 0;
+    while (i < _count && us > _bounds[i]) {
+        i++;
+    }
+    _buckets[i].fetch_add(1, std::memory_order_relaxed);
+    _sum_us.fetch_add(us, std::memory_order_relaxed);
+}
+
+// Prometheus wants cumulative buckets and seconds.  With a label, the header is left out
+// when help is NULL, as for labelled counters.
+void Histogram::render(std::string *out, const char *name, const char *help, const char *label) const {
+    char buf[192];
+    char labels[96];
+    uint64_t total = 0;
+
+    if (help != NULL) {
+        out->append(buf, snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s histogram\n", name, help, name));
+    }
+    if (label != NULL) {
+        snprintf(labels, sizeof(labels), "{%s}", label);
+    } else {
+        labels[0] = '\0';
+    }
+    for (size_t i = 0; i <= _count; i++) {
+        total += _buckets[i].load(std::memory_order_relaxed);
+        if (i < _count) {
+            out->append(buf, snprintf(buf, sizeof(buf), "%s_bucket{%s%sle=\"%g\"} %llu\n", name,
+                                      label != NULL ? label : "", label != NULL ? "," : "", _bounds[i] / 1e6,
+                                      (unsigned long long) total));
+        } else {
+            out->append(buf, snprintf(buf, sizeof(buf), "%s_bucket{%s%sle=\"+Inf\"} %llu\n", name,
+                                      label != NULL ? label : "", label != NULL ? "," : "", (unsigned long long) total));
+        }
+    }
+    out->append(buf, snprintf(buf, sizeof(buf), "%s_sum%s %.6f\n%s_count%s %llu\n", name, labels,
+                              _sum_us.load(std::memory_order_relaxed) / 1e6, name, labels, (unsigned long long) total));
+}
+
+static void header(std::string *out, const char *name, const char *help, const char *type) {
+    char buf[160];
+    out->append(buf, snprintf(buf, sizeof(buf), "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type));
+}
+
+void metricsCounter(std::string *out, const char *name, const char *help, uint64_t value) {
+    char buf[96];
+    header(out, name, help, "counter");
+    out->append(buf, snprintf(buf, sizeof(buf), "%s %llu\n", name, (unsigned long long) value));
+}
+
+// A counter with one labelled series, for series of the same name to follow without a header
+void metricsCounter(std::string *out, const char *name, const char *help, const char *label, uint64_t value) {
+    char buf[128];
+    if (help != NULL) {
+        header(out, name, help, "counter");
+    }
+    out->append(buf, snprintf(buf, sizeof(buf), "%s{%s} %llu\n", name, label, (unsigned long long) value));
+}
+
+void metricsGauge(std::string *out, const char *name, const char *help, int64_t value) {
+    char buf[96];
+    header(out, name, help, "gauge");
+    out->append(buf, snprintf(buf, sizeof(buf), "%s %lld\n", name, (long long) value));
+}
+
+// A gauge with one labelled series, like the labelled counter
+void metricsGauge(std::string *out, const char *name, const char *help, const char *label, double value) {
+    char buf[128];
+    if (help != NULL) {
+        header(out, name, help, "gauge");
+    }
+    out->append(buf, snprintf(buf, sizeof(buf), "%s{%s} %g\n", name, label, value));
+}
@@ -0,0 +1,53 @@
+#ifndef METRICS_H_
+#define METRICS_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// Most buckets a histogram can have, not counting the one for everything above the last bound
+#define METRICS_MAX_BUCKETS 16
+
+// Counters, gauges and histograms cheap enough to update on the radio thread: every update
+// is a single relaxed atomic operation, nothing allocates or locks.  They're read (with
+// no attempt at a consistent snapshot) when rendered in the Prometheus text format.
+
+class Counter {
+  public:
+    Counter() : _value(0) {}
+    void add(uint64_t n = 1) { _value.fetch_add(n, std::memory_order_relaxed); }
+    uint64_t value(void) const { return _value.load(std::memory_order_relaxed); }
+  private:
+    std::atomic<uint64_t> _value;
+};
+
+class Gauge {
+  public:
+    Gauge() : _value(0) {}
+    void set(int64_t value) { _value.store(value, std::memory_order_relaxed); }
+    int64_t value(void) const { return _value.load(std::memory_order_relaxed); }
+  private:
+    std::atomic<int64_t> _value;
+};
+
+// Durations in microseconds, counted into fixed buckets given by their upper bounds
+class Histogram {
+  public:
+    Histogram(const uint32_t *bounds_us, size_t count);
+    void observe(uint64_t us);
+    void render(std::string *out, const char *name, const char *help, const char *label = NULL) const;
+  private:
+    uint32_t _bounds[METRICS_MAX_BUCKETS];
+    size_t _count;
+    // One per bound plus one for slower than the last; not cumulative
+    std::atomic<uint64_t> _buckets[METRICS_MAX_BUCKETS + 1];
+    std::atomic<uint64_t> _sum_us;
+};
+
+void metricsCounter(std::string *out, const char *name, const char *help, uint64_t value);
+void metricsCounter(std::string *out, const char *name, const char *help, const char *label, uint64_t value);
+void metricsGauge(std::string *out, const char *name, const char *help, int64_t value);
+void metricsGauge(std::string *out, const char *name, const char *help, const char *label, double value);
+
+#endif /* METRICS_H_ */
@@ -0,0 +1,205 @@
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "MqttWriter.h"
+
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PINGREQ 0xc0
+#define MQTT_PINGRESP 0xd0
+
+#define MQTT_RETAIN 0x01
+#define MQTT_CLEAN_SESSION 0x02
+
+// Remaining length, 7 bits at a time with the top bit set on all but the last byte
+static void appendLength(std::string *out, size_t len) {
+    do {
+        uint8_t byte = len % 128;
+        len /= 128;
+        out->push_back((char) (len > 0 ? byte | 0x80 : byte));
+    } while (len > 0);
+}
+
+static void appendString(std::string *out, const char *str, size_t len) {
+    out->push_back((char) (len >> 8));
+    out->push_back((char) (len & 0xff));
+    out->append(str, len);
+}
+
+MqttWriter::MqttWriter(const char *host, int port, const char *prefix) {
+    _host = host;
+    _port = port;
+    _prefix = prefix;
+}
+
+MqttWriter::~MqttWriter() {
+    _disconnect();
+}
+
+void MqttWriter::add(const Reading &reading) {
+    char topic[128];
+    char payload[256];
+
+    int topic_len = snprintf(topic, sizeof(topic), "%s/%04x", _prefix.c_str(), reading.sensor_id);
+    int payload_len = snprintf(payload, sizeof(payload),
+                               "{\"time\":%llu,\"temperature\":%d,\"moisture\":%u,\"battery\":%u,\"retries\":%u,"
+                               "\"heartbeat\":%s,\"filled\":%s}",
+                               (unsigned long long) reading.timestamp_ms, reading.temperature, reading.moisture,
+                               reading.vcc, reading.retries, reading.flags & READING_HEARTBEAT ? "true" : "false",
+                               reading.flags & READING_FILLED ? "true" : "false");
+
+    _out.push_back((char) (MQTT_PUBLISH | MQTT_RETAIN));
+    appendLength(&_out, 2 + topic_len + payload_len);
+    appendString(&_out, topic, topic_len);
+    _out.append(payload, payload_len);
+}
+
+// Send the batch and wait for the broker to answer the ping behind it.  A connection
+// left idle may have been dropped by the broker, so a failure on one gets one more try
+// on a fresh connection.
+bool MqttWriter::flush(void) {
+    if (_out.empty()) {
+        return true;
+    }
+
+    _out.push_back((char) MQTT_PINGREQ);
+    _out.push_back(0);
+
+    bool reused = _fd >= 0;
+    for (int attempt = 0; attempt < (reused ? 2 : 1); attempt++) {
+        if ((_fd >= 0 || _connect()) && _send(_out) && _receive(MQTT_PINGRESP)) {
+            _out.clear();
+            return true;
+        }
+        _disconnect();
+    }
+
+    // Try again with the same batch next time, without the ping
+    _out.resize(_out.size() - 2);
+    return false;
+}
+
+void MqttWriter::discard(void) {
+    _out.clear();
+}
+
+bool MqttWriter::_connect(void) {
+    struct addrinfo hints, *res, *ai;
+    char port[8];
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    snprintf(port, sizeof(port), "%d", _port);
+
+    if (getaddrinfo(_host.c_str(), port, &hints, &res) != 0) {
+        printf("Could not resolve MQTT broker %s\n", _host.c_str());
+        return false;
+    }
+
+    for (ai = res; ai != NULL; ai = ai->ai_next) {
+        _fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (_fd < 0) {
+            continue;
+        }
+
+        struct timeval tv = {MQTT_IO_TIMEOUT_MS / 1000, (MQTT_IO_TIMEOUT_MS % 1000) * 1000};
+        setsockopt(_fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+        setsockopt(_fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+        int one = 1;
+        setsockopt(_fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        if (connect(_fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        close(_fd);
+        _fd = -1;
+    }
+    freeaddrinfo(res);
+    if (_fd < 0) {
+        return false;
+    }
+
+    // No keep alive, so the broker never expects a ping between batches
+    std::string connect;
+    std::string body;
+    appendString(&body, "MQTT", 4);
+    body.push_back(4);
+    body.push_back(MQTT_CLEAN_SESSION);
+    body.push_back(0);
+    body.push_back(0);
+    appendString(&body, MQTT_CLIENT_ID, strlen(MQTT_CLIENT_ID));
+    connect.push_back((char) MQTT_CONNECT);
+    appendLength(&connect, body.size());
+    connect += body;
+
+    if (!_send(connect) || !_receive(MQTT_CONNACK)) {
+        printf("MQTT broker %s:%d refused the connection\n", _host.c_str(), _port);
+        _disconnect();
+        return false;
+    }
+    return true;
+}
+
+void MqttWriter::_disconnect(void) {
+    if (_fd >= 0) {
+        close(_fd);
+        _fd = -1;
+    }
+}
+
+bool MqttWriter::_send(const std::string &data) {
+    size_t sent = 0;
+
+    while (sent < data.size()) {
+        ssize_t n = send(_fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += n;
+    }
+    return true;
+}
+
+// Read packets until one of the given type turns up.  A CONNACK also has to say the
+// connection was accepted.
+bool MqttWriter::_receive(uint8_t type) {
+    uint8_t body[256];
+
+    while (1) {
+        uint8_t header;
+        size_t len = 0;
+        int shift = 0;
+        uint8_t byte;
+
+        if (recv(_fd, &header, 1, MSG_WAITALL) != 1) {
+            return false;
+        }
+        do {
+            if (recv(_fd, &byte, 1, MSG_WAITALL) != 1 || shift > 21) {
+                return false;
+            }
+            len |= (size_t) (byte & 0x7f) << shift;
+            shift += 7;
+        } while (byte & 0x80);
+
+        // Nothing the broker sends a publisher at QoS 0 is anywhere near this long
+        if (len > sizeof(body) || (len > 0 && recv(_fd, body, len, MSG_WAITALL) != (ssize_t) len)) {
+            return false;
+        }
+
+        if ((header & 0xf0) == type) {
+            return type != MQTT_CONNACK || (len == 2 && body[1] == 0);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+#ifndef MQTT_WRITER_H_
+#define MQTT_WRITER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "Reading.h"
+#include "Sink.h"
+
+#define MQTT_PORT 1883
+// Each sensor's readings are published to <prefix>/<sensor id>
+#define MQTT_TOPIC_PREFIX "plants"
+#define MQTT_CLIENT_ID "plant-monitor-collector"
+
+// Socket send/receive timeout
+#define MQTT_IO_TIMEOUT_MS 5000
+
+// Publishes readings to an MQTT broker for home automation, one retained JSON message per
+// reading so anything subscribing gets each plant's latest straight away.
+//
+// Speaks just enough MQTT 3.1.1 to connect with a clean session and publish at QoS 0 over
+// one long-lived connection.  A batch goes out as a run of PUBLISH packets in one write,
+// followed by a PINGREQ: as the broker handles packets in order, its PINGRESP says the
+// whole batch got there.  Rollups aren't published.
+class MqttWriter : public Sink {
+  public:
+    MqttWriter(const char *host, int port = MQTT_PORT, const char *prefix = MQTT_TOPIC_PREFIX);
+    ~MqttWriter();
+    void add(const Reading &reading);
+    bool flush(void);
+    void discard(void);
+  private:
+    bool _connect(void);
+    void _disconnect(void);
+    bool _send(const std::string &data);
+    bool _receive(uint8_t type);
+    std::string _host;
+    int _port;
+    std::string _prefix;
+    std::string _out;
+    int _fd = -1;
+};
+
+#endif /* MQTT_WRITER_H_ */
@@ -0,0 +1,398 @@
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <strings.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "QueryServer.h"
+
+#define QUERY_EVENTS 64
+
+QueryServer::QueryServer(SensorTable *table, std::mutex *lock) : _table(table), _lock(lock), _requests(0) {
+}
+
+QueryServer::~QueryServer() {
+    stop();
+}
+
+void QueryServer::setMetrics(MetricsRenderer render) {
+    _metrics = render;
+}
+
+// Listen on the given address and port (0 picks a free one) and return the port in use
+int QueryServer::start(const char *host, int port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    struct epoll_event ev;
+    int one = 1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, host, &addr.sin_addr) != 1) {
+        printf("Query server: bad address %s\n", host);
+        return -1;
+    }
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (bind(_listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(_listen_fd, 64) < 0) {
+        printf("Query server: can't listen on %s:%d: %s\n", host, port, strerror(errno));
+        close(_listen_fd);
+        _listen_fd = -1;
+        return -1;
+    }
+    getsockname(_listen_fd, (struct sockaddr *) &addr, &len);
+
+    _epoll_fd = epoll_create1(0);
+    _stop_fd = eventfd(0, EFD_NONBLOCK);
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = _listen_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _listen_fd, &ev);
+    ev.data.fd = _stop_fd;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _stop_fd, &ev);
+
+    _thread = std::thread(&QueryServer::_loop, this);
+
+    return ntohs(addr.sin_port);
+}
+
+void QueryServer::stop(void) {
+    if (!_thread.joinable()) {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(_stop_fd, &one, sizeof(one)) < 0) {
+        perror("query server stop");
+    }
+    _thread.join();
+
+    for (auto &client : _clients) {
+        close(client.first);
+    }
+    _clients.clear();
+    close(_listen_fd);
+    close(_epoll_fd);
+    close(_stop_fd);
+    _listen_fd = _epoll_fd = _stop_fd = -1;
+}
+
+uint64_t QueryServer::requests(void) {
+    return _requests.load(std::memory_order_relaxed);
+}
+
+void QueryServer::_loop(void) {
+    struct epoll_event events[QUERY_EVENTS];
+
+    while (true) {
+        int n = epoll_wait(_epoll_fd, events, QUERY_EVENTS, -1);
+        if (n < 0 && errno != EINTR) {
+            perror("query server");
+            return;
+        }
+
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+
+            if (fd == _stop_fd) {
+                return;
+            }
+            if (fd == _listen_fd) {
+                _accept();
+                continue;
+            }
+
+            auto it = _clients.find(fd);
+            if (it == _clients.end()) {
+                continue;
+            }
+            if (events[i].events & (EPOLLERR | EPOLLHUP)) {
+                _drop(fd);
+                continue;
+            }
+            if ((events[i].events & EPOLLOUT) && !_write(fd, &it->second)) {
+                continue;
+            }
+            if (events[i].events & EPOLLIN) {
+                _read(fd, &it->second);
+            }
+        }
+    }
+}
+
+void QueryServer::_accept(void) {
+    struct epoll_event ev;
+    int one = 1;
+
+    while (true) {
+        int fd = accept4(_listen_fd, NULL, NULL, SOCK_NONBLOCK);
+        if (fd < 0) {
+            return;
+        }
+        if (_clients.size() >= QUERY_MAX_CLIENTS) {
+            close(fd);
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+        _clients[fd];
+    }
+}
+
+// Read what's there and answer every complete request in it
+void QueryServer::_read(int fd, Client *client) {
+    char buf[QUERY_REQUEST_MAX];
+
+    while (true) {
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+            _drop(fd);
+            return;
+        }
+        if (n < 0) {
+            break;
+        }
+        client->in.append(buf, n);
+    }
+
+    size_t start = 0, end;
+    while (!client->close && (end = client->in.find("\r\n\r\n", start)) != std::string::npos) {
+        _handle(client->in.substr(start, end - start), client);
+        start = end + 4;
+    }
+    client->in.erase(0, start);
+
+    if (client->in.size() > QUERY_REQUEST_MAX) {
+        client->in.clear();
+        _respond(client, 431, "{\"error\":\"request too large\"}");
+        client->close = true;
+    }
+
+    _write(fd, client);
+}
+
+// Send what's queued; wait for the socket to drain if it's full.  Returns false if the
+// client has gone.
+bool QueryServer::_write(int fd, Client *client) {
+    struct epoll_event ev;
+
+    while (client->sent < client->out.size()) {
+        ssize_t n = send(fd, client->out.data() + client->sent, client->out.size() - client->sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0 && errno == EAGAIN) {
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN | EPOLLOUT;
+            ev.data.fd = fd;
+            epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+            return true;
+        }
+        if (n < 0) {
+            _drop(fd);
+            return false;
+        }
+        client->sent += n;
+    }
+
+    bool waiting = client->sent > 0;
+    client->out.clear();
+    client->sent = 0;
+    if (client->close) {
+        _drop(fd);
+        return false;
+    }
+    if (waiting) {
+        memset(&ev, 0, sizeof(ev));
+        ev.events = EPOLLIN;
+        ev.data.fd = fd;
+        epoll_ctl(_epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+    }
+    return true;
+}
+
+void QueryServer::_drop(int fd) {
+    epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+    close(fd);
+    _clients.erase(fd);
+}
+
+void QueryServer::_handle(const std::string &request, Client *client) {
+    char method[8], target[256], version[16];
+
+    _requests.fetch_add(1, std::memory_order_relaxed);
+
+    if (sscanf(request.c_str(), "%7s %255s %15s", method, target, version) != 3) {
+        _respond(client, 400, "{\"error\":\"bad request\"}");
+        client->close = true;
+        return;
+    }
+    // HTTP/1.0 closes unless asked not to, 1.1 stays open unless asked to close
+    if (strcmp(version, "HTTP/1.0") == 0) {
+        client->close = strcasestr(request.c_str(), "\r\nConnection: keep-alive") == NULL;
+    } else {
+        client->close = strcasestr(request.c_str(), "\r\nConnection: close") != NULL;
+    }
+
+    if (strcmp(method, "GET") != 0) {
+        _respond(client, 405, "{\"error\":\"only GET is supported\"}");
+        client->close = true;
+        return;
+    }
+
+    if (strcmp(target, "/sensors") == 0 || strcmp(target, "/sensors/") == 0) {
+        _latest(client);
+        return;
+    }
+
+    if (strcmp(target, "/metrics") == 0 && _metrics != NULL) {
+        std::string body;
+        _metrics(&body);
+        _respond(client, 200, body, "text/plain; version=0.0.4");
+        return;
+    }
+
+    if (strncmp(target, "/sensors/", 9) == 0) {
+        char *end;
+        uint32_t sensor_id = strtoul(target + 9, &end, 16);
+        size_t max = SIZE_MAX;
+
+        if (end != target + 9 && strncmp(end, "?n=", 3) == 0) {
+            max = strtoul(end + 3, &end, 10);
+        }
+        if (end != target + 9 && *end == '\0') {
+            _history(sensor_id, max, client);
+            return;
+        }
+    }
+
+    _respond(client, 404, "{\"error\":\"not found\"}");
+}
+
+static const char *statusText(int status) {
+    switch (status) {
+        case 200: return "OK";
+        case 400: return "Bad Request";
+        case 404: return "Not Found";
+        case 405: return "Method Not Allowed";
+        case 431: return "Request Header Fields Too Large";
+        default: return "Error";
+    }
+}
+
+static void appendResponse(std::string *out, int status, const char *body, size_t body_len,
+                           const char *type = "application/json") {
+    char header[192];
+    int len = snprintf(header, sizeof(header),
+                       "HTTP/1.1 %d %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\n\r\n",
+                       status, statusText(status), type, body_len);
+    out->append(header, len);
+    out->append(body, body_len);
+}
+
+void QueryServer::_respond(Client *client, int status, const std::string &body, const char *type) {
+    appendResponse(&client->out, status, body.data(), body.size(), type);
+}
+
+static void appendReading(std::string *out, const Reading &reading) {
+    char buf[256];
+    int len = snprintf(buf, sizeof(buf),
+                       "{\"timestamp\":%llu,\"vcc\":%u,\"moisture\":%u,\"temperature\":%d,\"cycles\":%u,"
+                       "\"retries\":%u,\"heartbeat\":%s,\"filled\":%s}",
+                       (unsigned long long) reading.timestamp_ms, reading.vcc, reading.moisture, reading.temperature,
+                       reading.cycles, reading.retries, reading.flags & READING_HEARTBEAT ? "true" : "false",
+                       reading.flags & READING_FILLED ? "true" : "false");
+    out->append(buf, len);
+}
+
+// Every sensor's newest reading.  Only rebuilt when something has been recorded since the
+// last time; otherwise the finished response is copied straight out.
+void QueryServer::_latest(Client *client) {
+    uint64_t generation = _table->generation();
+
+    if (!_have_latest || generation != _latest_generation) {
+        {
+            std::lock_guard<std::mutex> guard(*_lock);
+            // Read again under the lock so the generation matches what gets copied
+            generation = _table->generation();
+            _states.resize(_table->size());
+            for (size_t i = 0; i < _states.size(); i++) {
+                _states[i] = *_table->at(i);
+            }
+        }
+
+        std::string body;
+        char buf[192];
+        body.reserve(_states.size() * 400 + 2);
+        body += '[';
+        for (size_t i = 0; i < _states.size(); i++) {
+            const SensorState &state = _states[i];
+            int len = snprintf(buf, sizeof(buf),
+                               "%s{\"sensor\":\"%08x\",\"last_seen\":%llu,\"silent\":%s,\"lost\":%u,\"duplicates\":%u,"
+                               "\"gaps\":%u,\"loss_pct\":%u,\"dup_pct\":%u,\"latest\":",
+                               i > 0 ? "," : "", state.sensor_id, (unsigned long long) state.last_seen_ms,
+                               state.silent ? "true" : "false", state.lost, state.duplicates, state.gaps,
+                               state.latest.loss_pct, state.latest.dup_pct);
+            body.append(buf, len);
+            appendReading(&body, state.latest);
+            body += '}';
+        }
+        body += ']';
+
+        _latest_response.clear();
+        appendResponse(&_latest_response, 200, body.data(), body.size());
+        _latest_generation = generation;
+        _have_latest = true;
+    }
+
+    client->out += _latest_response;
+}
+
+// The sensor's most recent readings, oldest first
+void QueryServer::_history(uint32_t sensor_id, size_t max, Client *client) {
+    size_t count = 0;
+    bool found = false;
+
+    {
+        std::lock_guard<std::mutex> guard(*_lock);
+        SensorState *state = _table->find(sensor_id);
+        if (state != NULL) {
+            found = true;
+            _readings.resize(state->history_count);
+            count = _table->history(state, _readings.data(), _readings.size());
+        }
+    }
+
+    if (!found) {
+        _respond(client, 404, "{\"error\":\"unknown sensor\"}");
+        return;
+    }
+
+    size_t first = count > max ? count - max : 0;
+    std::string body;
+    char buf[48];
+    body.reserve((count - first) * 160 + 64);
+    body.append(buf, snprintf(buf, sizeof(buf), "{\"sensor\":\"%08x\",\"readings\":[", sensor_id));
+    for (size_t i = first; i < count; i++) {
+        if (i > first) {
+            body += ',';
+        }
+        appendReading(&body, _readings[i]);
+    }
+    body += "]}";
+
+    _respond(client, 200, body);
+}
@@ -0,0 +1,77 @@
+#ifndef QUERY_SERVER_H_
+#define QUERY_SERVER_H_
+
+#include <atomic>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "SensorTable.h"
+
+// Where the query API listens.  Can be overridden with -q on the command line, 0 turns it off.
+#define QUERY_BIND "127.0.0.1"
+#define QUERY_PORT 8087
+
+// Requests bigger than this are refused
+#define QUERY_REQUEST_MAX 4096
+// Most connections served at once
+#define QUERY_MAX_CLIENTS 256
+
+// A small HTTP/1.1 API answering from the collector's own SensorTable, so dashboards and
+// scripts don't need to go to InfluxDB for the latest readings:
+//
+//   GET /sensors             latest reading and link stats of every sensor
+//   GET /sensors/<id>?n=N    the sensor's last N readings (all that are kept without n)
+//   GET /metrics             the collector's metrics, in the Prometheus text format
+//
+// Responses are JSON.  The one for every sensor is serialized once and served from cache
+// until the next reading arrives.  Connections are kept alive, and all are served from one
+// thread with epoll.  The table lock is only held to copy out what a response needs.
+// Appends the metrics text for /metrics
+typedef void (*MetricsRenderer)(std::string *out);
+
+class QueryServer {
+  public:
+    QueryServer(SensorTable *table, std::mutex *lock);
+    ~QueryServer();
+    void setMetrics(MetricsRenderer render);
+    int start(const char *host, int port);
+    void stop(void);
+    uint64_t requests(void);
+  private:
+    struct Client {
+        std::string in;
+        std::string out;
+        size_t sent = 0;
+        bool close = false;
+    };
+    void _loop(void);
+    void _accept(void);
+    void _read(int fd, Client *client);
+    bool _write(int fd, Client *client);
+    void _drop(int fd);
+    void _handle(const std::string &request, Client *client);
+    void _respond(Client *client, int status, const std::string &body, const char *type = "application/json");
+    void _latest(Client *client);
+    void _history(uint32_t sensor_id, size_t max, Client *client);
+    SensorTable *_table;
+    std::mutex *_lock;
+    MetricsRenderer _metrics = NULL;
+    int _listen_fd = -1;
+    int _epoll_fd = -1;
+    int _stop_fd = -1;
+    std::thread _thread;
+    std::unordered_map<int, Client> _clients;
+    // The cached response for every sensor, and the table generation it was built from
+    std::string _latest_response;
+    uint64_t _latest_generation = 0;
+    bool _have_latest = false;
+    std::vector<SensorState> _states;
+    std::vector<Reading> _readings;
+    std::atomic<uint64_t> _requests;
+};
+
+#endif /* QUERY_SERVER_H_ */
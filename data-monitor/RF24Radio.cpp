@@ -0,0 +1,96 @@
+#include <cstdio>
+#include "RF24Radio.h"
+
+RF24Radio::RF24Radio(uint16_t ce_pin, uint16_t csn_pin, uint32_t spi_speed, int irq_gpio)
+    : _rf24(ce_pin, csn_pin, spi_speed), _irq(irq_gpio) {
+    _use_irq = irq_gpio >= 0;
+}
+
+bool RF24Radio::begin(void) {
+    bool ok = _rf24.begin();
+
+    // Same rate the sensors use
+    _rf24.setDataRate(RF24_2MBPS);
+    //_rf24.setDataRate(RF24_250KBPS);
+
+    // Only pull the IRQ line for received packets, not for our own replies
+    _rf24.maskIRQ(true, true, false);
+
+    if (_use_irq && !_irq.open()) {
+        printf("Falling back to polling the radio\n");
+        _use_irq = false;
+    }
+
+    return ok;
+}
+
+void RF24Radio::setRetries(uint8_t delay, uint8_t count) {
+    _rf24.setRetries(delay, count);
+}
+
+void RF24Radio::openWritingPipe(const uint8_t *address) {
+    _rf24.openWritingPipe(address);
+}
+
+void RF24Radio::openReadingPipe(uint8_t pipe, const uint8_t *address) {
+    _rf24.openReadingPipe(pipe, address);
+}
+
+void RF24Radio::startListening(void) {
+    _rf24.startListening();
+}
+
+void RF24Radio::stopListening(void) {
+    _rf24.stopListening();
+}
+
+void RF24Radio::enableDynamicPayloads(void) {
+    _rf24.enableDynamicPayloads();
+}
+
+uint8_t RF24Radio::getDynamicPayloadSize(void) {
+    return _rf24.getDynamicPayloadSize();
+}
+
+bool RF24Radio::available(uint8_t *pipe) {
+    return _rf24.available(pipe);
+}
+
+void RF24Radio::read(void *buf, uint8_t len) {
+    _rf24.read(buf, len);
+}
+
+bool RF24Radio::write(const void *buf, uint8_t len) {
+    return _rf24.write(buf, len);
+}
+
+void RF24Radio::printDetails(void) {
+    _rf24.printDetails();
+}
+
+void RF24Radio::enableAckPayload(void) {
+    _rf24.enableAckPayload();
+}
+
+// Older versions of the library don't say whether the payload fit in the TX FIFO, so it's
+// up to the caller not to queue more than it holds
+bool RF24Radio::writeAckPayload(uint8_t pipe, const void *buf, uint8_t len) {
+    _rf24.writeAckPayload(pipe, buf, len);
+    return true;
+}
+
+bool RF24Radio::isAckPayloadAvailable(void) {
+    return _rf24.isAckPayloadAvailable();
+}
+
+void RF24Radio::flush_tx(void) {
+    _rf24.flush_tx();
+}
+
+bool RF24Radio::hasIrq(void) {
+    return _use_irq;
+}
+
+bool RF24Radio::waitIrq(int timeout_ms) {
+    return _irq.wait(timeout_ms);
+}
@@ -0,0 +1,36 @@
+#ifndef RF24_RADIO_H_
+#define RF24_RADIO_H_
+
+#include "RF24/RF24.h"
+#include "Radio.h"
+#include "RadioIrq.h"
+
+// A real nRF24L01 on the Pi's SPI bus, optionally with its IRQ pin wired to a GPIO
+class RF24Radio : public Radio {
+  public:
+    RF24Radio(uint16_t ce_pin, uint16_t csn_pin, uint32_t spi_speed, int irq_gpio = -1);
+    bool begin(void);
+    void setRetries(uint8_t delay, uint8_t count);
+    void openWritingPipe(const uint8_t *address);
+    void openReadingPipe(uint8_t pipe, const uint8_t *address);
+    void startListening(void);
+    void stopListening(void);
+    void enableDynamicPayloads(void);
+    uint8_t getDynamicPayloadSize(void);
+    bool available(uint8_t *pipe = NULL);
+    void read(void *buf, uint8_t len);
+    bool write(const void *buf, uint8_t len);
+    void printDetails(void);
+    void enableAckPayload(void);
+    bool writeAckPayload(uint8_t pipe, const void *buf, uint8_t len);
+    bool isAckPayloadAvailable(void);
+    void flush_tx(void);
+    bool hasIrq(void);
+    bool waitIrq(int timeout_ms);
+  private:
+    RF24 _rf24;
+    RadioIrq _irq;
+    bool _use_irq = false;
+};
+
+#endif /* RF24_RADIO_H_ */
@@ -0,0 +1,55 @@
+#ifndef RADIO_H_
+#define RADIO_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The part of the nRF24 the collector uses, so it can run against real hardware
+// (RF24Radio), a simulated radio on any Linux box (SimRadio) or a capture being
+// replayed (ReplayRadio).  Method names and semantics follow the RF24 library.
+class Radio {
+  public:
+    virtual ~Radio() {}
+    virtual bool begin(void) = 0;
+    // Auto-retransmit delay (in 250us steps) and count
+    virtual void setRetries(uint8_t delay, uint8_t count) = 0;
+    virtual void openWritingPipe(const uint8_t *address) = 0;
+    virtual void openReadingPipe(uint8_t pipe, const uint8_t *address) = 0;
+    virtual void startListening(void) = 0;
+    virtual void stopListening(void) = 0;
+    // Send and receive payloads of any length up to 32 bytes instead of a fixed 32
+    virtual void enableDynamicPayloads(void) = 0;
+    // Length of the next payload to read()
+    virtual uint8_t getDynamicPayloadSize(void) = 0;
+    virtual bool available(uint8_t *pipe = NULL) = 0;
+    virtual void read(void *buf, uint8_t len) = 0;
+    // Blocks until the packet is acknowledged or the retries run out
+    virtual bool write(const void *buf, uint8_t len) = 0;
+    virtual void printDetails(void) {}
+    // Send payloads back in the ACKs to frames received, needing dynamic payloads
+    virtual void enableAckPayload(void) {}
+    // Queue a payload for the ACK to the next frame received on the pipe.  The payloads share
+    // the TX FIFO, and are flushed by stopListening().  Returns false if there's no room.
+    virtual bool writeAckPayload(uint8_t /* pipe */, const void * /* buf */, uint8_t /* len */) {
+        return false;
+    }
+    // Whether the ACK to the last write() carried a payload, which is then read()
+    virtual bool isAckPayloadAvailable(void) {
+        return false;
+    }
+    virtual void flush_tx(void) {}
+    // Whether waitIrq() can be used to sleep until a packet arrives
+    virtual bool hasIrq(void) {
+        return false;
+    }
+    // Sleep until a packet may have arrived or the timeout passes
+    virtual bool waitIrq(int /* timeout_ms */) {
+        return false;
+    }
+    // Whether nothing more will ever arrive, which only happens replaying a capture
+    virtual bool finished(void) {
+        return false;
+    }
+};
+
+#endif /* RADIO_H_ */
@@ -0,0 +1,101 @@
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include "RadioIrq.h"
+
+RadioIrq::RadioIrq(int gpio) {
+    _gpio = gpio;
+}
+
+RadioIrq::~RadioIrq() {
+    if (_epoll_fd >= 0) {
+        close(_epoll_fd);
+    }
+    if (_value_fd >= 0) {
+        close(_value_fd);
+    }
+}
+
+// Export the pin, set it up as an input that reports falling edges, and register its
+// value file with epoll.  Returns false if any of that fails.
+bool RadioIrq::open(void) {
+    char path[64], value[16];
+
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d", _gpio);
+    if (access(path, F_OK) != 0) {
+        snprintf(value, sizeof(value), "%d", _gpio);
+        if (!_writeSysfs("/sys/class/gpio/export", value)) {
+            return false;
+        }
+        // udev needs a moment to fix up permissions on the new files
+        usleep(100000);
+    }
+
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/direction", _gpio);
+    if (!_writeSysfs(path, "in")) {
+        return false;
+    }
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/edge", _gpio);
+    if (!_writeSysfs(path, "falling")) {
+        return false;
+    }
+
+    snprintf(path, sizeof(path), "/sys/class/gpio/gpio%d/value", _gpio);
+    _value_fd = ::open(path, O_RDONLY | O_NONBLOCK);
+    if (_value_fd < 0) {
+        printf("Could not open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+
+    // Reading the value once clears any edge that happened before we got here
+    if (read(_value_fd, value, sizeof(value)) < 0) {
+        return false;
+    }
+
+    _epoll_fd = epoll_create1(0);
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLPRI | EPOLLERR;
+    event.data.fd = _value_fd;
+    if (epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _value_fd, &event) < 0) {
+        printf("Could not watch GPIO %d: %s\n", _gpio, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+// Sleep until the IRQ line falls or the timeout passes.  Returns true on an edge.
+bool RadioIrq::wait(int timeout_ms) {
+    struct epoll_event event;
+    char value[16];
+
+    int n = epoll_wait(_epoll_fd, &event, 1, timeout_ms);
+    if (n <= 0) {
+        return false;
+    }
+
+    // Rewind and re-read the value to acknowledge the edge
+    lseek(_value_fd, 0, SEEK_SET);
+    if (read(_value_fd, value, sizeof(value)) < 0) {
+        return false;
+    }
+    return true;
+}
+
+bool RadioIrq::_writeSysfs(const char *path, const char *value) {
+    int fd = ::open(path, O_WRONLY);
+    if (fd < 0) {
+        printf("Could not open %s: %s\n", path, strerror(errno));
+        return false;
+    }
+    bool ok = write(fd, value, strlen(value)) == (ssize_t) strlen(value);
+    if (!ok) {
+        printf("Could not write %s to %s: %s\n", value, path, strerror(errno));
+    }
+    close(fd);
+    return ok;
+}
@@ -0,0 +1,19 @@
+#ifndef RADIO_IRQ_H_
+#define RADIO_IRQ_H_
+
+// Waits for the nRF24's IRQ line (active low) to fall, using the kernel's sysfs GPIO
+// edge events so the collector sleeps in epoll until a packet arrives.
+class RadioIrq {
+  public:
+    RadioIrq(int gpio);
+    ~RadioIrq();
+    bool open(void);
+    bool wait(int timeout_ms);
+  private:
+    bool _writeSysfs(const char *path, const char *value);
+    int _gpio;
+    int _value_fd = -1;
+    int _epoll_fd = -1;
+};
+
+#endif /* RADIO_IRQ_H_ */
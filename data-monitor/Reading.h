@@ -0,0 +1,35 @@
+#ifndef READING_H_
+#define READING_H_
+
+#include <stdint.h>
+
+// Sent by the sensor because its heartbeat came round, not because anything changed
+#define READING_HEARTBEAT 0x0001
+// Not sent by the sensor: its last reading, filled forward while nothing changed
+#define READING_FILLED 0x0002
+// The sensor's first report since it restarted
+#define READING_BOOT 0x0004
+
+// One decoded status report from a sensor.  Fixed size so it can be handed between
+// threads and written to disk without any per-reading allocation.
+struct Reading {
+    // Wall clock time (ms since epoch) the reading was taken
+    uint64_t timestamp_ms;
+    uint32_t sensor_id;
+    uint32_t cycles;
+    uint16_t retries;
+    uint16_t flags;
+    uint32_t vcc;
+    uint32_t moisture;
+    int32_t temperature;
+    // The sensor's link when the reading arrived (see ReportTracker): reports missing and
+    // retransmissions dropped since the collector started, runs of missing reports, and the
+    // percentage of its recent reports that went missing and of its frames that were repeats
+    uint32_t lost;
+    uint32_t duplicates;
+    uint16_t gaps;
+    uint8_t loss_pct;
+    uint8_t dup_pct;
+};
+
+#endif /* READING_H_ */
@@ -0,0 +1,135 @@
+#include "ReplayRadio.h"
+
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include "Clock.h"
+
+ReplayRadio::ReplayRadio(const char *path, double speed) : _reader(path), _speed(speed) {
+    memset(&_record, 0, sizeof(_record));
+}
+
+ReplayRadio::~ReplayRadio() {
+    replayClockMillis().store(0, std::memory_order_relaxed);
+}
+
+// Opened up front by the collector to catch a bad capture early, then again as part of
+// setting the radio up
+bool ReplayRadio::begin(void) {
+    if (_opened) {
+        return true;
+    }
+    _opened = true;
+    if (!_reader.open()) {
+        _finished = true;
+        return false;
+    }
+    return true;
+}
+
+// Reads the next record in, unless one is already waiting
+bool ReplayRadio::_load(void) {
+    if (_have_record) {
+        return true;
+    }
+    if (_finished) {
+        return false;
+    }
+    if (!_reader.next(&_record)) {
+        _finished = true;
+        return false;
+    }
+
+    if (_frames == 0) {
+        _first_ns = _record.time_ns;
+        _start_ns = monotonicNanos();
+    }
+    _have_record = true;
+    return true;
+}
+
+// When the waiting record should be delivered, on the monotonic clock
+uint64_t ReplayRadio::_due(void) {
+    if (_speed <= 0 || _record.time_ns <= _first_ns) {
+        return 0;
+    }
+    return _start_ns + (uint64_t) ((_record.time_ns - _first_ns) / _speed);
+}
+
+bool ReplayRadio::available(uint8_t *pipe) {
+    if (!_load() || monotonicNanos() < _due()) {
+        return false;
+    }
+    if (pipe != NULL) {
+        *pipe = _record.pipe;
+    }
+    return true;
+}
+
+uint8_t ReplayRadio::getDynamicPayloadSize(void) {
+    return _have_record ? _record.len : 0;
+}
+
+void ReplayRadio::read(void *buf, uint8_t len) {
+    if (!_have_record) {
+        return;
+    }
+
+    memset(buf, 0, len);
+    memcpy(buf, _record.data, len < _record.len ? len : _record.len);
+    replayClockMillis().store(_reader.wallMillis(_record), std::memory_order_relaxed);
+    _have_record = false;
+    _frames++;
+    _last_ns = monotonicNanos();
+}
+
+bool ReplayRadio::write(const void * /* buf */, uint8_t /* len */) {
+    _replies++;
+    return true;
+}
+
+void ReplayRadio::printDetails(void) {
+    if (_speed > 0) {
+        printf("Replay radio: %.1fx the captured speed\n", _speed);
+    } else {
+        printf("Replay radio: as fast as frames are taken\n");
+    }
+}
+
+// There's always a next frame due, or the end of the capture
+bool ReplayRadio::hasIrq(void) {
+    return true;
+}
+
+bool ReplayRadio::waitIrq(int timeout_ms) {
+    if (!_load()) {
+        return false;
+    }
+
+    uint64_t due = _due();
+    uint64_t now = monotonicNanos();
+    if (due > now) {
+        uint64_t wait_us = (due - now) / 1000;
+        if (wait_us > (uint64_t) timeout_ms * 1000) {
+            wait_us = (uint64_t) timeout_ms * 1000;
+        }
+        usleep(wait_us);
+    }
+    return true;
+}
+
+bool ReplayRadio::finished(void) {
+    return !_load();
+}
+
+uint64_t ReplayRadio::frames(void) {
+    return _frames;
+}
+
+uint64_t ReplayRadio::replies(void) {
+    return _replies;
+}
+
+uint64_t ReplayRadio::elapsedNanos(void) {
+    return _frames > 0 ? _last_ns - _start_ns : 0;
+}
@@ -0,0 +1,56 @@
+#ifndef REPLAY_RADIO_H_
+#define REPLAY_RADIO_H_
+
+#include <stdint.h>
+#include "Capture.h"
+#include "Radio.h"
+
+// Plays a capture (see CaptureWriter) back to the collector as if the frames were
+// arriving over the air, so they go through the same decode and dispatch path.
+//
+// Frames are delivered with the gaps between them they were captured with, divided by
+// the speed; a speed of 0 delivers them as fast as the collector takes them.  The wall
+// clock follows the capture as each frame is read, so readings get the timestamps they
+// would have had at the time.  Replies are counted and dropped, as there's no one there
+// to receive them.
+class ReplayRadio : public Radio {
+  public:
+    ReplayRadio(const char *path, double speed);
+    ~ReplayRadio();
+    bool begin(void);
+    void setRetries(uint8_t /* delay */, uint8_t /* count */) {}
+    void openWritingPipe(const uint8_t * /* address */) {}
+    void openReadingPipe(uint8_t /* pipe */, const uint8_t * /* address */) {}
+    void startListening(void) {}
+    void stopListening(void) {}
+    void enableDynamicPayloads(void) {}
+    uint8_t getDynamicPayloadSize(void);
+    bool available(uint8_t *pipe = NULL);
+    void read(void *buf, uint8_t len);
+    bool write(const void *buf, uint8_t len);
+    void printDetails(void);
+    bool hasIrq(void);
+    bool waitIrq(int timeout_ms);
+    bool finished(void);
+    uint64_t frames(void);
+    uint64_t replies(void);
+    // Monotonic time from the first frame being delivered to the last
+    uint64_t elapsedNanos(void);
+  private:
+    bool _load(void);
+    uint64_t _due(void);
+    CaptureReader _reader;
+    double _speed;
+    CaptureRecord _record;
+    bool _opened = false;
+    bool _have_record = false;
+    bool _finished = false;
+    // Capture time of the first frame, and when it was delivered
+    uint64_t _first_ns = 0;
+    uint64_t _start_ns = 0;
+    uint64_t _last_ns = 0;
+    uint64_t _frames = 0;
+    uint64_t _replies = 0;
+};
+
+#endif /* REPLAY_RADIO_H_ */
@@ -0,0 +1,158 @@
+#include <cstdio>
+#include "Clock.h"
+#include "ReportTracker.h"
+
+// Counters are compared on their low 16 bits, all compact frames carry.  A step back
+// further than this is taken as the sensor restarting rather than an old report.
+#define COUNTER_MASK 0xffff
+#define COUNTER_RESTART 0x8000
+
+ReportTracker::ReportTracker(SensorTable *table, uint32_t fill_interval_ms, uint32_t heartbeat_timeout_ms) {
+    _table = table;
+    _fill_interval_ms = fill_interval_ms;
+    _heartbeat_timeout_ms = heartbeat_timeout_ms;
+}
+
+// Note a reading from a sensor and fill in its link stats.  Returns false if it repeats
+// one already seen, in which case it shouldn't be written.  Otherwise up to max readings
+// filled forward are put in filled, to be written before it, and their number in count.
+bool ReportTracker::track(Reading *reading, Reading *filled, size_t max, size_t *count) {
+    *count = 0;
+
+    SensorState *state = _table->find(reading->sensor_id);
+    if (state == NULL) {
+        state = _table->insert(reading->sensor_id);
+        if (state == NULL) {
+            // Written as it is, without any of the checks
+            if (!_table_full) {
+                printf("Sensor table full at %zu sensors, not tracking any more\n", _table->size());
+                _table_full = true;
+            }
+            return true;
+        }
+        state->window = 1;
+        state->span = 1;
+        _accept(state, reading);
+        return true;
+    }
+
+    uint32_t step = (reading->cycles - state->latest.cycles) & COUNTER_MASK;
+
+    if (step == 0) {
+        state->duplicates++;
+        _duplicates++;
+        return false;
+    }
+
+    if (step >= COUNTER_RESTART) {
+        uint32_t back = COUNTER_MASK + 1 - step;
+
+        // One of the recent reports, either again or arriving late after being counted missing
+        if (back < state->span) {
+            if (state->window & (1ull << back)) {
+                state->duplicates++;
+                _duplicates++;
+                return false;
+            }
+            state->window |= 1ull << back;
+            state->lost--;
+            _missing--;
+            _accept(state, reading);
+            return true;
+        }
+        if (reading->timestamp_ms <= state->latest.timestamp_ms) {
+            state->duplicates++;
+            _duplicates++;
+            return false;
+        }
+
+        printf("Sensor %08x restarted\n", reading->sensor_id);
+        _restarts++;
+        state->window = 0;
+        state->span = 0;
+        step = 1;
+    } else if (reading->flags & READING_BOOT) {
+        printf("Sensor %08x restarted, %u counters on\n", reading->sensor_id, step);
+        _restarts++;
+        state->window = 0;
+        state->span = 0;
+        step = 1;
+    } else if (step == 1) {
+        if (_fill_interval_ms > 0) {
+            for (uint64_t ts = state->latest.timestamp_ms + _fill_interval_ms;
+                 ts < reading->timestamp_ms && *count < max; ts += _fill_interval_ms) {
+                filled[*count] = state->latest;
+                filled[*count].timestamp_ms = ts;
+                filled[*count].retries = 0;
+                filled[*count].flags = READING_FILLED;
+                (*count)++;
+            }
+        }
+    } else {
+        printf("Sensor %08x: %u reports missing\n", reading->sensor_id, step - 1);
+        state->lost += step - 1;
+        state->gaps++;
+        _missing += step - 1;
+    }
+
+    state->window = step < REPORT_WINDOW ? (state->window << step) | 1 : 1;
+    state->span = state->span + step < REPORT_WINDOW ? state->span + step : REPORT_WINDOW;
+
+    if (state->silent) {
+        printf("Sensor %08x back after %llus\n", reading->sensor_id,
+               (unsigned long long) (wallClockMillis() - state->last_seen_ms) / 1000);
+        state->silent = false;
+    }
+    _filled += *count;
+    _accept(state, reading);
+    state->latest = *reading;
+    return true;
+}
+
+// A reading that will be written: fill in its link stats, and keep it in the sensor's
+// history.  The caller makes it the latest unless it arrived late.
+void ReportTracker::_accept(SensorState *state, Reading *reading) {
+    state->received++;
+    uint32_t frames = state->received + state->duplicates;
+
+    reading->lost = state->lost;
+    reading->duplicates = state->duplicates;
+    reading->gaps = state->gaps;
+    reading->loss_pct = state->span > 0 ? 100 * (state->span - __builtin_popcountll(state->window)) / state->span : 0;
+    reading->dup_pct = frames > 0 ? (uint64_t) 100 * state->duplicates / frames : 0;
+
+    if (state->received == 1) {
+        state->latest = *reading;
+    }
+    state->last_seen_ms = wallClockMillis();
+    _table->record(state, *reading);
+}
+
+// Log any sensor that has gone quiet for longer than its heartbeat allows, as that
+// means it's missing rather than unchanged
+void ReportTracker::checkSilent(uint64_t now_ms) {
+    for (size_t i = 0; i < _table->size(); i++) {
+        SensorState *state = _table->at(i);
+        if (!state->silent && now_ms > state->last_seen_ms + _heartbeat_timeout_ms) {
+            printf("Sensor %08x silent for %llus, past its heartbeat\n", state->sensor_id,
+                   (unsigned long long) (now_ms - state->last_seen_ms) / 1000);
+            state->silent = true;
+        }
+    }
+}
+
+uint64_t ReportTracker::filled(void) {
+    return _filled;
+}
+
+uint64_t ReportTracker::missing(void) {
+    return _missing;
+}
+
+uint64_t ReportTracker::duplicates(void) {
+    return _duplicates;
+}
+
+uint64_t ReportTracker::restarts(void) {
+    return _restarts;
+}
@@ -0,0 +1,48 @@
+#ifndef REPORT_TRACKER_H_
+#define REPORT_TRACKER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Reading.h"
+#include "SensorTable.h"
+
+// Message counters of the last REPORT_WINDOW reports from each sensor are remembered
+#define REPORT_WINDOW 64
+
+// Sensors only report readings that changed, plus a heartbeat now and then, and their
+// message counters only count what they report.  Consecutive counters mean nothing
+// changed in between, so the last reading is filled forward over the gap; a jump in the
+// counter means reports went missing, and nothing is made up for them.
+//
+// A bitmap of the counters seen recently catches the same report arriving again, when
+// the sensor retries after losing the reply, so it is only written once.  The counts of
+// missing and repeated reports are kept per sensor and go out with each reading.
+//
+// A sensor flags its first report after a restart.  Its counter carries on from the last
+// one it saved, skipping ahead a little, and the jump isn't counted as missing reports.
+// Older firmware starts again from 0, which is caught by the counter going a long way back.
+//
+// Per-sensor state lives in a SensorTable, which is kept up to date with each sensor's
+// latest readings.  Only used from the writer thread.
+class ReportTracker {
+  public:
+    ReportTracker(SensorTable *table, uint32_t fill_interval_ms, uint32_t heartbeat_timeout_ms);
+    bool track(Reading *reading, Reading *filled, size_t max, size_t *count);
+    void checkSilent(uint64_t now_ms);
+    uint64_t filled(void);
+    uint64_t missing(void);
+    uint64_t duplicates(void);
+    uint64_t restarts(void);
+  private:
+    void _accept(SensorState *state, Reading *reading);
+    SensorTable *_table;
+    uint32_t _fill_interval_ms;
+    uint32_t _heartbeat_timeout_ms;
+    bool _table_full = false;
+    uint64_t _filled = 0;
+    uint64_t _missing = 0;
+    uint64_t _duplicates = 0;
+    uint64_t _restarts = 0;
+};
+
+#endif /* REPORT_TRACKER_H_ */
@@ -0,0 +1,39 @@
+#ifndef ROLLUP_H_
+#define ROLLUP_H_
+
+#include <stdint.h>
+
+// Rollups are kept at 1 minute, 1 hour and 1 day resolution, in windows aligned to UTC
+#define ROLLUP_RESOLUTIONS 3
+#define ROLLUP_MINUTE 0
+#define ROLLUP_HOUR 1
+#define ROLLUP_DAY 2
+
+// Fields rolled up: battery (vcc), moisture and temperature
+#define ROLLUP_FIELDS 3
+#define ROLLUP_VCC 0
+#define ROLLUP_MOISTURE 1
+#define ROLLUP_TEMPERATURE 2
+
+struct RollupStats {
+    int32_t min;
+    int32_t max;
+    int32_t last;
+    int64_t sum;
+};
+
+// One sensor's readings in one window, built up as they arrive.  Empty while count is 0.
+struct RollupWindow {
+    uint64_t start_ms;
+    uint32_t count;
+    RollupStats fields[ROLLUP_FIELDS];
+};
+
+// A window that has closed, on its way to the sink
+struct Rollup {
+    uint32_t sensor_id;
+    uint8_t resolution;
+    RollupWindow window;
+};
+
+#endif /* ROLLUP_H_ */
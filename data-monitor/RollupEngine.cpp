@@ -0,0 +1,100 @@
+#include "RollupEngine.h"
+
+const uint64_t rollup_window_ms[ROLLUP_RESOLUTIONS] = {60 * 1000ull, 3600 * 1000ull, 24 * 3600 * 1000ull};
+
+static int32_t fieldValue(const Reading &reading, int field) {
+    switch (field) {
+        case ROLLUP_VCC: return reading.vcc;
+        case ROLLUP_MOISTURE: return reading.moisture;
+        default: return reading.temperature;
+    }
+}
+
+static void closeWindow(const SensorState *state, int resolution, RollupWindow *window, Rollup *closed) {
+    closed->sensor_id = state->sensor_id;
+    closed->resolution = resolution;
+    closed->window = *window;
+    window->count = 0;
+}
+
+RollupEngine::RollupEngine(SensorTable *table) {
+    _table = table;
+}
+
+// Add the reading to its sensor's windows.  Any of them it's too new for are closed first
+// and copied to closed, which must have room for ROLLUP_RESOLUTIONS; returns how many.
+size_t RollupEngine::add(const Reading &reading, Rollup *closed) {
+    SensorState *state = _table->find(reading.sensor_id);
+    size_t count = 0;
+    bool late = false;
+
+    if (state == NULL) {
+        return 0;
+    }
+
+    for (int resolution = 0; resolution < ROLLUP_RESOLUTIONS; resolution++) {
+        RollupWindow *window = &state->rollups[resolution];
+        uint64_t start_ms = reading.timestamp_ms - reading.timestamp_ms % rollup_window_ms[resolution];
+
+        // Too late for this window, though a coarser one may still be open
+        if (window->count > 0 && start_ms < window->start_ms) {
+            late = true;
+            continue;
+        }
+        if (window->count > 0 && start_ms > window->start_ms) {
+            closeWindow(state, resolution, window, &closed[count++]);
+            _emitted++;
+        }
+
+        if (window->count == 0) {
+            window->start_ms = start_ms;
+            for (int field = 0; field < ROLLUP_FIELDS; field++) {
+                int32_t value = fieldValue(reading, field);
+                window->fields[field].min = window->fields[field].max = value;
+                window->fields[field].sum = 0;
+            }
+        }
+
+        window->count++;
+        for (int field = 0; field < ROLLUP_FIELDS; field++) {
+            RollupStats *stats = &window->fields[field];
+            int32_t value = fieldValue(reading, field);
+            stats->min = value < stats->min ? value : stats->min;
+            stats->max = value > stats->max ? value : stats->max;
+            stats->last = value;
+            stats->sum += value;
+        }
+    }
+
+    if (late) {
+        _late++;
+    }
+    return count;
+}
+
+// Close windows that ended at least idle_ms ago, for sensors that have gone quiet.  Returns
+// how many were copied to closed; call again if that's max.
+size_t RollupEngine::closeIdle(uint64_t now_ms, uint64_t idle_ms, Rollup *closed, size_t max) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < _table->size() && count < max; i++) {
+        SensorState *state = _table->at(i);
+        for (int resolution = 0; resolution < ROLLUP_RESOLUTIONS && count < max; resolution++) {
+            RollupWindow *window = &state->rollups[resolution];
+            if (window->count > 0 && window->start_ms + rollup_window_ms[resolution] + idle_ms <= now_ms) {
+                closeWindow(state, resolution, window, &closed[count++]);
+                _emitted++;
+            }
+        }
+    }
+
+    return count;
+}
+
+uint64_t RollupEngine::emitted(void) {
+    return _emitted;
+}
+
+uint64_t RollupEngine::late(void) {
+    return _late;
+}
@@ -0,0 +1,35 @@
+#ifndef ROLLUP_ENGINE_H_
+#define ROLLUP_ENGINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include "Reading.h"
+#include "Rollup.h"
+#include "SensorTable.h"
+
+// Length of the windows at each resolution
+extern const uint64_t rollup_window_ms[ROLLUP_RESOLUTIONS];
+
+// Keeps min, max, mean, last and count of each sensor's fields over the current minute,
+// hour and day, so long range graphs can read a few hundred downsampled points instead of
+// every reading.  Each reading updates the sensor's open windows in place, in constant
+// time.  A window closes when a reading arrives for a later one, or when the sensor has
+// been quiet for a while after it ended, and is handed out to be written.
+//
+// Filled forward readings count like any other.  A reading older than an open window (one
+// that arrived late) can't be added to it any more, and is counted as late.  Windows live in
+// the sensor's SensorState; only used from the writer thread.
+class RollupEngine {
+  public:
+    RollupEngine(SensorTable *table);
+    size_t add(const Reading &reading, Rollup *closed);
+    size_t closeIdle(uint64_t now_ms, uint64_t idle_ms, Rollup *closed, size_t max);
+    uint64_t emitted(void);
+    uint64_t late(void);
+  private:
+    SensorTable *_table;
+    uint64_t _emitted = 0;
+    uint64_t _late = 0;
+};
+
+#endif /* ROLLUP_ENGINE_H_ */
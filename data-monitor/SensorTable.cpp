@@ -0,0 +1,108 @@
+#include <cstring>
+#include "SensorTable.h"
+
+SensorTable::SensorTable(uint32_t capacity, uint32_t history) : _generation(0) {
+    _capacity = capacity;
+    _history = history;
+
+    // At least twice as many slots as sensors keeps probe sequences short
+    uint32_t bits = 1;
+    while ((1u << bits) < capacity * 2) {
+        bits++;
+    }
+    _mask = (1u << bits) - 1;
+    _shift = 32 - bits;
+
+    Slot empty = {0, 0};
+    _slots.assign(_mask + 1, empty);
+    _states.resize(capacity);
+    _readings.resize((size_t) capacity * history);
+}
+
+// Fibonacci hashing: sensor ids are often close together, and multiplying spreads them
+// across the table
+uint32_t SensorTable::_hash(uint32_t sensor_id) {
+    return (sensor_id * 2654435769u) >> _shift;
+}
+
+// The sensor's state, or NULL if it hasn't been seen
+SensorState *SensorTable::find(uint32_t sensor_id) {
+    for (uint32_t i = _hash(sensor_id);; i = (i + 1) & _mask) {
+        const Slot &slot = _slots[i];
+        if (slot.idx == 0) {
+            return NULL;
+        }
+        if (slot.sensor_id == sensor_id) {
+            return &_states[slot.idx - 1];
+        }
+    }
+}
+
+// Add a sensor with cleared state, or return its existing state.  Returns NULL if the
+// table is full.
+SensorState *SensorTable::insert(uint32_t sensor_id) {
+    uint32_t i = _hash(sensor_id);
+    for (; _slots[i].idx != 0; i = (i + 1) & _mask) {
+        if (_slots[i].sensor_id == sensor_id) {
+            return &_states[_slots[i].idx - 1];
+        }
+    }
+    if (_size == _capacity) {
+        return NULL;
+    }
+
+    SensorState *state = &_states[_size];
+    memset(state, 0, sizeof(*state));
+    state->sensor_id = sensor_id;
+
+    _slots[i].sensor_id = sensor_id;
+    _slots[i].idx = ++_size;
+    return state;
+}
+
+// Keep a reading in the sensor's history, dropping the oldest once it's full
+void SensorTable::record(SensorState *state, const Reading &reading) {
+    _generation.fetch_add(1, std::memory_order_release);
+    if (_history == 0) {
+        return;
+    }
+    Reading *ring = &_readings[(size_t) (state - &_states[0]) * _history];
+
+    ring[(state->history_head + state->history_count) % _history] = reading;
+    if (state->history_count < _history) {
+        state->history_count++;
+    } else {
+        state->history_head = (state->history_head + 1) % _history;
+    }
+}
+
+// Copy up to max of the sensor's most recent readings, oldest first.  Returns how many.
+size_t SensorTable::history(const SensorState *state, Reading *readings, size_t max) {
+    size_t count = state->history_count < max ? state->history_count : max;
+    if (count == 0) {
+        return 0;
+    }
+    const Reading *ring = &_readings[(size_t) (state - &_states[0]) * _history];
+
+    for (size_t i = 0; i < count; i++) {
+        readings[i] = ring[(state->history_head + state->history_count - count + i) % _history];
+    }
+    return count;
+}
+
+// States by index, in the order sensors were first seen, for going over all of them
+SensorState *SensorTable::at(size_t idx) {
+    return idx < _size ? &_states[idx] : NULL;
+}
+
+size_t SensorTable::size(void) {
+    return _size;
+}
+
+size_t SensorTable::capacity(void) {
+    return _capacity;
+}
+
+uint64_t SensorTable::generation(void) {
+    return _generation.load(std::memory_order_acquire);
+}
@@ -0,0 +1,78 @@
+#ifndef SENSOR_TABLE_H_
+#define SENSOR_TABLE_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include "Reading.h"
+#include "Rollup.h"
+
+// Most sensors the collector keeps state for, and readings kept per sensor.  Can be
+// overridden with -S and -R on the command line.
+#define SENSOR_TABLE_CAPACITY 1024
+#define SENSOR_HISTORY 64
+
+// Everything the collector knows about one sensor
+struct SensorState {
+    uint32_t sensor_id;
+    // Wall clock time (ms since epoch) of its newest reading, and the reading itself
+    uint64_t last_seen_ms;
+    Reading latest;
+    bool silent;
+    // Link stats, see ReportTracker.  Bit n of the window is set if the report n before
+    // the newest was seen; span is how many counters the window covers so far.
+    uint64_t window;
+    uint8_t span;
+    uint32_t received;
+    uint32_t lost;
+    uint32_t duplicates;
+    uint16_t gaps;
+    // Open rollup windows at each resolution, see RollupEngine
+    RollupWindow rollups[ROLLUP_RESOLUTIONS];
+    // Recent readings, a ring in the table's history buffer
+    uint32_t history_head;
+    uint32_t history_count;
+};
+
+// Per-sensor state, in an open addressing hash table keyed by sensor id.  Everything is
+// allocated up front for a fixed number of sensors, so lookups and updates never
+// allocate.
+//
+// Probing only touches a compact array of ids and state indexes; the states themselves
+// are packed densely in the order sensors were first seen, so going over every sensor
+// is a straight walk through memory.  Each state has a fixed size ring of its recent
+// readings.
+//
+// Not thread safe, apart from generation(), which changes with every reading recorded so
+// readers can tell when something they built from the table is out of date.
+class SensorTable {
+  public:
+    SensorTable(uint32_t capacity = SENSOR_TABLE_CAPACITY, uint32_t history = SENSOR_HISTORY);
+    SensorState *find(uint32_t sensor_id);
+    SensorState *insert(uint32_t sensor_id);
+    void record(SensorState *state, const Reading &reading);
+    size_t history(const SensorState *state, Reading *readings, size_t max);
+    SensorState *at(size_t idx);
+    size_t size(void);
+    size_t capacity(void);
+    uint64_t generation(void);
+  private:
+    struct Slot {
+        uint32_t sensor_id;
+        // Index of the state plus one, 0 for an empty slot
+        uint32_t idx;
+    };
+    uint32_t _hash(uint32_t sensor_id);
+    uint32_t _capacity;
+    uint32_t _history;
+    uint32_t _mask;
+    uint32_t _shift;
+    std::vector<Slot> _slots;
+    std::vector<SensorState> _states;
+    std::vector<Reading> _readings;
+    size_t _size = 0;
+    std::atomic<uint64_t> _generation;
+};
+
+#endif /* SENSOR_TABLE_H_ */
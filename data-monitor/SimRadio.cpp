@@ -0,0 +1,430 @@
+#include <cstddef>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <poll.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#include "SimRadio.h"
+
+// Used in the epoll data to tell the stop event apart from the pipes
+#define SIM_STOP_EVENT 0xff
+
+SimRadio::SimRadio(const char *name_space, int fifo_depth, double loss)
+    : _listening(false), _dropped_full(0), _dropped_loss(0) {
+    _namespace = name_space;
+    _fifo_depth = fifo_depth > 0 ? fifo_depth : 1;
+    _fifo.resize(_fifo_depth);
+    _loss = loss;
+
+    for (int i = 0; i < SIM_RADIO_PIPES; i++) {
+        _pipe_fds[i] = -1;
+        _last_seq[i] = 0;
+        _last_ack[i].len = 0;
+    }
+
+    _rx_seed = (unsigned int) time(NULL) ^ (unsigned int) getpid();
+    _tx_seed = _rx_seed * 2654435761u;
+}
+
+SimRadio::~SimRadio() {
+    if (_chip.joinable()) {
+        uint64_t one = 1;
+        if (::write(_stop_fd, &one, sizeof(one)) == sizeof(one)) {
+            _chip.join();
+        } else {
+            _chip.detach();
+        }
+    }
+
+    for (int i = 0; i < SIM_RADIO_PIPES; i++) {
+        if (_pipe_fds[i] >= 0) {
+            close(_pipe_fds[i]);
+        }
+    }
+    int fds[] = {_tx_fd, _epoll_fd, _irq_fd, _stop_fd};
+    for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+        if (fds[i] >= 0) {
+            close(fds[i]);
+        }
+    }
+}
+
+bool SimRadio::begin(void) {
+    struct sockaddr_un addr;
+
+    // The TX socket gets a kernel assigned (autobind) name, which is where ACKs come back to
+    _tx_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (_tx_fd < 0 || bind(_tx_fd, (struct sockaddr *) &addr, sizeof(sa_family_t)) < 0) {
+        printf("Could not create simulated radio socket: %s\n", strerror(errno));
+        return false;
+    }
+
+    _epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    _irq_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    _stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (_epoll_fd < 0 || _irq_fd < 0 || _stop_fd < 0) {
+        return false;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = SIM_STOP_EVENT;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _stop_fd, &event);
+
+    _chip = std::thread(&SimRadio::_chipLoop, this);
+    return true;
+}
+
+// Retransmit delay is in 250us steps, as on the nRF24
+void SimRadio::setRetries(uint8_t delay, uint8_t count) {
+    _retry_delay = delay;
+    _retry_count = count;
+}
+
+void SimRadio::openWritingPipe(const uint8_t *address) {
+    memcpy(_write_address, address, sizeof(_write_address));
+    _have_write_address = true;
+}
+
+void SimRadio::openReadingPipe(uint8_t pipe, const uint8_t *address) {
+    struct sockaddr_un addr;
+    socklen_t len;
+
+    if (pipe >= SIM_RADIO_PIPES) {
+        return;
+    }
+    if (_pipe_fds[pipe] >= 0) {
+        epoll_ctl(_epoll_fd, EPOLL_CTL_DEL, _pipe_fds[pipe], NULL);
+        close(_pipe_fds[pipe]);
+    }
+
+    _address(address, &addr, &len);
+    _pipe_fds[pipe] = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (bind(_pipe_fds[pipe], (struct sockaddr *) &addr, len) < 0) {
+        printf("Could not bind simulated pipe %d: %s\n", pipe, strerror(errno));
+        close(_pipe_fds[pipe]);
+        _pipe_fds[pipe] = -1;
+        return;
+    }
+
+    struct epoll_event event;
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+    event.data.u32 = pipe;
+    epoll_ctl(_epoll_fd, EPOLL_CTL_ADD, _pipe_fds[pipe], &event);
+}
+
+void SimRadio::startListening(void) {
+    _listening = true;
+}
+
+// As with the RF24 library, ACK payloads still waiting are flushed so the TX FIFO is free
+// for write()
+void SimRadio::stopListening(void) {
+    _listening = false;
+    if (_ack_payloads) {
+        flush_tx();
+    }
+}
+
+void SimRadio::enableDynamicPayloads(void) {
+    _dynamic_payloads = true;
+}
+
+// Length of the frame at the head of the RX FIFO, or 0 if it's empty
+uint8_t SimRadio::getDynamicPayloadSize(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (_fifo_count == 0) {
+        return 0;
+    }
+    return _fifo[_fifo_head].len;
+}
+
+bool SimRadio::available(uint8_t *pipe) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (_fifo_count == 0) {
+        return false;
+    }
+    if (pipe != NULL) {
+        *pipe = _fifo[_fifo_head].pipe;
+    }
+    return true;
+}
+
+void SimRadio::read(void *buf, uint8_t len) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    memset(buf, 0, len);
+    if (_fifo_count == 0) {
+        return;
+    }
+
+    RxFrame &frame = _fifo[_fifo_head];
+    memcpy(buf, frame.data, len < frame.len ? len : frame.len);
+    _fifo_head = (_fifo_head + 1) % _fifo_depth;
+    _fifo_count--;
+}
+
+// Payloads are padded out to the full 32 bytes unless dynamic payloads are enabled
+bool SimRadio::write(const void *buf, uint8_t len) {
+    uint8_t frame[sizeof(SimFrameHeader) + SIM_RADIO_PAYLOAD_SIZE];
+    uint8_t ack[sizeof(SimFrameHeader) + SIM_RADIO_PAYLOAD_SIZE];
+    struct sockaddr_un addr;
+    socklen_t addr_len;
+
+    if (!_have_write_address) {
+        return false;
+    }
+    _address(_write_address, &addr, &addr_len);
+
+    if (len > SIM_RADIO_PAYLOAD_SIZE) {
+        len = SIM_RADIO_PAYLOAD_SIZE;
+    }
+    SimFrameHeader *header = (SimFrameHeader *) frame;
+    header->type = SIM_FRAME_DATA;
+    header->len = _dynamic_payloads ? len : SIM_RADIO_PAYLOAD_SIZE;
+    header->seq = ++_tx_seq;
+    memset(frame + sizeof(SimFrameHeader), 0, SIM_RADIO_PAYLOAD_SIZE);
+    memcpy(frame + sizeof(SimFrameHeader), buf, len);
+    size_t frame_len = sizeof(SimFrameHeader) + header->len;
+
+    // Each attempt waits one auto-retransmit delay for the ACK
+    struct timespec ard;
+    ard.tv_sec = 0;
+    ard.tv_nsec = (_retry_delay + 1) * 250000L;
+
+    for (int attempt = 0; attempt <= _retry_count; attempt++) {
+        if (_lost(&_tx_seed)) {
+            // Lost in the air; the sender can't tell, it just never hears an ACK
+        } else {
+            sendto(_tx_fd, frame, frame_len, MSG_DONTWAIT, (struct sockaddr *) &addr, addr_len);
+        }
+
+        struct timespec start, now;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        struct timespec remaining = ard;
+        while (1) {
+            struct pollfd pfd = {_tx_fd, POLLIN, 0};
+            if (ppoll(&pfd, 1, &remaining, NULL) <= 0) {
+                break;
+            }
+
+            ssize_t n = recv(_tx_fd, ack, sizeof(ack), MSG_DONTWAIT);
+            SimFrameHeader *ack_header = (SimFrameHeader *) ack;
+            if (n >= (ssize_t) sizeof(SimFrameHeader) && ack_header->type == SIM_FRAME_ACK &&
+                ack_header->seq == header->seq) {
+                if (_ack_payloads && ack_header->len > 0 && n == (ssize_t) (sizeof(SimFrameHeader) + ack_header->len)) {
+                    _pushFifo(0, ack + sizeof(SimFrameHeader), ack_header->len);
+                }
+                return true;
+            }
+
+            // A late ACK for an earlier frame; keep waiting out this attempt
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            long elapsed = (now.tv_sec - start.tv_sec) * 1000000000L + now.tv_nsec - start.tv_nsec;
+            if (elapsed >= ard.tv_nsec) {
+                break;
+            }
+            remaining.tv_nsec = ard.tv_nsec - elapsed;
+        }
+    }
+
+    return false;
+}
+
+void SimRadio::printDetails(void) {
+    printf("Simulated radio: namespace=%s, FIFO depth=%d, loss=%.3f, retries=%d x %dus\n", _namespace.c_str(),
+           _fifo_depth, _loss, _retry_count, (_retry_delay + 1) * 250);
+}
+
+void SimRadio::enableAckPayload(void) {
+    _ack_payloads = true;
+}
+
+bool SimRadio::writeAckPayload(uint8_t pipe, const void *buf, uint8_t len) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (!_ack_payloads || pipe >= SIM_RADIO_PIPES || (int) _tx_fifo.size() >= _fifo_depth) {
+        return false;
+    }
+
+    RxFrame payload;
+    payload.pipe = pipe;
+    payload.len = len < SIM_RADIO_PAYLOAD_SIZE ? len : SIM_RADIO_PAYLOAD_SIZE;
+    memcpy(payload.data, buf, payload.len);
+    _tx_fifo.push_back(payload);
+    return true;
+}
+
+// The ACK payload is the frame at the head of the RX FIFO on pipe 0
+bool SimRadio::isAckPayloadAvailable(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    return _fifo_count > 0 && _fifo[_fifo_head].pipe == 0;
+}
+
+void SimRadio::flush_tx(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    _tx_fifo.clear();
+}
+
+bool SimRadio::hasIrq(void) {
+    return true;
+}
+
+bool SimRadio::waitIrq(int timeout_ms) {
+    struct pollfd pfd = {_irq_fd, POLLIN, 0};
+    uint64_t count;
+
+    if (poll(&pfd, 1, timeout_ms) <= 0) {
+        return false;
+    }
+    return ::read(_irq_fd, &count, sizeof(count)) == sizeof(count);
+}
+
+uint64_t SimRadio::droppedFull(void) {
+    return _dropped_full.load();
+}
+
+uint64_t SimRadio::droppedLoss(void) {
+    return _dropped_loss.load();
+}
+
+bool SimRadio::_lost(unsigned int *seed) {
+    return _loss > 0 && rand_r(seed) < _loss * ((double) RAND_MAX + 1);
+}
+
+// Drops the frame if the RX FIFO is full
+void SimRadio::_pushFifo(uint8_t pipe, const uint8_t *data, uint8_t len) {
+    std::lock_guard<std::mutex> guard(_lock);
+
+    if (_fifo_count == _fifo_depth) {
+        _dropped_full++;
+        return;
+    }
+
+    RxFrame &frame = _fifo[(_fifo_head + _fifo_count) % _fifo_depth];
+    frame.pipe = pipe;
+    frame.len = len;
+    memcpy(frame.data, data, len);
+    _fifo_count++;
+}
+
+// Radio addresses map to names in the abstract socket namespace
+void SimRadio::_address(const uint8_t *address, struct sockaddr_un *addr, socklen_t *len) {
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    int n = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1, "%s/%02x%02x%02x%02x%02x", _namespace.c_str(),
+                     address[0], address[1], address[2], address[3], address[4]);
+    *len = offsetof(struct sockaddr_un, sun_path) + 1 + n;
+}
+
+// Plays the radio chip: takes frames off the pipe sockets as they arrive
+void SimRadio::_chipLoop(void) {
+    struct epoll_event events[SIM_RADIO_PIPES + 1];
+
+    while (1) {
+        int n = epoll_wait(_epoll_fd, events, SIM_RADIO_PIPES + 1, -1);
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.u32 == SIM_STOP_EVENT) {
+                return;
+            }
+            _receive(events[i].data.u32);
+        }
+    }
+}
+
+void SimRadio::_receive(int pipe) {
+    uint8_t buf[sizeof(SimFrameHeader) + SIM_RADIO_PAYLOAD_SIZE];
+    struct sockaddr_un from;
+    socklen_t from_len;
+    ssize_t n;
+
+    while (1) {
+        from_len = sizeof(from);
+        n = recvfrom(_pipe_fds[pipe], buf, sizeof(buf), 0, (struct sockaddr *) &from, &from_len);
+        if (n < 0) {
+            return;
+        }
+
+        SimFrameHeader *header = (SimFrameHeader *) buf;
+        if (n < (ssize_t) sizeof(SimFrameHeader) || header->type != SIM_FRAME_DATA) {
+            continue;
+        }
+        if (_lost(&_rx_seed)) {
+            _dropped_loss++;
+            continue;
+        }
+        if (!_listening) {
+            continue;
+        }
+        if (!_dynamic_payloads && n - sizeof(SimFrameHeader) != SIM_RADIO_PAYLOAD_SIZE) {
+            continue;
+        }
+
+        std::string sender(from.sun_path, from_len - offsetof(struct sockaddr_un, sun_path));
+        bool duplicate = header->seq == _last_seq[pipe] && sender == _last_sender[pipe];
+
+        if (!duplicate) {
+            std::lock_guard<std::mutex> guard(_lock);
+
+            if (_fifo_count == _fifo_depth) {
+                _dropped_full++;
+                continue;
+            }
+
+            RxFrame &frame = _fifo[(_fifo_head + _fifo_count) % _fifo_depth];
+            frame.pipe = pipe;
+            frame.len = n - sizeof(SimFrameHeader);
+            memcpy(frame.data, buf + sizeof(SimFrameHeader), frame.len);
+            _fifo_count++;
+
+            // A new frame takes the next ACK payload for its pipe, if there is one
+            _last_ack[pipe].len = 0;
+            for (size_t i = 0; i < _tx_fifo.size(); i++) {
+                if (_tx_fifo[i].pipe == pipe) {
+                    _last_ack[pipe] = _tx_fifo[i];
+                    _tx_fifo.erase(_tx_fifo.begin() + i);
+                    break;
+                }
+            }
+        }
+
+        _last_seq[pipe] = header->seq;
+        _last_sender[pipe] = sender;
+
+        if (!duplicate) {
+            uint64_t one = 1;
+            if (::write(_irq_fd, &one, sizeof(one)) < 0) {
+                // Counter can't overflow in practice; nothing to do
+            }
+        }
+
+        // The ACK can be lost on the way back too
+        uint8_t ack[sizeof(SimFrameHeader) + SIM_RADIO_PAYLOAD_SIZE];
+        SimFrameHeader *ack_header = (SimFrameHeader *) ack;
+        ack_header->type = SIM_FRAME_ACK;
+        ack_header->len = 0;
+        ack_header->seq = header->seq;
+        if (_ack_payloads) {
+            std::lock_guard<std::mutex> guard(_lock);
+            ack_header->len = _last_ack[pipe].len;
+            memcpy(ack + sizeof(SimFrameHeader), _last_ack[pipe].data, _last_ack[pipe].len);
+        }
+        if (!_lost(&_rx_seed)) {
+            sendto(_pipe_fds[pipe], ack, sizeof(SimFrameHeader) + ack_header->len, MSG_DONTWAIT,
+                   (struct sockaddr *) &from, from_len);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef SIM_RADIO_H_
+#define SIM_RADIO_H_
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <thread>
+#include <vector>
+#include "Radio.h"
+
+// Same as the nRF24
+#define SIM_RADIO_PAYLOAD_SIZE 32
+#define SIM_RADIO_PIPES 6
+#define SIM_RADIO_FIFO_DEPTH 3
+
+// Abstract socket namespace prefix used when none is given
+#define SIM_RADIO_NAMESPACE "plant-monitor"
+
+// Datagram types exchanged between simulated radios
+#define SIM_FRAME_DATA 1
+#define SIM_FRAME_ACK 2
+
+struct SimFrameHeader {
+    uint8_t type;
+    uint8_t len;
+    uint16_t seq;
+};
+
+// An nRF24 simulated over Unix datagram sockets, so the collector (and anything
+// talking to it) can run on any Linux box.
+//
+// Each reading pipe address is a socket in the abstract namespace.  A background
+// thread plays the part of the radio chip: it accepts frames into an RX FIFO of
+// limited depth and auto-acknowledges them, or drops them unacknowledged when the
+// FIFO is full, the radio isn't listening or the loss model says the frame was lost.
+// write() sends a frame and waits for the ACK, retransmitting like the real thing.
+// Without dynamic payloads every frame is padded to 32 bytes, and a frame of any
+// other length can't be received, as a static payload width mismatch fails the CRC.
+// With ACK payloads, the first one queued for a pipe goes back in the ACK to the next
+// frame received on it (and again in the ACK to any retransmission of that frame), and
+// the sender finds it in its RX FIFO on pipe 0.
+class SimRadio : public Radio {
+  public:
+    SimRadio(const char *name_space = SIM_RADIO_NAMESPACE, int fifo_depth = SIM_RADIO_FIFO_DEPTH,
+             double loss = 0.0);
+    ~SimRadio();
+    bool begin(void);
+    void setRetries(uint8_t delay, uint8_t count);
+    void openWritingPipe(const uint8_t *address);
+    void openReadingPipe(uint8_t pipe, const uint8_t *address);
+    void startListening(void);
+    void stopListening(void);
+    void enableDynamicPayloads(void);
+    uint8_t getDynamicPayloadSize(void);
+    bool available(uint8_t *pipe = NULL);
+    void read(void *buf, uint8_t len);
+    bool write(const void *buf, uint8_t len);
+    void printDetails(void);
+    void enableAckPayload(void);
+    bool writeAckPayload(uint8_t pipe, const void *buf, uint8_t len);
+    bool isAckPayloadAvailable(void);
+    void flush_tx(void);
+    bool hasIrq(void);
+    bool waitIrq(int timeout_ms);
+    // Frames dropped because the RX FIFO was full or to simulated loss
+    uint64_t droppedFull(void);
+    uint64_t droppedLoss(void);
+  private:
+    struct RxFrame {
+        uint8_t pipe;
+        uint8_t len;
+        uint8_t data[SIM_RADIO_PAYLOAD_SIZE];
+    };
+    bool _lost(unsigned int *seed);
+    void _address(const uint8_t *address, struct sockaddr_un *addr, socklen_t *len);
+    void _chipLoop(void);
+    void _receive(int pipe);
+    void _pushFifo(uint8_t pipe, const uint8_t *data, uint8_t len);
+    std::string _namespace;
+    int _fifo_depth;
+    double _loss;
+    uint8_t _retry_delay = 5;
+    uint8_t _retry_count = 15;
+    uint8_t _write_address[5];
+    bool _have_write_address = false;
+    bool _dynamic_payloads = false;
+    bool _ack_payloads = false;
+    int _tx_fd = -1;
+    uint16_t _tx_seq = 0;
+    int _pipe_fds[SIM_RADIO_PIPES];
+    int _epoll_fd = -1;
+    int _irq_fd = -1;
+    int _stop_fd = -1;
+    std::atomic<bool> _listening;
+    std::mutex _lock;
+    std::vector<RxFrame> _fifo;
+    int _fifo_head = 0;
+    int _fifo_count = 0;
+    // ACK payloads waiting for a frame on their pipe, up to the FIFO depth, and the one
+    // last sent on each pipe for retransmissions
+    std::vector<RxFrame> _tx_fifo;
+    RxFrame _last_ack[SIM_RADIO_PIPES];
+    // Sender and sequence number of the last frame on each pipe, to drop
+    // retransmissions of a frame whose ACK was lost, as the chip does
+    std::string _last_sender[SIM_RADIO_PIPES];
+    uint16_t _last_seq[SIM_RADIO_PIPES];
+    std::thread _chip;
+    std::atomic<uint64_t> _dropped_full;
+    std::atomic<uint64_t> _dropped_loss;
+    unsigned int _rx_seed;
+    unsigned int _tx_seed;
+};
+
+#endif /* SIM_RADIO_H_ */
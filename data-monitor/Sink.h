@@ -0,0 +1,24 @@
+#ifndef SINK_H_
+#define SINK_H_
+
+#include "Reading.h"
+#include "Rollup.h"
+
+// Where readings go once they're safely in the spool: InfluxDB (InfluxWriter), MQTT
+// (MqttWriter), a file (FileWriter) or the collector's own storage (Tsdb).  Each sink has
+// its own SinkWorker, whose thread adds a batch of readings and flushes it; they're only
+// taken off the sink's queue or spill once the flush has succeeded.
+class Sink {
+  public:
+    virtual ~Sink() {}
+    virtual void add(const Reading &reading) = 0;
+    // Downsampled windows from RollupEngine, batched and flushed with the readings.  Sinks
+    // that can scan their raw readings quickly enough have no use for them.
+    virtual void addRollup(const Rollup & /* rollup */) {}
+    // Write out everything added since the last flush.  Returns false if that couldn't be
+    // done, in which case the batch is discarded and offered again later.
+    virtual bool flush(void) = 0;
+    virtual void discard(void) = 0;
+};
+
+#endif /* SINK_H_ */
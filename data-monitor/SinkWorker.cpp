@@ -0,0 +1,288 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include "Clock.h"
+#include "SinkWorker.h"
+
+static const uint32_t latency_bounds_us[] = {1000, 2500, 5000, 10000, 25000, 50000, 100000, 250000,
+                                             500000, 1000000, 2500000, 5000000, 10000000};
+
+SinkWorker::SinkWorker(const char *name, Sink *sink, const SinkPolicy &policy, Spool *spill)
+    : latency(latency_bounds_us, sizeof(latency_bounds_us) / sizeof(latency_bounds_us[0])) {
+    _name = name;
+    _sink = sink;
+    _policy = policy;
+    _spill = spill;
+}
+
+SinkWorker::~SinkWorker() {
+    stop();
+}
+
+void SinkWorker::start(void) {
+    // Left over from last time
+    if (_spill != NULL && _spill->pending() > 0) {
+        _spilling_since_ms = monotonicMillis();
+    }
+    _thread = std::thread(&SinkWorker::_run, this);
+}
+
+void SinkWorker::stop(void) {
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stopping = true;
+    }
+    _wake.notify_one();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+const std::string &SinkWorker::name(void) {
+    return _name;
+}
+
+uint64_t SinkWorker::offered(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _offered;
+}
+
+size_t SinkWorker::room(size_t max) {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_policy.overflow != SINK_BLOCK) {
+        return max;
+    }
+    size_t room = _queue.size() < _policy.queue ? _policy.queue - _queue.size() : 0;
+    return room < max ? room : max;
+}
+
+size_t SinkWorker::offer(uint64_t position, const Reading *readings, size_t count) {
+    std::lock_guard<std::mutex> guard(_lock);
+    uint64_t now = monotonicMillis();
+    bool spilled = false;
+    size_t taken;
+
+    for (taken = 0; taken < count; taken++) {
+        // Once anything has spilled, the rest follow it there until it's drained, to keep
+        // them in order
+        bool spilling = _spill != NULL && _spill->pending() > 0;
+        if (!spilling && _queue.size() < _policy.queue) {
+            Entry entry = {readings[taken], position + taken, now};
+            _queue.push_back(entry);
+            continue;
+        }
+
+        if (_policy.overflow == SINK_BLOCK) {
+            break;
+        }
+        if (_policy.overflow == SINK_SPILL && _spill != NULL && _spill->append(readings[taken])) {
+            if (_spilling_since_ms == 0) {
+                _spilling_since_ms = now;
+            }
+            spilled = true;
+            continue;
+        }
+        dropped.add();
+    }
+
+    if (spilled) {
+        _spill->sync();
+    }
+    _offered = position + taken;
+    if (taken > 0) {
+        _wake.notify_one();
+    }
+    return taken;
+}
+
+void SinkWorker::offerRollups(const Rollup *rollups, size_t count) {
+    std::lock_guard<std::mutex> guard(_lock);
+    uint64_t now = monotonicMillis();
+
+    for (size_t i = 0; i < count; i++) {
+        if (_rollups.size() >= SINK_ROLLUP_QUEUE_MAX) {
+            _rollups.pop_front();
+            rollups_dropped.add();
+        }
+        RollupEntry entry = {rollups[i], now};
+        _rollups.push_back(entry);
+    }
+    if (count > 0) {
+        _wake.notify_one();
+    }
+}
+
+uint64_t SinkWorker::resolved(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_policy.overflow == SINK_BLOCK && !_queue.empty()) {
+        return _queue.front().position;
+    }
+    return _offered;
+}
+
+bool SinkWorker::idle(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+    return !_busy && _queue.empty() && _rollups.empty() && (_spill == NULL || _spill->pending() == 0);
+}
+
+size_t SinkWorker::queued(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _queue.size();
+}
+
+uint64_t SinkWorker::spilled(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _spill != NULL ? _spill->pending() : 0;
+}
+
+uint64_t SinkWorker::lagMillis(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+    uint64_t now = monotonicMillis();
+    uint64_t oldest = now;
+
+    if (!_queue.empty() && _queue.front().queued_ms < oldest) {
+        oldest = _queue.front().queued_ms;
+    }
+    if (!_rollups.empty() && _rollups.front().queued_ms < oldest) {
+        oldest = _rollups.front().queued_ms;
+    }
+    if (_spilling_since_ms != 0 && _spilling_since_ms < oldest) {
+        oldest = _spilling_since_ms;
+    }
+    return now - oldest;
+}
+
+// Whether a batch should be written now: it's full, or the oldest in it has waited long
+// enough.  Otherwise says how long to wait.  Called with the lock held.
+bool SinkWorker::_ready(uint64_t now, uint64_t *wait_ms) {
+    uint64_t spilled = _spill != NULL ? _spill->pending() : 0;
+    uint64_t oldest = now;
+
+    if (_queue.empty() && _rollups.empty() && spilled == 0) {
+        *wait_ms = _policy.wait_ms;
+        return false;
+    }
+    if (_queue.size() + spilled >= _policy.batch || _rollups.size() >= _policy.batch) {
+        return true;
+    }
+
+    if (!_queue.empty()) {
+        oldest = _queue.front().queued_ms;
+    } else if (spilled > 0) {
+        oldest = _spilling_since_ms;
+    }
+    if (!_rollups.empty() && _rollups.front().queued_ms < oldest) {
+        oldest = _rollups.front().queued_ms;
+    }
+    if (now - oldest >= _policy.wait_ms) {
+        return true;
+    }
+    *wait_ms = _policy.wait_ms - (now - oldest);
+    return false;
+}
+
+void SinkWorker::_run(void) {
+    std::vector<Reading> batch;
+    std::vector<RollupEntry> rollup_batch;
+    uint64_t backoff = SINK_BACKOFF_MIN_MS;
+    uint64_t retry_at = 0;
+    std::unique_lock<std::mutex> lock(_lock);
+
+    while (!_stopping) {
+        uint64_t now = monotonicMillis();
+        uint64_t wait_ms;
+
+        if (now < retry_at) {
+            _wake.wait_for(lock, std::chrono::milliseconds(retry_at - now));
+            continue;
+        }
+        if (!_ready(now, &wait_ms)) {
+            _wake.wait_for(lock, std::chrono::milliseconds(wait_ms));
+            continue;
+        }
+
+        // Oldest first: what's queued, then whatever spilled after it.  Readings stay where
+        // they are until written; rollups are taken out, as the oldest can be dropped
+        // meanwhile.
+        batch.clear();
+        size_t count = _queue.size() < _policy.batch ? _queue.size() : _policy.batch;
+        for (size_t i = 0; i < count; i++) {
+            batch.push_back(_queue[i].reading);
+        }
+        bool from_spill = false;
+        if (count == 0 && _spill != NULL && _spill->pending() > 0) {
+            batch.resize(_policy.batch);
+            count = _spill->peek(batch.data(), _policy.batch);
+            batch.resize(count);
+            from_spill = true;
+        }
+        rollup_batch.clear();
+        while (!_rollups.empty() && rollup_batch.size() < _policy.batch) {
+            rollup_batch.push_back(_rollups.front());
+            _rollups.pop_front();
+        }
+        _busy = true;
+        lock.unlock();
+
+        for (size_t i = 0; i < batch.size(); i++) {
+            _sink->add(batch[i]);
+        }
+        for (size_t i = 0; i < rollup_batch.size(); i++) {
+            _sink->addRollup(rollup_batch[i].rollup);
+        }
+        uint64_t start = monotonicMicros();
+        bool ok = _sink->flush();
+        latency.observe(monotonicMicros() - start);
+        if (!ok) {
+            _sink->discard();
+        }
+
+        lock.lock();
+        _busy = false;
+        if (ok) {
+            if (from_spill) {
+                _spill->commit(count);
+                if (_spill->pending() == 0) {
+                    _spilling_since_ms = 0;
+                }
+            } else {
+                _queue.erase(_queue.begin(), _queue.begin() + count);
+            }
+            writes_ok.add();
+            readings.add(count);
+            rollups.add(rollup_batch.size());
+            backoff = SINK_BACKOFF_MIN_MS;
+            retry_at = 0;
+            continue;
+        }
+
+        // Put the rollups back in front of any that have closed since, as long as there's room
+        for (size_t i = rollup_batch.size(); i > 0; i--) {
+            _rollups.push_front(rollup_batch[i - 1]);
+        }
+        while (_rollups.size() > SINK_ROLLUP_QUEUE_MAX) {
+            _rollups.pop_front();
+            rollups_dropped.add();
+        }
+
+        writes_failed.add();
+        printf("Sink %s write failed, %zu readings queued, %llu spilled, retrying in %llums\n", _name.c_str(),
+               _queue.size(), (unsigned long long) (_spill != NULL ? _spill->pending() : 0),
+               (unsigned long long) backoff);
+        retry_at = monotonicMillis() + backoff;
+        backoff = backoff * 2 < SINK_BACKOFF_MAX_MS ? backoff * 2 : SINK_BACKOFF_MAX_MS;
+    }
+}
+
+bool parseSinkOverflow(const char *name, SinkOverflow *overflow) {
+    if (strcmp(name, "block") == 0) {
+        *overflow = SINK_BLOCK;
+    } else if (strcmp(name, "drop") == 0) {
+        *overflow = SINK_DROP;
+    } else if (strcmp(name, "spill") == 0) {
+        *overflow = SINK_SPILL;
+    } else {
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,119 @@
+#ifndef SINK_WORKER_H_
+#define SINK_WORKER_H_
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Metrics.h"
+#include "Reading.h"
+#include "Rollup.h"
+#include "Sink.h"
+#include "Spool.h"
+
+// Defaults for each sink's policy, which can be set per sink on the command line
+
+// Readings held in memory for the sink
+#define SINK_QUEUE_SIZE 10000
+// Most readings written to the sink in one go
+#define SINK_BATCH 5000
+// Longest a reading waits for a batch to fill up before it's written anyway
+#define SINK_WAIT_MS 1000
+
+// Closed rollup windows held for the sink.  They aren't spooled, so while the sink is
+// unreachable only this many are kept, dropping the oldest.
+#define SINK_ROLLUP_QUEUE_MAX 65536
+
+// Wait between attempts while the sink is unreachable, doubling each time
+#define SINK_BACKOFF_MIN_MS 1000
+#define SINK_BACKOFF_MAX_MS 300000
+
+// What happens to readings offered to a sink whose queue is full
+enum SinkOverflow {
+    // Leave them in the spool, which holds on to them until the sink has written them
+    SINK_BLOCK,
+    // Throw them away
+    SINK_DROP,
+    // Append them to the sink's own spool, to be written once it catches up
+    SINK_SPILL
+};
+
+struct SinkPolicy {
+    size_t queue = SINK_QUEUE_SIZE;
+    size_t batch = SINK_BATCH;
+    uint32_t wait_ms = SINK_WAIT_MS;
+    SinkOverflow overflow = SINK_BLOCK;
+};
+
+// Feeds one sink from its own queue on its own thread, so a slow or unreachable sink
+// only ever holds up itself.
+//
+// The writer thread offers each sink the spooled readings it hasn't had yet, tracking
+// them by their position in the spool.  A blocking sink only takes what fits in its queue
+// and the rest wait in the spool, which isn't let go of past the oldest reading a blocking
+// sink still has to write.  Drop and spill sinks take everything offered, so they never
+// hold the spool back; the price is that a crash loses what was in their queues.
+class SinkWorker {
+  public:
+    SinkWorker(const char *name, Sink *sink, const SinkPolicy &policy, Spool *spill = NULL);
+    ~SinkWorker();
+    void start(void);
+    void stop(void);
+    const std::string &name(void);
+    // Spool position of the next reading the sink hasn't been offered
+    uint64_t offered(void);
+    // Most readings the sink would take right now, up to max
+    size_t room(size_t max);
+    // Offer readings starting at the given spool position.  Returns how many were taken.
+    size_t offer(uint64_t position, const Reading *readings, size_t count);
+    void offerRollups(const Rollup *rollups, size_t count);
+    // Spool position everything before which the sink is done with
+    uint64_t resolved(void);
+    // Whether everything offered has been written (or dropped)
+    bool idle(void);
+    size_t queued(void);
+    uint64_t spilled(void);
+    // How long the oldest reading waiting for the sink has waited
+    uint64_t lagMillis(void);
+    Counter writes_ok;
+    Counter writes_failed;
+    Counter readings;
+    Counter rollups;
+    Counter dropped;
+    Counter rollups_dropped;
+    Histogram latency;
+  private:
+    struct Entry {
+        Reading reading;
+        uint64_t position;
+        uint64_t queued_ms;
+    };
+    struct RollupEntry {
+        Rollup rollup;
+        uint64_t queued_ms;
+    };
+    bool _ready(uint64_t now, uint64_t *wait_ms);
+    void _run(void);
+    std::string _name;
+    Sink *_sink;
+    SinkPolicy _policy;
+    Spool *_spill;
+    std::mutex _lock;
+    std::condition_variable _wake;
+    std::deque<Entry> _queue;
+    std::deque<RollupEntry> _rollups;
+    uint64_t _offered = 0;
+    // When the spill last went from empty to holding readings
+    uint64_t _spilling_since_ms = 0;
+    bool _busy = false;
+    bool _stopping = false;
+    std::thread _thread;
+};
+
+bool parseSinkOverflow(const char *name, SinkOverflow *overflow);
+
+#endif /* SINK_WORKER_H_ */
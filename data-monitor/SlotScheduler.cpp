@@ -0,0 +1,170 @@
+#include <algorithm>
+#include "SlotScheduler.h"
+
+SlotScheduler::SlotScheduler(uint32_t period_ms) : _size(0), _rebalances(0) {
+    _period_ms = period_ms > 0 ? period_ms : 1;
+}
+
+int32_t SlotScheduler::arrived(uint32_t sensor_id, uint64_t now_ms) {
+    if (now_ms >= _next_expire_ms) {
+        _expire(now_ms);
+        _next_expire_ms = now_ms + _period_ms;
+    }
+
+    int i = _find(sensor_id);
+    if (i < 0) {
+        i = _insert(sensor_id, now_ms);
+        _slots[i].last_seen_ms = now_ms;
+        return 0;
+    }
+
+    Slot &slot = _slots[i];
+    slot.last_seen_ms = now_ms;
+
+    // Lateness is only learnt from sensors doing as they were told.  Anything else is
+    // measured against the nearest turn of its slot.
+    int64_t off;
+    if (slot.target_ms != 0) {
+        off = (int64_t) (now_ms - slot.target_ms);
+        slot.target_ms = 0;
+        if (off > -(int64_t) _period_ms / 2 && off < (int64_t) _period_ms / 2) {
+            int32_t error = (int32_t) off - slot.late_ms;
+            slot.late_ms += error / 2;
+            return error;
+        }
+    }
+    off = (int64_t) ((now_ms + _period_ms - slot.offset_ms % _period_ms) % _period_ms);
+    if (off > _period_ms / 2) {
+        off -= _period_ms;
+    }
+    return (int32_t) off - slot.late_ms;
+}
+
+uint32_t SlotScheduler::delay(uint32_t sensor_id, uint64_t now_ms) {
+    uint32_t delay = plan(sensor_id, now_ms);
+    told(sensor_id, now_ms, delay);
+    return delay;
+}
+
+// Aims for when the sensor turns up, so it's told to set off early by its usual lateness.
+// A slot less than half a period off is too soon to be sure of making, so it gets the one
+// after.
+uint32_t SlotScheduler::plan(uint32_t sensor_id, uint64_t at_ms) {
+    int i = _find(sensor_id);
+    if (i < 0) {
+        i = _insert(sensor_id, at_ms);
+        _slots[i].last_seen_ms = at_ms;
+    }
+
+    Slot &slot = _slots[i];
+    int64_t start = (int64_t) slot.offset_ms - slot.late_ms;
+    uint64_t delay = (uint64_t) ((start - (int64_t) (at_ms % _period_ms)) % (int64_t) _period_ms + _period_ms) %
+                     _period_ms;
+    if (delay < _period_ms / 2) {
+        delay += _period_ms;
+    }
+    return (uint32_t) delay;
+}
+
+void SlotScheduler::told(uint32_t sensor_id, uint64_t now_ms, uint32_t delay_ms) {
+    int i = _find(sensor_id);
+    if (i >= 0) {
+        _slots[i].target_ms = now_ms + delay_ms + _slots[i].late_ms;
+    }
+}
+
+uint64_t SlotScheduler::due(uint32_t sensor_id) {
+    int i = _find(sensor_id);
+    return i < 0 ? 0 : _slots[i].target_ms;
+}
+
+uint32_t SlotScheduler::tolerance(void) {
+    return _period_ms / (_slots.empty() ? 1 : _slots.size()) / 4;
+}
+
+uint32_t SlotScheduler::period(void) {
+    return _period_ms;
+}
+
+size_t SlotScheduler::size(void) {
+    return _size.load();
+}
+
+uint64_t SlotScheduler::rebalances(void) {
+    return _rebalances.load();
+}
+
+void SlotScheduler::_sort(void) {
+    std::sort(_slots.begin(), _slots.end(), [](const Slot &a, const Slot &b) { return a.offset_ms < b.offset_ms; });
+}
+
+int SlotScheduler::_find(uint32_t sensor_id) {
+    for (size_t i = 0; i < _slots.size(); i++) {
+        if (_slots[i].sensor_id == sensor_id) {
+            return (int) i;
+        }
+    }
+    return -1;
+}
+
+// The first sensor keeps the phase it turned up at.  The rest go in the middle of the
+// biggest gap, before everyone is spaced out again.
+int SlotScheduler::_insert(uint32_t sensor_id, uint64_t now_ms) {
+    Slot slot;
+    slot.sensor_id = sensor_id;
+    slot.last_seen_ms = now_ms;
+    slot.target_ms = 0;
+    slot.late_ms = 0;
+    slot.offset_ms = now_ms % _period_ms;
+
+    if (!_slots.empty()) {
+        size_t widest = 0;
+        uint32_t widest_gap = 0;
+        for (size_t i = 0; i < _slots.size(); i++) {
+            uint32_t next = i + 1 < _slots.size() ? _slots[i + 1].offset_ms : _slots[0].offset_ms + _period_ms;
+            if (next - _slots[i].offset_ms > widest_gap) {
+                widest_gap = next - _slots[i].offset_ms;
+                widest = i;
+            }
+        }
+        slot.offset_ms = (_slots[widest].offset_ms + widest_gap / 2) % _period_ms;
+    }
+
+    _slots.push_back(slot);
+    _sort();
+    _respace();
+    return _find(sensor_id);
+}
+
+void SlotScheduler::_expire(uint64_t now_ms) {
+    uint64_t limit = (uint64_t) _period_ms * SLOT_MISSED_PERIODS;
+    size_t kept = 0;
+
+    for (size_t i = 0; i < _slots.size(); i++) {
+        if (now_ms - _slots[i].last_seen_ms <= limit) {
+            _slots[kept++] = _slots[i];
+        }
+    }
+    if (kept < _slots.size()) {
+        _slots.resize(kept);
+        _respace();
+    }
+}
+
+// Evenly from the first slot's offset, in the order they're in now
+void SlotScheduler::_respace(void) {
+    _size.store(_slots.size());
+    if (_slots.empty()) {
+        return;
+    }
+
+    uint32_t first = _slots[0].offset_ms;
+    for (size_t i = 1; i < _slots.size(); i++) {
+        _slots[i].offset_ms = (uint32_t) (first + (uint64_t) _period_ms * i / _slots.size());
+    }
+    for (size_t i = 0; i < _slots.size(); i++) {
+        _slots[i].offset_ms %= _period_ms;
+    }
+    _sort();
+    _rebalances++;
+}
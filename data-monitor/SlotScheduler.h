@@ -0,0 +1,68 @@
+#ifndef SLOT_SCHEDULER_H_
+#define SLOT_SCHEDULER_H_
+
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A sensor that hasn't been heard from for this many periods gives up its slot
+#define SLOT_MISSED_PERIODS 3
+
+// Hands out report slots, spread evenly over a period, so sensors take turns on the air
+// instead of colliding whenever their schedules happen to line up.
+//
+// Each sensor has an offset into the period, and each reply tells it how long to wait
+// until its next one, and to report every period from then on.  A sensor's watchdog
+// isn't accurate, and it spends a while waking up before it sends, so how late it turned
+// up last time it was told is remembered and it's told to come that much earlier.  A
+// sensor only sleeps whole wake intervals plus a shift to line up with its slot, so the
+// period needs to be a little longer than the sensors' wake interval for them to keep it.
+//
+// A new sensor goes in the middle of the biggest gap, and sensors that stop reporting
+// are dropped.  Either way the rest are spaced out evenly again, keeping their order so
+// none of them has to cross another.  Only used from the radio thread, apart from the
+// counts.
+class SlotScheduler {
+  public:
+    SlotScheduler(uint32_t period_ms);
+    // A frame from the sensor arrived, which gives it a slot if it hasn't one.  Returns
+    // how far from its slot it was, beyond its usual lateness, in ms.
+    int32_t arrived(uint32_t sensor_id, uint64_t now_ms);
+    // Time from now until the sensor's next slot, for its reply
+    uint32_t delay(uint32_t sensor_id, uint64_t now_ms);
+    // A reply queued ahead of the sensor's frame, as an ACK payload is, can't be worked
+    // out from when the frame arrives.  plan() works it out from when the sensor is due,
+    // leaving it to told() to note what it was told once its frame has taken the reply.
+    uint32_t plan(uint32_t sensor_id, uint64_t at_ms);
+    void told(uint32_t sensor_id, uint64_t now_ms, uint32_t delay_ms);
+    // When the sensor was last told to come, or 0
+    uint64_t due(uint32_t sensor_id);
+    // Furthest a sensor can be from its slot before it gets near its neighbours'
+    uint32_t tolerance(void);
+    uint32_t period(void);
+    size_t size(void);
+    uint64_t rebalances(void);
+  private:
+    struct Slot {
+        uint32_t sensor_id;
+        uint32_t offset_ms;
+        uint64_t last_seen_ms;
+        // When it was last told to come, or 0
+        uint64_t target_ms;
+        int32_t late_ms;
+    };
+    void _sort(void);
+    int _find(uint32_t sensor_id);
+    int _insert(uint32_t sensor_id, uint64_t now_ms);
+    void _expire(uint64_t now_ms);
+    void _respace(void);
+    uint32_t _period_ms;
+    // Sorted by offset
+    std::vector<Slot> _slots;
+    uint64_t _next_expire_ms = 0;
+    std::atomic<size_t> _size;
+    std::atomic<uint64_t> _rebalances;
+};
+
+#endif /* SLOT_SCHEDULER_H_ */
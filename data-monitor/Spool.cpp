@@ -0,0 +1,402 @@
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include "Crc32.h"
+#include "Directory.h"
+#include "Spool.h"
+
+struct SpoolCursor {
+    uint64_t seq;
+    uint32_t idx;
+    uint32_t crc;
+};
+
+Spool::Spool(const char *dir, uint32_t segment_records) {
+    _dir = dir;
+    _segment_records = segment_records;
+    _segment_bytes = SPOOL_HEADER_SIZE + (size_t) segment_records * sizeof(SpoolRecord);
+}
+
+Spool::~Spool() {
+    sync();
+    _closeSegment(&_write);
+    _closeSegment(&_read);
+    _closeSegment(&_ahead);
+}
+
+// Find the existing segments, restore the read cursor and work out where writing
+// left off.  Returns false if the spool directory can't be used.
+bool Spool::open(void) {
+    std::vector<uint64_t> seqs;
+    unsigned long long seq;
+    char extra;
+
+    if (!createDirectories(_dir)) {
+        printf("Could not create spool directory %s: %s\n", _dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    DIR *dir = opendir(_dir.c_str());
+    if (dir == NULL) {
+        printf("Could not open spool directory %s: %s\n", _dir.c_str(), strerror(errno));
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "spool-%16llx.da%c", &seq, &extra) == 2 && extra == 't') {
+            seqs.push_back(seq);
+        }
+    }
+    closedir(dir);
+    std::sort(seqs.begin(), seqs.end());
+
+    // Segments left by a collector with a different record layout can't be read back.  Move
+    // them out of the way rather than refuse to start.
+    for (size_t i = 0; i < seqs.size();) {
+        if (_currentFormat(seqs[i])) {
+            i++;
+            continue;
+        }
+        std::string path = _segmentPath(seqs[i]);
+        printf("Spool segment %s is in an older format, moving it aside\n", path.c_str());
+        rename(path.c_str(), (path + ".old").c_str());
+        seqs.erase(seqs.begin() + i);
+    }
+
+    _loadCursor();
+
+    if (seqs.empty()) {
+        uint64_t first = _read.seq > 0 ? _read.seq : 1;
+        if (!_openSegment(&_write, first, true) || !_openSegment(&_read, first, false)) {
+            return false;
+        }
+        _write_idx = _synced_idx = _read_idx = 0;
+        _saveCursor();
+        return true;
+    }
+
+    // Anything before the cursor has already been written to the sink
+    if (_read.seq < seqs.front() || _read.seq > seqs.back()) {
+        _read.seq = seqs.front();
+        _read_idx = 0;
+    }
+    for (size_t i = 0; i < seqs.size() && seqs[i] < _read.seq; i++) {
+        unlink(_segmentPath(seqs[i]).c_str());
+    }
+
+    if (!_openSegment(&_write, seqs.back(), false)) {
+        return false;
+    }
+
+    // Records are written in order, so the first one that isn't valid is where the
+    // previous run stopped
+    _write_idx = 0;
+    while (_write_idx < _segment_records && _valid(_record(&_write, _write_idx))) {
+        _write_idx++;
+    }
+    _synced_idx = _write_idx;
+
+    if (!_openSegment(&_read, _read.seq, false)) {
+        return false;
+    }
+    if (_read.seq == _write.seq && _read_idx > _write_idx) {
+        _read_idx = _write_idx;
+    }
+
+    printf("Spool recovered %llu unsent readings\n", (unsigned long long) pending());
+    return true;
+}
+
+bool Spool::append(const Reading &reading) {
+    if (_write_idx == _segment_records) {
+        uint64_t next = _write.seq + 1;
+        sync();
+        _closeSegment(&_write);
+        if (!_openSegment(&_write, next, true)) {
+            return false;
+        }
+        _write_idx = _synced_idx = 0;
+    }
+
+    SpoolRecord *record = _record(&_write, _write_idx);
+    record->reading = reading;
+    record->crc = crc32(&record->reading, sizeof(Reading));
+
+    // The marker goes in last so a record is only ever seen as complete once it is
+    __sync_synchronize();
+    record->marker = SPOOL_RECORD_MARKER;
+
+    _write_idx++;
+    return true;
+}
+
+// Flush records appended since the last sync out to disk
+void Spool::sync(void) {
+    if (_write.map == NULL || _synced_idx == _write_idx) {
+        return;
+    }
+
+    long page = sysconf(_SC_PAGESIZE);
+    size_t start = (uint8_t *) _record(&_write, _synced_idx) - _write.map;
+    size_t end = (uint8_t *) _record(&_write, _write_idx) - _write.map;
+    start -= start % page;
+
+    msync(_write.map + start, end - start, MS_SYNC);
+    _synced_idx = _write_idx;
+}
+
+// Copy up to max of the oldest unsent readings without consuming them.  Call commit()
+// once they have been written to the sink.
+size_t Spool::peek(Reading *readings, size_t max) {
+    size_t count = 0;
+
+    // Caught up at the end of a segment before the next one was started
+    if (_advance()) {
+        _saveCursor();
+    }
+
+    while (count < max) {
+        uint32_t end = _read.seq == _write.seq ? _write_idx : _segment_records;
+        uint32_t idx = _read_idx + count;
+        if (idx >= end) {
+            break;
+        }
+
+        SpoolRecord *record = _record(&_read, idx);
+        if (!_valid(record)) {
+            if (count > 0) {
+                break;
+            }
+            // Damaged on disk; nothing to do but step over it
+            printf("Spool skipping corrupt record %u in segment %llu\n", idx, (unsigned long long) _read.seq);
+            commit(1);
+            continue;
+        }
+
+        readings[count++] = record->reading;
+    }
+
+    return count;
+}
+
+// Copy up to max readings starting from a position at or after the cursor, without
+// consuming them.  Stops short at a damaged record, which is left for peek() to step over
+// once the cursor gets to it.
+size_t Spool::peekAt(uint64_t position, Reading *readings, size_t max) {
+    if (position <= this->position()) {
+        return peek(readings, max);
+    }
+
+    size_t count = 0;
+    while (count < max) {
+        uint64_t seq = (position + count) / _segment_records;
+        uint32_t idx = (position + count) % _segment_records;
+        if (seq > _write.seq || (seq == _write.seq && idx >= _write_idx)) {
+            break;
+        }
+
+        Segment *segment = &_ahead;
+        if (seq == _read.seq) {
+            segment = &_read;
+        } else if (seq == _write.seq) {
+            segment = &_write;
+        } else if (_ahead.seq != seq || _ahead.map == NULL) {
+            _closeSegment(&_ahead);
+            if (!_openSegment(&_ahead, seq, false)) {
+                break;
+            }
+        }
+
+        SpoolRecord *record = _record(segment, idx);
+        if (!_valid(record)) {
+            break;
+        }
+        readings[count++] = record->reading;
+    }
+
+    return count;
+}
+
+// Position of the oldest unsent reading, counting up through every reading ever spooled
+uint64_t Spool::position(void) {
+    return _read.seq * _segment_records + _read_idx;
+}
+
+// Mark the oldest count readings as sent
+void Spool::commit(size_t count) {
+    _read_idx += count;
+    _advance();
+    _saveCursor();
+}
+
+// Move the cursor on to the next segment once it has read all of this one and there is a
+// next one, which there may not be until some time after.  Returns whether it moved.
+bool Spool::_advance(void) {
+    bool moved = false;
+
+    while (_read_idx >= _segment_records && _read.seq < _write.seq) {
+        uint64_t done = _read.seq;
+        _closeSegment(&_read);
+        if (_ahead.seq == done) {
+            _closeSegment(&_ahead);
+        }
+        unlink(_segmentPath(done).c_str());
+
+        // A commit can run on past the end of the segment, into the next
+        _read_idx -= _segment_records;
+        for (uint64_t next = done + 1; next <= _write.seq; next++) {
+            if (_openSegment(&_read, next, false)) {
+                break;
+            }
+        }
+        moved = true;
+    }
+
+    return moved;
+}
+
+uint64_t Spool::pending(void) {
+    return (_write.seq - _read.seq) * _segment_records + _write_idx - _read_idx;
+}
+
+std::string Spool::_segmentPath(uint64_t seq) {
+    char name[64];
+    snprintf(name, sizeof(name), "/spool-%016llx.dat", (unsigned long long) seq);
+    return _dir + name;
+}
+
+// Whether a segment's header matches the record layout of this build.  Ones too short
+// to have a header are left for _openSegment() to complain about.
+bool Spool::_currentFormat(uint64_t seq) {
+    char header[16];
+
+    int fd = ::open(_segmentPath(seq).c_str(), O_RDONLY);
+    if (fd < 0) {
+        return true;
+    }
+    ssize_t len = pread(fd, header, sizeof(header), 0);
+    close(fd);
+    if (len < (ssize_t) sizeof(header) || memcmp(header, SPOOL_MAGIC, sizeof(SPOOL_MAGIC)) != 0) {
+        return true;
+    }
+
+    uint32_t version, record_size;
+    memcpy(&version, header + 8, sizeof(version));
+    memcpy(&record_size, header + 12, sizeof(record_size));
+    return version == SPOOL_VERSION && record_size == sizeof(SpoolRecord);
+}
+
+bool Spool::_openSegment(Segment *segment, uint64_t seq, bool create) {
+    std::string path = _segmentPath(seq);
+
+    segment->seq = seq;
+    segment->fd = ::open(path.c_str(), O_RDWR | (create ? O_CREAT | O_TRUNC : 0), 0644);
+    if (segment->fd < 0) {
+        printf("Could not open spool segment %s: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    if (create && ftruncate(segment->fd, _segment_bytes) < 0) {
+        printf("Could not size spool segment %s: %s\n", path.c_str(), strerror(errno));
+        _closeSegment(segment);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(segment->fd, &st) < 0 || (size_t) st.st_size < _segment_bytes) {
+        printf("Spool segment %s is truncated\n", path.c_str());
+        _closeSegment(segment);
+        return false;
+    }
+
+    void *map = mmap(NULL, _segment_bytes, PROT_READ | PROT_WRITE, MAP_SHARED, segment->fd, 0);
+    if (map == MAP_FAILED) {
+        printf("Could not map spool segment %s: %s\n", path.c_str(), strerror(errno));
+        _closeSegment(segment);
+        return false;
+    }
+    segment->map = (uint8_t *) map;
+
+    char *header = (char *) segment->map;
+    if (create) {
+        memcpy(header, SPOOL_MAGIC, sizeof(SPOOL_MAGIC));
+        uint32_t version = SPOOL_VERSION, record_size = sizeof(SpoolRecord);
+        memcpy(header + 8, &version, sizeof(version));
+        memcpy(header + 12, &record_size, sizeof(record_size));
+    } else if (memcmp(header, SPOOL_MAGIC, sizeof(SPOOL_MAGIC)) != 0 || *(uint32_t *) (header + 8) != SPOOL_VERSION ||
+               *(uint32_t *) (header + 12) != sizeof(SpoolRecord)) {
+        printf("Spool segment %s has an unknown format\n", path.c_str());
+        _closeSegment(segment);
+        return false;
+    }
+
+    return true;
+}
+
+void Spool::_closeSegment(Segment *segment) {
+    if (segment->map != NULL) {
+        munmap(segment->map, _segment_bytes);
+        segment->map = NULL;
+    }
+    if (segment->fd >= 0) {
+        close(segment->fd);
+        segment->fd = -1;
+    }
+}
+
+SpoolRecord *Spool::_record(Segment *segment, uint32_t idx) {
+    return (SpoolRecord *) (segment->map + SPOOL_HEADER_SIZE) + idx;
+}
+
+bool Spool::_valid(const SpoolRecord *record) {
+    return record->marker == SPOOL_RECORD_MARKER && record->crc == crc32(&record->reading, sizeof(Reading));
+}
+
+void Spool::_loadCursor(void) {
+    SpoolCursor cursor;
+    std::string path = _dir + "/cursor";
+
+    _read.seq = 0;
+    _read_idx = 0;
+
+    FILE *f = fopen(path.c_str(), "rb");
+    if (f == NULL) {
+        return;
+    }
+    if (fread(&cursor, sizeof(cursor), 1, f) == 1 && cursor.crc == crc32(&cursor, offsetof(SpoolCursor, crc))) {
+        _read.seq = cursor.seq;
+        _read_idx = cursor.idx;
+    }
+    fclose(f);
+}
+
+// Written to a temporary file and renamed into place so a crash leaves either the
+// old cursor or the new one
+void Spool::_saveCursor(void) {
+    SpoolCursor cursor;
+    std::string path = _dir + "/cursor";
+    std::string tmp = path + ".tmp";
+
+    memset(&cursor, 0, sizeof(cursor));
+    cursor.seq = _read.seq;
+    cursor.idx = _read_idx;
+    cursor.crc = crc32(&cursor, offsetof(SpoolCursor, crc));
+
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    if (write(fd, &cursor, sizeof(cursor)) == sizeof(cursor)) {
+        fdatasync(fd);
+        rename(tmp.c_str(), path.c_str());
+    }
+    close(fd);
+}
@@ -0,0 +1,74 @@
+#ifndef SPOOL_H_
+#define SPOOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include "Reading.h"
+
+// Records per segment file.  Each record is 56 bytes, so a bit under 3.7MB a segment.
+#define SPOOL_SEGMENT_RECORDS 65536
+
+#define SPOOL_MAGIC "PMSPOOL"
+#define SPOOL_VERSION 2
+#define SPOOL_HEADER_SIZE 64
+
+// Set on a record once it has been completely written
+#define SPOOL_RECORD_MARKER 0x5350524cu
+
+struct SpoolRecord {
+    uint32_t marker;
+    uint32_t crc;
+    Reading reading;
+};
+
+// Append-only write-ahead log of readings, kept as a series of fixed size,
+// memory-mapped segment files in one directory.  Readings are appended as they
+// arrive and read back in order from a persistent cursor once they are safely in the
+// sink; segments behind the cursor are deleted.
+//
+// With more than one sink, each reads ahead from its own position with peekAt(), and the
+// cursor only moves past readings every sink is done with.
+//
+// On open, the last segment is scanned for the first record that isn't complete and
+// valid, and writing resumes there, so a crash mid-append loses at most that record.
+class Spool {
+  public:
+    Spool(const char *dir, uint32_t segment_records = SPOOL_SEGMENT_RECORDS);
+    ~Spool();
+    bool open(void);
+    bool append(const Reading &reading);
+    void sync(void);
+    size_t peek(Reading *readings, size_t max);
+    size_t peekAt(uint64_t position, Reading *readings, size_t max);
+    uint64_t position(void);
+    void commit(size_t count);
+    uint64_t pending(void);
+  private:
+    struct Segment {
+        uint64_t seq = 0;
+        int fd = -1;
+        uint8_t *map = NULL;
+    };
+    std::string _segmentPath(uint64_t seq);
+    bool _currentFormat(uint64_t seq);
+    bool _openSegment(Segment *segment, uint64_t seq, bool create);
+    void _closeSegment(Segment *segment);
+    bool _advance(void);
+    SpoolRecord *_record(Segment *segment, uint32_t idx);
+    bool _valid(const SpoolRecord *record);
+    void _loadCursor(void);
+    void _saveCursor(void);
+    std::string _dir;
+    uint32_t _segment_records;
+    size_t _segment_bytes;
+    Segment _write;
+    uint32_t _write_idx = 0;
+    uint32_t _synced_idx = 0;
+    Segment _read;
+    uint32_t _read_idx = 0;
+    // Whichever segment in between a sink reading ahead last looked at
+    Segment _ahead;
+};
+
+#endif /* SPOOL_H_ */
@@ -0,0 +1,57 @@
+#ifndef SPSC_QUEUE_H_
+#define SPSC_QUEUE_H_
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer thread.
+// Items are copied in and out of a fixed array, so nothing is allocated after
+// construction.  Size must be a power of two.
+template <typename T, size_t Size>
+class SpscQueue {
+    static_assert((Size & (Size - 1)) == 0, "SpscQueue size must be a power of two");
+
+  public:
+    SpscQueue() : _head(0), _tail(0) {}
+
+    // Producer side.  Returns false without blocking if the queue is full.
+    bool push(const T &item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (tail - _head.load(std::memory_order_acquire) == Size) {
+            return false;
+        }
+        _items[tail & (Size - 1)] = item;
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side.  Returns false if the queue is empty.
+    bool pop(T *item) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head == _tail.load(std::memory_order_acquire)) {
+            return false;
+        }
+        *item = _items[head & (Size - 1)];
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Safe to call from either side (or a third thread); only a snapshot
+    size_t depth(void) const {
+        size_t head = _head.load(std::memory_order_acquire);
+        size_t depth = _tail.load(std::memory_order_acquire) - head;
+        return depth < Size ? depth : Size;
+    }
+
+    size_t capacity(void) const {
+        return Size;
+    }
+
+  private:
+    // Head and tail on their own cache lines so the two threads don't fight over one
+    alignas(64) std::atomic<size_t> _head;
+    alignas(64) std::atomic<size_t> _tail;
+    alignas(64) T _items[Size];
+};
+
+#endif /* SPSC_QUEUE_H_ */
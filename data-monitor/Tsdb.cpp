@@ -0,0 +1,831 @@
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <set>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "Clock.h"
+#include "Crc32.h"
+#include "Directory.h"
+#include "Tsdb.h"
+
+// Where things are in a segment's header
+#define HEADER_VERSION 8
+#define HEADER_LEVEL 12
+#define HEADER_REPLACES 16
+#define HEADER_MERGED_COUNT 24
+#define HEADER_CHUNK_SIZE 28
+#define HEADER_MERGED 64
+
+// Bits are written most significant first
+class BitWriter {
+  public:
+    BitWriter(std::vector<uint8_t> *out) : _out(out) {}
+    void put(uint32_t value, int bits) {
+        _acc = (_acc << bits) | (bits == 32 ? value : value & ((1u << bits) - 1));
+        _bits += bits;
+        while (_bits >= 8) {
+            _bits -= 8;
+            _out->push_back(_acc >> _bits);
+        }
+    }
+    void put64(uint64_t value) {
+        put(value >> 32, 32);
+        put((uint32_t) value, 32);
+    }
+    void finish(void) {
+        if (_bits > 0) {
+            _out->push_back(_acc << (8 - _bits));
+            _bits = 0;
+        }
+    }
+  private:
+    std::vector<uint8_t> *_out;
+    uint64_t _acc = 0;
+    int _bits = 0;
+};
+
+class BitReader {
+  public:
+    BitReader(const uint8_t *data, size_t len) : _data(data), _len(len) {}
+    uint32_t get(int bits) {
+        while (_bits < bits) {
+            _acc = (_acc << 8) | (_pos < _len ? _data[_pos] : 0);
+            _pos++;
+            _bits += 8;
+        }
+        _bits -= bits;
+        uint32_t value = _acc >> _bits;
+        return bits == 32 ? value : value & ((1u << bits) - 1);
+    }
+    uint64_t get64(void) {
+        uint64_t high = get(32);
+        return high << 32 | get(32);
+    }
+  private:
+    const uint8_t *_data;
+    size_t _len;
+    size_t _pos = 0;
+    uint64_t _acc = 0;
+    int _bits = 0;
+};
+
+static uint64_t zigzag(int64_t value) {
+    return ((uint64_t) value << 1) ^ (uint64_t) (value >> 63);
+}
+
+static int64_t unzigzag(uint64_t value) {
+    return (int64_t) (value >> 1) ^ -(int64_t) (value & 1);
+}
+
+// Delta-of-delta timestamps.  Readings a steady interval apart take one bit each, and
+// a few ms of jitter fits in the shortest of the prefixed buckets.
+static void encodeTimestamps(const Reading *readings, size_t count, std::vector<uint8_t> *out) {
+    BitWriter bits(out);
+    int64_t prev_delta = 0;
+
+    bits.put64(readings[0].timestamp_ms);
+    for (size_t i = 1; i < count; i++) {
+        int64_t delta = readings[i].timestamp_ms - readings[i - 1].timestamp_ms;
+        uint64_t dod = zigzag(delta - prev_delta);
+        prev_delta = delta;
+
+        if (dod == 0) {
+            bits.put(0x0, 1);
+        } else if (dod < (1u << 7)) {
+            bits.put(0x2, 2);
+            bits.put(dod, 7);
+        } else if (dod < (1u << 9)) {
+            bits.put(0x6, 3);
+            bits.put(dod, 9);
+        } else if (dod < (1u << 12)) {
+            bits.put(0xe, 4);
+            bits.put(dod, 12);
+        } else if (dod < (1u << 24)) {
+            bits.put(0x1e, 5);
+            bits.put(dod, 24);
+        } else {
+            bits.put(0x1f, 5);
+            bits.put64(dod);
+        }
+    }
+    bits.finish();
+}
+
+static void decodeTimestamps(const uint8_t *data, size_t len, Reading *readings, size_t count) {
+    BitReader bits(data, len);
+    int64_t prev_delta = 0;
+
+    readings[0].timestamp_ms = bits.get64();
+    for (size_t i = 1; i < count; i++) {
+        uint64_t dod = 0;
+        if (bits.get(1) == 0) {
+            dod = 0;
+        } else if (bits.get(1) == 0) {
+            dod = bits.get(7);
+        } else if (bits.get(1) == 0) {
+            dod = bits.get(9);
+        } else if (bits.get(1) == 0) {
+            dod = bits.get(12);
+        } else if (bits.get(1) == 0) {
+            dod = bits.get(24);
+        } else {
+            dod = bits.get64();
+        }
+        prev_delta += unzigzag(dod);
+        readings[i].timestamp_ms = readings[i - 1].timestamp_ms + prev_delta;
+    }
+}
+
+// Every other column, as 32 bit values
+static uint32_t columnValue(const Reading &reading, int column) {
+    switch (column) {
+        case 1: return reading.cycles;
+        case 2: return reading.retries;
+        case 3: return reading.flags;
+        case 4: return reading.vcc;
+        case 5: return reading.moisture;
+        default: return (uint32_t) reading.temperature;
+    }
+}
+
+static void setColumnValue(Reading *reading, int column, uint32_t value) {
+    switch (column) {
+        case 1: reading->cycles = value; break;
+        case 2: reading->retries = value; break;
+        case 3: reading->flags = value; break;
+        case 4: reading->vcc = value; break;
+        case 5: reading->moisture = value; break;
+        default: reading->temperature = (int32_t) value; break;
+    }
+}
+
+// Each value is XORed with the one before.  An unchanged value takes one bit; otherwise
+// only the bits that differ are written, reusing the previous leading and trailing zero
+// counts when they still fit.
+static void encodeValues(const Reading *readings, size_t count, int column, std::vector<uint8_t> *out) {
+    BitWriter bits(out);
+    uint32_t prev = columnValue(readings[0], column);
+    int lead = -1, trail = 0;
+
+    bits.put(prev, 32);
+    for (size_t i = 1; i < count; i++) {
+        uint32_t value = columnValue(readings[i], column);
+        uint32_t x = value ^ prev;
+        prev = value;
+
+        if (x == 0) {
+            bits.put(0x0, 1);
+            continue;
+        }
+        int l = __builtin_clz(x), t = __builtin_ctz(x);
+        if (lead >= 0 && l >= lead && t >= trail) {
+            bits.put(0x2, 2);
+            bits.put(x >> trail, 32 - lead - trail);
+        } else {
+            lead = l;
+            trail = t;
+            bits.put(0x3, 2);
+            bits.put(lead, 5);
+            bits.put(32 - lead - trail - 1, 5);
+            bits.put(x >> trail, 32 - lead - trail);
+        }
+    }
+    bits.finish();
+}
+
+static void decodeValues(const uint8_t *data, size_t len, int column, Reading *readings, size_t count) {
+    BitReader bits(data, len);
+    uint32_t prev = bits.get(32);
+    int lead = 0, trail = 0;
+
+    setColumnValue(&readings[0], column, prev);
+    for (size_t i = 1; i < count; i++) {
+        if (bits.get(1) != 0) {
+            if (bits.get(1) != 0) {
+                lead = bits.get(5);
+                trail = 32 - lead - (bits.get(5) + 1);
+            }
+            prev ^= bits.get(32 - lead - trail) << trail;
+        }
+        setColumnValue(&readings[i], column, prev);
+    }
+}
+
+static size_t alignChunk(size_t len) {
+    return (len + 7) & ~(size_t) 7;
+}
+
+// Append a chunk of readings from one sensor, sorted by time, with its marker unset
+static void encodeChunk(const Reading *readings, size_t count, std::vector<uint8_t> *out) {
+    size_t start = out->size();
+    TsdbChunk chunk;
+
+    memset(&chunk, 0, sizeof(chunk));
+    out->resize(start + sizeof(chunk));
+    for (int column = 0; column < TSDB_COLUMNS; column++) {
+        size_t before = out->size();
+        if (column == 0) {
+            encodeTimestamps(readings, count, out);
+        } else {
+            encodeValues(readings, count, column, out);
+        }
+        chunk.lengths[column] = out->size() - before;
+    }
+
+    chunk.sensor_id = readings[0].sensor_id;
+    chunk.count = count;
+    chunk.first_ms = readings[0].timestamp_ms;
+    chunk.last_ms = readings[count - 1].timestamp_ms;
+    memcpy(out->data() + start, &chunk, sizeof(chunk));
+    size_t len = out->size() - start;
+    chunk.crc = crc32(out->data() + start + offsetof(TsdbChunk, sensor_id), len - offsetof(TsdbChunk, sensor_id));
+    memcpy(out->data() + start, &chunk, sizeof(chunk));
+    out->resize(start + alignChunk(len));
+}
+
+// Length of the header and columns, without padding
+static size_t chunkLength(const uint8_t *data) {
+    const TsdbChunk *chunk = (const TsdbChunk *) data;
+    size_t len = sizeof(TsdbChunk);
+
+    for (int column = 0; column < TSDB_COLUMNS; column++) {
+        len += chunk->lengths[column];
+    }
+    return len;
+}
+
+// Length of the chunk including padding, or 0 if it isn't complete and valid
+static size_t validChunk(const uint8_t *data, size_t avail) {
+    const TsdbChunk *chunk = (const TsdbChunk *) data;
+
+    if (avail < sizeof(TsdbChunk) || chunk->marker != TSDB_CHUNK_MARKER || chunk->count == 0) {
+        return 0;
+    }
+    size_t len = chunkLength(data);
+    if (len > avail ||
+        chunk->crc != crc32(data + offsetof(TsdbChunk, sensor_id), len - offsetof(TsdbChunk, sensor_id))) {
+        return 0;
+    }
+    return std::min(alignChunk(len), avail);
+}
+
+// Append the chunk's readings
+static void decodeChunk(const uint8_t *data, std::vector<Reading> *out) {
+    const TsdbChunk *chunk = (const TsdbChunk *) data;
+    size_t start = out->size();
+
+    out->resize(start + chunk->count);
+    Reading *readings = out->data() + start;
+    memset(readings, 0, chunk->count * sizeof(Reading));
+    for (uint16_t i = 0; i < chunk->count; i++) {
+        readings[i].sensor_id = chunk->sensor_id;
+    }
+
+    const uint8_t *column_data = data + sizeof(TsdbChunk);
+    for (int column = 0; column < TSDB_COLUMNS; column++) {
+        if (column == 0) {
+            decodeTimestamps(column_data, chunk->lengths[column], readings, chunk->count);
+        } else {
+            decodeValues(column_data, chunk->lengths[column], column, readings, chunk->count);
+        }
+        column_data += chunk->lengths[column];
+    }
+}
+
+// Flush the pages holding bytes from..to of a mapped segment out to disk
+static void syncRange(uint8_t *map, size_t from, size_t to) {
+    long page = sysconf(_SC_PAGESIZE);
+
+    from -= from % page;
+    if (to > from) {
+        msync(map + from, to - from, MS_SYNC);
+    }
+}
+
+static bool byTime(const Reading &a, const Reading &b) {
+    return a.timestamp_ms < b.timestamp_ms;
+}
+
+static bool bySensorAndTime(const Reading &a, const Reading &b) {
+    return a.sensor_id != b.sensor_id ? a.sensor_id < b.sensor_id : a.timestamp_ms < b.timestamp_ms;
+}
+
+// Chunks for every sensor in readings, sorted by sensor then time
+static void encodeChunks(const Reading *readings, size_t count, std::vector<uint8_t> *out) {
+    for (size_t start = 0; start < count;) {
+        size_t end = start + 1;
+        while (end < count && end - start < TSDB_CHUNK_POINTS && readings[end].sensor_id == readings[start].sensor_id) {
+            end++;
+        }
+        encodeChunk(readings + start, end - start, out);
+        start = end;
+    }
+}
+
+Tsdb::Tsdb(const char *dir, size_t segment_bytes, bool background) {
+    _dir = dir;
+    _segment_bytes = segment_bytes;
+    _background = background;
+}
+
+Tsdb::~Tsdb() {
+    if (_compactor.joinable()) {
+        {
+            std::lock_guard<std::mutex> guard(_compact_lock);
+            _stopping = true;
+        }
+        _compact_wake.notify_one();
+        _compactor.join();
+    }
+    for (size_t i = 0; i < _segments.size(); i++) {
+        _unmap(_segments[i], false);
+    }
+}
+
+// Find the segments and compacted files, tidy up after a compaction that was cut short,
+// index every chunk and carry on appending to the newest segment.  Returns false if the
+// directory can't be used.
+bool Tsdb::open(void) {
+    std::vector<uint64_t> segs, cmps;
+    std::set<uint64_t> merged;
+    unsigned long long seq;
+    uint64_t replaced = 0;
+    char extra;
+
+    if (!createDirectories(_dir)) {
+        printf("Could not create tsdb directory %s: %s\n", _dir.c_str(), strerror(errno));
+        return false;
+    }
+
+    DIR *dir = opendir(_dir.c_str());
+    if (dir == NULL) {
+        printf("Could not open tsdb directory %s: %s\n", _dir.c_str(), strerror(errno));
+        return false;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (sscanf(entry->d_name, "tsdb-%16llx.se%c", &seq, &extra) == 2 && extra == 'g') {
+            segs.push_back(seq);
+        } else if (sscanf(entry->d_name, "tsdb-%16llx.cm%c", &seq, &extra) == 2 && extra == 'p') {
+            cmps.push_back(seq);
+        } else if (strstr(entry->d_name, ".tmp") != NULL) {
+            // A compaction that didn't finish
+            unlink((_dir + "/" + entry->d_name).c_str());
+        }
+    }
+    closedir(dir);
+    std::sort(segs.begin(), segs.end());
+    std::sort(cmps.begin(), cmps.end());
+
+    // A compacted file replaces the segments up to the one it names and the compacted
+    // files it lists.  Any still around were due to be deleted when the collector stopped.
+    for (size_t i = 0; i < cmps.size(); i++) {
+        uint8_t header[TSDB_HEADER_SIZE];
+        int fd = ::open(_path(cmps[i], 1).c_str(), O_RDONLY);
+        if (fd < 0) {
+            continue;
+        }
+        if (pread(fd, header, sizeof(header), 0) == sizeof(header) && memcmp(header, TSDB_MAGIC, sizeof(TSDB_MAGIC)) == 0) {
+            uint32_t count = std::min(*(uint32_t *) (header + HEADER_MERGED_COUNT), (uint32_t) TSDB_MERGE_MAX);
+            replaced = std::max(replaced, *(uint64_t *) (header + HEADER_REPLACES));
+            for (uint32_t j = 0; j < count; j++) {
+                merged.insert(((uint64_t *) (header + HEADER_MERGED))[j]);
+            }
+        }
+        close(fd);
+        _next_seq = std::max(_next_seq, cmps[i] + 1);
+    }
+
+    for (size_t i = 0; i < cmps.size(); i++) {
+        if (merged.count(cmps[i]) > 0) {
+            unlink(_path(cmps[i], 1).c_str());
+            continue;
+        }
+        Segment *segment = _map(cmps[i], 1, false);
+        if (segment != NULL) {
+            _segments.push_back(segment);
+            _load(segment);
+        }
+    }
+
+    for (size_t i = 0; i < segs.size(); i++) {
+        _next_seq = std::max(_next_seq, segs[i] + 1);
+        if (segs[i] <= replaced) {
+            unlink(_path(segs[i], 0).c_str());
+            continue;
+        }
+        Segment *segment = _map(segs[i], 0, false);
+        if (segment != NULL) {
+            _segments.push_back(segment);
+            _load(segment);
+            _active = segment;
+        }
+    }
+
+    // Appending resumes in the newest segment, after its last complete chunk
+    if (_active == NULL) {
+        _active = _map(_next_seq++, 0, true);
+        if (_active == NULL) {
+            return false;
+        }
+        _segments.push_back(_active);
+    }
+    _active->opened_ms = monotonicMillis();
+
+    printf("Tsdb has %llu points from %zu sensors in %zu files\n", (unsigned long long) _points,
+           _index_by_sensor.size(), _segments.size());
+
+    if (_background) {
+        _compact_due = _segments.size() > 1;
+        _compactor = std::thread(&Tsdb::_compactLoop, this);
+    }
+    return true;
+}
+
+void Tsdb::add(const Reading &reading) {
+    _pending.push_back(reading);
+}
+
+// Append a chunk per sensor for the readings added since the last flush, and sync them
+bool Tsdb::flush(void) {
+    if (_pending.empty()) {
+        return true;
+    }
+    std::stable_sort(_pending.begin(), _pending.end(), bySensorAndTime);
+
+    std::lock_guard<std::mutex> guard(_lock);
+    if (!_append(_pending.data(), _pending.size())) {
+        return false;
+    }
+    _pending.clear();
+    return true;
+}
+
+void Tsdb::discard(void) {
+    _pending.clear();
+}
+
+// The sensor's readings from from_ms up to and including to_ms, appended in time order.
+// Returns how many there were.
+size_t Tsdb::scan(uint32_t sensor_id, uint64_t from_ms, uint64_t to_ms, std::vector<Reading> *readings) {
+    size_t start = readings->size();
+
+    std::lock_guard<std::mutex> guard(_lock);
+    auto it = _index_by_sensor.find(sensor_id);
+    if (it == _index_by_sensor.end()) {
+        return 0;
+    }
+
+    for (const ChunkRef &ref : it->second) {
+        if (ref.last_ms < from_ms || ref.first_ms > to_ms) {
+            continue;
+        }
+        size_t before = readings->size();
+        decodeChunk(ref.segment->map + ref.offset, readings);
+        if (ref.first_ms < from_ms || ref.last_ms > to_ms) {
+            readings->erase(std::remove_if(readings->begin() + before, readings->end(),
+                                           [from_ms, to_ms](const Reading &r) {
+                                               return r.timestamp_ms < from_ms || r.timestamp_ms > to_ms;
+                                           }),
+                            readings->end());
+        }
+    }
+
+    // Chunks come back in the order they were written, which after a restart or a late
+    // reading isn't always time order
+    if (!std::is_sorted(readings->begin() + start, readings->end(), byTime)) {
+        std::stable_sort(readings->begin() + start, readings->end(), byTime);
+    }
+    return readings->size() - start;
+}
+
+std::vector<uint32_t> Tsdb::sensors(void) {
+    std::vector<uint32_t> ids;
+
+    std::lock_guard<std::mutex> guard(_lock);
+    for (auto &entry : _index_by_sensor) {
+        ids.push_back(entry.first);
+    }
+    std::sort(ids.begin(), ids.end());
+    return ids;
+}
+
+// Seal the segment being appended to and compact everything sealed, without waiting for
+// the background thread
+bool Tsdb::compact(void) {
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if (_active->chunks > 0 && !_seal()) {
+            return false;
+        }
+    }
+    return _compact();
+}
+
+uint64_t Tsdb::points(void) {
+    std::lock_guard<std::mutex> guard(_lock);
+    return _points;
+}
+
+// Bytes of headers and chunks stored, not counting space preallocated for appending
+uint64_t Tsdb::bytes(void) {
+    uint64_t total = 0;
+
+    std::lock_guard<std::mutex> guard(_lock);
+    for (size_t i = 0; i < _segments.size(); i++) {
+        total += _segments[i]->used;
+    }
+    return total;
+}
+
+std::string Tsdb::_path(uint64_t seq, uint32_t level) {
+    char name[64];
+    snprintf(name, sizeof(name), "/tsdb-%016llx.%s", (unsigned long long) seq, level == 0 ? "seg" : "cmp");
+    return _dir + name;
+}
+
+// Segments are mapped read-write at their preallocated size, compacted files read only
+Tsdb::Segment *Tsdb::_map(uint64_t seq, uint32_t level, bool create) {
+    std::string path = _path(seq, level);
+    struct stat st;
+
+    int fd = ::open(path.c_str(), level == 0 ? O_RDWR | (create ? O_CREAT | O_TRUNC : 0) : O_RDONLY, 0644);
+    if (fd < 0) {
+        printf("Could not open tsdb file %s: %s\n", path.c_str(), strerror(errno));
+        return NULL;
+    }
+    if (create && ftruncate(fd, _segment_bytes) < 0) {
+        printf("Could not size tsdb segment %s: %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return NULL;
+    }
+    size_t size = level == 0 ? _segment_bytes : 0;
+    if (fstat(fd, &st) < 0 || (size_t) st.st_size < std::max(size, (size_t) TSDB_HEADER_SIZE)) {
+        printf("Tsdb file %s is truncated\n", path.c_str());
+        close(fd);
+        return NULL;
+    }
+    if (level == 1) {
+        size = st.st_size;
+    }
+
+    void *map = mmap(NULL, size, level == 0 ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        printf("Could not map tsdb file %s: %s\n", path.c_str(), strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    Segment *segment = new Segment();
+    segment->seq = seq;
+    segment->level = level;
+    segment->fd = fd;
+    segment->map = (uint8_t *) map;
+    segment->size = size;
+    segment->used = TSDB_HEADER_SIZE;
+
+    char *header = (char *) segment->map;
+    if (create) {
+        memcpy(header, TSDB_MAGIC, sizeof(TSDB_MAGIC));
+        *(uint32_t *) (header + HEADER_VERSION) = TSDB_VERSION;
+        *(uint32_t *) (header + HEADER_LEVEL) = level;
+        *(uint32_t *) (header + HEADER_CHUNK_SIZE) = sizeof(TsdbChunk);
+        msync(segment->map, TSDB_HEADER_SIZE, MS_SYNC);
+    } else if (memcmp(header, TSDB_MAGIC, sizeof(TSDB_MAGIC)) != 0 || *(uint32_t *) (header + HEADER_VERSION) != TSDB_VERSION ||
+               *(uint32_t *) (header + HEADER_LEVEL) != level || *(uint32_t *) (header + HEADER_CHUNK_SIZE) != sizeof(TsdbChunk)) {
+        printf("Tsdb file %s has an unknown format\n", path.c_str());
+        _unmap(segment, false);
+        return NULL;
+    }
+
+    return segment;
+}
+
+void Tsdb::_unmap(Segment *segment, bool remove) {
+    if (segment->map != NULL) {
+        munmap(segment->map, segment->size);
+    }
+    if (segment->fd >= 0) {
+        close(segment->fd);
+    }
+    if (remove) {
+        unlink(_path(segment->seq, segment->level).c_str());
+    }
+    delete segment;
+}
+
+// Index the file's chunks, up to the first that isn't complete and valid
+void Tsdb::_load(Segment *segment) {
+    size_t offset = TSDB_HEADER_SIZE;
+    size_t len;
+
+    while ((len = validChunk(segment->map + offset, segment->size - offset)) > 0) {
+        _index(segment, offset);
+        offset += len;
+    }
+    segment->used = offset;
+}
+
+void Tsdb::_index(Segment *segment, size_t offset) {
+    const TsdbChunk *chunk = (const TsdbChunk *) (segment->map + offset);
+    ChunkRef ref;
+
+    ref.segment = segment;
+    ref.offset = offset;
+    ref.count = chunk->count;
+    ref.first_ms = chunk->first_ms;
+    ref.last_ms = chunk->last_ms;
+    _index_by_sensor[chunk->sensor_id].push_back(ref);
+
+    segment->chunks++;
+    segment->points += chunk->count;
+    _points += chunk->count;
+}
+
+bool Tsdb::_append(const Reading *readings, size_t count) {
+    _buf.clear();
+    encodeChunks(readings, count, &_buf);
+
+    size_t synced = _active->used;
+    for (size_t offset = 0; offset < _buf.size();) {
+        size_t len = alignChunk(chunkLength(_buf.data() + offset));
+        if (_active->used + len > _active->size) {
+            syncRange(_active->map, synced, _active->used);
+            if (!_seal()) {
+                return false;
+            }
+            synced = _active->used;
+        }
+
+        // The marker goes in last so a chunk is only ever seen as complete once it is
+        uint8_t *dest = _active->map + _active->used;
+        memcpy(dest + sizeof(uint32_t), _buf.data() + offset + sizeof(uint32_t), len - sizeof(uint32_t));
+        __sync_synchronize();
+        *(uint32_t *) dest = TSDB_CHUNK_MARKER;
+
+        _index(_active, _active->used);
+        _active->used += len;
+        offset += len;
+    }
+
+    syncRange(_active->map, synced, _active->used);
+    return true;
+}
+
+// Start appending to a new segment, leaving the current one for the compactor
+bool Tsdb::_seal(void) {
+    Segment *segment = _map(_next_seq, 0, true);
+    if (segment == NULL) {
+        return false;
+    }
+    _next_seq++;
+    segment->opened_ms = monotonicMillis();
+    _segments.push_back(segment);
+    _active = segment;
+
+    {
+        std::lock_guard<std::mutex> guard(_compact_lock);
+        _compact_due = true;
+    }
+    _compact_wake.notify_one();
+    return true;
+}
+
+// Rewrite every sealed segment, and compacted files still made of small chunks, as one
+// compacted file of full chunks.  Inputs are read without the lock, as nothing else
+// changes them, and swapped for the result under it.
+bool Tsdb::_compact(void) {
+    std::lock_guard<std::mutex> compacting(_compacting);
+    std::vector<Segment *> inputs;
+    std::vector<uint64_t> merged;
+    uint64_t replaces = 0, seq;
+    bool sealed = false;
+
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        for (size_t i = 0; i < _segments.size(); i++) {
+            Segment *segment = _segments[i];
+            if (segment->level == 0 && segment != _active) {
+                inputs.push_back(segment);
+                replaces = std::max(replaces, segment->seq);
+                sealed = true;
+            } else if (segment->level == 1 && merged.size() < TSDB_MERGE_MAX &&
+                       segment->points < segment->chunks * TSDB_MERGE_BELOW_POINTS) {
+                inputs.push_back(segment);
+                merged.push_back(segment->seq);
+            }
+        }
+        // Small compacted files are only worth merging with something new, or each other
+        if (!sealed && merged.size() < 2) {
+            return true;
+        }
+        seq = _next_seq++;
+    }
+
+    std::vector<Reading> readings;
+    for (size_t i = 0; i < inputs.size(); i++) {
+        size_t len;
+        for (size_t offset = TSDB_HEADER_SIZE; offset < inputs[i]->used; offset += len) {
+            len = validChunk(inputs[i]->map + offset, inputs[i]->used - offset);
+            if (len == 0) {
+                break;
+            }
+            decodeChunk(inputs[i]->map + offset, &readings);
+        }
+    }
+    std::stable_sort(readings.begin(), readings.end(), bySensorAndTime);
+
+    std::vector<uint8_t> out(TSDB_HEADER_SIZE, 0);
+    memcpy(out.data(), TSDB_MAGIC, sizeof(TSDB_MAGIC));
+    *(uint32_t *) (out.data() + HEADER_VERSION) = TSDB_VERSION;
+    *(uint32_t *) (out.data() + HEADER_LEVEL) = 1;
+    *(uint64_t *) (out.data() + HEADER_REPLACES) = replaces;
+    *(uint32_t *) (out.data() + HEADER_MERGED_COUNT) = merged.size();
+    *(uint32_t *) (out.data() + HEADER_CHUNK_SIZE) = sizeof(TsdbChunk);
+    memcpy(out.data() + HEADER_MERGED, merged.data(), merged.size() * sizeof(uint64_t));
+    encodeChunks(readings.data(), readings.size(), &out);
+    for (size_t offset = TSDB_HEADER_SIZE; offset < out.size(); offset += alignChunk(chunkLength(out.data() + offset))) {
+        *(uint32_t *) (out.data() + offset) = TSDB_CHUNK_MARKER;
+    }
+
+    // Written in full and synced under a temporary name, then renamed into place, so a
+    // crash leaves either the inputs or the compacted file
+    std::string path = _path(seq, 1);
+    std::string tmp = path + ".tmp";
+    int fd = ::open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        printf("Could not create tsdb file %s: %s\n", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    size_t written = 0;
+    while (written < out.size()) {
+        ssize_t n = write(fd, out.data() + written, out.size() - written);
+        if (n <= 0) {
+            printf("Could not write tsdb file %s: %s\n", tmp.c_str(), strerror(errno));
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        written += n;
+    }
+    fdatasync(fd);
+    close(fd);
+    rename(tmp.c_str(), path.c_str());
+
+    std::lock_guard<std::mutex> guard(_lock);
+    Segment *compacted = _map(seq, 1, false);
+    if (compacted == NULL) {
+        return false;
+    }
+
+    std::set<Segment *> replaced(inputs.begin(), inputs.end());
+    for (auto &entry : _index_by_sensor) {
+        std::vector<ChunkRef> &refs = entry.second;
+        refs.erase(std::remove_if(refs.begin(), refs.end(),
+                                  [&replaced](const ChunkRef &ref) { return replaced.count(ref.segment) > 0; }),
+                   refs.end());
+    }
+    for (size_t i = 0; i < inputs.size(); i++) {
+        _points -= inputs[i]->points;
+        _segments.erase(std::find(_segments.begin(), _segments.end(), inputs[i]));
+        _unmap(inputs[i], true);
+    }
+    _segments.push_back(compacted);
+    _load(compacted);
+
+    printf("Tsdb compacted %zu files into %s: %zu points, %zu bytes\n", inputs.size(), path.c_str(), readings.size(),
+           out.size());
+    return true;
+}
+
+void Tsdb::_compactLoop(void) {
+    std::unique_lock<std::mutex> lock(_compact_lock);
+
+    while (!_stopping) {
+        _compact_wake.wait_for(lock, std::chrono::milliseconds(TSDB_COMPACT_CHECK_MS),
+                               [this] { return _stopping || _compact_due; });
+        if (_stopping) {
+            break;
+        }
+        _compact_due = false;
+        lock.unlock();
+
+        // With few sensors a segment takes a long time to fill, so it's sealed by age too
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            if (_active->chunks > 0 && monotonicMillis() - _active->opened_ms >= TSDB_SEAL_MS) {
+                _seal();
+            }
+        }
+        _compact();
+
+        lock.lock();
+    }
+}
@@ -0,0 +1,136 @@
+#ifndef TSDB_H_
+#define TSDB_H_
+
+#include <condition_variable>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Reading.h"
+#include "Sink.h"
+
+// Size of each segment file appended to.  Preallocated and memory-mapped.
+#define TSDB_SEGMENT_BYTES (4 * 1024 * 1024)
+// An appended segment is closed off for compaction once it's full, or this old
+#define TSDB_SEAL_MS (60 * 60 * 1000)
+// How often the compactor looks for work when nothing wakes it
+#define TSDB_COMPACT_CHECK_MS 60000
+
+// Most points compaction puts in a chunk
+#define TSDB_CHUNK_POINTS 1024
+// Compacted files whose chunks average fewer points than this get merged again
+#define TSDB_MERGE_BELOW_POINTS (TSDB_CHUNK_POINTS / 2)
+// Most compacted files merged in one go
+#define TSDB_MERGE_MAX 32
+
+#define TSDB_MAGIC "PMTSDB"
+#define TSDB_VERSION 1
+// Segment header, with room for the list of compacted files a merged one replaces
+#define TSDB_HEADER_SIZE (64 + 8 * TSDB_MERGE_MAX)
+
+// Set on a chunk once it has been completely written
+#define TSDB_CHUNK_MARKER 0x54534443u
+
+// Timestamp, then cycles, retries, flags, vcc, moisture and temperature
+#define TSDB_COLUMNS 7
+
+struct TsdbChunk {
+    uint32_t marker;
+    // Of the rest of the header and the column data
+    uint32_t crc;
+    uint32_t sensor_id;
+    uint16_t count;
+    uint16_t reserved;
+    uint64_t first_ms;
+    uint64_t last_ms;
+    // Bytes of each column, which follow the header in order
+    uint16_t lengths[TSDB_COLUMNS];
+    uint16_t padding;
+};
+
+// A small time series store for the collector's readings, for running without InfluxDB.
+//
+// Each flush appends, for every sensor in the batch, a chunk holding that sensor's new
+// readings one column per field.  Timestamps are stored as delta-of-deltas and values as
+// the XOR with the previous value, both bit-packed (as in Facebook's Gorilla), which takes
+// a steady series down to a few bits per point.  Chunks are appended to a preallocated,
+// memory-mapped segment file and synced like the spool's records; on open, each segment is
+// read up to the first chunk that isn't complete and valid.
+//
+// With slow sensors, a flush only carries a reading or two per sensor, so segments fill
+// with tiny chunks.  A background thread compacts sealed segments: each sensor's points
+// are decoded, sorted and packed again into chunks of up to TSDB_CHUNK_POINTS, written to
+// a compacted file that replaces them.  Compacted files that are still made of small
+// chunks are merged again in later rounds.
+//
+// Only the fields above are kept; the link stats in a Reading read back as zero.
+class Tsdb : public Sink {
+  public:
+    Tsdb(const char *dir, size_t segment_bytes = TSDB_SEGMENT_BYTES, bool background = true);
+    ~Tsdb();
+    bool open(void);
+    void add(const Reading &reading);
+    bool flush(void);
+    void discard(void);
+    size_t scan(uint32_t sensor_id, uint64_t from_ms, uint64_t to_ms, std::vector<Reading> *readings);
+    std::vector<uint32_t> sensors(void);
+    bool compact(void);
+    uint64_t points(void);
+    uint64_t bytes(void);
+  private:
+    struct Segment {
+        uint64_t seq = 0;
+        // 0 for appended segments, 1 for compacted files
+        uint32_t level = 0;
+        int fd = -1;
+        uint8_t *map = NULL;
+        size_t size = 0;
+        size_t used = 0;
+        uint64_t opened_ms = 0;
+        uint64_t chunks = 0;
+        uint64_t points = 0;
+    };
+    struct ChunkRef {
+        Segment *segment;
+        size_t offset;
+        uint16_t count;
+        uint64_t first_ms;
+        uint64_t last_ms;
+    };
+    std::string _path(uint64_t seq, uint32_t level);
+    Segment *_map(uint64_t seq, uint32_t level, bool create);
+    void _unmap(Segment *segment, bool remove);
+    void _load(Segment *segment);
+    void _index(Segment *segment, size_t offset);
+    bool _append(const Reading *readings, size_t count);
+    bool _seal(void);
+    bool _compact(void);
+    void _compactLoop(void);
+    std::string _dir;
+    size_t _segment_bytes;
+    bool _background;
+    // Added since the last flush; only touched by the thread adding readings
+    std::vector<Reading> _pending;
+    // Guards everything below, apart from the contents of sealed segments, which only the
+    // compactor reads outside it
+    std::mutex _lock;
+    std::vector<Segment *> _segments;
+    Segment *_active = NULL;
+    uint64_t _next_seq = 1;
+    std::unordered_map<uint32_t, std::vector<ChunkRef> > _index_by_sensor;
+    uint64_t _points = 0;
+    std::vector<uint8_t> _buf;
+    // One compaction at a time
+    std::mutex _compacting;
+    // Wakes the background compactor
+    std::mutex _compact_lock;
+    std::condition_variable _compact_wake;
+    bool _compact_due = false;
+    bool _stopping = false;
+    std::thread _compactor;
+};
+
+#endif /* TSDB_H_ */
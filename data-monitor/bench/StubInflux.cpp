@@ -0,0 +1,138 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <netinet/in.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "StubInflux.h"
+
+StubInflux::StubInflux() : requests(0), lines(0), filled(0), rollups(0), bytes(0), delay_ms(0), failing(false), _running(false) {
+}
+
+StubInflux::~StubInflux() {
+    stop();
+}
+
+// Listen on the given port (0 picks a free one) and return the port in use
+int StubInflux::start(int port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int one = 1;
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(_listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(_listen_fd, 16) < 0) {
+        perror("stub influx");
+        return -1;
+    }
+    getsockname(_listen_fd, (struct sockaddr *) &addr, &len);
+
+    _running = true;
+    _acceptor = std::thread(&StubInflux::_acceptLoop, this);
+
+    return ntohs(addr.sin_port);
+}
+
+void StubInflux::stop(void) {
+    if (!_running) {
+        return;
+    }
+    _running = false;
+    shutdown(_listen_fd, SHUT_RDWR);
+    close(_listen_fd);
+    _acceptor.join();
+    for (size_t i = 0; i < _clients.size(); i++) {
+        _clients[i].join();
+    }
+    _clients.clear();
+}
+
+void StubInflux::_acceptLoop(void) {
+    while (_running) {
+        int fd = accept(_listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        struct timeval tv = {0, 200000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        _clients.push_back(std::thread(&StubInflux::_serve, this, fd));
+    }
+}
+
+void StubInflux::_serve(int fd) {
+    std::vector<char> buf(1 << 16);
+    size_t len = 0;
+
+    while (_running) {
+        char *end = (char *) memmem(buf.data(), len, "\r\n\r\n", 4);
+
+        if (end == NULL) {
+            if (len == buf.size()) {
+                buf.resize(buf.size() * 2);
+            }
+            ssize_t n = read(fd, buf.data() + len, buf.size() - len);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                break;
+            }
+            len += n > 0 ? n : 0;
+            continue;
+        }
+
+        *end = '\0';
+        size_t header_len = end + 4 - buf.data();
+        size_t body_len = 0;
+        char *cl = strcasestr(buf.data(), "Content-Length:");
+        if (cl != NULL) {
+            body_len = strtoul(cl + 15, NULL, 10);
+        }
+
+        if (buf.size() < header_len + body_len) {
+            buf.resize(header_len + body_len);
+        }
+        while (len < header_len + body_len && _running) {
+            ssize_t n = read(fd, buf.data() + len, buf.size() - len);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                close(fd);
+                return;
+            }
+            len += n > 0 ? n : 0;
+        }
+
+        if (delay_ms > 0) {
+            usleep(delay_ms * 1000);
+        }
+
+        requests++;
+        if (!failing) {
+            const char *body = buf.data() + header_len;
+            lines += std::count(body, body + body_len, '\n');
+            for (const char *p = body; (p = (const char *) memmem(p, body + body_len - p, ",filled=", 8)) != NULL; p += 8) {
+                filled++;
+            }
+            for (const char *p = body; (p = (const char *) memmem(p, body + body_len - p, " count=", 7)) != NULL; p += 7) {
+                rollups++;
+            }
+            bytes += body_len;
+        }
+
+        const char *response = failing ? "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n"
+                                       : "HTTP/1.1 204 No Content\r\n\r\n";
+        if (write(fd, response, strlen(response)) < 0) {
+            break;
+        }
+
+        memmove(buf.data(), buf.data() + header_len + body_len, len - header_len - body_len);
+        len -= header_len + body_len;
+    }
+
+    close(fd);
+}
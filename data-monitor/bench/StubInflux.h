@@ -0,0 +1,37 @@
+#ifndef STUB_INFLUX_H_
+#define STUB_INFLUX_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// A stand-in for InfluxDB's /write endpoint.  Accepts keep-alive HTTP/1.1 POSTs on
+// localhost, counts the line protocol records in each body and answers 204.
+class StubInflux {
+  public:
+    StubInflux();
+    ~StubInflux();
+    int start(int port);
+    void stop(void);
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> lines;
+    // Of those, readings the collector filled forward
+    std::atomic<uint64_t> filled;
+    // and rollups, which aren't readings at all
+    std::atomic<uint64_t> rollups;
+    std::atomic<uint64_t> bytes;
+    // Artificial delay before answering each request, to play a slow server
+    std::atomic<int> delay_ms;
+    // When set, refuse requests with a 503
+    std::atomic<bool> failing;
+  private:
+    void _acceptLoop(void);
+    void _serve(int fd);
+    int _listen_fd = -1;
+    std::atomic<bool> _running;
+    std::thread _acceptor;
+    std::vector<std::thread> _clients;
+};
+
+#endif /* STUB_INFLUX_H_ */
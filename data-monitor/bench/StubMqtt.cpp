@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <vector>
+#include "StubMqtt.h"
+
+StubMqtt::StubMqtt() : connections(0), publishes(0), pings(0), bytes(0), delay_ms(0), failing(false), _running(false) {
+}
+
+StubMqtt::~StubMqtt() {
+    stop();
+}
+
+// Listen on the given port (0 picks a free one) and return the port in use
+int StubMqtt::start(int port) {
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    int one = 1;
+
+    _listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    setsockopt(_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(_listen_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(_listen_fd, 16) < 0) {
+        perror("stub mqtt");
+        return -1;
+    }
+    getsockname(_listen_fd, (struct sockaddr *) &addr, &len);
+
+    _running = true;
+    _acceptor = std::thread(&StubMqtt::_acceptLoop, this);
+
+    return ntohs(addr.sin_port);
+}
+
+void StubMqtt::stop(void) {
+    if (!_running) {
+        return;
+    }
+    _running = false;
+    shutdown(_listen_fd, SHUT_RDWR);
+    close(_listen_fd);
+    _acceptor.join();
+    for (size_t i = 0; i < _clients.size(); i++) {
+        _clients[i].join();
+    }
+    _clients.clear();
+}
+
+void StubMqtt::_acceptLoop(void) {
+    while (_running) {
+        int fd = accept(_listen_fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        struct timeval tv = {0, 200000};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+        _clients.push_back(std::thread(&StubMqtt::_serve, this, fd));
+    }
+}
+
+void StubMqtt::_serve(int fd) {
+    std::vector<uint8_t> buf(1 << 16);
+    size_t len = 0;
+
+    if (failing) {
+        close(fd);
+        return;
+    }
+    connections++;
+
+    while (_running) {
+        // A whole packet: type, remaining length and that many bytes
+        size_t remaining = 0, header_len = 0;
+        bool complete = false;
+        for (size_t i = 1; i < len && i <= 4; i++) {
+            remaining |= (size_t) (buf[i] & 0x7f) << (7 * (i - 1));
+            if (!(buf[i] & 0x80)) {
+                header_len = i + 1;
+                complete = len >= header_len + remaining;
+                break;
+            }
+        }
+
+        if (!complete) {
+            if (len == buf.size()) {
+                buf.resize(buf.size() * 2);
+            }
+            ssize_t n = read(fd, buf.data() + len, buf.size() - len);
+            if (n == 0 || (n < 0 && errno != EAGAIN && errno != EINTR)) {
+                break;
+            }
+            len += n > 0 ? n : 0;
+            continue;
+        }
+
+        uint8_t type = buf[0] & 0xf0;
+        bool ok = true;
+        if (type == 0x10) {
+            static const uint8_t connack[] = {0x20, 0x02, 0x00, 0x00};
+            ok = write(fd, connack, sizeof(connack)) == sizeof(connack);
+        } else if (type == 0x30) {
+            publishes++;
+            bytes += header_len + remaining;
+        } else if (type == 0xc0) {
+            static const uint8_t pingresp[] = {0xd0, 0x00};
+            if (delay_ms > 0) {
+                usleep(delay_ms * 1000);
+            }
+            pings++;
+            ok = write(fd, pingresp, sizeof(pingresp)) == sizeof(pingresp);
+        }
+        if (!ok) {
+            break;
+        }
+
+        memmove(buf.data(), buf.data() + header_len + remaining, len - header_len - remaining);
+        len -= header_len + remaining;
+    }
+
+    close(fd);
+}
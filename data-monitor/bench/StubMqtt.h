@@ -0,0 +1,36 @@
+#ifndef STUB_MQTT_H_
+#define STUB_MQTT_H_
+
+#include <atomic>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+
+// A stand-in MQTT broker, just enough for the collector's MQTT sink.  Accepts
+// connections on localhost, answers CONNECT and PINGREQ, and counts the PUBLISH packets
+// it's sent without passing them on to anyone.
+class StubMqtt {
+  public:
+    StubMqtt();
+    ~StubMqtt();
+    int start(int port);
+    void stop(void);
+    std::atomic<uint64_t> connections;
+    std::atomic<uint64_t> publishes;
+    // Each batch the collector sends ends with a ping
+    std::atomic<uint64_t> pings;
+    std::atomic<uint64_t> bytes;
+    // Artificial delay before answering each ping, to play a slow broker
+    std::atomic<int> delay_ms;
+    // When set, refuse connections
+    std::atomic<bool> failing;
+  private:
+    void _acceptLoop(void);
+    void _serve(int fd);
+    int _listen_fd = -1;
+    std::atomic<bool> _running;
+    std::thread _acceptor;
+    std::vector<std::thread> _clients;
+};
+
+#endif /* STUB_MQTT_H_ */
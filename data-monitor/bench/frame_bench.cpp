@@ -0,0 +1,167 @@
+/**
+ * Compares the legacy 32 byte frame with the compact one: size and time on air at
+ * each nRF24 data rate, what that costs the sensor's battery per message, and how
+ * long encoding and decoding take.  Also what each reading costs when readings are
+ * stored up and sent in batches.
+ *
+ * Usage: frame_bench [-n frames]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include "Frame.h"
+
+// Enhanced ShockBurst packet: preamble, 5 byte address, 9 bit packet control field,
+// payload and the 2 byte CRC the sensors use
+#define ESB_PREAMBLE_BITS 8
+#define ESB_ADDRESS_BITS 40
+#define ESB_PCF_BITS 9
+#define ESB_CRC_BITS 16
+
+// PLL settling before each transmission and before listening for the ACK
+#define ESB_SETTLE_US 130
+
+// nRF24L01+ supply current at the sensor's PA level (-12dBm), and in RX
+#define TX_CURRENT_MA 7.5
+#define RX_CURRENT_MA 13.5
+
+// Radio start up from power down, and listening for the collector's reply after the
+// last frame (the collector's turnaround, roughly)
+#define POWER_UP_US 1500
+#define POWER_UP_CURRENT_MA 0.3
+#define REPLY_WAIT_US 2000
+
+static const struct {
+    const char *name;
+    double bits_per_us;
+} rates[] = {{"250kbps", 0.25}, {"1Mbps", 1.0}, {"2Mbps", 2.0}};
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int packetBits(int payload_len) {
+    return ESB_PREAMBLE_BITS + ESB_ADDRESS_BITS + ESB_PCF_BITS + payload_len * 8 + ESB_CRC_BITS;
+}
+
+static void fakeFrame(Frame *frame, uint8_t version, int i) {
+    frame->version = version;
+    frame->cmd = 1;
+    frame->retries = i % 4;
+    frame->flags = 0;
+    frame->sensor_id = 0x5e000000 + (i % 300);
+    frame->collector_id = 0x8080;
+    frame->counter = i;
+    frame->vcc = 3300 + (i % 900);
+    frame->moisture = i % 1024;
+    frame->temperature = (i % 60) - 20;
+}
+
+// One attempt: data packet out, empty ACK back, with a settle period before each
+static double exchangeMicros(int payload_len, double bits_per_us) {
+    return 2 * ESB_SETTLE_US + (packetBits(payload_len) + packetBits(0)) / bits_per_us;
+}
+
+static void airtime(const char *name, int payload_len) {
+    printf("%-8s %2d bytes, %3d bits on air:", name, payload_len, packetBits(payload_len));
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        double tx_us = packetBits(payload_len) / rates[i].bits_per_us;
+        double exchange_us = exchangeMicros(payload_len, rates[i].bits_per_us);
+        // Charge in nC: TX for the packet, RX for the rest of the exchange
+        double charge = tx_us * TX_CURRENT_MA + (exchange_us - tx_us) * RX_CURRENT_MA;
+        printf("  %s %6.1fus (%6.1fus, %5.2fuC w/ ACK)", rates[i].name, tx_us, exchange_us, charge / 1000);
+    }
+    printf("\n");
+}
+
+// Charge per reading, in uC, for an upload of the given number of readings at 2Mbps:
+// power up, the data frames, then waiting for and receiving the reply
+static double readingCharge(int readings, bool batched) {
+    double bits_per_us = 2.0;
+    double charge = POWER_UP_US * POWER_UP_CURRENT_MA;
+
+    if (batched) {
+        for (int left = readings; left > 0; left -= FRAME_BATCH_MAX) {
+            int count = left < FRAME_BATCH_MAX ? left : FRAME_BATCH_MAX;
+            double tx_us = packetBits(FRAME_BATCH_HEADER_LEN + count * 4) / bits_per_us;
+            charge += tx_us * TX_CURRENT_MA + (exchangeMicros(0, bits_per_us) - packetBits(0) / bits_per_us) * RX_CURRENT_MA;
+        }
+    } else {
+        double tx_us = packetBits(FRAME_COMPACT_LEN) / bits_per_us;
+        charge += tx_us * TX_CURRENT_MA + (exchangeMicros(0, bits_per_us) - packetBits(0) / bits_per_us) * RX_CURRENT_MA;
+    }
+
+    double reply_us = REPLY_WAIT_US + packetBits((FRAME_REPLY_IDX_SLOT_INTERVAL + 1) * 4) / bits_per_us;
+    charge += reply_us * RX_CURRENT_MA;
+    return charge / 1000 / readings;
+}
+
+static void batches(void) {
+    static const int sizes[] = {1, 4, 8, 16};
+    double single = readingCharge(1, false);
+
+    printf("radio charge per reading at 2Mbps, with power up and reply wait: status %.2fuC", single);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        double batch = readingCharge(sizes[i], true);
+        printf(", batch of %d %.2fuC (%.1fx less)", sizes[i], batch, single / batch);
+    }
+    printf("\n");
+}
+
+static void codec(uint8_t version, int frames) {
+    uint8_t buf[FRAME_MAX_LEN];
+    Frame frame, decoded;
+    uint32_t check = 0;
+    uint8_t len = 0;
+
+    double start = nowSeconds();
+    for (int i = 0; i < frames; i++) {
+        fakeFrame(&frame, version, i);
+        len = frameEncode(&frame, buf);
+        if (!frameDecode(buf, len, &decoded) || decoded.moisture != frame.moisture ||
+            decoded.temperature != frame.temperature || decoded.vcc != frame.vcc) {
+            printf("round trip failed for frame %d\n", i);
+            exit(1);
+        }
+        check += decoded.counter;
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("%-8s encode + decode: %.1f ns/frame (check %u)\n",
+           version == FRAME_VERSION_LEGACY ? "legacy" : "compact", elapsed * 1e9 / frames, check);
+}
+
+int main(int argc, char **argv) {
+    int frames = 10000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                frames = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n frames]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    airtime("legacy", FRAME_LEGACY_LEN);
+    airtime("compact", FRAME_COMPACT_LEN);
+    for (size_t i = 0; i < sizeof(rates) / sizeof(rates[0]); i++) {
+        double legacy = exchangeMicros(FRAME_LEGACY_LEN, rates[i].bits_per_us);
+        double compact = exchangeMicros(FRAME_COMPACT_LEN, rates[i].bits_per_us);
+        printf("%s: compact exchange takes %.0f%% of the legacy one, %.0f%% of the data packet's bits\n",
+               rates[i].name, 100 * compact / legacy, 100.0 * packetBits(FRAME_COMPACT_LEN) / packetBits(FRAME_LEGACY_LEN));
+    }
+
+    batches();
+
+    codec(FRAME_VERSION_LEGACY, frames);
+    codec(FRAME_VERSION_COMPACT, frames);
+    return 0;
+}
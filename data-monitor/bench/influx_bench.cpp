@@ -0,0 +1,125 @@
+/**
+ * Measures how many status packets per second the collector's InfluxDB writer can
+ * push to a local stand-in server, and what each one costs in CPU time.
+ *
+ * Usage: influx_bench [-n packets] [-s sensors] [-c curl_packets]
+ *   -c also times the old five-curls-per-packet path for comparison
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <sys/resource.h>
+#include <unistd.h>
+#include "../Clock.h"
+#include "../InfluxWriter.h"
+#include "StubInflux.h"
+
+static double cpuSeconds(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static double childCpuSeconds(void) {
+    struct rusage ru;
+    getrusage(RUSAGE_CHILDREN, &ru);
+    return ru.ru_utime.tv_sec + ru.ru_stime.tv_sec + (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1e6;
+}
+
+static void fakeReading(Reading *reading, int i, int sensors) {
+    reading->timestamp_ms = wallClockMillis();
+    reading->sensor_id = 0x5e000000 + (i % sensors);
+    reading->cycles = i / sensors;
+    reading->retries = i % 3;
+    reading->flags = 0;
+    reading->lost = i % 5;
+    reading->duplicates = i % 2;
+    reading->gaps = i % 5;
+    reading->loss_pct = i % 5;
+    reading->dup_pct = i % 2;
+    reading->vcc = 3700 + (i % 400);
+    reading->moisture = 300 + (i % 500);
+    reading->temperature = 20 + (i % 7);
+}
+
+static void benchWriter(StubInflux &stub, int port, int packets, int sensors) {
+    InfluxWriter writer("127.0.0.1", port, "plants");
+    Reading reading;
+
+    uint64_t start = monotonicMillis();
+    double cpu_start = cpuSeconds();
+
+    for (int i = 0; i < packets; i++) {
+        fakeReading(&reading, i, sensors);
+        writer.add(reading);
+        if (writer.due(monotonicMillis())) {
+            writer.flush();
+        }
+    }
+    writer.flush();
+
+    double elapsed = (monotonicMillis() - start) / 1000.0;
+    double cpu = cpuSeconds() - cpu_start;
+
+    printf("batched writer: %d packets in %.3fs, %.0f packets/s, %.2f us CPU/packet, %llu POSTs, %llu records\n",
+           packets, elapsed, packets / elapsed, cpu * 1e6 / packets, (unsigned long long) stub.requests.load(),
+           (unsigned long long) stub.lines.load());
+}
+
+static void benchCurl(int port, int packets, int sensors) {
+    const char *fields[] = {"temperature", "moisture", "cycles", "battery", "retries"};
+    char cmd[255];
+    Reading reading;
+
+    uint64_t start = monotonicMillis();
+    double cpu_start = cpuSeconds() + childCpuSeconds();
+
+    for (int i = 0; i < packets; i++) {
+        fakeReading(&reading, i, sensors);
+        for (int f = 0; f < 5; f++) {
+            snprintf(cmd, sizeof(cmd),
+                     "curl -s -i -XPOST 'http://127.0.0.1:%d/write?db=plants' --data-binary '%s,plant_id=%04x value=%d' >> /dev/null",
+                     port, fields[f], reading.sensor_id, reading.moisture);
+            if (system(cmd) != 0) {
+                printf("curl failed, is it installed?\n");
+                return;
+            }
+        }
+    }
+
+    double elapsed = (monotonicMillis() - start) / 1000.0;
+    double cpu = cpuSeconds() + childCpuSeconds() - cpu_start;
+
+    printf("curl per field: %d packets in %.3fs, %.0f packets/s, %.2f us CPU/packet\n", packets, elapsed,
+           packets / elapsed, cpu * 1e6 / packets);
+}
+
+int main(int argc, char **argv) {
+    int packets = 200000, sensors = 300, curl_packets = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:c:")) != -1) {
+        switch (opt) {
+            case 'n': packets = atoi(optarg); break;
+            case 's': sensors = atoi(optarg); break;
+            case 'c': curl_packets = atoi(optarg); break;
+            default:
+                fprintf(stderr, "Usage: %s [-n packets] [-s sensors] [-c curl_packets]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    StubInflux stub;
+    int port = stub.start(0);
+    if (port < 0) {
+        return 1;
+    }
+
+    benchWriter(stub, port, packets, sensors);
+    if (curl_packets > 0) {
+        benchCurl(port, curl_packets, sensors);
+    }
+
+    stub.stop();
+    return 0;
+}
@@ -0,0 +1,795 @@
+/**
+ * Sensor swarm load generator.
+ *
+ * Emulates a number of sensors talking to a collector built with the simulated radio
+ * (make RADIO=sim).  Each sensor finds the collector and then sends status messages
+ * on its wake interval, building frames and retrying the same way sendMessage() in
+ * sensor.ino does.  Frames are compact unless -L asks for the legacy layout.
+ *
+ * Compact frame sensors each get their own radio, listening on their own address and
+ * sending to the collector pipe they were assigned.  Legacy sensors share one radio per
+ * worker thread, and their replies come back on the shared sensor address and are
+ * handed to whichever emulated sensor they are for.
+ *
+ * A stand-in InfluxDB is started as well, so point the collector at it:
+ *
+ *   ./collector -H 127.0.0.1 -P 18086 -d /tmp/spool
+ *   bench/loadgen -s 300 -w 1 -t 30
+ *
+ * With -m, a stand-in MQTT broker is started too, for the collector's MQTT sink:
+ *
+ *   ./collector -H 127.0.0.1 -P 18086 -d /tmp/spool -o influx -o mqtt=127.0.0.1:18883
+ *   bench/loadgen -s 300 -w 1 -t 30 -m 18883
+ *
+ * With -D, readings drift slowly like a stable plant's, and sensors only report ones
+ * that moved past the firmware's deadbands, plus a heartbeat every few wakes.
+ *
+ * With -a, sensors take their reply from the ACK to their frame when the collector sends
+ * one there.  Comparing the two ways of replying:
+ *
+ *   ./collector -H 127.0.0.1 -P 18086 -d /tmp/spool        ./collector ... -a
+ *   bench/loadgen -s 300 -w 1 -t 30                         bench/loadgen -s 300 -w 1 -t 30 -a
+ *
+ * Against a collector handing out report slots, sensors move their wakes to the slot in
+ * each reply, as the firmware does.  The slot period needs to be a little longer than the
+ * wake interval.  Comparing free-running sensors with slotted ones:
+ *
+ *   ./collector -H 127.0.0.1 -P 18086 -d /tmp/spool        ./collector ... -s 1
+ *   bench/loadgen -s 1000 -w 0.9 -t 30                      bench/loadgen -s 1000 -w 0.9 -t 30
+ *
+ * Reports the reply round-trip latency distribution, how long sensors were awake for
+ * each message, how many frames the collector's radio accepted, and how fast readings
+ * reached the sink.
+ */
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <sys/resource.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../Clock.h"
+#include "../SimRadio.h"
+#include "Frame.h"
+#include "StubInflux.h"
+#include "StubMqtt.h"
+
+// Same as the sensor firmware
+#define HOST_RADIO_ADDR (const uint8_t *) "3Node"
+#define SELF_RADIO_ADDR (const uint8_t *) "4Node"
+
+#define MESSAGE_ACK_TTL_US 250001
+#define MAX_RETRIES 3
+#define PACKET_RETRY_DELAY 15
+#define PACKET_RETRIES 15
+
+#define COMMAND_STATUS 0x01
+#define COMMAND_FIND_COLLECTOR 0x02
+#define COMMAND_BATCH 0x03
+
+// Batched reporting, as on an ATmega328P sensor
+#define READING_RING_SIZE 128
+#define BATCH_BURST_FRAMES 4
+
+// Change-driven reporting, as in the firmware
+#define DEADBAND_VCC_MV 50
+#define DEADBAND_MOISTURE 8
+#define DEADBAND_TEMPERATURE 1
+
+// Emulated sensors get consecutive ids from here
+#define SENSOR_ID_BASE 0x5e000000u
+
+#define STUB_INFLUX_PORT 18086
+
+struct Sensor {
+    uint32_t id;
+    uint32_t collector_id;
+    uint32_t message_counter;
+    uint64_t next_wake_us;
+    // Its own radio, or its worker's for legacy sensors
+    SimRadio *radio;
+    // Stored readings waiting to be uploaded, with -B
+    std::vector<uint32_t> ring;
+    uint16_t ring_first_counter;
+    uint16_t reading_counter;
+    int wakes;
+    // With -D: the slowly drifting values, the last reading reported and wakes since then
+    int vcc, moisture, temperature;
+    uint32_t last_report;
+    int report_wakes;
+    // The report slot from the collector's last reply, in wakes
+    int slot_wakes, slot_interval_wakes;
+};
+
+// One per worker thread: a radio legacy sensors send with, and a slot for the reply
+// they're waiting on
+struct Worker {
+    SimRadio *radio = NULL;
+    std::vector<Sensor> sensors;
+    std::mutex lock;
+    std::condition_variable replied;
+    uint32_t waiting_for = 0;
+    bool have_reply = false;
+    uint32_t reply[FRAME_REPLY_WORDS];
+    unsigned int seed;
+    // Results
+    std::vector<uint32_t> latencies_us;
+    // Time spent sending and waiting for replies, leaving out the backoffs the sensor
+    // sleeps through
+    std::vector<uint32_t> awake_us;
+    uint64_t messages = 0, failed = 0, finds = 0, statuses_ok = 0, readings_ok = 0, readings_taken = 0;
+    uint64_t attempts = 0, acked = 0, reply_timeouts = 0, ack_replies = 0;
+    uint64_t retry_histogram[MAX_RETRIES + 2] = {0};
+};
+
+static std::atomic<bool> running(true);
+static std::vector<Worker *> workers;
+static uint32_t sensor_count = 0;
+static double backoff_scale = 1.0;
+static uint8_t frame_version = FRAME_VERSION_COMPACT;
+static int batch_wakes = 0;
+static int heartbeat_wakes = 0;
+static double wake_interval_s = 0;
+static bool ack_payloads = false;
+
+static void sleepUntil(uint64_t when_us) {
+    uint64_t now = monotonicMicros();
+    if (when_us > now) {
+        usleep(when_us - now);
+    }
+}
+
+// Takes every reply off the shared sensor address and wakes the worker whose sensor it's for
+static void dispatchReplies(SimRadio *listener) {
+    uint32_t response[FRAME_MAX_LEN / sizeof(uint32_t)];
+
+    while (running) {
+        if (!listener->available()) {
+            listener->waitIrq(50);
+            continue;
+        }
+        listener->read(response, sizeof(response));
+
+        uint32_t idx = response[0] - SENSOR_ID_BASE;
+        if (response[0] < SENSOR_ID_BASE || idx >= sensor_count) {
+            continue;
+        }
+        Worker *worker = workers[idx % workers.size()];
+
+        std::lock_guard<std::mutex> guard(worker->lock);
+        if (worker->waiting_for == response[0] && !worker->have_reply) {
+            worker->have_reply = true;
+            memcpy(worker->reply, response, sizeof(worker->reply));
+            worker->replied.notify_one();
+        }
+    }
+}
+
+// readResponse(): wait up to the TTL for a reply meant for this sensor, and copy the
+// reply words after the sensor id into values
+static bool readResponse(Worker *worker, Sensor *sensor, uint32_t *values) {
+    uint32_t response[FRAME_REPLY_WORDS];
+
+    if (frame_version == FRAME_VERSION_LEGACY) {
+        std::unique_lock<std::mutex> guard(worker->lock);
+
+        bool got = worker->replied.wait_for(guard, std::chrono::microseconds(MESSAGE_ACK_TTL_US),
+                                            [worker] { return worker->have_reply; });
+        if (got) {
+            memcpy(values, worker->reply + 1, sizeof(worker->reply) - sizeof(uint32_t));
+        }
+        worker->waiting_for = 0;
+        return got;
+    }
+
+    uint64_t deadline = monotonicMicros() + MESSAGE_ACK_TTL_US;
+    while (1) {
+        while (sensor->radio->available()) {
+            uint8_t len = sensor->radio->getDynamicPayloadSize();
+            memset(response, 0, sizeof(response));
+            sensor->radio->read(response, len < sizeof(response) ? len : sizeof(response));
+            if (response[FRAME_REPLY_IDX_SENSOR_ID] == sensor->id) {
+                memcpy(values, response + 1, sizeof(response) - sizeof(uint32_t));
+                return true;
+            }
+        }
+
+        uint64_t now = monotonicMicros();
+        if (now >= deadline) {
+            return false;
+        }
+        sensor->radio->waitIrq((deadline - now + 999) / 1000);
+    }
+}
+
+// readAckPayload(): take a reply the collector sent in the ACK to the last write, copying
+// the words after the sensor id into values.  As with the firmware, it has to be for this
+// sensor, or any sensor, from its own collector.
+static bool readAckPayload(Sensor *sensor, uint32_t *values) {
+    uint32_t response[FRAME_REPLY_WORDS];
+
+    if (!ack_payloads || !sensor->radio->isAckPayloadAvailable()) {
+        return false;
+    }
+
+    uint8_t len = sensor->radio->getDynamicPayloadSize();
+    memset(response, 0, sizeof(response));
+    sensor->radio->read(response, len < sizeof(response) ? len : sizeof(response));
+    if ((response[FRAME_REPLY_IDX_SENSOR_ID] != sensor->id &&
+         response[FRAME_REPLY_IDX_SENSOR_ID] != FRAME_REPLY_ANY_SENSOR) ||
+        response[FRAME_REPLY_IDX_COLLECTOR_ID] != sensor->collector_id) {
+        return false;
+    }
+    memcpy(values, response + 1, sizeof(response) - sizeof(uint32_t));
+    return true;
+}
+
+// Send to the collector pipe the sensor was assigned, or pipe 1
+static void openCollectorPipe(Sensor *sensor, uint8_t pipe_addr) {
+    uint8_t address[FRAME_ADDR_LEN];
+
+    memcpy(address, HOST_RADIO_ADDR, FRAME_ADDR_LEN);
+    if (pipe_addr != 0) {
+        address[0] = pipe_addr;
+    }
+    sensor->radio->openWritingPipe(address);
+}
+
+// Send a burst of encoded frames and wait for the reply to the last, with the same retry
+// counter and random backoff as the firmware
+static bool sendFrames(Worker *worker, Sensor *sensor, uint8_t (*payloads)[FRAME_MAX_LEN], const uint8_t *lens,
+                       int count, uint32_t *response) {
+    bool success = false;
+    uint8_t retry_count = 0;
+    uint64_t started = monotonicMicros();
+    uint64_t awake = 0;
+
+    while (!success && retry_count <= MAX_RETRIES) {
+        {
+            std::lock_guard<std::mutex> guard(worker->lock);
+            worker->waiting_for = sensor->id;
+            worker->have_reply = false;
+        }
+
+        bool sent = true, replied = false;
+        uint64_t woke = monotonicMicros();
+        for (int i = 0; i < count && sent; i++) {
+            worker->attempts++;
+            sent = sensor->radio->write(payloads[i], lens[i]);
+            if (sent) {
+                worker->acked++;
+            }
+            // Only the reply to the last frame counts
+            replied = sent && readAckPayload(sensor, response);
+        }
+
+        if (sent && replied) {
+            worker->ack_replies++;
+            awake += monotonicMicros() - woke;
+            success = true;
+            break;
+        }
+        if (sent) {
+            bool got = readResponse(worker, sensor, response);
+            awake += monotonicMicros() - woke;
+            if (got) {
+                success = true;
+                break;
+            }
+            worker->reply_timeouts++;
+        } else {
+            awake += monotonicMicros() - woke;
+            std::lock_guard<std::mutex> guard(worker->lock);
+            worker->waiting_for = 0;
+        }
+
+        retry_count++;
+        for (int i = 0; i < count; i++) {
+            frameSetRetries(payloads[i], frame_version, retry_count);
+        }
+
+        usleep((useconds_t) ((250 + rand_r(&worker->seed) % 1000) * 1000 * backoff_scale));
+    }
+
+    worker->messages++;
+    worker->retry_histogram[retry_count]++;
+    worker->awake_us.push_back(awake);
+    if (success) {
+        worker->latencies_us.push_back(monotonicMicros() - started);
+    } else {
+        worker->failed++;
+    }
+
+    return success;
+}
+
+// sendMessage(): same frame layout as the firmware
+static bool sendMessage(Worker *worker, Sensor *sensor, uint8_t cmd, uint32_t *data, uint8_t flags,
+                        uint32_t *response) {
+    Frame frame;
+    uint8_t payload[1][FRAME_MAX_LEN];
+    uint8_t len;
+
+    frame.version = frame_version;
+    frame.cmd = cmd;
+    frame.retries = 0;
+    frame.flags = flags;
+    frame.sensor_id = sensor->id;
+    frame.collector_id = sensor->collector_id;
+    frame.counter = sensor->message_counter;
+    frame.vcc = data[0];
+    frame.moisture = data[1];
+    frame.temperature = (int16_t) data[2];
+    len = frameEncode(&frame, payload[0]);
+
+    bool success = sendFrames(worker, sensor, payload, &len, 1, response);
+    if (cmd != COMMAND_FIND_COLLECTOR) {
+        sensor->message_counter++;
+    }
+    return success;
+}
+
+// uploadReadings(): the oldest stored readings in a burst of batch frames
+static bool uploadReadings(Worker *worker, Sensor *sensor, uint32_t *response) {
+    uint8_t payloads[BATCH_BURST_FRAMES][FRAME_MAX_LEN];
+    uint8_t lens[BATCH_BURST_FRAMES];
+    FrameBatch batch;
+
+    int count = std::min((int) sensor->ring.size(), BATCH_BURST_FRAMES * FRAME_BATCH_MAX);
+    int frames = (count + FRAME_BATCH_MAX - 1) / FRAME_BATCH_MAX;
+
+    batch.frame.version = FRAME_VERSION_COMPACT;
+    batch.frame.cmd = COMMAND_BATCH;
+    batch.frame.retries = 0;
+    batch.frame.sensor_id = sensor->id;
+    batch.frame.collector_id = sensor->collector_id;
+    batch.interval = (uint16_t) wake_interval_s;
+    for (int f = 0; f < frames; f++) {
+        int first = f * FRAME_BATCH_MAX;
+        batch.count = std::min(count - first, FRAME_BATCH_MAX);
+        batch.more = f < frames - 1;
+        batch.frame.counter = sensor->ring_first_counter + first;
+        batch.age = (uint32_t) (sensor->ring.size() - first - batch.count) * batch.interval;
+        for (int i = 0; i < batch.count; i++) {
+            batch.readings[i] = sensor->ring[first + i];
+        }
+        lens[f] = frameEncodeBatch(&batch, payloads[f]);
+    }
+
+    if (!sendFrames(worker, sensor, payloads, lens, frames, response)) {
+        return false;
+    }
+    sensor->last_report = sensor->ring[count - 1];
+    sensor->report_wakes = 0;
+    sensor->ring.erase(sensor->ring.begin(), sensor->ring.begin() + count);
+    sensor->ring_first_counter += count;
+    worker->readings_ok += count;
+    return true;
+}
+
+// readingChanged(): whether a packed reading moved past any deadband from the last reported
+static bool readingChanged(const Sensor *sensor, uint32_t reading) {
+    Frame now, last;
+
+    frameUnpackReading(reading, &now);
+    frameUnpackReading(sensor->last_report, &last);
+    return abs(now.vcc - last.vcc) > DEADBAND_VCC_MV || abs(now.moisture - last.moisture) > DEADBAND_MOISTURE ||
+           abs(now.temperature - last.temperature) > DEADBAND_TEMPERATURE;
+}
+
+// A stable plant: each value takes a small random step now and then
+static void drift(Worker *worker, Sensor *sensor, uint32_t *data) {
+    int r = rand_r(&worker->seed) % 64;
+
+    if (r == 0) {
+        sensor->vcc -= 5;
+    } else if (r < 4) {
+        sensor->moisture += r == 1 ? 3 : -3;
+    } else if (r == 4) {
+        sensor->temperature += rand_r(&worker->seed) % 2 ? 1 : -1;
+    }
+    data[0] = sensor->vcc;
+    data[1] = sensor->moisture;
+    data[2] = sensor->temperature;
+}
+
+// takeSlot(): move the sensor's reports to the slot in a reply.  The delay counts from now,
+// like the firmware's watchdog starting its period again.
+static void takeSlot(Sensor *sensor, const uint32_t *values) {
+    uint64_t delay_us = (uint64_t) values[FRAME_REPLY_IDX_SLOT_DELAY - 1] * 1000;
+    uint64_t interval_us = (uint64_t) values[FRAME_REPLY_IDX_SLOT_INTERVAL - 1] * 1000;
+    uint64_t wake_us = (uint64_t) (wake_interval_s * 1e6);
+
+    if (delay_us == 0 || interval_us == 0 || wake_us == 0) {
+        return;
+    }
+    if (delay_us < wake_us) {
+        delay_us += interval_us;
+    }
+    sensor->slot_interval_wakes = std::max(1, (int) ((interval_us + wake_us / 2) / wake_us));
+    sensor->slot_wakes = std::max(1, (int) (delay_us / wake_us));
+    // The extra sleep that lines the next wake up with the slot.  runWorker() adds the
+    // wake interval.
+    sensor->next_wake_us = monotonicMicros() + delay_us % wake_us;
+}
+
+// slotDue(): counts the wakes down to the sensor's slot
+static bool slotDue(Sensor *sensor) {
+    if (sensor->slot_wakes > 1) {
+        sensor->slot_wakes--;
+        return false;
+    }
+    sensor->slot_wakes = sensor->slot_interval_wakes;
+    return true;
+}
+
+static void wake(Worker *worker, Sensor *sensor) {
+    uint32_t data[3] = {0, 0, 0};
+    uint32_t result[FRAME_REPLY_WORDS - 1];
+
+    if (sensor->collector_id == 0) {
+        worker->finds++;
+        if (sendMessage(worker, sensor, COMMAND_FIND_COLLECTOR, data, 0, result)) {
+            sensor->collector_id = result[0];
+            if (frame_version != FRAME_VERSION_LEGACY) {
+                openCollectorPipe(sensor, result[FRAME_REPLY_IDX_PIPE_ADDR - 1]);
+            }
+            takeSlot(sensor, result);
+        }
+        return;
+    }
+
+    // Status reports wait for the sensor's slot, if it has one
+    if (batch_wakes == 0 && sensor->slot_interval_wakes > 0 && !slotDue(sensor)) {
+        return;
+    }
+
+    if (heartbeat_wakes > 0) {
+        drift(worker, sensor, data);
+    } else {
+        data[0] = 3500 + rand_r(&worker->seed) % 700;
+        data[1] = 200 + rand_r(&worker->seed) % 600;
+        data[2] = 18 + rand_r(&worker->seed) % 8;
+    }
+    worker->readings_taken++;
+
+    uint32_t reading = framePackReading(data[0], data[1], data[2], 0);
+    bool heartbeat = true, changed = true;
+    if (heartbeat_wakes > 0) {
+        if (sensor->report_wakes < heartbeat_wakes) {
+            sensor->report_wakes++;
+        }
+        heartbeat = sensor->report_wakes >= heartbeat_wakes;
+        changed = readingChanged(sensor, reading);
+    }
+
+    if (batch_wakes > 0) {
+        if (sensor->ring.size() == READING_RING_SIZE) {
+            sensor->ring.erase(sensor->ring.begin());
+            sensor->ring_first_counter++;
+        }
+        if (sensor->ring.empty()) {
+            sensor->ring_first_counter = sensor->reading_counter;
+        }
+        sensor->ring.push_back(reading);
+        sensor->reading_counter++;
+
+        bool upload = sensor->slot_interval_wakes > 0 ? slotDue(sensor) : ++sensor->wakes >= batch_wakes;
+        if (upload) {
+            sensor->wakes = 0;
+
+            // batchWake(): unchanged readings are dropped, and their counters handed out again
+            bool ring_changed = false;
+            for (size_t i = 0; i < sensor->ring.size() && !ring_changed; i++) {
+                ring_changed = readingChanged(sensor, sensor->ring[i]);
+            }
+            if (heartbeat_wakes > 0 && !heartbeat && !ring_changed) {
+                sensor->reading_counter -= sensor->ring.size();
+                sensor->ring.clear();
+                return;
+            }
+            if (heartbeat_wakes > 0 && !ring_changed) {
+                sensor->ring.back() |= FRAME_FLAG_HEARTBEAT;
+            }
+            if (uploadReadings(worker, sensor, result)) {
+                takeSlot(sensor, result);
+            }
+        }
+        return;
+    }
+
+    if (!heartbeat && !changed) {
+        return;
+    }
+    if (sendMessage(worker, sensor, COMMAND_STATUS, data, changed ? 0 : FRAME_FLAG_HEARTBEAT, result)) {
+        worker->statuses_ok++;
+        worker->readings_ok++;
+        sensor->last_report = reading;
+        sensor->report_wakes = 0;
+        takeSlot(sensor, result);
+    }
+}
+
+static void runWorker(Worker *worker, uint64_t interval_us, uint64_t end_us) {
+    while (running) {
+        Sensor *next = &worker->sensors[0];
+        for (size_t i = 1; i < worker->sensors.size(); i++) {
+            if (worker->sensors[i].next_wake_us < next->next_wake_us) {
+                next = &worker->sensors[i];
+            }
+        }
+        if (next->next_wake_us >= end_us) {
+            break;
+        }
+
+        sleepUntil(next->next_wake_us);
+        wake(worker, next);
+
+        // Like the firmware, the next wake is a fixed sleep after this one, so a slow
+        // exchange pushes the schedule back
+        next->next_wake_us += interval_us;
+        uint64_t now = monotonicMicros();
+        if (next->next_wake_us < now) {
+            next->next_wake_us = now;
+        }
+    }
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double p) {
+    if (sorted.empty()) {
+        return 0;
+    }
+    size_t idx = (size_t) (p * (sorted.size() - 1) + 0.5);
+    return sorted[idx];
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "Usage: %s [-s sensors] [-w wake_interval_s] [-t duration_s] [-W workers] [-b backoff_scale]\n"
+            "          [-n namespace] [-l loss] [-p stub_influx_port] [-x] [-m stub_mqtt_port] [-L] [-B upload_wakes]\n"
+            "          [-D heartbeat_wakes] [-a]\n"
+            "  -x  don't start the stand-in InfluxDB (collector writes elsewhere)\n"
+            "  -m  start a stand-in MQTT broker on this port as well\n"
+            "  -L  send legacy 32 byte frames instead of compact ones\n"
+            "  -B  store a reading every wake and upload them in batches every upload_wakes wakes\n"
+            "  -D  drift readings slowly and only report changes past the deadbands, or a heartbeat\n"
+            "      once heartbeat_wakes wakes go by without a report\n"
+            "  -a  take replies from ACK payloads, for a collector run with -a\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    int sensors = 100, worker_count = 0, stub_port = STUB_INFLUX_PORT, mqtt_port = 0;
+    double interval = 10.0, duration = 30.0, loss = 0.0;
+    const char *name_space = SIM_RADIO_NAMESPACE;
+    bool use_stub = true;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:w:t:W:b:n:l:p:xm:LB:D:a")) != -1) {
+        switch (opt) {
+            case 's': sensors = atoi(optarg); break;
+            case 'w': interval = atof(optarg); break;
+            case 't': duration = atof(optarg); break;
+            case 'W': worker_count = atoi(optarg); break;
+            case 'b': backoff_scale = atof(optarg); break;
+            case 'n': name_space = optarg; break;
+            case 'l': loss = atof(optarg); break;
+            case 'p': stub_port = atoi(optarg); break;
+            case 'x': use_stub = false; break;
+            case 'm': mqtt_port = atoi(optarg); break;
+            case 'L': frame_version = FRAME_VERSION_LEGACY; break;
+            case 'B': batch_wakes = atoi(optarg); break;
+            case 'D': heartbeat_wakes = atoi(optarg); break;
+            case 'a': ack_payloads = true; break;
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+    if (sensors < 1 || ((batch_wakes > 0 || ack_payloads) && frame_version == FRAME_VERSION_LEGACY)) {
+        usage(argv[0]);
+        return 1;
+    }
+    sensor_count = sensors;
+    wake_interval_s = interval;
+    if (worker_count <= 0) {
+        worker_count = sensors < 64 ? sensors : 64;
+    }
+
+    StubInflux stub;
+    if (use_stub && stub.start(stub_port) < 0) {
+        return 1;
+    }
+    StubMqtt mqtt;
+    if (mqtt_port > 0 && mqtt.start(mqtt_port) < 0) {
+        return 1;
+    }
+
+    // Every sensor has a radio of its own, and they all need file descriptors
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    // The legacy sensors' shared reply address.  Its FIFO stands in for every sensor's
+    // own radio, so make it deep enough that it never drops anything itself.
+    SimRadio *listener = NULL;
+    if (frame_version == FRAME_VERSION_LEGACY) {
+        listener = new SimRadio(name_space, 4096, loss);
+        if (!listener->begin()) {
+            return 1;
+        }
+        listener->openReadingPipe(1, SELF_RADIO_ADDR);
+        listener->startListening();
+    }
+
+    uint64_t start_us = monotonicMicros();
+    uint64_t interval_us = (uint64_t) (interval * 1e6);
+    uint64_t end_us = start_us + (uint64_t) (duration * 1e6);
+    unsigned int seed = (unsigned int) start_us;
+
+    for (int w = 0; w < worker_count; w++) {
+        Worker *worker = new Worker();
+        if (frame_version == FRAME_VERSION_LEGACY) {
+            worker->radio = new SimRadio(name_space, SIM_RADIO_FIFO_DEPTH, loss);
+            worker->radio->begin();
+            worker->radio->setRetries(PACKET_RETRY_DELAY, PACKET_RETRIES);
+            worker->radio->openWritingPipe(HOST_RADIO_ADDR);
+        }
+        worker->seed = seed + w;
+        worker->sensors.reserve((sensors + worker_count - 1) / worker_count);
+        workers.push_back(worker);
+    }
+    for (int i = 0; i < sensors; i++) {
+        Sensor sensor;
+        sensor.id = SENSOR_ID_BASE + i;
+        sensor.collector_id = 0;
+        sensor.message_counter = 0;
+        sensor.ring_first_counter = 0;
+        sensor.reading_counter = 0;
+        sensor.wakes = 0;
+        sensor.vcc = 3500 + rand_r(&seed) % 700;
+        sensor.moisture = 200 + rand_r(&seed) % 600;
+        sensor.temperature = 18 + rand_r(&seed) % 8;
+        sensor.last_report = 0;
+        // The first reading is always reported
+        sensor.report_wakes = heartbeat_wakes;
+        sensor.slot_wakes = 0;
+        sensor.slot_interval_wakes = 0;
+        // Sensors come up at random points in the first interval
+        sensor.next_wake_us = start_us + (uint64_t) rand_r(&seed) % (interval_us > 0 ? interval_us : 1);
+        sensor.radio = workers[i % worker_count]->radio;
+
+        if (frame_version != FRAME_VERSION_LEGACY) {
+            uint8_t address[FRAME_ADDR_LEN];
+            frameSensorAddress(sensor.id, address);
+            sensor.radio = new SimRadio(name_space, SIM_RADIO_FIFO_DEPTH, loss);
+            if (!sensor.radio->begin()) {
+                return 1;
+            }
+            sensor.radio->setRetries(PACKET_RETRY_DELAY, PACKET_RETRIES);
+            sensor.radio->enableDynamicPayloads();
+            if (ack_payloads) {
+                sensor.radio->enableAckPayload();
+            }
+            sensor.radio->openWritingPipe(HOST_RADIO_ADDR);
+            sensor.radio->openReadingPipe(1, address);
+            sensor.radio->startListening();
+        }
+        workers[i % worker_count]->sensors.push_back(sensor);
+    }
+
+    printf("Emulating %d sensors, waking every %.2fs for %.0fs, %d worker threads\n", sensors, interval, duration,
+           worker_count);
+
+    std::thread dispatcher;
+    if (listener != NULL) {
+        dispatcher = std::thread(dispatchReplies, listener);
+    }
+    std::vector<std::thread> threads;
+    for (int w = 0; w < worker_count; w++) {
+        threads.push_back(std::thread(runWorker, workers[w], interval_us, end_us));
+    }
+    for (size_t w = 0; w < threads.size(); w++) {
+        threads[w].join();
+    }
+    double elapsed = (monotonicMicros() - start_us) / 1e6;
+
+    // Let the collector's last batch reach the sink
+    uint64_t sink_lines = stub.lines;
+    if (use_stub) {
+        for (int i = 0; i < 50; i++) {
+            usleep(100000);
+            if (stub.lines == sink_lines && i >= 20) {
+                break;
+            }
+            sink_lines = stub.lines;
+        }
+    }
+
+    running = false;
+    if (dispatcher.joinable()) {
+        dispatcher.join();
+    }
+
+    Worker totals;
+    std::vector<uint32_t> latencies, awake;
+    for (size_t w = 0; w < workers.size(); w++) {
+        Worker *worker = workers[w];
+        latencies.insert(latencies.end(), worker->latencies_us.begin(), worker->latencies_us.end());
+        awake.insert(awake.end(), worker->awake_us.begin(), worker->awake_us.end());
+        totals.messages += worker->messages;
+        totals.failed += worker->failed;
+        totals.finds += worker->finds;
+        totals.statuses_ok += worker->statuses_ok;
+        totals.readings_ok += worker->readings_ok;
+        totals.readings_taken += worker->readings_taken;
+        totals.attempts += worker->attempts;
+        totals.acked += worker->acked;
+        totals.reply_timeouts += worker->reply_timeouts;
+        totals.ack_replies += worker->ack_replies;
+        for (int r = 0; r <= MAX_RETRIES + 1; r++) {
+            totals.retry_histogram[r] += worker->retry_histogram[r];
+        }
+    }
+    std::sort(latencies.begin(), latencies.end());
+    std::sort(awake.begin(), awake.end());
+    uint64_t awake_total = 0;
+    for (size_t i = 0; i < awake.size(); i++) {
+        awake_total += awake[i];
+    }
+
+    printf("messages: %llu sent (%llu find collector), %llu ok, %llu failed, %.1f msgs/s\n",
+           (unsigned long long) totals.messages, (unsigned long long) totals.finds,
+           (unsigned long long) (totals.messages - totals.failed), (unsigned long long) totals.failed,
+           totals.messages / elapsed);
+    printf("frames: %llu transmitted, %llu accepted (%.2f%%), %llu dropped, %llu reply timeouts\n",
+           (unsigned long long) totals.attempts, (unsigned long long) totals.acked,
+           totals.attempts ? 100.0 * totals.acked / totals.attempts : 0.0,
+           (unsigned long long) (totals.attempts - totals.acked), (unsigned long long) totals.reply_timeouts);
+    printf("retries:");
+    for (int r = 0; r <= MAX_RETRIES + 1; r++) {
+        printf(" %d:%llu", r, (unsigned long long) totals.retry_histogram[r]);
+    }
+    printf("\n");
+    printf("reply round trip (ms): p50=%.2f p99=%.2f p999=%.2f max=%.2f\n", percentile(latencies, 0.5) / 1e3,
+           percentile(latencies, 0.99) / 1e3, percentile(latencies, 0.999) / 1e3,
+           latencies.empty() ? 0.0 : latencies.back() / 1e3);
+    printf("awake per message (ms): mean=%.2f p50=%.2f p99=%.2f max=%.2f\n",
+           awake.empty() ? 0.0 : awake_total / 1e3 / awake.size(), percentile(awake, 0.5) / 1e3,
+           percentile(awake, 0.99) / 1e3, awake.empty() ? 0.0 : awake.back() / 1e3);
+    if (ack_payloads) {
+        printf("ack payload replies: %llu of %llu ok messages\n", (unsigned long long) totals.ack_replies,
+               (unsigned long long) (totals.messages - totals.failed));
+    }
+    if (heartbeat_wakes > 0) {
+        printf("readings: %llu taken, %llu reported (%.1fx fewer)\n", (unsigned long long) totals.readings_taken,
+               (unsigned long long) totals.readings_ok,
+               totals.readings_ok ? (double) totals.readings_taken / totals.readings_ok : 0.0);
+    }
+    if (use_stub) {
+        uint64_t readings = totals.readings_ok;
+        uint64_t filled = stub.filled;
+        uint64_t rollups = stub.rollups;
+        printf("sink: %llu records (%llu filled forward, %llu rollups) in %llu requests, %.1f records/s, %lld readings not (yet) written\n",
+               (unsigned long long) sink_lines, (unsigned long long) filled, (unsigned long long) rollups,
+               (unsigned long long) stub.requests.load(), sink_lines / elapsed,
+               (long long) readings - (long long) (sink_lines - filled - rollups));
+    }
+
+    if (mqtt_port > 0) {
+        printf("mqtt: %llu publishes in %llu batches over %llu connections, %.1f publishes/s\n",
+               (unsigned long long) mqtt.publishes.load(), (unsigned long long) mqtt.pings.load(),
+               (unsigned long long) mqtt.connections.load(), mqtt.publishes / elapsed);
+    }
+
+    stub.stop();
+    mqtt.stop();
+    return 0;
+}
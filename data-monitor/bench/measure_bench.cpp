@@ -0,0 +1,172 @@
+/**
+ * Checks the sensor's integer measurement path (Measure.h) against the float one it
+ * replaced, over every ADC code, and compares how long each takes and how much memory
+ * its tables need.
+ *
+ * The float versions are as they were in sensor.ino, with float in place of double as
+ * avr-gcc's double is only 32 bits.  Timings are for this machine; on the AVR, without
+ * an FPU, the gap is wider.
+ *
+ * Exits non-zero if the integer path doesn't match, so it's also run as a test.
+ *
+ * Usage: measure_bench [-n rounds]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include "Measure.h"
+
+// Bandgap readings for a supply of 5.5V down to 1.8V
+#define BANDGAP_ADC_MIN 205
+#define BANDGAP_ADC_MAX 626
+
+#define R_CONSTANT 200
+#define RANGE_LEN 34
+#define MOISTURE_MAX_VAL 3.3f
+
+static const int8_t temp_range[RANGE_LEN] = {
+  -40, -35, -30, -25, -20, -15, -10, -5,  0,
+    5,  10,  15,  20,  25,  30,  35,  40, 45,
+   50,  55,  60,  65,  70,  75,  80,  85, 90,
+   95, 100, 105, 110, 115, 120, 125};
+static const float r_range[RANGE_LEN] = {
+  4397.119, 3088.599, 2197.225, 1581.881, 1151.037, 846.579, 628.988, 471.632, 357.012,
+   272.500,  209.710,  162.651,  127.080,  100.000,  79.222,  63.167,  50.677,  40.904,
+    33.195,   27.091,   22.224,   18.323,   15.184,  12.635,  10.566,   8.873,   7.481,
+     6.337,    5.384,    4.594,    3.934,    3.380,   2.916,   2.522};
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static float floatBatteryVoltage(uint16_t adc_result) {
+    return (1024 * 1.1f) / adc_result;
+}
+
+static uint16_t floatMoisture(uint16_t sensor_reading, float vcc) {
+    return sensor_reading * (vcc / MOISTURE_MAX_VAL);
+}
+
+static uint8_t findClosestRVal(float r_temp) {
+    uint8_t idx = 0;
+    while (idx < RANGE_LEN) {
+        if (r_temp >= r_range[idx]) {
+            break;
+        }
+        idx++;
+    }
+    if (idx == RANGE_LEN) {
+        return idx - 1;
+    }
+    return idx;
+}
+
+// With the out of bounds read of r_range[RANGE_LEN] for the hot edge case fixed
+static int16_t floatTemperature(uint16_t adc_reading) {
+    float r_temp = R_CONSTANT * (adc_reading / (1024.0f - adc_reading));
+
+    if (r_temp >= r_range[0]) {
+        return temp_range[0];
+    }
+    if (r_temp < r_range[RANGE_LEN - 1]) {
+        return temp_range[RANGE_LEN - 1];
+    }
+
+    uint8_t idx = findClosestRVal(r_temp);
+    float factor = (r_temp - r_range[idx]) / (r_range[idx - 1] - r_range[idx]);
+    int8_t temp_delta = temp_range[idx - 1] - temp_range[idx];
+    return (int) (temp_delta * factor) + temp_range[idx];
+}
+
+// Whether the integer path gives what the float one did.  Moisture can only differ where
+// the exact value is a whole number the float version fell just short of.
+static bool compare(void) {
+    int temp_diffs = 0, temp_max = 0, vcc_diffs = 0, moisture_diffs = 0, moisture_max = 0, moisture_whole = 0;
+
+    for (int adc = 0; adc < 1024; adc++) {
+        int diff = abs(floatTemperature(adc) - measureTemperature(adc));
+        if (diff != 0) {
+            printf("temperature differs at adc %d: float %d, integer %d\n", adc, floatTemperature(adc),
+                   measureTemperature(adc));
+            temp_diffs++;
+            temp_max = diff > temp_max ? diff : temp_max;
+        }
+    }
+
+    for (int bandgap = BANDGAP_ADC_MIN; bandgap < BANDGAP_ADC_MAX; bandgap++) {
+        float vcc = floatBatteryVoltage(bandgap);
+        if ((uint16_t) (vcc * 1000) != measureVcc(bandgap)) {
+            vcc_diffs++;
+        }
+        for (int adc = 0; adc < 1024; adc++) {
+            int diff = abs(floatMoisture(adc, vcc) - measureMoisture(adc, bandgap));
+            if (diff != 0) {
+                moisture_diffs++;
+                moisture_max = diff > moisture_max ? diff : moisture_max;
+                // The exact value is a whole number the float version fell just short of
+                if ((uint32_t) adc * 1024 * MEASURE_BANDGAP_MV % ((uint32_t) bandgap * MEASURE_MOISTURE_MAX_MV) == 0) {
+                    moisture_whole++;
+                }
+            }
+        }
+    }
+
+    printf("temperature: %d of 1024 adc codes differ (max %dC)\n", temp_diffs, temp_max);
+    printf("vcc: %d of %d bandgap codes differ\n", vcc_diffs, BANDGAP_ADC_MAX - BANDGAP_ADC_MIN);
+    printf("moisture: %d of %d adc/bandgap pairs differ (max %d), %d where float rounding fell short of a whole value\n",
+           moisture_diffs, 1024 * (BANDGAP_ADC_MAX - BANDGAP_ADC_MIN), moisture_max, moisture_whole);
+    return temp_diffs == 0 && vcc_diffs == 0 && moisture_diffs == moisture_whole && moisture_max <= 1;
+}
+
+// One measurement as the sensor takes it: bandgap, moisture and temperature readings
+static void timing(int rounds) {
+    volatile uint32_t check = 0;
+    double start, float_s, integer_s;
+
+    start = nowSeconds();
+    for (int i = 0; i < rounds; i++) {
+        uint16_t bandgap = BANDGAP_ADC_MIN + i % (BANDGAP_ADC_MAX - BANDGAP_ADC_MIN);
+        float vcc = floatBatteryVoltage(bandgap);
+        check += (uint32_t) (vcc * 1000) + floatMoisture(i & 1023, vcc) + floatTemperature((i * 7) & 1023);
+    }
+    float_s = nowSeconds() - start;
+
+    start = nowSeconds();
+    for (int i = 0; i < rounds; i++) {
+        uint16_t bandgap = BANDGAP_ADC_MIN + i % (BANDGAP_ADC_MAX - BANDGAP_ADC_MIN);
+        check += measureVcc(bandgap) + measureMoisture(i & 1023, bandgap) + measureTemperature((i * 7) & 1023);
+    }
+    integer_s = nowSeconds() - start;
+
+    printf("per measurement: float %.1f ns, integer %.1f ns (%.1fx)\n", float_s * 1e9 / rounds,
+           integer_s * 1e9 / rounds, float_s / integer_s);
+    printf("tables: float %zu bytes of SRAM, integer %zu bytes of flash and none of SRAM\n",
+           sizeof(temp_range) + sizeof(r_range), MEASURE_TEMP_POINTS * sizeof(uint32_t));
+}
+
+int main(int argc, char **argv) {
+    int rounds = 10000000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:")) != -1) {
+        switch (opt) {
+            case 'n':
+                rounds = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n rounds]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (!compare()) {
+        printf("FAIL: the integer conversions don't match the float ones\n");
+        return 1;
+    }
+    timing(rounds);
+    return 0;
+}
@@ -0,0 +1,269 @@
+/**
+ * Latency and throughput of the collector's query API under concurrent clients.  Fills a
+ * SensorTable, serves it with a QueryServer and has clients hammer it over keep-alive
+ * connections, asking for every sensor's latest reading or one sensor's history, while
+ * another thread records new readings as the writer thread would.
+ *
+ * Usage: query_bench [-s sensors] [-c clients] [-t seconds] [-u updates_per_s] [-h history_pct]
+ */
+
+#include <algorithm>
+#include <arpa/inet.h>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <string>
+#include <sys/socket.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../QueryServer.h"
+
+#define SENSOR_ID_BASE 0x5e000000u
+
+// Readings asked for in a history request
+#define HISTORY_REQUEST 16
+
+static std::atomic<bool> running(true);
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void fakeReading(Reading *reading, uint32_t sensor_id, uint32_t i) {
+    memset(reading, 0, sizeof(*reading));
+    reading->timestamp_ms = 1500000000000ull + i * 1000ull;
+    reading->sensor_id = sensor_id;
+    reading->cycles = i;
+    reading->vcc = 3300 + i % 900;
+    reading->moisture = i % 1024;
+    reading->temperature = i % 60 - 20;
+}
+
+static void record(SensorTable *table, uint32_t sensor_id, uint32_t i) {
+    Reading reading;
+    fakeReading(&reading, sensor_id, i);
+    SensorState *state = table->find(sensor_id);
+    if (state == NULL) {
+        state = table->insert(sensor_id);
+        state->sensor_id = sensor_id;
+    }
+    state->latest = reading;
+    state->last_seen_ms = reading.timestamp_ms;
+    table->record(state, reading);
+}
+
+static int connectTo(int port) {
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return fd;
+}
+
+// Reads one response, returns its body length or -1 on error
+static long readResponse(int fd, std::string *buf) {
+    char chunk[16384];
+    size_t header_end;
+
+    while ((header_end = buf->find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) {
+            return -1;
+        }
+        buf->append(chunk, n);
+    }
+    if (buf->compare(0, 12, "HTTP/1.1 200") != 0) {
+        return -1;
+    }
+
+    const char *cl = strstr(buf->c_str(), "Content-Length: ");
+    size_t body_len = cl != NULL ? strtoul(cl + 16, NULL, 10) : 0;
+    size_t total = header_end + 4 + body_len;
+    while (buf->size() < total) {
+        ssize_t n = read(fd, chunk, sizeof(chunk));
+        if (n <= 0) {
+            return -1;
+        }
+        buf->append(chunk, n);
+    }
+    buf->erase(0, total);
+    return body_len;
+}
+
+struct ClientStats {
+    std::vector<double> latencies;
+    uint64_t bytes = 0;
+    uint64_t errors = 0;
+};
+
+static void client(int port, int id, uint32_t sensors, int history_pct, ClientStats *stats) {
+    int fd = connectTo(port);
+    std::string buf;
+    char request[128];
+    uint32_t i = id;
+
+    while (running) {
+        i = i * 1103515245u + 12345u;
+        if ((int) (i >> 8) % 100 < history_pct) {
+            snprintf(request, sizeof(request), "GET /sensors/%08x?n=%d HTTP/1.1\r\nHost: localhost\r\n\r\n",
+                     SENSOR_ID_BASE + (i >> 4) % sensors, HISTORY_REQUEST);
+        } else {
+            snprintf(request, sizeof(request), "GET /sensors HTTP/1.1\r\nHost: localhost\r\n\r\n");
+        }
+
+        double start = nowSeconds();
+        if (write(fd, request, strlen(request)) < 0) {
+            stats->errors++;
+            break;
+        }
+        long len = readResponse(fd, &buf);
+        if (len < 0) {
+            stats->errors++;
+            break;
+        }
+        stats->latencies.push_back(nowSeconds() - start);
+        stats->bytes += len;
+    }
+    close(fd);
+}
+
+// Records readings at the given rate, as the collector's writer thread would
+static void updater(SensorTable *table, std::mutex *lock, uint32_t sensors, int per_second, uint64_t *updates) {
+    uint32_t i = sensors;
+    double next = nowSeconds();
+
+    while (running && per_second > 0) {
+        {
+            std::lock_guard<std::mutex> guard(*lock);
+            record(table, SENSOR_ID_BASE + i % sensors, i);
+        }
+        i++;
+        (*updates)++;
+        next += 1.0 / per_second;
+        double wait = next - nowSeconds();
+        if (wait > 0) {
+            usleep(wait * 1e6);
+        }
+    }
+}
+
+static void run(uint32_t sensors, int clients, int seconds, int per_second, int history_pct) {
+    SensorTable table(sensors, SENSOR_HISTORY);
+    std::mutex lock;
+    QueryServer server(&table, &lock);
+    std::vector<ClientStats> stats(clients);
+    std::vector<std::thread> threads;
+    uint64_t updates = 0;
+
+    for (uint32_t i = 0; i < sensors * SENSOR_HISTORY; i++) {
+        record(&table, SENSOR_ID_BASE + i % sensors, i);
+    }
+
+    int port = server.start("127.0.0.1", 0);
+    if (port < 0) {
+        exit(1);
+    }
+
+    running = true;
+    double start = nowSeconds();
+    std::thread update_thread(updater, &table, &lock, sensors, per_second, &updates);
+    for (int i = 0; i < clients; i++) {
+        threads.push_back(std::thread(client, port, i + 1, sensors, history_pct, &stats[i]));
+    }
+    sleep(seconds);
+    running = false;
+    for (size_t i = 0; i < threads.size(); i++) {
+        threads[i].join();
+    }
+    update_thread.join();
+    double elapsed = nowSeconds() - start;
+    server.stop();
+
+    std::vector<double> all;
+    uint64_t bytes = 0, errors = 0;
+    for (size_t i = 0; i < stats.size(); i++) {
+        all.insert(all.end(), stats[i].latencies.begin(), stats[i].latencies.end());
+        bytes += stats[i].bytes;
+        errors += stats[i].errors;
+    }
+    std::sort(all.begin(), all.end());
+    if (all.empty()) {
+        printf("no requests completed\n");
+        return;
+    }
+
+    printf("%4u sensors, %3d clients, %5d updates/s, %3d%% history: %8.0f req/s, %6.1f MB/s, "
+           "latency p50 %6.1fus p99 %7.1fus max %7.1fus, errors %llu\n",
+           sensors, clients, (int) (updates / elapsed), history_pct, all.size() / elapsed, bytes / elapsed / 1e6,
+           all[all.size() / 2] * 1e6, all[all.size() * 99 / 100] * 1e6, all.back() * 1e6,
+           (unsigned long long) errors);
+}
+
+int main(int argc, char **argv) {
+    uint32_t sensors = 100;
+    int clients = 0;
+    int seconds = 2;
+    int per_second = -1;
+    int history_pct = -1;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:c:t:u:h:")) != -1) {
+        switch (opt) {
+            case 's':
+                sensors = atoi(optarg);
+                break;
+            case 'c':
+                clients = atoi(optarg);
+                break;
+            case 't':
+                seconds = atoi(optarg);
+                break;
+            case 'u':
+                per_second = atoi(optarg);
+                break;
+            case 'h':
+                history_pct = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s sensors] [-c clients] [-t seconds] [-u updates_per_s] [-h history_pct]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+
+    if (clients > 0 && per_second >= 0 && history_pct >= 0) {
+        run(sensors, clients, seconds, per_second, history_pct);
+        return 0;
+    }
+
+    // With nothing given, a sweep: cached latest readings, the cache invalidated by a busy
+    // radio, and history lookups, at a few client counts
+    static const int client_counts[] = {1, 8, 64};
+    for (size_t i = 0; i < sizeof(client_counts) / sizeof(client_counts[0]); i++) {
+        int c = clients > 0 ? clients : client_counts[i];
+        run(sensors, c, seconds, per_second >= 0 ? per_second : 0, history_pct >= 0 ? history_pct : 0);
+        run(sensors, c, seconds, per_second >= 0 ? per_second : 1000, history_pct >= 0 ? history_pct : 0);
+        run(sensors, c, seconds, per_second >= 0 ? per_second : 1000, history_pct >= 0 ? history_pct : 100);
+        if (clients > 0) {
+            break;
+        }
+    }
+    return 0;
+}
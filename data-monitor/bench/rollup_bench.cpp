@@ -0,0 +1,133 @@
+/**
+ * Cost of keeping rollups at ingest, and what they save at query time.  Feeds a year of
+ * simulated readings through RollupEngine, interleaved across sensors as they arrive at
+ * the collector, and reports the time per reading, windows closed at each resolution,
+ * and how many points graphs of a day, a month and a year read from the raw readings
+ * against the coarsest rollup that still gives a point every few pixels.  Also checks the
+ * rollups against the raw readings.
+ *
+ * Usage: rollup_bench [-s sensors] [-y days] [-i interval_s]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <vector>
+#include "../RollupEngine.h"
+
+#define SENSOR_ID_BASE 0x5e000000u
+#define START_MS 1500000000000ull
+#define DAY_MS (24 * 3600 * 1000ull)
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void simulate(Reading *reading, uint32_t sensor, uint64_t i, uint64_t interval_ms) {
+    uint32_t noise = (uint32_t) ((i * 2654435761u) ^ (sensor * 40503u));
+
+    reading->timestamp_ms = START_MS + i * interval_ms + noise % 40;
+    reading->sensor_id = SENSOR_ID_BASE + sensor;
+    reading->vcc = 4200 - (uint32_t) (i * interval_ms / (DAY_MS / 2)) % 900;
+    reading->moisture = 800 - (uint32_t) (i % 2000) / 5 + noise % 3;
+    reading->temperature = 10 + (int32_t) (noise % 15);
+}
+
+int main(int argc, char **argv) {
+    uint32_t sensors = 100;
+    int days = 365;
+    int interval_s = 300;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:y:i:")) != -1) {
+        switch (opt) {
+            case 's':
+                sensors = atoi(optarg);
+                break;
+            case 'y':
+                days = atoi(optarg);
+                break;
+            case 'i':
+                interval_s = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s sensors] [-y days] [-i interval_s]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    uint64_t interval_ms = interval_s * 1000ull;
+    uint64_t per_sensor = days * DAY_MS / interval_ms;
+    SensorTable table(sensors, 0);
+    RollupEngine engine(&table);
+    Rollup closed[ROLLUP_RESOLUTIONS];
+    uint64_t windows[ROLLUP_RESOLUTIONS] = {0};
+    uint64_t counted[ROLLUP_RESOLUTIONS] = {0};
+    int64_t moisture_sum = 0, rolled_sum = 0;
+    Reading reading = Reading();
+
+    for (uint32_t s = 0; s < sensors; s++) {
+        table.insert(SENSOR_ID_BASE + s);
+    }
+
+    double start = nowSeconds();
+    for (uint64_t i = 0; i < per_sensor; i++) {
+        for (uint32_t s = 0; s < sensors; s++) {
+            simulate(&reading, s, i, interval_ms);
+            moisture_sum += reading.moisture;
+            size_t count = engine.add(reading, closed);
+            for (size_t c = 0; c < count; c++) {
+                windows[closed[c].resolution]++;
+                counted[closed[c].resolution] += closed[c].window.count;
+                if (closed[c].resolution == ROLLUP_DAY) {
+                    rolled_sum += closed[c].window.fields[ROLLUP_MOISTURE].sum;
+                }
+            }
+        }
+    }
+    double elapsed = nowSeconds() - start;
+
+    // Whatever is still open, as if every sensor went quiet
+    Rollup idle[64];
+    size_t count;
+    while ((count = engine.closeIdle(UINT64_MAX / 2, 0, idle, 64)) > 0) {
+        for (size_t c = 0; c < count; c++) {
+            windows[idle[c].resolution]++;
+            counted[idle[c].resolution] += idle[c].window.count;
+            if (idle[c].resolution == ROLLUP_DAY) {
+                rolled_sum += idle[c].window.fields[ROLLUP_MOISTURE].sum;
+            }
+        }
+    }
+
+    uint64_t total = per_sensor * sensors;
+    printf("%u sensors, %d days every %ds: %llu readings, %.1f ns/reading\n", sensors, days, interval_s,
+           (unsigned long long) total, elapsed * 1e9 / total);
+    static const char *names[ROLLUP_RESOLUTIONS] = {"1m", "1h", "1d"};
+    for (int r = 0; r < ROLLUP_RESOLUTIONS; r++) {
+        printf("%s windows: %llu, covering %llu readings%s\n", names[r], (unsigned long long) windows[r],
+               (unsigned long long) counted[r], counted[r] == total ? "" : " (MISMATCH)");
+    }
+    printf("daily moisture sums %s the raw readings\n", rolled_sum == moisture_sum ? "match" : "DO NOT match");
+
+    // One sensor over each range, read raw or from the rollup that still gives a point
+    // every few pixels on a graph
+    static const struct {
+        const char *range;
+        uint64_t ms;
+        int resolution;
+    } graphs[] = {{"day", DAY_MS, ROLLUP_MINUTE}, {"month", 30 * DAY_MS, ROLLUP_HOUR}, {"year", 365 * DAY_MS, ROLLUP_DAY}};
+    for (size_t g = 0; g < sizeof(graphs) / sizeof(graphs[0]); g++) {
+        uint64_t raw = graphs[g].ms / interval_ms;
+        uint64_t window = rollup_window_ms[graphs[g].resolution];
+        uint64_t rolled = graphs[g].ms / (window > interval_ms ? window : interval_ms);
+        printf("graph of a %-5s: %6llu raw points, %5llu %s rollups (%.0fx fewer)\n", graphs[g].range,
+               (unsigned long long) raw, (unsigned long long) rolled, names[graphs[g].resolution],
+               (double) raw / rolled);
+    }
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+/**
+ * Per-reading cost of keeping the collector's per-sensor state: SensorTable against a
+ * std::unordered_map holding the same state, for a few fleet sizes.  Also counts heap
+ * allocations once every sensor has been seen, which should be none for the table.
+ *
+ * Usage: sensor_table_bench [-n updates] [-R history]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <new>
+#include <unistd.h>
+#include <unordered_map>
+#include "../SensorTable.h"
+
+#define SENSOR_ID_BASE 0x5e000000u
+
+static size_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size);
+    if (p == NULL) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Readings come in from sensors in no particular order
+static uint32_t sensorFor(uint32_t i, uint32_t sensors) {
+    return SENSOR_ID_BASE + (i * 2654435761u >> 7) % sensors;
+}
+
+static void fakeReading(Reading *reading, uint32_t sensor_id, uint32_t i) {
+    reading->timestamp_ms = 1500000000000ull + i;
+    reading->sensor_id = sensor_id;
+    reading->cycles = i;
+    reading->moisture = i % 1024;
+}
+
+static void benchTable(uint32_t sensors, uint32_t history, int updates) {
+    SensorTable table(sensors, history);
+    Reading reading;
+    uint64_t check = 0;
+
+    for (uint32_t i = 0; i < sensors; i++) {
+        fakeReading(&reading, SENSOR_ID_BASE + i, i);
+        table.record(table.insert(reading.sensor_id), reading);
+    }
+
+    size_t allocations_before = allocations;
+    double start = nowSeconds();
+    for (int i = 0; i < updates; i++) {
+        fakeReading(&reading, sensorFor(i, sensors), i);
+        SensorState *state = table.find(reading.sensor_id);
+        state->latest = reading;
+        state->last_seen_ms = reading.timestamp_ms;
+        state->received++;
+        table.record(state, reading);
+        check += state->history_count;
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("SensorTable    %6u sensors: %6.1f ns/reading, %zu allocations (check %llu)\n", sensors,
+           elapsed * 1e9 / updates, allocations - allocations_before, (unsigned long long) check);
+}
+
+// The same state, with the history as a ring in each map entry
+static void benchMap(uint32_t sensors, uint32_t history, int updates) {
+    struct Entry {
+        SensorState state;
+        std::vector<Reading> ring;
+    };
+    std::unordered_map<uint32_t, Entry> map;
+    Reading reading;
+    uint64_t check = 0;
+
+    for (uint32_t i = 0; i < sensors; i++) {
+        Entry &entry = map[SENSOR_ID_BASE + i];
+        entry.ring.resize(history);
+    }
+
+    size_t allocations_before = allocations;
+    double start = nowSeconds();
+    for (int i = 0; i < updates; i++) {
+        fakeReading(&reading, sensorFor(i, sensors), i);
+        Entry &entry = map[reading.sensor_id];
+        SensorState &state = entry.state;
+        state.latest = reading;
+        state.last_seen_ms = reading.timestamp_ms;
+        state.received++;
+        if (history > 0) {
+            entry.ring[(state.history_head + state.history_count) % history] = reading;
+            if (state.history_count < history) {
+                state.history_count++;
+            } else {
+                state.history_head = (state.history_head + 1) % history;
+            }
+        }
+        check += state.history_count;
+    }
+    double elapsed = nowSeconds() - start;
+
+    printf("unordered_map  %6u sensors: %6.1f ns/reading, %zu allocations (check %llu)\n", sensors,
+           elapsed * 1e9 / updates, allocations - allocations_before, (unsigned long long) check);
+}
+
+int main(int argc, char **argv) {
+    static const uint32_t fleets[] = {100, 1000, 10000};
+    int updates = 10000000;
+    uint32_t history = SENSOR_HISTORY;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:R:")) != -1) {
+        switch (opt) {
+            case 'n':
+                updates = atoi(optarg);
+                break;
+            case 'R':
+                history = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-n updates] [-R history]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(fleets) / sizeof(fleets[0]); i++) {
+        benchTable(fleets[i], history, updates);
+        benchMap(fleets[i], history, updates);
+    }
+    return 0;
+}
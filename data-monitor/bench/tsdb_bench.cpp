@@ -0,0 +1,195 @@
+/**
+ * The collector's own time series store against a year of simulated readings: ingest
+ * rate through the sink interface, bytes per point before and after compaction, range
+ * scan speed, and reopening (which rebuilds the index).  Every point read back is checked
+ * against what was written.
+ *
+ * Usage: tsdb_bench [-s sensors] [-y days] [-i interval_s] [-b flush_batch] [-d dir]
+ */
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <string>
+#include <unistd.h>
+#include <vector>
+#include "../Tsdb.h"
+
+#define SENSOR_ID_BASE 0x5e000000u
+#define START_MS 1500000000000ull
+#define DAY_MS (24 * 3600 * 1000ull)
+
+// What InfluxDB's line protocol and the spool take per reading, for comparison
+#define LINE_PROTOCOL_BYTES 135
+#define SPOOL_RECORD_BYTES 56
+
+static double nowSeconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Readings as a sensor takes them: a few ms of jitter in the wake up, soil drying out
+// between waterings, a daily temperature swing and a battery slowly running down
+static void simulate(Reading *reading, uint32_t sensor, uint64_t i, uint64_t interval_ms) {
+    uint32_t noise = (uint32_t) ((i * 2654435761u) ^ (sensor * 40503u));
+    double day = (double) (i * interval_ms % DAY_MS) / DAY_MS;
+
+    reading->timestamp_ms = START_MS + i * interval_ms + noise % 40;
+    reading->sensor_id = SENSOR_ID_BASE + sensor;
+    reading->cycles = (uint16_t) i;
+    reading->retries = noise % 50 == 0 ? 1 : 0;
+    reading->flags = 0;
+    reading->vcc = 4200 - (uint32_t) (i * interval_ms / (DAY_MS / 2)) % 900;
+    reading->moisture = 800 - (uint32_t) (i % 2000) / 5 + noise % 3;
+    reading->temperature = 15 + (int32_t) lround(6 * sin(2 * M_PI * day)) + sensor % 4;
+    reading->lost = reading->duplicates = reading->gaps = 0;
+    reading->loss_pct = reading->dup_pct = 0;
+}
+
+static bool same(const Reading &a, const Reading &b) {
+    return a.timestamp_ms == b.timestamp_ms && a.sensor_id == b.sensor_id && a.cycles == b.cycles &&
+           a.retries == b.retries && a.flags == b.flags && a.vcc == b.vcc && a.moisture == b.moisture &&
+           a.temperature == b.temperature;
+}
+
+static uint64_t verify(Tsdb *tsdb, uint32_t sensors, uint64_t points, uint64_t interval_ms) {
+    std::vector<Reading> readings;
+    Reading expected;
+    uint64_t bad = 0;
+
+    for (uint32_t s = 0; s < sensors; s++) {
+        readings.clear();
+        tsdb->scan(SENSOR_ID_BASE + s, 0, UINT64_MAX, &readings);
+        if (readings.size() != points) {
+            bad += points > readings.size() ? points - readings.size() : readings.size() - points;
+        }
+        for (size_t i = 0; i < readings.size() && i < points; i++) {
+            simulate(&expected, s, i, interval_ms);
+            bad += same(readings[i], expected) ? 0 : 1;
+        }
+    }
+    return bad;
+}
+
+int main(int argc, char **argv) {
+    uint32_t sensors = 100;
+    int days = 365;
+    int interval_s = 300;
+    int batch = 5000;
+    std::string dir = "/tmp/tsdb_bench";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:y:i:b:d:")) != -1) {
+        switch (opt) {
+            case 's':
+                sensors = atoi(optarg);
+                break;
+            case 'y':
+                days = atoi(optarg);
+                break;
+            case 'i':
+                interval_s = atoi(optarg);
+                break;
+            case 'b':
+                batch = atoi(optarg);
+                break;
+            case 'd':
+                dir = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-s sensors] [-y days] [-i interval_s] [-b flush_batch] [-d dir]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        return 1;
+    }
+
+    uint64_t interval_ms = interval_s * 1000ull;
+    uint64_t per_sensor = days * DAY_MS / interval_ms;
+    uint64_t total = per_sensor * sensors;
+    Reading reading;
+
+    printf("%u sensors, %d days every %ds: %llu points, flushed %d at a time\n", sensors, days, interval_s,
+           (unsigned long long) total, batch);
+
+    {
+        Tsdb tsdb(dir.c_str());
+        if (!tsdb.open()) {
+            return 1;
+        }
+
+        // Readings arrive interleaved across sensors, as they do at the collector
+        double start = nowSeconds();
+        int added = 0;
+        for (uint64_t i = 0; i < per_sensor; i++) {
+            for (uint32_t s = 0; s < sensors; s++) {
+                simulate(&reading, s, i, interval_ms);
+                tsdb.add(reading);
+                if (++added == batch) {
+                    if (!tsdb.flush()) {
+                        printf("flush failed\n");
+                        return 1;
+                    }
+                    added = 0;
+                }
+            }
+        }
+        tsdb.flush();
+        double elapsed = nowSeconds() - start;
+        uint64_t appended = tsdb.bytes();
+        printf("ingest:  %.2fs, %.0f points/s, %.2f bytes/point on disk (spool %d, line protocol ~%d)\n",
+               elapsed, total / elapsed, (double) appended / total, SPOOL_RECORD_BYTES, LINE_PROTOCOL_BYTES);
+
+        start = nowSeconds();
+        tsdb.compact();
+        elapsed = nowSeconds() - start;
+        printf("compact: %.2fs, %.2f bytes/point, %.1f MB in all\n", elapsed, (double) tsdb.bytes() / total,
+               tsdb.bytes() / 1e6);
+
+        // A year of one sensor, a day of one sensor, and every sensor's year
+        std::vector<Reading> readings;
+        int rounds = 20;
+        start = nowSeconds();
+        for (int r = 0; r < rounds; r++) {
+            readings.clear();
+            tsdb.scan(SENSOR_ID_BASE + r % sensors, 0, UINT64_MAX, &readings);
+        }
+        elapsed = nowSeconds() - start;
+        printf("scan:    one sensor's %zu points in %.2fms (%.1fM points/s)\n", readings.size(),
+               elapsed * 1e3 / rounds, readings.size() * rounds / elapsed / 1e6);
+
+        rounds = 10000;
+        uint64_t found = 0;
+        start = nowSeconds();
+        for (int r = 0; r < rounds; r++) {
+            uint64_t from = START_MS + (uint64_t) (r * 7919 % days) * DAY_MS;
+            readings.clear();
+            found += tsdb.scan(SENSOR_ID_BASE + r % sensors, from, from + DAY_MS - 1, &readings);
+        }
+        elapsed = nowSeconds() - start;
+        printf("scan:    one sensor's day (%llu points) in %.1fus\n", (unsigned long long) found / rounds,
+               elapsed * 1e6 / rounds);
+
+        start = nowSeconds();
+        uint64_t bad = verify(&tsdb, sensors, per_sensor, interval_ms);
+        elapsed = nowSeconds() - start;
+        printf("scan:    every sensor's year in %.2fs (%.1fM points/s), %llu points wrong\n", elapsed,
+               total / elapsed / 1e6, (unsigned long long) bad);
+    }
+
+    double start = nowSeconds();
+    Tsdb reopened(dir.c_str());
+    if (!reopened.open()) {
+        return 1;
+    }
+    double elapsed = nowSeconds() - start;
+    uint64_t bad = verify(&reopened, sensors, per_sensor, interval_ms);
+    printf("reopen:  %.1fms, %llu points, %llu wrong\n", elapsed * 1e3, (unsigned long long) reopened.points(),
+           (unsigned long long) bad);
+
+    return bad == 0 ? 0 : 1;
+}
@@ -2,32 +2,64 @@
  * Moisture monitor
  */
 
+#include <algorithm>
+#include <atomic>
 #include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <mutex>
 #include <sstream>
 #include <string>
+#include <thread>
 #include <unistd.h>
-#include "RF24/RF24.h"
+#include <vector>
+#include "Capture.h"
+#include "Clock.h"
+#include "FileWriter.h"
+#include "Frame.h"
+#include "InfluxWriter.h"
+#include "Metrics.h"
+#include "MqttWriter.h"
+#include "QueryServer.h"
+#include "Radio.h"
+#include "Reading.h"
+#include "ReplayRadio.h"
+#include "ReportTracker.h"
+#include "RollupEngine.h"
+#include "SensorTable.h"
+#include "Sink.h"
+#include "SinkWorker.h"
+#include "SlotScheduler.h"
+#include "SpscQueue.h"
+#include "Spool.h"
+#include "Tsdb.h"
+
+#ifdef RADIO_SIM
+#include "SimRadio.h"
+#else
+#include "RF24Radio.h"
+#endif
 
 using namespace std;
 
 #define SELF_RADIO_ADDR (uint8_t *) "3Node"
 #define REMOTE_RADIO_ADDR (uint8_t *) "4Node"
 
+// Sensors find us on pipe 1, and legacy sensors stay there.  Compact frame sensors are
+// assigned one of pipes 2-5, whose addresses can only differ from pipe 1's in the first
+// byte.  Pipe 0 is left for receiving ACKs to our replies.
+#define FIRST_PIPE 1
+#define FIRST_ASSIGNED_PIPE 2
+#define LAST_PIPE 5
+static const uint8_t pipe_addr_first_byte[LAST_PIPE + 1] = {0, '3', '5', '6', '7', '8'};
+
 // Our (the collector) ID
 #define SELF_ID 0x8080l
 
 #define COMMAND_STATUS 0x01
 #define COMMAND_FIND_COLLECTOR 0x02
-
-#define IDX_CMD 0
-#define IDX_SENSOR_ID 1
-#define IDX_COLLECTOR_ID 2
-#define IDX_MESG_CNTR 3
-#define IDX_RETRY_CNTR 4
-#define IDX_DATA_1 5
-#define IDX_DATA_2 6
-#define IDX_DATA_3 7
+#define COMMAND_BATCH 0x03
 
 #define RESPONSE_SUCCESS 1
 #define RESPONSE_FAIL 0
@@ -38,163 +70,1185 @@ using namespace std;
 #define INFLUX_PORT 8086
 #define INFLUX_DB_NAME "plants"
 
-// Time in milliseconds to sleep between checking the radio
+// Every reading is written here first, then handed to each sink.  Sinks that spill keep
+// their own spool in a directory named after them under this one.
+#define SPOOL_DIR "/var/lib/plant-monitor/spool"
+
+// Most spooled readings offered to each sink in one go
+#define REPLAY_BATCH 5000
+
+// The spool's cursor, which is synced to disk, is moved on past readings every sink is
+// done with once there are a batch of them or this long has passed
+#define SPOOL_COMMIT_MS 1000
+
+// Sink used when none are given on the command line
+#define DEFAULT_SINK "influx"
+
+// GPIO (BCM numbering) wired to the nRF24's IRQ pin, or -1 if it isn't connected.
+// Can be overridden with -i on the command line.
+#define RADIO_IRQ_GPIO -1
+
+// Safety net in case an IRQ is ever missed: check the radio at least this often
+#define RADIO_IRQ_TIMEOUT_MS 1000
+
+// Without an IRQ pin the radio is polled, starting at the min delay (in milliseconds)
+// after a packet and backing off to the max while nothing arrives
+#define RADIO_CHECK_MIN_DELAY 1
 #define RADIO_CHECK_DELAY 100
 
-/****************** Raspberry Pi ***********************/
+// Sensors only report readings that changed, and a heartbeat.  In between, their last reading
+// is filled forward at this interval (0 turns it off), up to a limit per gap.  Can be
+// overridden with -F on the command line, in seconds.
+#define FILL_FORWARD_INTERVAL_MS 300000
+#define FILL_FORWARD_MAX 288
 
-// Radio CE Pin, CSN Pin, SPI Speed
-// See http://www.airspayce.com/mikem/bcm2835/group__constants.html#ga63c029bd6500167152db4e57736d0939
-// and the related enumerations for pin information.
-//
-// Setup for GPIO 22 CE and CE0 CSN with SPI Speed @ 4Mhz
-RF24 radio(RPI_V2_GPIO_P1_15, BCM2835_SPI_CS0, BCM2835_SPI_SPEED_4MHZ);
+// A sensor that hasn't reported for this long has missed its heartbeat and is taken to be
+// missing rather than unchanged.  Can be overridden with -T on the command line, in seconds.
+#define HEARTBEAT_TIMEOUT_MS 3600000
+
+// Readings waiting between the radio thread and the writer thread.  Must be a power of two.
+#define READING_QUEUE_SIZE 1024
+
+// Time in milliseconds the writer sleeps when there is nothing to write
+#define WRITER_IDLE_DELAY 10
+
+// How often the writer logs the queue stats
+#define QUEUE_STATS_INTERVAL_MS 60000
+
+// How long a sensor listens for our reply before it gives up and sends again (MESSAGE_ACK_TTL
+// in the sensor sketch).  Reply latency is measured against it.
+#define SENSOR_ACK_TTL_US 250000
+
+// With -a, replies to frames on the assigned pipes are queued ahead of time as ACK payloads,
+// so the sensor gets its answer in the ACK to its own frame.  The TX FIFO holds this many,
+// so with more assigned pipes than that they take turns.
+#define ACK_PAYLOAD_SLOTS 3
+
+// Queued replies carry our time, so they're replaced once they've waited this long
+#define ACK_PAYLOAD_REFRESH_MS 5000
 
-/********************************/
+// Compact frame sensors are given report slots spread over this period, so they take
+// turns on the air (see SlotScheduler).  0 leaves them to their own schedules.  Can be
+// overridden with -s on the command line, in seconds.
+#define SLOT_PERIOD_MS 0
+
+// Set up in main(), either the real radio or the simulated one depending on the build
+Radio *radio = NULL;
 
 int getSelfID(void) {
     return SELF_ID;
 }
 
+// Defaults from the defines above, can be overridden on the command line
+const char *influx_host = INFLUX_HOST;
+int influx_port = INFLUX_PORT;
+const char *influx_db_name = INFLUX_DB_NAME;
+const char *spool_dir = SPOOL_DIR;
+// Where readings go, as given with -o (see addSink())
+std::vector<std::string> sink_specs;
+uint32_t fill_interval_ms = FILL_FORWARD_INTERVAL_MS;
+uint32_t heartbeat_timeout_ms = HEARTBEAT_TIMEOUT_MS;
+uint32_t sensor_capacity = SENSOR_TABLE_CAPACITY;
+uint32_t sensor_history = SENSOR_HISTORY;
+int query_port = QUERY_PORT;
+// Every frame received is appended to this capture file
+const char *capture_path = NULL;
+// Frames come from this capture file instead of the radio, at this multiple of the speed
+// they were captured at (0 for as fast as they can be handled)
+const char *replay_path = NULL;
+double replay_speed = 1.0;
+// Reply in ACK payloads.  Every compact frame sensor needs firmware that reads them, as a
+// frame that took one isn't replied to again.
+bool ack_payloads = false;
+uint32_t slot_period_ms = SLOT_PERIOD_MS;
+
 const char* getInfluxHost(void) {
-    return INFLUX_HOST;
+    return influx_host;
 }
 
 int getInfluxPort(void) {
-    return INFLUX_PORT;
+    return influx_port;
 }
 
 const char* getInfluxDBName(void) {
-    return INFLUX_DB_NAME;
+    return influx_db_name;
+}
+
+// Set up in main() once the command line has been read
+std::vector<SinkWorker *> sinks;
+Spool *spool = NULL;
+SensorTable *sensors = NULL;
+ReportTracker *tracker = NULL;
+RollupEngine *rollups = NULL;
+QueryServer *query = NULL;
+CaptureWriter *capture = NULL;
+SlotScheduler *slots = NULL;
+
+// The writer thread updates the sensor table, the query server reads it
+std::mutex sensors_lock;
+
+// The radio thread only decodes and replies; readings are handed over here and the
+// writer thread does the (possibly slow) sink writes
+SpscQueue<Reading, READING_QUEUE_SIZE> reading_queue;
+
+// Set once a replayed capture has run out, and by the writer once everything from it has
+// been written to the sinks
+std::atomic<bool> draining(false);
+std::atomic<bool> drained(false);
+
+// Pipe each sensor has been assigned, how many sensors are on each and the first sensor
+// given each, which is the only one while the count is 1
+std::map<uint32_t, uint8_t> sensor_pipes;
+uint32_t pipe_sensor_count[LAST_PIPE + 1];
+uint32_t pipe_first_sensor[LAST_PIPE + 1];
+
+// Address replies currently go to
+uint8_t reply_address[FRAME_ADDR_LEN];
+
+// Pipes with a reply queued as an ACK payload, and when the first of them was queued.
+// Only used on the radio thread.
+bool ack_loaded[LAST_PIPE + 1];
+// Sensor each queued reply is for, or FRAME_REPLY_ANY_SENSOR, and the slot delay it
+// carries, or 0
+uint32_t ack_loaded_for[LAST_PIPE + 1];
+uint32_t ack_loaded_delay[LAST_PIPE + 1];
+uint8_t ack_loaded_count = 0;
+uint64_t ack_loaded_ms = 0;
+// Next pipe to get a reply queued
+uint8_t ack_next_pipe = FIRST_ASSIGNED_PIPE;
+// A sensor that has drifted from its slot needs a full reply to put it right, so no reply
+// is queued on its pipe until it has had one, or until the hold runs out
+uint32_t ack_held_for[LAST_PIPE + 1];
+uint64_t ack_held_until_ms[LAST_PIPE + 1];
+
+// Readings dropped because the writer had fallen too far behind
+std::atomic<uint64_t> reading_queue_overflows(0);
+// Most readings seen waiting in the queue at once
+std::atomic<size_t> reading_queue_max_depth(0);
+
+size_t getQueueDepth(void) {
+    return reading_queue.depth();
+}
+
+uint64_t getQueueOverflows(void) {
+    return reading_queue_overflows.load(std::memory_order_relaxed);
+}
+
+size_t getQueueMaxDepth(void) {
+    return reading_queue_max_depth.load(std::memory_order_relaxed);
+}
+
+// Metrics, served on /metrics by the query server
+static const uint32_t reply_latency_bounds_us[] = {100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000,
+                                                   100000, 150000, 200000, SENSOR_ACK_TTL_US};
+Counter packets_received;
+Counter malformed_packets;
+Counter find_collector_commands;
+Counter status_commands;
+Counter batch_commands;
+Counter foreign_collector_skips;
+Counter duplicate_reports;
+Counter sensor_restarts;
+Counter rollups_emitted;
+Counter ack_payload_replies;
+Counter ack_payload_misfires;
+Counter slot_misses;
+Gauge spooled_readings;
+// From reading the frame off the radio to the reply going out
+Histogram reply_latency(reply_latency_bounds_us, sizeof(reply_latency_bounds_us) / sizeof(reply_latency_bounds_us[0]));
+
+// When the frame being handled came off the radio, the pipe it came in on, whether it
+// took a reply from its ACK payload and the slot delay that reply carried.  Only used on
+// the radio thread.
+uint64_t frame_read_us = 0;
+uint8_t frame_pipe = 0;
+bool frame_ack_replied = false;
+uint32_t frame_ack_delay = 0;
+
+void renderMetrics(std::string *out) {
+    metricsCounter(out, "collector_packets_received_total", "Frames read from the radio", packets_received.value());
+    metricsCounter(out, "collector_malformed_packets_total", "Frames that could not be decoded", malformed_packets.value());
+    metricsCounter(out, "collector_commands_total", "Commands handled, by command", "command=\"find_collector\"",
+                   find_collector_commands.value());
+    metricsCounter(out, "collector_commands_total", NULL, "command=\"status\"", status_commands.value());
+    metricsCounter(out, "collector_commands_total", NULL, "command=\"batch\"", batch_commands.value());
+    metricsCounter(out, "collector_foreign_collector_skips_total", "Frames skipped as they were for another collector",
+                   foreign_collector_skips.value());
+    metricsCounter(out, "collector_duplicates_total", "Retransmitted reports dropped", duplicate_reports.value());
+    metricsCounter(out, "collector_sensor_restarts_total", "Sensors seen starting again", sensor_restarts.value());
+    metricsCounter(out, "collector_rollups_total", "Rollup windows closed", rollups_emitted.value());
+    metricsGauge(out, "collector_queue_depth", "Readings waiting for the writer thread", getQueueDepth());
+    metricsGauge(out, "collector_queue_max_depth", "Most readings seen waiting for the writer thread", getQueueMaxDepth());
+    metricsCounter(out, "collector_queue_overflows_total", "Readings dropped as the writer thread was behind",
+                   getQueueOverflows());
+    metricsGauge(out, "collector_spooled_readings", "Readings spooled, waiting for the sinks to be done with them",
+                 spooled_readings.value());
+    reply_latency.render(out, "collector_reply_latency_seconds", "Time from reading a frame off the radio to replying");
+    metricsCounter(out, "collector_ack_payload_replies_total", "Replies that went out in an ACK payload",
+                   ack_payload_replies.value());
+    metricsCounter(out, "collector_ack_payload_misfires_total",
+                   "ACK payload replies taken by frames that could not be handled", ack_payload_misfires.value());
+    if (slots != NULL) {
+        metricsGauge(out, "collector_slot_sensors", "Sensors with a report slot", slots->size());
+        metricsCounter(out, "collector_slot_rebalances_total", "Times the slots were spaced out again",
+                       slots->rebalances());
+        metricsCounter(out, "collector_slot_misses_total", "Frames that turned up away from their sensor's slot",
+                       slot_misses.value());
+    }
+
+    // Each family has a series per sink, which have to follow on from one header
+    char label[128];
+    for (size_t i = 0; i < sinks.size(); i++) {
+        const char *name = sinks[i]->name().c_str();
+        snprintf(label, sizeof(label), "sink=\"%s\",result=\"ok\"", name);
+        metricsCounter(out, "collector_sink_writes_total", i == 0 ? "Batches written to each sink, by result" : NULL,
+                       label, sinks[i]->writes_ok.value());
+        snprintf(label, sizeof(label), "sink=\"%s\",result=\"failed\"", name);
+        metricsCounter(out, "collector_sink_writes_total", NULL, label, sinks[i]->writes_failed.value());
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i]->name().c_str());
+        metricsCounter(out, "collector_sink_readings_total", i == 0 ? "Readings written to each sink" : NULL, label,
+                       sinks[i]->readings.value());
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i]->name().c_str());
+        metricsCounter(out, "collector_sink_rollups_total", i == 0 ? "Rollup windows written to each sink" : NULL,
+                       label, sinks[i]->rollups.value());
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i]->name().c_str());
+        metricsCounter(out, "collector_sink_dropped_total",
+                       i == 0 ? "Readings dropped as a sink's queue was full" : NULL, label, sinks[i]->dropped.value());
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i]->name().c_str());
+        metricsCounter(out, "collector_sink_rollups_dropped_total",
+                       i == 0 ? "Rollup windows dropped while a sink was unreachable" : NULL, label,
+                       sinks[i]->rollups_dropped.value());
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i]->name().c_str());
+        metricsGauge(out, "collector_sink_queue_depth", i == 0 ? "Readings queued in memory for each sink" : NULL,
+                     label, sinks[i]->queued());
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i]->name().c_str());
+        metricsGauge(out, "collector_sink_spilled_readings", i == 0 ? "Readings spilled to disk for each sink" : NULL,
+                     label, sinks[i]->spilled());
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i]->name().c_str());
+        metricsGauge(out, "collector_sink_lag_seconds",
+                     i == 0 ? "How long the oldest reading waiting for each sink has waited" : NULL, label,
+                     sinks[i]->lagMillis() / 1000.0);
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        snprintf(label, sizeof(label), "sink=\"%s\"", sinks[i]->name().c_str());
+        sinks[i]->latency.render(out, "collector_sink_write_latency_seconds",
+                                 i == 0 ? "Time taken by each write to each sink" : NULL, label);
+    }
+}
+
+void clearAckPayloads(void) {
+    memset(ack_loaded, 0, sizeof(ack_loaded));
+    ack_loaded_count = 0;
+}
+
+// Queue a success reply for the next frame on each assigned pipe that doesn't have one
+// waiting, as far as the TX FIFO goes.  A pipe with a single sensor on it gets that
+// sensor's own reply, with its slot when it has been told one, worked out from when it's
+// due.  Replies that have waited too long are flushed and queued again with the current
+// time.
+void loadAckPayloads(void) {
+    uint32_t response[FRAME_REPLY_WORDS];
+    uint64_t now = monotonicMillis();
+
+    if (ack_loaded_count > 0 && now - ack_loaded_ms >= ACK_PAYLOAD_REFRESH_MS) {
+        radio->flush_tx();
+        clearAckPayloads();
+    }
+
+    uint64_t wall_now = wallClockMillis();
+    response[FRAME_REPLY_IDX_VALUE] = RESPONSE_SUCCESS;
+    response[FRAME_REPLY_IDX_TIME] = wall_now / 1000;
+    response[FRAME_REPLY_IDX_PIPE_ADDR] = 0;
+    response[FRAME_REPLY_IDX_COLLECTOR_ID] = SELF_ID;
+
+    for (uint8_t i = FIRST_ASSIGNED_PIPE; i <= LAST_PIPE && ack_loaded_count < ACK_PAYLOAD_SLOTS; i++) {
+        uint8_t pipe = ack_next_pipe;
+        ack_next_pipe = pipe == LAST_PIPE ? FIRST_ASSIGNED_PIPE : pipe + 1;
+        if (ack_loaded[pipe] || (ack_held_for[pipe] != 0 && now < ack_held_until_ms[pipe])) {
+            continue;
+        }
+
+        uint32_t sensor_id = pipe_sensor_count[pipe] == 1 ? pipe_first_sensor[pipe] : FRAME_REPLY_ANY_SENSOR;
+        uint64_t due = sensor_id != FRAME_REPLY_ANY_SENSOR && slots != NULL ? slots->due(sensor_id) : 0;
+        response[FRAME_REPLY_IDX_SENSOR_ID] = sensor_id;
+        response[FRAME_REPLY_IDX_SLOT_DELAY] = due != 0 ? slots->plan(sensor_id, std::max(due, wall_now)) : 0;
+        response[FRAME_REPLY_IDX_SLOT_INTERVAL] = due != 0 ? slots->period() : 0;
+        if (!radio->writeAckPayload(pipe, response, sizeof(response))) {
+            break;
+        }
+        if (ack_loaded_count == 0) {
+            ack_loaded_ms = now;
+        }
+        ack_loaded[pipe] = true;
+        ack_loaded_for[pipe] = sensor_id;
+        ack_loaded_delay[pipe] = response[FRAME_REPLY_IDX_SLOT_DELAY];
+        ack_loaded_count++;
+    }
+}
+
+// Send the response words (the first being the sensor id) to the sensor the frame came from
+void sendReply(const Frame &frame, const uint32_t *response, uint8_t len) {
+    uint32_t padded[FRAME_MAX_LEN / sizeof(uint32_t)] = {0};
+    uint8_t address[FRAME_ADDR_LEN];
+
+    // The sensor already has its reply, from the ACK to its frame
+    if (frame_ack_replied) {
+        ack_payload_replies.add();
+        return;
+    }
+
+    // Legacy sensors all listen on the same address, with a static 32 byte payload
+    // width, so their replies have to be padded out to match or their radio won't
+    // receive them.  Everyone else has their own address.
+    if (frame.version == FRAME_VERSION_LEGACY) {
+        memcpy(address, REMOTE_RADIO_ADDR, FRAME_ADDR_LEN);
+        memcpy(padded, response, FRAME_REPLY_LEN);
+        response = padded;
+        len = FRAME_MAX_LEN;
+    } else {
+        frameSensorAddress(frame.sensor_id, address);
+    }
+
+    radio->stopListening();
+    if (memcmp(address, reply_address, FRAME_ADDR_LEN) != 0) {
+        radio->openWritingPipe(address);
+        memcpy(reply_address, address, FRAME_ADDR_LEN);
+    }
+    radio->write(response, len);
+    radio->startListening();
+
+    // Stopping listening flushed any replies queued as ACK payloads
+    if (ack_payloads) {
+        clearAckPayloads();
+        if (frame_pipe <= LAST_PIPE && ack_held_for[frame_pipe] == frame.sensor_id) {
+            ack_held_for[frame_pipe] = 0;
+        }
+    }
+
+    reply_latency.observe(monotonicMicros() - frame_read_us);
 }
 
-void reply(uint32_t sensor_id, uint32_t value) {
-    uint32_t response[2] = {sensor_id, value};
+// With slots handed out, note how close to its slot the sensor's frame was and tell it
+// when to report next.  Returns the length of the reply, which is len without slots.
+uint8_t addSlot(const Frame &frame, uint32_t *response, uint8_t len) {
+    if (slots == NULL || frame.version == FRAME_VERSION_LEGACY) {
+        return len;
+    }
+
+    uint64_t now = wallClockMillis();
+    if ((uint32_t) abs(slots->arrived(frame.sensor_id, now)) > slots->tolerance()) {
+        slot_misses.add();
 
-    radio.stopListening();
-    radio.write(response, sizeof(response));
-    radio.startListening();
+        // An ACK payload can't move it back to its slot
+        if (frame_ack_replied && frame_pipe <= LAST_PIPE) {
+            ack_held_for[frame_pipe] = frame.sensor_id;
+            ack_held_until_ms[frame_pipe] = monotonicMillis() + 2 * slot_period_ms;
+        }
+    }
+    if (frame_ack_replied) {
+        if (frame_ack_delay != 0) {
+            slots->told(frame.sensor_id, now, frame_ack_delay);
+        }
+        return len;
+    }
+
+    if (len <= FRAME_REPLY_IDX_PIPE_ADDR * sizeof(uint32_t)) {
+        response[FRAME_REPLY_IDX_PIPE_ADDR] = 0;
+    }
+    response[FRAME_REPLY_IDX_SLOT_DELAY] = slots->delay(frame.sensor_id, now);
+    response[FRAME_REPLY_IDX_SLOT_INTERVAL] = slots->period();
+    return (FRAME_REPLY_IDX_SLOT_INTERVAL + 1) * sizeof(uint32_t);
+}
+
+// Compact frame sensors set their clock from the time in every reply
+void reply(const Frame &frame, uint32_t value) {
+    uint32_t response[FRAME_REPLY_WORDS];
+
+    response[FRAME_REPLY_IDX_SENSOR_ID] = frame.sensor_id;
+    response[FRAME_REPLY_IDX_VALUE] = value;
+    response[FRAME_REPLY_IDX_TIME] = wallClockMillis() / 1000;
+    sendReply(frame, response, addSlot(frame, response, (FRAME_REPLY_IDX_TIME + 1) * sizeof(uint32_t)));
 }
 
-void handleFindCollectorCommand(uint32_t *payload) {
-    uint32_t id = payload[IDX_SENSOR_ID];
+// A frame that took an ACK payload but couldn't be handled was told it succeeded.  Where
+// the sensor is known it's sent a failure after it, to retry if it's still listening.
+// The sensor isn't given a slot: it may not even be ours.
+void misfire(uint32_t sensor_id) {
+    Frame frame;
+    uint32_t response[FRAME_REPLY_IDX_TIME + 1];
 
-    printf("Handling command 'find collector' for sensor id %08x\n", id);
+    ack_payload_misfires.add();
+    frame_ack_replied = false;
+    if (sensor_id == FRAME_REPLY_ANY_SENSOR) {
+        return;
+    }
 
-    reply(id, getSelfID());
+    memset(&frame, 0, sizeof(frame));
+    frame.version = FRAME_VERSION_COMPACT;
+    frame.sensor_id = sensor_id;
+    response[FRAME_REPLY_IDX_SENSOR_ID] = sensor_id;
+    response[FRAME_REPLY_IDX_VALUE] = RESPONSE_FAIL;
+    response[FRAME_REPLY_IDX_TIME] = wallClockMillis() / 1000;
+    sendReply(frame, response, sizeof(response));
 }
 
-void handleStatusCommand(uint32_t *payload) {
-    uint32_t id, cycles, retries, vcc, moisture, temperature;
+// Hand a reading over to the writer thread
+void queueReading(const Reading &reading) {
+    if (!reading_queue.push(reading)) {
+        reading_queue_overflows.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    size_t depth = reading_queue.depth();
+    if (depth > reading_queue_max_depth.load(std::memory_order_relaxed)) {
+        reading_queue_max_depth.store(depth, std::memory_order_relaxed);
+    }
+}
+
+// A replay at full speed would outrun the writer and overflow the queue, where a real
+// radio would have left the sensors retrying.  It's held back instead, so every run of a
+// capture comes out the same.
+bool holdingBack(void) {
+    return replay_path != NULL && reading_queue.depth() >= READING_QUEUE_SIZE / 2;
+}
+
+// The sensor keeps the pipe it was given last time, otherwise it gets the one with the
+// fewest sensors on it
+uint8_t assignPipe(uint32_t sensor_id) {
+    std::map<uint32_t, uint8_t>::iterator it = sensor_pipes.find(sensor_id);
+    if (it != sensor_pipes.end()) {
+        return it->second;
+    }
+
+    uint8_t pipe = FIRST_ASSIGNED_PIPE;
+    for (uint8_t p = FIRST_ASSIGNED_PIPE + 1; p <= LAST_PIPE; p++) {
+        if (pipe_sensor_count[p] < pipe_sensor_count[pipe]) {
+            pipe = p;
+        }
+    }
+
+    sensor_pipes[sensor_id] = pipe;
+    if (pipe_sensor_count[pipe]++ == 0) {
+        pipe_first_sensor[pipe] = sensor_id;
+    }
+    return pipe;
+}
+
+void handleFindCollectorCommand(const Frame &frame) {
+    uint32_t response[FRAME_REPLY_WORDS];
+
+    find_collector_commands.add();
+    printf("Handling command 'find collector' for sensor id %08x\n", frame.sensor_id);
+
+    if (frame.version == FRAME_VERSION_LEGACY) {
+        reply(frame, getSelfID());
+        return;
+    }
+
+    uint8_t pipe = assignPipe(frame.sensor_id);
+    printf("Assigned sensor id %08x to pipe %d\n", frame.sensor_id, pipe);
+
+    response[FRAME_REPLY_IDX_SENSOR_ID] = frame.sensor_id;
+    response[FRAME_REPLY_IDX_VALUE] = getSelfID();
+    response[FRAME_REPLY_IDX_TIME] = wallClockMillis() / 1000;
+    response[FRAME_REPLY_IDX_PIPE_ADDR] = pipe_addr_first_byte[pipe];
+    sendReply(frame, response, addSlot(frame, response, (FRAME_REPLY_IDX_PIPE_ADDR + 1) * sizeof(uint32_t)));
+}
+
+uint16_t readingFlags(uint8_t frame_flags) {
+    return (frame_flags & FRAME_FLAG_HEARTBEAT ? READING_HEARTBEAT : 0) | (frame_flags & FRAME_FLAG_BOOT ? READING_BOOT : 0);
+}
+
+void handleStatusCommand(const Frame &frame) {
+    Reading reading;
+
+    status_commands.add();
 
     // Success for the sensor just means we got the message.  Reply quickly so that
     // it can go back to sleep
-    id = payload[IDX_SENSOR_ID];
-    reply(id, RESPONSE_SUCCESS);
+    reply(frame, RESPONSE_SUCCESS);
+
+    reading.timestamp_ms = wallClockMillis();
+    reading.sensor_id = frame.sensor_id;
+    reading.cycles = frame.counter;
+    reading.retries = frame.retries;
+    reading.flags = readingFlags(frame.flags);
+    reading.vcc = frame.vcc;
+    reading.moisture = frame.moisture;
+    reading.temperature = frame.temperature;
+
+    queueReading(reading);
+}
+
+// Readings the sensor stored up, sent in a burst of frames.  Only the last frame of the
+// burst gets a reply.
+void handleBatchCommand(const Frame &frame, const uint8_t *payload, uint8_t len) {
+    FrameBatch batch;
+    Reading reading;
+    Frame unpacked;
+
+    batch_commands.add();
+    if (!frameDecodeBatch(payload, len, &batch)) {
+        malformed_packets.add();
+        printf("Skipping malformed %d byte batch frame\n", len);
+        if (frame_ack_replied) {
+            misfire(frame.sensor_id);
+        }
+        return;
+    }
+    if (!batch.more) {
+        reply(batch.frame, RESPONSE_SUCCESS);
+    }
+
+    // The sensor says how long ago its readings were taken, by its own (synced) clock
+    uint64_t now = wallClockMillis();
+    for (uint8_t i = 0; i < batch.count; i++) {
+        uint64_t age_ms = ((uint64_t) batch.age + (uint64_t) (batch.count - 1 - i) * batch.interval) * 1000;
+
+        frameUnpackReading(batch.readings[i], &unpacked);
+        reading.timestamp_ms = now - age_ms;
+        reading.sensor_id = batch.frame.sensor_id;
+        reading.cycles = (uint16_t) (batch.frame.counter + i);
+        reading.retries = batch.frame.retries;
+        reading.flags = readingFlags(unpacked.flags);
+        reading.vcc = unpacked.vcc;
+        reading.moisture = unpacked.moisture;
+        reading.temperature = unpacked.temperature;
+
+        queueReading(reading);
+    }
+}
 
-    cycles = payload[IDX_MESG_CNTR];
-    retries = payload[IDX_RETRY_CNTR];
-    vcc = payload[IDX_DATA_1];
-    moisture = payload[IDX_DATA_2];
-    temperature = payload[IDX_DATA_3];
+void queueRollups(const Rollup *closed, size_t count) {
+    if (count == 0) {
+        return;
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        sinks[i]->offerRollups(closed, count);
+    }
+    rollups_emitted.add(count);
+}
+
+// Add the reading to its sensor's rollups, queueing any windows it closes
+void rollUp(const Reading &reading) {
+    Rollup closed[ROLLUP_RESOLUTIONS];
+    queueRollups(closed, rollups->add(reading, closed));
+}
+
+// Offer each sink the spooled readings it hasn't had yet, then move the spool on past the
+// ones every sink is done with.  Returns true if a sink took a full batch, as there may
+// be more waiting.
+bool feedSinks(void) {
+    static Reading batch[REPLAY_BATCH];
+    static uint64_t last_commit = 0;
+    uint64_t position = spool->position();
+    uint64_t done = UINT64_MAX;
+    bool more = false;
+
+    for (size_t i = 0; i < sinks.size(); i++) {
+        SinkWorker *worker = sinks[i];
+        uint64_t from = std::max(worker->offered(), position);
+        size_t room = worker->room(REPLAY_BATCH);
+        size_t count = room > 0 ? spool->peekAt(from, batch, room) : 0;
+        if (count > 0 && worker->offer(from, batch, count) == REPLAY_BATCH) {
+            more = true;
+        }
+        done = std::min(done, std::max(worker->resolved(), position));
+    }
+
+    // Stepping over a damaged record moves the cursor on by itself
+    position = spool->position();
+    uint64_t now = monotonicMillis();
+    if (done != UINT64_MAX && done > position &&
+        (done - position >= REPLAY_BATCH || now - last_commit >= SPOOL_COMMIT_MS || draining.load())) {
+        spool->commit(done - position);
+        last_commit = now;
+    }
+    spooled_readings.set(spool->pending());
+    return more;
+}
 
-    printf("Status (%04x): r=%d, vcc=%4d, m=%3d, t=%2d\n", id, retries, vcc, moisture, temperature);
+// Drains the reading queue into the spool, and the spool into the sinks' queues.  Runs on
+// its own thread so nothing the sinks do ever holds up the radio.
+void writerLoop(void) {
+    uint64_t last_stats = monotonicMillis();
+    uint64_t last_capture_flush = last_stats;
+    static Reading filled[FILL_FORWARD_MAX];
+    Reading reading;
 
-    char base_cmd[255];
-    const char *base_tmpl = "curl -s -i -XPOST 'http://%s:%d/write?db=%s' --data-binary";
-    snprintf(base_cmd, 255, base_tmpl, getInfluxHost(), getInfluxPort(), getInfluxDBName());
+    while (1) {
+        bool idle = true;
 
-    char full_cmd[255];
-    const char *full_tmpl = "%s '%s,plant_id=%04x value=%d' >> /dev/null";
+        while (reading_queue.pop(&reading)) {
+            idle = false;
 
-    snprintf(full_cmd, 255, full_tmpl, base_cmd, "temperature", id, temperature);
-    //printf("%s\n", full_cmd);
-    system(full_cmd);
+            // The sensor sends the same report again when it misses our reply.  It has
+            // been replied to again, but is only written once.
+            size_t count;
+            bool tracked;
+            {
+                std::lock_guard<std::mutex> guard(sensors_lock);
+                uint64_t restarts = tracker->restarts();
+                tracked = tracker->track(&reading, filled, FILL_FORWARD_MAX, &count);
+                sensor_restarts.add(tracker->restarts() - restarts);
+                if (tracked) {
+                    for (size_t i = 0; i < count; i++) {
+                        rollUp(filled[i]);
+                    }
+                    rollUp(reading);
+                }
+            }
+            if (!tracked) {
+                duplicate_reports.add();
+                printf("Duplicate (%04x): counter %u, r=%d\n", reading.sensor_id, reading.cycles, reading.retries);
+                continue;
+            }
 
-    snprintf(full_cmd, 255, full_tmpl, base_cmd, "moisture", id, moisture);
-    //printf("%s\n", full_cmd);
-    system(full_cmd);
+            printf("Status (%04x): r=%d, vcc=%4d, m=%3d, t=%2d, loss=%d%%%s\n", reading.sensor_id, reading.retries,
+                   reading.vcc, reading.moisture, reading.temperature, reading.loss_pct,
+                   reading.flags & READING_HEARTBEAT ? " (heartbeat)" : "");
 
-    snprintf(full_cmd, 255, full_tmpl, base_cmd, "cycles", id, cycles);
-    //printf("%s\n", full_cmd);
-    system(full_cmd);
+            for (size_t i = 0; i < count; i++) {
+                if (!spool->append(filled[i])) {
+                    printf("Could not spool filled reading for %04x\n", reading.sensor_id);
+                }
+            }
+            if (!spool->append(reading)) {
+                printf("Could not spool reading from %04x\n", reading.sensor_id);
+            }
+        }
+        spool->sync();
 
-    snprintf(full_cmd, 255, full_tmpl, base_cmd, "battery", id, vcc);
-    //printf("%s\n", full_cmd);
-    system(full_cmd);
+        if (feedSinks()) {
+            idle = false;
+        }
 
-    snprintf(full_cmd, 255, full_tmpl, base_cmd, "retries", id, retries);
-    //printf("%s\n", full_cmd);
-    system(full_cmd);
+        uint64_t now = monotonicMillis();
+        if (capture != NULL && now - last_capture_flush >= CAPTURE_FLUSH_MS) {
+            capture->flush();
+            last_capture_flush = now;
+        }
+
+        // Nothing more is coming once a replay has run out, so it's done when the last of
+        // it is in the sinks
+        if (draining.load() && reading_queue.depth() == 0 && spool->pending() == 0) {
+            bool sinks_idle = true;
+            for (size_t i = 0; i < sinks.size(); i++) {
+                sinks_idle = sinks_idle && sinks[i]->idle();
+            }
+            drained.store(sinks_idle);
+        }
+
+        if (now - last_stats >= QUEUE_STATS_INTERVAL_MS) {
+            printf("Reading queue: depth=%zu, max depth=%zu, overflows=%llu, spooled=%llu\n", getQueueDepth(),
+                   getQueueMaxDepth(), (unsigned long long) getQueueOverflows(), (unsigned long long) spool->pending());
+            printf("Reports: filled forward=%llu, missing=%llu, duplicates=%llu, restarts=%llu\n",
+                   (unsigned long long) tracker->filled(), (unsigned long long) tracker->missing(),
+                   (unsigned long long) tracker->duplicates(), (unsigned long long) tracker->restarts());
+            printf("Rollups: closed=%llu, late readings=%llu\n", (unsigned long long) rollups->emitted(),
+                   (unsigned long long) rollups->late());
+            for (size_t i = 0; i < sinks.size(); i++) {
+                printf("Sink %s: written=%llu, queued=%zu, spilled=%llu, dropped=%llu, rollups dropped=%llu, lag=%llums\n",
+                       sinks[i]->name().c_str(), (unsigned long long) sinks[i]->readings.value(), sinks[i]->queued(),
+                       (unsigned long long) sinks[i]->spilled(), (unsigned long long) sinks[i]->dropped.value(),
+                       (unsigned long long) sinks[i]->rollups_dropped.value(),
+                       (unsigned long long) sinks[i]->lagMillis());
+            }
+            if (query != NULL) {
+                printf("Query server: requests=%llu\n", (unsigned long long) query->requests());
+            }
+            if (capture != NULL) {
+                printf("Capture: frames=%llu\n", (unsigned long long) capture->frames());
+            }
+            {
+                std::lock_guard<std::mutex> guard(sensors_lock);
+                tracker->checkSilent(wallClockMillis());
+
+                // Windows of sensors that have gone quiet are closed once they've missed
+                // their heartbeat, rather than waiting for them to come back
+                Rollup closed[64];
+                const size_t max = sizeof(closed) / sizeof(closed[0]);
+                size_t closed_count;
+                do {
+                    closed_count = rollups->closeIdle(wallClockMillis(), heartbeat_timeout_ms, closed, max);
+                    queueRollups(closed, closed_count);
+                } while (closed_count == max);
+            }
+            last_stats = now;
+        }
+
+        if (idle) {
+            usleep(WRITER_IDLE_DELAY * 1000);
+        }
+    }
 }
 
 int readCommand(void) {
-    unsigned long result = 0;
-    uint32_t payload[8];
+    uint8_t payload[FRAME_MAX_LEN];
+    uint8_t pipe = 0;
+    Frame frame;
 
-    while (radio.available()) {
-        radio.read(&payload, sizeof(payload));
+    while (!holdingBack() && radio->available(&pipe)) {
+        // Legacy sensors send fixed 32 byte frames, newer ones compact frames; the length tells them apart
+        uint8_t len = radio->getDynamicPayloadSize();
+        if (len > sizeof(payload)) {
+            len = sizeof(payload);
+        }
+        radio->read(payload, len);
+        uint64_t read_ns = monotonicNanos();
+        frame_read_us = read_ns / 1000;
+        packets_received.add();
+
+        // The frame took the reply queued for its pipe, if there was one
+        uint32_t ack_sensor = FRAME_REPLY_ANY_SENSOR;
+        frame_pipe = pipe;
+        frame_ack_replied = pipe <= LAST_PIPE && ack_loaded[pipe];
+        frame_ack_delay = 0;
+        if (frame_ack_replied) {
+            ack_loaded[pipe] = false;
+            ack_loaded_count--;
+            ack_sensor = ack_loaded_for[pipe];
+            frame_ack_delay = ack_loaded_delay[pipe];
+        }
+
+        if (capture != NULL) {
+            capture->append(read_ns, pipe, payload, len);
+        }
+
+        if (!frameDecode(payload, len, &frame)) {
+            malformed_packets.add();
+            printf("Skipping malformed %d byte frame\n", len);
+            if (frame_ack_replied) {
+                misfire(ack_sensor);
+            }
+            continue;
+        }
 
         // Ignore any message that wasn't meant for us, unless its to find a new collector to talk to
-        if ((payload[IDX_CMD] != COMMAND_FIND_COLLECTOR) && (payload[IDX_COLLECTOR_ID] != SELF_ID)) {
-            printf("Skipping message not meant for us (ID:%d != our ID:%lu)\n", payload[IDX_COLLECTOR_ID], SELF_ID);
+        if ((frame.cmd != COMMAND_FIND_COLLECTOR) && !frameForCollector(&frame, SELF_ID)) {
+            foreign_collector_skips.add();
+            printf("Skipping message not meant for us (ID:%d != our ID:%lu)\n", frame.collector_id, SELF_ID);
+            if (frame_ack_replied) {
+                misfire(frame.sensor_id);
+            }
             return 0;
         }
 
-        switch (payload[IDX_CMD]) {
+        // Another sensor's reply is turned down, so this one has to be sent its own
+        if (frame_ack_replied && ack_sensor != FRAME_REPLY_ANY_SENSOR && ack_sensor != frame.sensor_id) {
+            frame_ack_replied = false;
+        }
+
+        switch (frame.cmd) {
             case COMMAND_STATUS:
-                handleStatusCommand(payload);
+                handleStatusCommand(frame);
                 break;
             case COMMAND_FIND_COLLECTOR:
-                handleFindCollectorCommand(payload);
+                handleFindCollectorCommand(frame);
+                break;
+            case COMMAND_BATCH:
+                handleBatchCommand(frame, payload, len);
                 break;
         }
     }
 
-    radio.stopListening();
-    radio.write(&result, sizeof(unsigned long));
-    radio.startListening();
-
     return 1;
 }
 
 void initRadio(void) {
     // Setup and configure rf radio
-    radio.begin();
+    radio->begin();
 
     // optionally, increase the delay between retries & # of retries
-    radio.setRetries(15, 15);
+    radio->setRetries(15, 15);
 
-    radio.setDataRate(RF24_2MBPS);
-    //radio.setDataRate(RF24_250KBPS);
+    // Needed for compact frames.  Legacy sensors still get through, as their static
+    // 32 byte payloads carry their length too.
+    radio->enableDynamicPayloads();
+
+    if (ack_payloads) {
+        radio->enableAckPayload();
+        printf("Replying in ACK payloads\n");
+    }
 
     // Dump the configuration of the rf unit for debugging
-    radio.printDetails();
+    radio->printDetails();
+
+    // Replies start out going to the legacy sensors' shared address
+    radio->openWritingPipe(REMOTE_RADIO_ADDR);
+    memcpy(reply_address, REMOTE_RADIO_ADDR, FRAME_ADDR_LEN);
+
+    // Listen on every pipe we can
+    for (uint8_t pipe = FIRST_PIPE; pipe <= LAST_PIPE; pipe++) {
+        uint8_t address[FRAME_ADDR_LEN];
+        memcpy(address, SELF_RADIO_ADDR, FRAME_ADDR_LEN);
+        address[0] = pipe_addr_first_byte[pipe];
+        radio->openReadingPipe(pipe, address);
+    }
+
+    radio->startListening();
+}
+
+// Set up a sink from the command line: type[=target][,option=value...], where the types
+// and their targets are
+//
+//   influx[=host[:port]/db]           InfluxDB, by default at -H, -P and -D
+//   tsdb=dir                          the collector's own time series store
+//   mqtt=host[:port][/topic_prefix]   an MQTT broker
+//   file=path                         a local archive, CSV if path ends in .csv
+//
+// and the options are queue, batch and wait_ms (see SinkPolicy), overflow (block, drop or
+// spill) and name, which defaults to the type.  MQTT is live data only, so drops by
+// default; the rest block.
+bool addSink(const std::string &spec) {
+    std::vector<std::string> parts;
+    size_t start = 0, comma;
+    do {
+        comma = spec.find(',', start);
+        parts.push_back(spec.substr(start, comma == std::string::npos ? std::string::npos : comma - start));
+        start = comma + 1;
+    } while (comma != std::string::npos);
+
+    size_t eq = parts[0].find('=');
+    std::string type = parts[0].substr(0, eq);
+    std::string target = eq == std::string::npos ? "" : parts[0].substr(eq + 1);
+    std::string name = type;
+    SinkPolicy policy;
+    if (type == "mqtt") {
+        policy.overflow = SINK_DROP;
+    }
+
+    for (size_t i = 1; i < parts.size(); i++) {
+        eq = parts[i].find('=');
+        std::string key = parts[i].substr(0, eq);
+        const char *value = eq == std::string::npos ? "" : parts[i].c_str() + eq + 1;
+        if (key == "queue" && atoi(value) > 0) {
+            policy.queue = atoi(value);
+        } else if (key == "batch" && atoi(value) > 0) {
+            policy.batch = atoi(value);
+        } else if (key == "wait_ms") {
+            policy.wait_ms = atoi(value);
+        } else if (key == "overflow" && parseSinkOverflow(value, &policy.overflow)) {
+            continue;
+        } else if (key == "name" && *value != '\0') {
+            name = value;
+        } else {
+            printf("Bad option '%s' for sink %s\n", parts[i].c_str(), type.c_str());
+            return false;
+        }
+    }
+
+    for (size_t i = 0; i < sinks.size(); i++) {
+        if (sinks[i]->name() == name) {
+            printf("There's already a sink called %s, give this one a name=\n", name.c_str());
+            return false;
+        }
+    }
+
+    Sink *sink;
+    if (type == "influx") {
+        std::string host = getInfluxHost(), db = getInfluxDBName();
+        int port = getInfluxPort();
+        if (!target.empty()) {
+            size_t slash = target.find('/'), colon = target.find(':');
+            if (slash == std::string::npos) {
+                printf("InfluxDB sink needs host[:port]/db, not %s\n", target.c_str());
+                return false;
+            }
+            db = target.substr(slash + 1);
+            host = target.substr(0, colon < slash ? colon : slash);
+            if (colon < slash) {
+                port = atoi(target.c_str() + colon + 1);
+            }
+        }
+        sink = new InfluxWriter(host.c_str(), port, db.c_str());
+    } else if (type == "tsdb" && !target.empty()) {
+        Tsdb *tsdb = new Tsdb(target.c_str());
+        if (!tsdb->open()) {
+            return false;
+        }
+        sink = tsdb;
+    } else if (type == "mqtt" && !target.empty()) {
+        std::string host = target, prefix = MQTT_TOPIC_PREFIX;
+        int port = MQTT_PORT;
+        size_t slash = host.find('/');
+        if (slash != std::string::npos) {
+            prefix = host.substr(slash + 1);
+            host.resize(slash);
+        }
+        size_t colon = host.find(':');
+        if (colon != std::string::npos) {
+            port = atoi(host.c_str() + colon + 1);
+            host.resize(colon);
+        }
+        sink = new MqttWriter(host.c_str(), port, prefix.c_str());
+    } else if (type == "file" && !target.empty()) {
+        FileWriter *file = new FileWriter(target.c_str());
+        if (!file->open()) {
+            return false;
+        }
+        sink = file;
+    } else {
+        printf("Unknown sink %s\n", spec.c_str());
+        return false;
+    }
+
+    Spool *spill = NULL;
+    if (policy.overflow == SINK_SPILL) {
+        spill = new Spool((std::string(spool_dir) + "/" + name).c_str());
+        if (!spill->open()) {
+            return false;
+        }
+    }
 
-    // This opens pipes for two nodes to communicate back and forth.
-    radio.openWritingPipe(REMOTE_RADIO_ADDR);
-    radio.openReadingPipe(1, SELF_RADIO_ADDR);
+    sinks.push_back(new SinkWorker(name.c_str(), sink, policy, spill));
+    printf("Sink %s: %s, queue %zu, batch %zu, wait %ums, %s when full\n", name.c_str(), spec.c_str(), policy.queue,
+           policy.batch, policy.wait_ms,
+           policy.overflow == SINK_BLOCK ? "block" : policy.overflow == SINK_DROP ? "drop" : "spill");
+    return true;
+}
 
-    radio.startListening();
+void usage(const char *name) {
+#ifdef RADIO_SIM
+    printf("Usage: %s [-H influx_host] [-P influx_port] [-D influx_db] [-d spool_dir] [-o sink]... [-t tsdb_dir] [-F fill_interval_s] [-T heartbeat_timeout_s] [-S max_sensors] [-R history] [-q query_port] [-c capture_file] [-r replay_file] [-x replay_speed] [-a] [-s slot_period_s] [-n namespace] [-f fifo_depth] [-l loss]\n", name);
+#else
+    printf("Usage: %s [-H influx_host] [-P influx_port] [-D influx_db] [-d spool_dir] [-o sink]... [-t tsdb_dir] [-F fill_interval_s] [-T heartbeat_timeout_s] [-S max_sensors] [-R history] [-q query_port] [-c capture_file] [-r replay_file] [-x replay_speed] [-a] [-s slot_period_s] [-i irq_gpio]\n", name);
+#endif
 }
 
 int main(int argc, char** argv) {
+#ifdef RADIO_SIM
+    const char *sim_namespace = SIM_RADIO_NAMESPACE;
+    int sim_fifo_depth = SIM_RADIO_FIFO_DEPTH;
+    double sim_loss = 0.0;
+    const char *options = "H:P:D:d:o:t:F:T:S:R:q:c:r:x:as:n:f:l:";
+#else
+    int irq_gpio = RADIO_IRQ_GPIO;
+    const char *options = "H:P:D:d:o:t:F:T:S:R:q:c:r:x:as:i:";
+#endif
+    int opt;
+
+    while ((opt = getopt(argc, argv, options)) != -1) {
+        switch (opt) {
+            case 'H':
+                influx_host = optarg;
+                break;
+            case 'P':
+                influx_port = atoi(optarg);
+                break;
+            case 'D':
+                influx_db_name = optarg;
+                break;
+            case 'd':
+                spool_dir = optarg;
+                break;
+            case 'o':
+                sink_specs.push_back(optarg);
+                break;
+            case 't':
+                // Short for -o tsdb=dir
+                sink_specs.push_back(std::string("tsdb=") + optarg);
+                break;
+            case 'F':
+                fill_interval_ms = atoi(optarg) * 1000;
+                break;
+            case 'T':
+                heartbeat_timeout_ms = atoi(optarg) * 1000;
+                break;
+            case 'S':
+                sensor_capacity = atoi(optarg);
+                break;
+            case 'R':
+                sensor_history = atoi(optarg);
+                break;
+            case 'q':
+                query_port = atoi(optarg);
+                break;
+            case 'c':
+                capture_path = optarg;
+                break;
+            case 'r':
+                replay_path = optarg;
+                break;
+            case 'x':
+                replay_speed = atof(optarg);
+                break;
+            case 'a':
+                ack_payloads = true;
+                break;
+            case 's':
+                slot_period_ms = atoi(optarg) * 1000;
+                break;
+#ifdef RADIO_SIM
+            case 'n':
+                sim_namespace = optarg;
+                break;
+            case 'f':
+                sim_fifo_depth = atoi(optarg);
+                break;
+            case 'l':
+                sim_loss = atof(optarg);
+                break;
+#else
+            case 'i':
+                irq_gpio = atoi(optarg);
+                break;
+#endif
+            default:
+                usage(argv[0]);
+                return 1;
+        }
+    }
+
     cout << "Collector starting up ...\n";
 
+    spool = new Spool(spool_dir);
+    if (!spool->open()) {
+        return 1;
+    }
+
+    if (sink_specs.empty()) {
+        sink_specs.push_back(DEFAULT_SINK);
+    }
+    for (size_t i = 0; i < sink_specs.size(); i++) {
+        if (!addSink(sink_specs[i])) {
+            return 1;
+        }
+    }
+    for (size_t i = 0; i < sinks.size(); i++) {
+        sinks[i]->start();
+    }
+
+    // Everything per sensor is allocated here, up front
+    sensors = new SensorTable(sensor_capacity, sensor_history);
+    tracker = new ReportTracker(sensors, fill_interval_ms, heartbeat_timeout_ms);
+    rollups = new RollupEngine(sensors);
+
+    if (query_port > 0) {
+        query = new QueryServer(sensors, &sensors_lock);
+        query->setMetrics(renderMetrics);
+        if (query->start(QUERY_BIND, query_port) < 0) {
+            return 1;
+        }
+        printf("Query server listening on %s:%d\n", QUERY_BIND, query_port);
+    }
+
+    if (capture_path != NULL) {
+        capture = new CaptureWriter(capture_path);
+        if (!capture->open()) {
+            return 1;
+        }
+        printf("Capturing frames to %s\n", capture_path);
+    }
+
+    if (slot_period_ms > 0) {
+        slots = new SlotScheduler(slot_period_ms);
+        printf("Handing out report slots over %us\n", slot_period_ms / 1000);
+    }
+
+    ReplayRadio *replay = NULL;
+    if (replay_path != NULL) {
+        replay = new ReplayRadio(replay_path, replay_speed);
+        if (!replay->begin()) {
+            return 1;
+        }
+        radio = replay;
+    } else {
+#ifdef RADIO_SIM
+        radio = new SimRadio(sim_namespace, sim_fifo_depth, sim_loss);
+#else
+        // Radio CE Pin, CSN Pin, SPI Speed
+        // See http://www.airspayce.com/mikem/bcm2835/group__constants.html#ga63c029bd6500167152db4e57736d0939
+        // and the related enumerations for pin information.
+        //
+        // Setup for GPIO 22 CE and CE0 CSN with SPI Speed @ 4Mhz
+        radio = new RF24Radio(RPI_V2_GPIO_P1_15, BCM2835_SPI_CS0, BCM2835_SPI_SPEED_4MHZ, irq_gpio);
+#endif
+    }
+
     initRadio();
 
+    std::thread writer(writerLoop);
+    writer.detach();
+
+    unsigned int check_delay = RADIO_CHECK_MIN_DELAY;
+
     while (1) {
         // Pong back role.  Receive each packet, dump it out, and send it back
 
+        if (holdingBack()) {
+            usleep(RADIO_CHECK_MIN_DELAY * 1000);
+            continue;
+        }
+
         // if there is data ready
-        if (radio.available()) {
+        if (radio->available()) {
             readCommand();
+            check_delay = RADIO_CHECK_MIN_DELAY;
+            continue;
+        }
+
+        if (radio->finished()) {
+            break;
+        }
+
+        if (ack_payloads) {
+            loadAckPayloads();
         }
 
-        //Delay after payload responded to, minimize RPi CPU time
-        delay(RADIO_CHECK_DELAY);
+        if (radio->hasIrq()) {
+            // Sleep until the radio says a packet has arrived
+            radio->waitIrq(RADIO_IRQ_TIMEOUT_MS);
+        } else {
+            // Poll quickly while packets are coming in, backing off when things go quiet
+            usleep(check_delay * 1000);
+            check_delay = check_delay * 2 < RADIO_CHECK_DELAY ? check_delay * 2 : RADIO_CHECK_DELAY;
+        }
+    }
+
+    // Only a replay gets here.  Wait for the writer to get everything into the sinks, then
+    // sum up, the same way every time for the same capture.
+    uint64_t elapsed_ns = replay->elapsedNanos();
+    uint64_t drain_start = monotonicMillis();
+    draining.store(true);
+    while (!drained.load()) {
+        usleep(WRITER_IDLE_DELAY * 1000);
+    }
+    if (capture != NULL) {
+        capture->flush();
+    }
+
+    printf("Replayed %llu frames in %.3fs (%.0f frames/s), then %llums writing to the sinks\n",
+           (unsigned long long) replay->frames(), elapsed_ns / 1e9,
+           elapsed_ns > 0 ? replay->frames() * 1e9 / elapsed_ns : 0.0,
+           (unsigned long long) (monotonicMillis() - drain_start));
+    printf("Replay: malformed=%llu, find collector=%llu, status=%llu, batch=%llu, foreign=%llu, replies=%llu\n",
+           (unsigned long long) malformed_packets.value(), (unsigned long long) find_collector_commands.value(),
+           (unsigned long long) status_commands.value(), (unsigned long long) batch_commands.value(),
+           (unsigned long long) foreign_collector_skips.value(), (unsigned long long) replay->replies());
+    printf("Replay: duplicates=%llu, filled forward=%llu, missing=%llu, restarts=%llu, rollups=%llu, queue overflows=%llu\n",
+           (unsigned long long) duplicate_reports.value(), (unsigned long long) tracker->filled(),
+           (unsigned long long) tracker->missing(), (unsigned long long) tracker->restarts(),
+           (unsigned long long) rollups_emitted.value(), (unsigned long long) getQueueOverflows());
+    for (size_t i = 0; i < sinks.size(); i++) {
+        printf("Replay: sink %s written=%llu, rollups=%llu, dropped=%llu\n", sinks[i]->name().c_str(),
+               (unsigned long long) sinks[i]->readings.value(), (unsigned long long) sinks[i]->rollups.value(),
+               (unsigned long long) sinks[i]->dropped.value());
     }
 
     return 0;
 }
-
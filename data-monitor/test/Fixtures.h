@@ -0,0 +1,16 @@
+#ifndef TEST_FIXTURES_H_
+#define TEST_FIXTURES_H_
+
+#include <stdint.h>
+#include "../Reading.h"
+
+// The nth reading of a test run, told apart from the others by its cycle count
+inline Reading reading(uint32_t n) {
+    Reading reading = {};
+    reading.timestamp_ms = 1500000000000ull + n;
+    reading.sensor_id = 0x5e000000u;
+    reading.cycles = n;
+    return reading;
+}
+
+#endif /* TEST_FIXTURES_H_ */
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Replays a capture through the collector as fast as it goes and checks the summary it
+# prints at the end, which comes out the same on every run of the same capture.
+#
+# Usage: replay_test.sh collector capture expected_summary work_dir
+
+collector=$1
+capture=$2
+expected=$3
+dir=$4
+
+rm -rf "$dir" && mkdir -p "$dir" || exit 1
+"$collector" -r "$capture" -x 0 -q 0 -d "$dir/spool" -o "file=$dir/readings.csv" > "$dir/out.log" 2>&1 || {
+    cat "$dir/out.log"
+    exit 1
+}
+grep '^Replay:' "$dir/out.log" > "$dir/summary"
+if ! diff -u "$expected" "$dir/summary"; then
+    echo "FAIL: the replay summary changed"
+    exit 1
+fi
+echo "replay ok"
@@ -0,0 +1,175 @@
+/**
+ * Checks a sink that spills gets every reading offered, in order, once it catches up.  The
+ * spill uses tiny segments so it runs over several of them, which once left all but the
+ * first stuck on disk until an empty batch was written.
+ *
+ * Usage: sink_worker_test [-d dir]
+ */
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "../SinkWorker.h"
+#include "Fixtures.h"
+
+#define SEGMENT_RECORDS 4
+#define READINGS 200
+#define TIMEOUT_MS 10000
+
+// Holds on to what it's written, and counts writes with nothing in them
+class RecordingSink : public Sink {
+  public:
+    RecordingSink() : empty_flushes(0) {}
+    void add(const Reading &reading) {
+        _batch.push_back(reading.cycles);
+    }
+    bool flush(void) {
+        std::lock_guard<std::mutex> guard(_lock);
+        if (_batch.empty()) {
+            empty_flushes++;
+        }
+        written.insert(written.end(), _batch.begin(), _batch.end());
+        _batch.clear();
+        return true;
+    }
+    void discard(void) {
+        _batch.clear();
+    }
+    std::vector<uint32_t> snapshot(void) {
+        std::lock_guard<std::mutex> guard(_lock);
+        return written;
+    }
+    std::atomic<uint64_t> empty_flushes;
+  private:
+    std::mutex _lock;
+    std::vector<uint32_t> written;
+    std::vector<uint32_t> _batch;
+};
+
+static bool waitIdle(SinkWorker *worker) {
+    for (int waited = 0; waited < TIMEOUT_MS; waited += 10) {
+        if (worker->idle()) {
+            return true;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    return false;
+}
+
+static int check(RecordingSink *sink, uint32_t count, const char *what) {
+    std::vector<uint32_t> written = sink->snapshot();
+    int failures = 0;
+
+    if (written.size() != count) {
+        printf("FAIL %s: %zu of %u readings written\n", what, written.size(), count);
+        failures++;
+    }
+    for (size_t i = 0; i < written.size(); i++) {
+        if (written[i] != i) {
+            printf("FAIL %s: reading %u written at %zu\n", what, written[i], i);
+            failures++;
+            break;
+        }
+    }
+    // A spill stuck at the end of a segment was only ever moved on by committing an empty
+    // batch read from it
+    if (sink->empty_flushes > 0) {
+        printf("FAIL %s: %llu empty writes\n", what, (unsigned long long) sink->empty_flushes.load());
+        failures++;
+    }
+    printf("%-20s %s\n", what, failures == 0 ? "ok" : "FAILED");
+    return failures;
+}
+
+int main(int argc, char **argv) {
+    std::string dir = "/tmp/sink_worker_test";
+    int failures = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dir = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d dir]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (system(("rm -rf " + dir).c_str()) != 0) {
+        printf("Could not clear %s\n", dir.c_str());
+        return 1;
+    }
+
+    SinkPolicy policy;
+    policy.queue = 2;
+    policy.batch = 3;
+    policy.wait_ms = 1;
+    policy.overflow = SINK_SPILL;
+
+    // Each round fills the queue and spills exactly two segments' worth, and waits for the
+    // worker to catch up at the end of the last segment before the next round starts one
+    {
+        Spool spill((dir + "/rounds").c_str(), SEGMENT_RECORDS);
+        RecordingSink sink;
+        SinkWorker worker("rounds", &sink, policy, &spill);
+        uint64_t position = 0;
+        uint32_t n = 0;
+        Reading readings[2 + 2 * SEGMENT_RECORDS];
+
+        if (!spill.open()) {
+            return 1;
+        }
+        worker.start();
+        for (int round = 0; round < 5; round++) {
+            for (size_t i = 0; i < sizeof(readings) / sizeof(readings[0]); i++) {
+                readings[i] = reading(n++);
+            }
+            position += worker.offer(position, readings, sizeof(readings) / sizeof(readings[0]));
+            if (!waitIdle(&worker)) {
+                printf("FAIL rounds: %llu still spilled after round %d\n", (unsigned long long) worker.spilled(),
+                       round);
+                failures++;
+                break;
+            }
+        }
+        worker.stop();
+        failures += check(&sink, n, "rounds");
+    }
+
+    // Offered a few at a time while the worker drains, catching up wherever it happens to
+    {
+        Spool spill((dir + "/during").c_str(), SEGMENT_RECORDS);
+        RecordingSink sink;
+        SinkWorker worker("during", &sink, policy, &spill);
+        uint64_t position = 0;
+        Reading readings[7];
+
+        if (!spill.open()) {
+            return 1;
+        }
+        worker.start();
+        for (uint32_t n = 0; n < READINGS;) {
+            size_t count = 0;
+            while (count < sizeof(readings) / sizeof(readings[0]) && n < READINGS) {
+                readings[count++] = reading(n++);
+            }
+            position += worker.offer(position, readings, count);
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+        if (!waitIdle(&worker)) {
+            printf("FAIL during: %llu still spilled\n", (unsigned long long) worker.spilled());
+        }
+        worker.stop();
+        failures += check(&sink, READINGS, "during");
+    }
+
+    system(("rm -rf " + dir).c_str());
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/**
+ * Checks the spool hands back every reading appended, in order, with tiny segments so
+ * the reader crosses a segment boundary every few readings.  Most of all with the reader
+ * caught up at the end of a full segment when the next one is started, which once left
+ * everything after it stuck on disk.
+ *
+ * Usage: spool_test [-d dir]
+ */
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+#include "../Spool.h"
+#include "Fixtures.h"
+
+#define SEGMENT_RECORDS 4
+
+static int failures = 0;
+
+#define check(cond, ...) do {                   \
+        if (!(cond)) {                          \
+            printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+            printf(__VA_ARGS__);                \
+            printf("\n");                       \
+            failures++;                         \
+        }                                       \
+    } while (0)
+
+static bool reset(const std::string &dir) {
+    return system(("rm -rf " + dir).c_str()) == 0;
+}
+
+// Takes everything the spool has to give, checking it carries on from next
+static void drain(Spool *spool, uint32_t *next, const char *what) {
+    Reading readings[SEGMENT_RECORDS * 3];
+    size_t count;
+
+    while ((count = spool->peek(readings, sizeof(readings) / sizeof(readings[0]))) > 0) {
+        for (size_t i = 0; i < count; i++) {
+            check(readings[i].cycles == *next, "%s: got reading %u, expected %u", what, readings[i].cycles, *next);
+            *next = readings[i].cycles + 1;
+        }
+        spool->commit(count);
+    }
+}
+
+// One at a time, the reader catching up after every append
+static void oneByOne(const std::string &dir) {
+    Spool spool(dir.c_str(), SEGMENT_RECORDS);
+    uint32_t next = 0;
+
+    check(spool.open(), "one by one: open");
+    for (uint32_t n = 0; n < SEGMENT_RECORDS * 5; n++) {
+        check(spool.append(reading(n)), "one by one: append %u", n);
+        drain(&spool, &next, "one by one");
+        check(spool.pending() == 0, "one by one: %llu pending after %u", (unsigned long long) spool.pending(), n);
+    }
+    check(next == SEGMENT_RECORDS * 5, "one by one: delivered %u of %u", next, SEGMENT_RECORDS * 5);
+}
+
+// A whole segment at a time, so the reader finishes each one exactly
+static void segmentAtATime(const std::string &dir) {
+    Spool spool(dir.c_str(), SEGMENT_RECORDS);
+    uint32_t next = 0, n = 0;
+
+    check(spool.open(), "segment at a time: open");
+    for (int round = 0; round < 5; round++) {
+        for (int i = 0; i < SEGMENT_RECORDS; i++, n++) {
+            check(spool.append(reading(n)), "segment at a time: append %u", n);
+        }
+        drain(&spool, &next, "segment at a time");
+    }
+    check(next == n, "segment at a time: delivered %u of %u", next, n);
+    check(spool.pending() == 0, "segment at a time: %llu pending", (unsigned long long) spool.pending());
+}
+
+// Reopened with the reader caught up at the end of a full segment
+static void reopened(const std::string &dir) {
+    uint32_t next = 0, n = 0;
+
+    for (int run = 0; run < 3; run++) {
+        Spool spool(dir.c_str(), SEGMENT_RECORDS);
+        check(spool.open(), "reopened: open");
+        for (int i = 0; i < SEGMENT_RECORDS; i++, n++) {
+            check(spool.append(reading(n)), "reopened: append %u", n);
+        }
+        drain(&spool, &next, "reopened");
+    }
+    check(next == n, "reopened: delivered %u of %u", next, n);
+}
+
+// A sink reading ahead of the cursor with peekAt(), from the end of a full segment
+static void readAhead(const std::string &dir) {
+    Spool spool(dir.c_str(), SEGMENT_RECORDS);
+    Reading readings[SEGMENT_RECORDS];
+    uint32_t n = 0;
+
+    check(spool.open(), "read ahead: open");
+    uint64_t first = spool.position();
+    uint64_t ahead = first;
+    for (int round = 0; round < 4; round++) {
+        for (int i = 0; i < SEGMENT_RECORDS; i++, n++) {
+            check(spool.append(reading(n)), "read ahead: append %u", n);
+        }
+        size_t count;
+        while ((count = spool.peekAt(ahead, readings, SEGMENT_RECORDS)) > 0) {
+            for (size_t i = 0; i < count; i++) {
+                uint32_t expected = (uint32_t) (ahead - first + i);
+                check(readings[i].cycles == expected, "read ahead: got reading %u, expected %u", readings[i].cycles,
+                      expected);
+            }
+            ahead += count;
+        }
+        check(ahead == spool.position() + spool.pending(), "read ahead: stuck at %llu of %llu",
+              (unsigned long long) ahead, (unsigned long long) (spool.position() + spool.pending()));
+        // The cursor follows a round behind
+        if (round > 0) {
+            spool.commit(SEGMENT_RECORDS);
+        }
+    }
+}
+
+// Commits running past the end of a segment, as they do when sinks read ahead with
+// peekAt(), carry on into the next one, across a reopen too
+static void commitAcross(const std::string &dir) {
+    Reading readings[SEGMENT_RECORDS];
+    uint64_t first;
+    uint32_t n = 0;
+
+    {
+        Spool spool(dir.c_str(), SEGMENT_RECORDS);
+        check(spool.open(), "commit across: open");
+        first = spool.position();
+        for (; n < SEGMENT_RECORDS * 4; n++) {
+            check(spool.append(reading(n)), "commit across: append %u", n);
+        }
+
+        spool.commit(2);
+        spool.commit(SEGMENT_RECORDS + 3);
+        check(spool.position() == first + SEGMENT_RECORDS + 5, "commit across: at %llu, expected %llu",
+              (unsigned long long) (spool.position() - first), (unsigned long long) SEGMENT_RECORDS + 5);
+        check(spool.pending() == n - SEGMENT_RECORDS - 5, "commit across: %llu pending, expected %u",
+              (unsigned long long) spool.pending(), n - SEGMENT_RECORDS - 5);
+        check(spool.peek(readings, 1) == 1 && readings[0].cycles == SEGMENT_RECORDS + 5,
+              "commit across: next is reading %u, expected %u", readings[0].cycles, SEGMENT_RECORDS + 5);
+
+        // Over two boundaries at once
+        spool.commit(SEGMENT_RECORDS + 2);
+        check(spool.pending() == n - 2 * SEGMENT_RECORDS - 7, "commit across two: %llu pending, expected %u",
+              (unsigned long long) spool.pending(), n - 2 * SEGMENT_RECORDS - 7);
+    }
+
+    Spool spool(dir.c_str(), SEGMENT_RECORDS);
+    check(spool.open(), "commit across: reopen");
+    check(spool.position() == first + 2 * SEGMENT_RECORDS + 7, "commit across: reopened at %llu, expected %llu",
+          (unsigned long long) (spool.position() - first), (unsigned long long) 2 * SEGMENT_RECORDS + 7);
+    uint32_t next = 2 * SEGMENT_RECORDS + 7;
+    drain(&spool, &next, "commit across");
+    check(next == n, "commit across: delivered up to %u of %u", next, n);
+}
+
+int main(int argc, char **argv) {
+    std::string dir = "/tmp/spool_test";
+    int opt;
+
+    while ((opt = getopt(argc, argv, "d:")) != -1) {
+        switch (opt) {
+            case 'd':
+                dir = optarg;
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-d dir]\n", argv[0]);
+                return 1;
+        }
+    }
+
+    struct {
+        const char *name;
+        void (*run)(const std::string &dir);
+    } tests[] = {{"one by one", oneByOne}, {"segment at a time", segmentAtATime}, {"reopened", reopened},
+                 {"read ahead", readAhead}, {"commit across", commitAcross}};
+
+    for (size_t i = 0; i < sizeof(tests) / sizeof(tests[0]); i++) {
+        if (!reset(dir)) {
+            printf("Could not clear %s\n", dir.c_str());
+            return 1;
+        }
+        int before = failures;
+        tests[i].run(dir);
+        printf("%-20s %s\n", tests[i].name, failures == before ? "ok" : "FAILED");
+    }
+    reset(dir);
+
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,161 @@
+#include "Frame.h"
+
+static void _putU32(uint8_t *buf, uint32_t value) {
+  buf[0] = value;
+  buf[1] = value >> 8;
+  buf[2] = value >> 16;
+  buf[3] = value >> 24;
+}
+
+static uint32_t _getU32(const uint8_t *buf) {
+  return (uint32_t) buf[0] | ((uint32_t) buf[1] << 8) | ((uint32_t) buf[2] << 16) | ((uint32_t) buf[3] << 24);
+}
+
+static uint16_t _clamp(int32_t value, int32_t low, int32_t high) {
+  if (value < low) {
+    return low;
+  }
+  if (value > high) {
+    return high;
+  }
+  return value;
+}
+
+// Pack a reading into the 32 bit word compact frames carry, clamped to fit
+uint32_t framePackReading(uint16_t vcc, uint16_t moisture, int16_t temperature, uint8_t flags) {
+  uint32_t data = (uint32_t) (_clamp(vcc, FRAME_VCC_OFFSET, FRAME_VCC_MAX) - FRAME_VCC_OFFSET) << 20;
+  data |= (uint32_t) _clamp(moisture, 0, FRAME_MOISTURE_MAX) << 10;
+  data |= (uint32_t) (uint8_t) _clamp(temperature, -128, 127) << 2;
+  return data | (flags & 0x03);
+}
+
+void frameUnpackReading(uint32_t data, Frame *frame) {
+  frame->vcc = (data >> 20) + FRAME_VCC_OFFSET;
+  frame->moisture = (data >> 10) & FRAME_MOISTURE_MAX;
+  frame->temperature = (int8_t) (data >> 2);
+  frame->flags = data & 0x03;
+}
+
+static void _encodeHeader(const Frame *frame, uint8_t *buf) {
+  uint8_t retries = frame->retries > FRAME_RETRIES_MAX ? FRAME_RETRIES_MAX : frame->retries;
+
+  buf[0] = (FRAME_VERSION_COMPACT << 6) | (retries << 4) | (frame->cmd & 0x0f);
+  _putU32(buf + 1, frame->sensor_id);
+  buf[5] = frame->collector_id;
+  buf[6] = frame->collector_id >> 8;
+  buf[7] = frame->counter;
+  buf[8] = frame->counter >> 8;
+}
+
+static void _decodeHeader(const uint8_t *buf, Frame *frame) {
+  frame->version = FRAME_VERSION_COMPACT;
+  frame->cmd = buf[0] & 0x0f;
+  frame->retries = (buf[0] >> 4) & 0x03;
+  frame->sensor_id = _getU32(buf + 1);
+  frame->collector_id = buf[5] | ((uint16_t) buf[6] << 8);
+  frame->counter = buf[7] | ((uint16_t) buf[8] << 8);
+}
+
+// Write the frame into buf in its version's layout; returns the number of bytes to send
+uint8_t frameEncode(const Frame *frame, uint8_t *buf) {
+  if (frame->version == FRAME_VERSION_LEGACY) {
+    _putU32(buf, frame->cmd);
+    _putU32(buf + 4, frame->sensor_id);
+    _putU32(buf + 8, frame->collector_id);
+    _putU32(buf + 12, frame->counter);
+    _putU32(buf + 16, frame->retries);
+    _putU32(buf + 20, frame->vcc);
+    _putU32(buf + 24, frame->moisture);
+    _putU32(buf + 28, (uint32_t) (int32_t) frame->temperature);
+    return FRAME_LEGACY_LEN;
+  }
+
+  _encodeHeader(frame, buf);
+  _putU32(buf + 9, framePackReading(frame->vcc, frame->moisture, frame->temperature, frame->flags));
+  return FRAME_COMPACT_LEN;
+}
+
+uint8_t frameEncodeBatch(const FrameBatch *batch, uint8_t *buf) {
+  uint8_t count = batch->count > FRAME_BATCH_MAX ? FRAME_BATCH_MAX : batch->count;
+
+  _encodeHeader(&batch->frame, buf);
+  buf[9] = count | (batch->more ? FRAME_BATCH_MORE : 0);
+  buf[10] = batch->interval;
+  buf[11] = batch->interval >> 8;
+  _putU32(buf + 12, batch->age);
+  for (uint8_t i = 0; i < count; i++) {
+    _putU32(buf + FRAME_BATCH_HEADER_LEN + i * 4, batch->readings[i]);
+  }
+  return FRAME_BATCH_HEADER_LEN + count * 4;
+}
+
+// Update the retry count of an already encoded frame before resending it
+void frameSetRetries(uint8_t *buf, uint8_t version, uint8_t retries) {
+  if (version == FRAME_VERSION_LEGACY) {
+    _putU32(buf + 16, retries);
+    return;
+  }
+  if (retries > FRAME_RETRIES_MAX) {
+    retries = FRAME_RETRIES_MAX;
+  }
+  buf[0] = (buf[0] & 0xcf) | (retries << 4);
+}
+
+// Decode either layout.  Returns false for anything else.  Batch frames decode as far
+// as the command; use frameDecodeBatch() for the rest.
+bool frameDecode(const uint8_t *buf, uint8_t len, Frame *frame) {
+  if (len == FRAME_LEGACY_LEN && (buf[0] >> 6) == FRAME_VERSION_LEGACY) {
+    frame->version = FRAME_VERSION_LEGACY;
+    frame->cmd = _getU32(buf);
+    frame->sensor_id = _getU32(buf + 4);
+    frame->collector_id = _getU32(buf + 8);
+    frame->counter = _getU32(buf + 12);
+    frame->retries = _getU32(buf + 16);
+    frame->vcc = _getU32(buf + 20);
+    frame->moisture = _getU32(buf + 24);
+    frame->temperature = (int32_t) _getU32(buf + 28);
+    frame->flags = 0;
+    return true;
+  }
+
+  if (len < FRAME_COMPACT_LEN || (buf[0] >> 6) != FRAME_VERSION_COMPACT) {
+    return false;
+  }
+
+  _decodeHeader(buf, frame);
+  frameUnpackReading(_getU32(buf + 9), frame);
+  return true;
+}
+
+bool frameDecodeBatch(const uint8_t *buf, uint8_t len, FrameBatch *batch) {
+  if (len < FRAME_BATCH_HEADER_LEN || (buf[0] >> 6) != FRAME_VERSION_COMPACT) {
+    return false;
+  }
+
+  _decodeHeader(buf, &batch->frame);
+  batch->count = buf[9] & ~FRAME_BATCH_MORE;
+  batch->more = (buf[9] & FRAME_BATCH_MORE) != 0;
+  batch->interval = buf[10] | ((uint16_t) buf[11] << 8);
+  batch->age = _getU32(buf + 12);
+  if (batch->count > FRAME_BATCH_MAX || len < FRAME_BATCH_HEADER_LEN + batch->count * 4) {
+    return false;
+  }
+  for (uint8_t i = 0; i < batch->count; i++) {
+    batch->readings[i] = _getU32(buf + FRAME_BATCH_HEADER_LEN + i * 4);
+  }
+  return true;
+}
+
+// Compact frames only carry the low 16 bits of the collector id
+bool frameForCollector(const Frame *frame, uint32_t collector_id) {
+  if (frame->version == FRAME_VERSION_LEGACY) {
+    return frame->collector_id == collector_id;
+  }
+  return frame->collector_id == (collector_id & 0xffff);
+}
+
+// Address a compact frame sensor listens for replies on
+void frameSensorAddress(uint32_t sensor_id, uint8_t *address) {
+  _putU32(address, sensor_id);
+  address[4] = FRAME_SENSOR_ADDR_PREFIX;
+}
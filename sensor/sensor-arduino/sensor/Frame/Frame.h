@@ -0,0 +1,119 @@
+// Radio frame layouts shared by the sensor firmware and the collector.
+//
+// Legacy frames are eight little-endian uint32_t words (32 bytes):
+//   cmd, sensor id, collector id, message counter, retry count, data 1-3
+//
+// Compact frames (version 1) pack the same message into 13 bytes and are sent with
+// dynamic payload length:
+//   byte 0      version (2 bits) | retry count (2 bits) | cmd (4 bits)
+//   bytes 1-4   sensor id
+//   bytes 5-6   collector id (low 16 bits)
+//   bytes 7-8   message counter (low 16 bits)
+//   bytes 9-12  vcc (12 bits, mV - 1000) | moisture (10 bits) | temperature (8 bits, signed) | flags (2 bits)
+//
+// Batch frames carry up to four stored readings, taken at a fixed interval:
+//   bytes 0-6   as above
+//   bytes 7-8   message counter of the first (oldest) reading
+//   byte 9      count | FRAME_BATCH_MORE
+//   bytes 10-11 seconds between readings
+//   bytes 12-15 seconds since the newest reading was taken
+//   bytes 16-   count readings, packed as in bytes 9-12 above
+//
+// Legacy frames start with the low byte of a small command number, so their version
+// bits read as 0.
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stdint.h>
+
+#define FRAME_VERSION_LEGACY 0
+#define FRAME_VERSION_COMPACT 1
+
+#define FRAME_LEGACY_LEN 32
+#define FRAME_COMPACT_LEN 13
+#define FRAME_MAX_LEN 32
+
+#define FRAME_BATCH_HEADER_LEN 16
+#define FRAME_BATCH_MAX 4
+// Set on every frame of a burst but the last; the collector only replies to the last one
+#define FRAME_BATCH_MORE 0x80
+
+// Replies are little-endian uint32_t words: the sensor id, a value, then anything
+// particular to the command.  Legacy sensors are sent the first two, padded to 32 bytes.
+#define FRAME_REPLY_IDX_SENSOR_ID 0
+#define FRAME_REPLY_IDX_VALUE 1
+// Collector's time, in seconds since the epoch
+#define FRAME_REPLY_IDX_TIME 2
+// Find collector: first address byte of the collector pipe to send to from now on
+#define FRAME_REPLY_IDX_PIPE_ADDR 3
+// When the collector hands out slots: ms from now until the sensor's next report, and ms
+// between reports from then on, by the collector's clock.  Left off, or 0, the sensor
+// keeps to its own schedule.
+#define FRAME_REPLY_IDX_SLOT_DELAY 4
+#define FRAME_REPLY_IDX_SLOT_INTERVAL 5
+// ACK payloads: the collector's ID.  A sensor on another collector can have its frame
+// ACKed by this one, and mustn't take its payload for the reply.
+#define FRAME_REPLY_IDX_COLLECTOR_ID 6
+#define FRAME_REPLY_WORDS 7
+#define FRAME_REPLY_LEN 8
+// A reply queued as an ACK payload on a pipe shared by several sensors goes to whichever
+// of them sends next, so it has this in place of the sensor id
+#define FRAME_REPLY_ANY_SENSOR 0
+
+// Compact frame sensors get their replies on their own address, so the radio filters
+// out replies to other sensors: the sensor id (LSB first) and this byte
+#define FRAME_SENSOR_ADDR_PREFIX 0xc3
+#define FRAME_ADDR_LEN 5
+
+// Range of the packed fields
+#define FRAME_VCC_OFFSET 1000
+#define FRAME_VCC_MAX (FRAME_VCC_OFFSET + 0xfff)
+#define FRAME_MOISTURE_MAX 0x3ff
+#define FRAME_RETRIES_MAX 3
+
+// Reading flags (the low 2 bits of a packed reading).  Sensors only report a reading once
+// it has changed, or when their heartbeat comes round, and message counters only count
+// reported readings: consecutive counters some time apart mean nothing changed in between,
+// a jump in the counter means readings went missing.
+// Sent because the heartbeat came round, not because anything changed
+#define FRAME_FLAG_HEARTBEAT 0x01
+// First report since the sensor started.  Its counter carries on from the last one it
+// saved, which may skip some, so a jump up to this one isn't reports going missing.
+#define FRAME_FLAG_BOOT 0x02
+
+struct Frame {
+  uint8_t version;
+  uint8_t cmd;
+  uint8_t retries;
+  uint8_t flags;
+  uint32_t sensor_id;
+  uint32_t collector_id;
+  uint32_t counter;
+  // Battery voltage in mV
+  uint16_t vcc;
+  uint16_t moisture;
+  int16_t temperature;
+};
+
+struct FrameBatch {
+  // Command, retries, ids, and the message counter of the first reading
+  Frame frame;
+  uint8_t count;
+  bool more;
+  uint16_t interval;
+  uint32_t age;
+  // framePackReading(), oldest first
+  uint32_t readings[FRAME_BATCH_MAX];
+};
+
+uint32_t framePackReading(uint16_t vcc, uint16_t moisture, int16_t temperature, uint8_t flags);
+void frameUnpackReading(uint32_t data, Frame *frame);
+uint8_t frameEncode(const Frame *frame, uint8_t *buf);
+uint8_t frameEncodeBatch(const FrameBatch *batch, uint8_t *buf);
+bool frameDecodeBatch(const uint8_t *buf, uint8_t len, FrameBatch *batch);
+void frameSetRetries(uint8_t *buf, uint8_t version, uint8_t retries);
+bool frameDecode(const uint8_t *buf, uint8_t len, Frame *frame);
+bool frameForCollector(const Frame *frame, uint32_t collector_id);
+void frameSensorAddress(uint32_t sensor_id, uint8_t *address);
+
+#endif /* FRAME_H_ */
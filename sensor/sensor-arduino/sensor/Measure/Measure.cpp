@@ -0,0 +1,77 @@
+#include "Measure.h"
+
+#if defined(__AVR__)
+#include <avr/pgmspace.h>
+#else
+#define PROGMEM
+#define pgm_read_dword(addr) (*(const uint32_t *) (addr))
+#endif
+
+// Evaluated by the compiler, so the float literals never reach the firmware
+#define THERMISTOR_R(kohms) ((uint32_t) ((kohms) * MEASURE_R_SCALE + 0.5))
+
+// Thermistor resistance at each datasheet point, from MEASURE_TEMP_MIN up.  Resistance
+// falls as the temperature rises.
+static const uint32_t thermistor_r[MEASURE_TEMP_POINTS] PROGMEM = {
+  THERMISTOR_R(4397.119), THERMISTOR_R(3088.599), THERMISTOR_R(2197.225), THERMISTOR_R(1581.881),
+  THERMISTOR_R(1151.037), THERMISTOR_R(846.579), THERMISTOR_R(628.988), THERMISTOR_R(471.632),
+  THERMISTOR_R(357.012), THERMISTOR_R(272.500), THERMISTOR_R(209.710), THERMISTOR_R(162.651),
+  THERMISTOR_R(127.080), THERMISTOR_R(100.000), THERMISTOR_R(79.222), THERMISTOR_R(63.167),
+  THERMISTOR_R(50.677), THERMISTOR_R(40.904), THERMISTOR_R(33.195), THERMISTOR_R(27.091),
+  THERMISTOR_R(22.224), THERMISTOR_R(18.323), THERMISTOR_R(15.184), THERMISTOR_R(12.635),
+  THERMISTOR_R(10.566), THERMISTOR_R(8.873), THERMISTOR_R(7.481), THERMISTOR_R(6.337),
+  THERMISTOR_R(5.384), THERMISTOR_R(4.594), THERMISTOR_R(3.934), THERMISTOR_R(3.380),
+  THERMISTOR_R(2.916), THERMISTOR_R(2.522)};
+
+// adc = 1024*vref/vcc, therefore vcc = 1024*vref/adc
+uint16_t measureVcc(uint16_t bandgap_adc) {
+  if (bandgap_adc == 0) {
+    return 0xffff;
+  }
+  return (1024UL * MEASURE_BANDGAP_MV) / bandgap_adc;
+}
+
+// The reading is against a known but variable vcc, so adjust it against the constant moisture
+// max: adc * vcc / max, with vcc worked out from the bandgap in the same division
+uint16_t measureMoisture(uint16_t adc, uint16_t bandgap_adc) {
+  if (bandgap_adc == 0) {
+    return 0xffff;
+  }
+  uint32_t moisture = ((uint32_t) adc * (1024UL * MEASURE_BANDGAP_MV)) / ((uint32_t) bandgap_adc * MEASURE_MOISTURE_MAX_MV);
+  return moisture > 0xffff ? 0xffff : moisture;
+}
+
+int16_t measureTemperature(uint16_t adc) {
+  // Thermistor resistance from the divider, r + rem / div ohms.  As the table holds whole ohms,
+  // comparing r alone against it gives the same answer as the exact value would.
+  uint32_t div = 1024 - adc;
+  uint32_t r = ((uint32_t) MEASURE_R_TOP * MEASURE_R_SCALE * adc) / div;
+  uint32_t rem = ((uint32_t) MEASURE_R_TOP * MEASURE_R_SCALE * adc) % div;
+
+  // Edge case; too cold to hold
+  if (r >= pgm_read_dword(&thermistor_r[0])) {
+    return MEASURE_TEMP_MIN;
+  }
+  // Edge case; too hot to handle
+  if (r < pgm_read_dword(&thermistor_r[MEASURE_TEMP_POINTS - 1])) {
+    return MEASURE_TEMP_MAX;
+  }
+
+  // Binary search for the first point whose resistance is at or below ours, so ours lies
+  // between it and the one before
+  uint8_t low = 1, high = MEASURE_TEMP_POINTS - 1;
+  while (low < high) {
+    uint8_t mid = (low + high) / 2;
+    if (r >= pgm_read_dword(&thermistor_r[mid])) {
+      high = mid;
+    } else {
+      low = mid + 1;
+    }
+  }
+
+  // Linear fit between the two points, rounding towards the warmer one as the float version did
+  uint32_t r_low = pgm_read_dword(&thermistor_r[low]);
+  uint32_t r_high = pgm_read_dword(&thermistor_r[low - 1]);
+  int16_t temp = MEASURE_TEMP_MIN + MEASURE_TEMP_STEP * low;
+  return temp - (int16_t) ((MEASURE_TEMP_STEP * ((r - r_low) * div + rem)) / ((r_high - r_low) * div));
+}
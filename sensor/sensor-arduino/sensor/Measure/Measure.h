@@ -0,0 +1,34 @@
+// Conversions from raw ADC readings to the values the sensor reports, in integer and
+// fixed point arithmetic only, so no soft-float code is linked in.  The thermistor table
+// is built at compile time and kept in flash rather than SRAM.
+//
+// Plain C++ so the same code can be checked against the old float conversions on a PC.
+#ifndef MEASURE_H_
+#define MEASURE_H_
+
+#include <stdint.h>
+
+// Internal bandgap reference the battery voltage is measured against
+#define MEASURE_BANDGAP_MV 1100
+// The max possible value from the moisture sensor is 3.3 volts
+#define MEASURE_MOISTURE_MAX_MV 3300
+
+// Top half resistance (in kOhms) of the voltage divider the thermistor is part of
+#define MEASURE_R_TOP 200
+// Resistances are worked in ohms, which holds the datasheet values exactly
+#define MEASURE_R_SCALE 1000
+
+// The thermistor datasheet gives its resistance every 5C from -40C to 125C
+#define MEASURE_TEMP_MIN -40
+#define MEASURE_TEMP_STEP 5
+#define MEASURE_TEMP_POINTS 34
+#define MEASURE_TEMP_MAX (MEASURE_TEMP_MIN + MEASURE_TEMP_STEP * (MEASURE_TEMP_POINTS - 1))
+
+// Battery voltage in mV from an ADC reading of the bandgap with Vcc as the reference
+uint16_t measureVcc(uint16_t bandgap_adc);
+// Moisture ADC reading scaled to the constant sensor max, against the Vcc the bandgap gave
+uint16_t measureMoisture(uint16_t adc, uint16_t bandgap_adc);
+// Temperature in C from the thermistor divider's ADC reading
+int16_t measureTemperature(uint16_t adc);
+
+#endif /* MEASURE_H_ */
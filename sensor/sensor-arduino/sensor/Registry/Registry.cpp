@@ -1,68 +1,154 @@
 #include <EEPROM.h>
+#include <string.h>
+#include <util/crc16.h>
 #include "Registry.h"
 
 Registry::Registry() {
-  _initSelfID();
+  _slots = (EEPROM.length() - EEPROM_ADDR_JOURNAL) / REGISTRY_RECORD_LEN;
+
+  if (!_load()) {
+    _loadOldLayout();
+  }
+
+  // Carry on from the saved counter, and save the next reserve along with the boot
+  _start_counter = _state.counter;
+  _state.counter += REGISTRY_COUNTER_RESERVE;
+  _state.boots++;
+  _append();
 }
 
 bool Registry::hasCollectorID() {
-  return EEPROM.read(EEPROM_ADDR_COLLECTOR_ID_FLAG) == FLAG_ID_SET;
+  return _state.collector_id != 0;
 }
 
 uint32_t Registry::getSelfID() {
-  if (_self_id == 0) {
-    _self_id = _readIdFromEEPROM(EEPROM_ADDR_SELF_ID);
-  }
-  return _self_id;
+  return _state.self_id;
 }
 
 uint32_t Registry::getCollectorID() {
-  if (_collector_id == 0) {
-    _collector_id = _readIdFromEEPROM(EEPROM_ADDR_COLLECTOR_ID);
-  }
-  return _collector_id;
+  return _state.collector_id;
+}
+
+uint8_t Registry::getCollectorPipe() {
+  return _state.collector_pipe;
 }
 
-void Registry::setCollectorID(uint32_t id) {
-  _collector_id = id;
-  _writeIdToEEPROM(EEPROM_ADDR_COLLECTOR_ID, id);
-  _setFlagInEEPROM(EEPROM_ADDR_COLLECTOR_ID_FLAG);
+void Registry::setCollector(uint32_t id, uint8_t pipe_addr) {
+  if (_state.collector_id != id || _state.collector_pipe != pipe_addr) {
+    _state.collector_id = id;
+    _state.collector_pipe = pipe_addr;
+    _append();
+  }
 }
 
+// Called after every failed search, so only saved the first time
 void Registry::clearCollectorID() {
-  _collector_id = 0;
-  EEPROM.write(EEPROM_ADDR_COLLECTOR_ID_FLAG, FLAG_ID_CLEAR);
+  if (_state.collector_id != 0) {
+    _state.collector_id = 0;
+    _append();
+  }
+}
+
+uint32_t Registry::getCounter() {
+  return _start_counter;
 }
 
-void Registry::_initSelfID() {
-  if (!_hasSelfID()) {
-    _setSelfID(__TIME_UNIX__);
+void Registry::reserveCounter(uint32_t counter) {
+  if ((int32_t) (counter - _state.counter) >= 0) {
+    _state.counter = counter + REGISTRY_COUNTER_RESERVE;
+    _append();
   }
 }
 
-bool Registry::_hasSelfID() {
-  return EEPROM.read(EEPROM_ADDR_SELF_ID_FLAG) == FLAG_ID_SET;
+uint16_t Registry::getBootCount() {
+  return _state.boots;
+}
+
+// Finds the newest good record.  Sequence numbers of the good ones are all within a lap
+// of each other, so they compare the right way round across a wrap.
+bool Registry::_load() {
+  RegistryState state;
+  uint16_t seq;
+  bool found = false;
+
+  for (uint16_t slot = 0; slot < _slots; slot++) {
+    if (!_readRecord(slot, &seq, &state)) {
+      continue;
+    }
+    if (!found || (int16_t) (seq - _seq) > 0) {
+      _state = state;
+      _seq = seq;
+      _slot = slot;
+      found = true;
+    }
+  }
+  return found;
 }
 
-void Registry::_setSelfID(uint32_t id) {
-  _writeIdToEEPROM(EEPROM_ADDR_SELF_ID, id);
-  _setFlagInEEPROM(EEPROM_ADDR_SELF_ID_FLAG);
+// Nothing in the journal: a new sensor, or one flashed over the old layout, whose IDs are
+// kept.  The first record goes in the first slot.
+void Registry::_loadOldLayout() {
+  memset(&_state, 0, sizeof(_state));
+  _state.self_id = __TIME_UNIX__;
+  _state.collector_pipe = COLLECTOR_PIPE_NONE;
+  _slot = _slots - 1;
+  _seq = REGISTRY_SEQ_ERASED;
+
+  if (EEPROM.read(EEPROM_ADDR_SELF_ID_FLAG) == FLAG_ID_SET) {
+    _state.self_id = _readIdFromEEPROM(EEPROM_ADDR_SELF_ID);
+  }
+  if (EEPROM.read(EEPROM_ADDR_COLLECTOR_ID_FLAG) == FLAG_ID_SET) {
+    _state.collector_id = _readIdFromEEPROM(EEPROM_ADDR_COLLECTOR_ID);
+    _state.collector_pipe = EEPROM.read(EEPROM_ADDR_COLLECTOR_PIPE);
+  }
 }
 
-void Registry::_setFlagInEEPROM(uint8_t addr) {
-  EEPROM.write(addr, FLAG_ID_SET);
+bool Registry::_readRecord(uint16_t slot, uint16_t *seq, RegistryState *state) {
+  uint16_t addr = _addr(slot);
+  uint8_t *bytes = (uint8_t *) state;
+  uint8_t crc = 0;
+
+  *seq = EEPROM.read(addr) | (uint16_t) EEPROM.read(addr + 1) << 8;
+  if (*seq == REGISTRY_SEQ_ERASED) {
+    return false;
+  }
+  crc = _crc8_ccitt_update(crc, *seq & 0xff);
+  crc = _crc8_ccitt_update(crc, *seq >> 8);
+  for (uint8_t i = 0; i < sizeof(RegistryState); i++) {
+    bytes[i] = EEPROM.read(addr + 2 + i);
+    crc = _crc8_ccitt_update(crc, bytes[i]);
+  }
+  return EEPROM.read(addr + 2 + sizeof(RegistryState)) == crc;
 }
 
-void Registry::_writeIdToEEPROM(uint8_t addr, uint32_t value) {
-  for (int i=0; i <= 3; i++) {
-    EEPROM.write(addr+i, (value >> i*8) & 0xFF);
+// Writes the state to the next slot.  The sequence number goes last, so until the rest is
+// down the slot still reads as the old record it was, or as torn.
+void Registry::_append() {
+  const uint8_t *bytes = (const uint8_t *) &_state;
+  uint8_t crc = 0;
+
+  _slot = (_slot + 1) % _slots;
+  _seq++;
+  if (_seq == REGISTRY_SEQ_ERASED) {
+    _seq = 0;
+  }
+
+  uint16_t addr = _addr(_slot);
+  crc = _crc8_ccitt_update(crc, _seq & 0xff);
+  crc = _crc8_ccitt_update(crc, _seq >> 8);
+  for (uint8_t i = 0; i < sizeof(RegistryState); i++) {
+    EEPROM.update(addr + 2 + i, bytes[i]);
+    crc = _crc8_ccitt_update(crc, bytes[i]);
   }
+  EEPROM.update(addr + 2 + sizeof(RegistryState), crc);
+  EEPROM.update(addr + 1, _seq >> 8);
+  EEPROM.update(addr, _seq & 0xff);
 }
 
-uint32_t Registry::_readIdFromEEPROM(uint8_t addr) {
+uint32_t Registry::_readIdFromEEPROM(uint16_t addr) {
   uint32_t id_val = 0;
   uint32_t value;
-  
+
   for (int i=0; i <= 3; i++) {
     value = EEPROM.read(addr+i);
     id_val += value << i*8;
@@ -70,3 +156,7 @@ uint32_t Registry::_readIdFromEEPROM(uint8_t addr) {
 
   return id_val;
 }
+
+uint16_t Registry::_addr(uint16_t slot) {
+  return EEPROM_ADDR_JOURNAL + slot * REGISTRY_RECORD_LEN;
+}
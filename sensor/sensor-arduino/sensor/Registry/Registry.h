@@ -3,6 +3,8 @@
 #ifndef REGISTRY_H_
 #define REGISTRY_H_
 
+#include <stdint.h>
+
 // extracts 1..4 characters from a string and interprets it as a decimal value
 #define CONV_STR2DEC_1(str, i)  (str[i]>'0'?str[i]-'0':0)
 #define CONV_STR2DEC_2(str, i)  (CONV_STR2DEC_1(str, i)*10 + str[i+1]-'0')
@@ -63,6 +65,8 @@
                                 __TIME_SECONDS__)
 
 
+// The fixed layout used before the journal.  Only read, to carry the IDs over the first
+// time the journal is empty.
 // Whether we've set our self ID yet
 #define EEPROM_ADDR_SELF_ID_FLAG 0x00
 // Whether we've identified our nearest collector
@@ -71,28 +75,80 @@
 #define EEPROM_ADDR_SELF_ID 0x02
 // Nearest collector (should be set once, then updated if too many retries)
 #define EEPROM_ADDR_COLLECTOR_ID 0x06
+// First address byte of the collector pipe we were assigned
+#define EEPROM_ADDR_COLLECTOR_PIPE 0x0a
 
 // A value indicating whether an ID has been set.  Arbitrary. 10-4 good buddy!
 #define FLAG_ID_SET 0xa4
-#define FLAG_ID_CLEAR 0xff
 
+// Erased EEPROM; no pipe assigned
+#define COLLECTOR_PIPE_NONE 0xff
+
+// The journal fills the rest of the EEPROM, after the old layout
+#define EEPROM_ADDR_JOURNAL 0x10
+
+// Message counters are saved this far ahead, so the journal is only written once every
+// this many reports.  After a restart the counter carries on from the saved value,
+// skipping whatever was left of the reserve.
+#define REGISTRY_COUNTER_RESERVE 16
+
+// Sequence number of an erased slot, which is never written
+#define REGISTRY_SEQ_ERASED 0xffff
+
+// Everything kept across restarts
+struct RegistryState {
+  uint32_t self_id;
+  // 0 until we've found a collector
+  uint32_t collector_id;
+  // Message counters below this may have been used
+  uint32_t counter;
+  uint16_t boots;
+  uint8_t collector_pipe;
+};
+
+// Sequence number, state, checksum
+#define REGISTRY_RECORD_LEN (2 + sizeof(RegistryState) + 1)
+
+// Keeps the sensor's IDs and counters in RAM, loaded once at boot, and saves them to a
+// journal in EEPROM.
+//
+// Each save appends a whole record, with a sequence number and a checksum, to the slot
+// after the last one, wrapping round at the end of the EEPROM, so every slot is worn
+// evenly and none more than once per lap.  An ATmega328P has 56 slots and an ATtiny84
+// 27, each good for 100,000 writes: at a report every 10 minutes, saving the counter
+// once every REGISTRY_COUNTER_RESERVE reports, that's centuries.
+//
+// At boot the newest record with a good checksum is the state.  A record torn by the
+// power going mid-write fails its checksum, and the one before it is used.  Finding it
+// reads and checksums every slot, so boot takes time bounded by the size of the EEPROM
+// rather than constant time: about a millisecond for the 1KB of an ATmega328P, and half
+// that on an ATtiny84.
 class Registry {
   public:
     Registry();
     bool hasCollectorID(void);
     uint32_t getSelfID(void);
     uint32_t getCollectorID(void);
-    void setCollectorID(uint32_t id);
+    uint8_t getCollectorPipe(void);
+    void setCollector(uint32_t id, uint8_t pipe_addr);
     void clearCollectorID(void);
+    // Message counter to carry on from after this boot
+    uint32_t getCounter(void);
+    // Make sure counter is saved as used before it goes out
+    void reserveCounter(uint32_t counter);
+    uint16_t getBootCount(void);
   private:
-    void _initSelfID(void);
-    bool _hasSelfID(void);
-    void _setSelfID(uint32_t id);
-    void _setFlagInEEPROM(uint8_t addr);
-    void _writeIdToEEPROM(uint8_t addr, uint32_t value);
-    uint32_t Registry::_readIdFromEEPROM(uint8_t addr);
-    uint32_t _self_id = 0;
-    uint32_t _collector_id = 0;
+    bool _load(void);
+    void _loadOldLayout(void);
+    bool _readRecord(uint16_t slot, uint16_t *seq, RegistryState *state);
+    void _append(void);
+    uint32_t _readIdFromEEPROM(uint16_t addr);
+    uint16_t _addr(uint16_t slot);
+    RegistryState _state;
+    uint32_t _start_counter;
+    uint16_t _slots;
+    uint16_t _slot;
+    uint16_t _seq;
 };
 
 #endif /* REGISTRY_H_ */
@@ -11,6 +11,8 @@
 #include <avr/sleep.h>
 #include <avr/wdt.h>
 #include "RF24.h"
+#include <Frame.h>
+#include <Measure.h>
 #include <Registry.h>
 
 #if defined(__AVR_ATmega328P__)
@@ -43,19 +45,23 @@
 #define RAIDIO_CSN_PIN 3
 #endif
 
+// The radio's IRQ pin, on a pin change interrupt so we can sleep while waiting for a reply.
+// Comment out if it isn't wired, and the radio is checked every watchdog tick instead.
+#if defined(__AVR_ATmega328P__)
+#define RADIO_IRQ_PIN 4
+#define RADIO_IRQ_VECT PCINT2_vect
+#else
+#define RADIO_IRQ_PIN 7
+#define RADIO_IRQ_VECT PCINT0_vect
+#endif
+
 //-----------------
 // ADC constants
 
 // analogue ref = VCC, input channel = VREF
 #define ADMUX_READ_INTERNAL 0x21
 
-// The max possible value from the moisture sensor is 3.3 volts
-#define MOISTURE_MAX_VAL 3.3l
-
-// Top half resistance (in kOhms) of voltage divider thermistor is part of
-#define R_CONSTANT 200
-// Number of discrete values defined for the thermistor resistance from datasheet.
-#define RANGE_LEN 34
+// Scaling to mV, moisture and temperature is done in Measure.h
 
 //-----------------
 // Radio constants
@@ -63,9 +69,13 @@
 #define MESSAGE_ACK_TTL 250001
 #define MAX_RETRIES 3
 #define READ_PACKET_LEN 3
-#define RESPONSE_PACKET_LEN 2
+#define RESPONSE_PACKET_LEN FRAME_REPLY_WORDS
 
+// Collector pipe 1, where we look for a collector.  It then assigns us one of its
+// other pipes, which differ only in the first address byte.
 #define HOST_RADIO_ADDR (byte *) "3Node"
+// Replies to legacy frames come to this shared address; compact frame replies come to
+// our own address (see frameSensorAddress())
 #define SELF_RADIO_ADDR (byte *) "4Node"
 
 // From the class docs: https://maniacbug.github.io/RF24/classRF24.html#a4c6d3959c8320e64568395f4ef507aef
@@ -78,15 +88,11 @@
 
 #define COMMAND_STATUS 0x01
 #define COMMAND_FIND_COLLECTOR 0x02
+#define COMMAND_BATCH 0x03
 
-#define IDX_CMD 0
-#define IDX_SENSOR_ID 1
-#define IDX_COLLECTOR_ID 2
-#define IDX_MESG_CNTR 3
-#define IDX_RETRY_CNTR 4
-#define IDX_DATA_1 5
-#define IDX_DATA_2 6
-#define IDX_DATA_3 7
+// Frame layout to send, see Frame.h.  Compact frames need a collector that understands
+// them; FRAME_VERSION_LEGACY talks to older ones.
+#define FRAME_VERSION FRAME_VERSION_COMPACT
 
 //-----------------
 // Sleep constants
@@ -115,6 +121,62 @@
 //#define SLEEP_CYCLES 38
 #define SLEEP_CYCLES 1
 
+// Watchdog timeout for a WDT_ level, in ms.  Each level doubles it from 16ms.
+#define WDT_PERIOD_MS(level) (16UL << (level))
+
+// While waiting for a reply we sleep until the radio's IRQ says one is in, with the watchdog
+// ending the wait after MESSAGE_ACK_TTL.  Without the IRQ pin we wake on short watchdog
+// ticks to check the radio instead.
+#ifdef RADIO_IRQ_PIN
+#define ACK_WAIT_WDT WDT_250ms
+#define ACK_WAKE_ON_RADIO true
+#else
+#define ACK_WAIT_WDT WDT_16ms
+#define ACK_WAKE_ON_RADIO false
+#endif
+#define ACK_WAIT_TICKS ((MESSAGE_ACK_TTL / 1000 + WDT_PERIOD_MS(ACK_WAIT_WDT) - 1) / WDT_PERIOD_MS(ACK_WAIT_WDT))
+
+// Random wait between retries, slept through on watchdog ticks
+#define RETRY_BACKOFF_MIN_MS 250
+#define RETRY_BACKOFF_MAX_MS 1250
+
+//-----------------
+// Batched reporting
+
+// Take a reading every wake, but only power up the radio every BATCH_UPLOAD_WAKES wakes to send
+// all the stored readings in one burst.  0 sends a status message every wake instead.  Needs
+// compact frames.
+#define BATCH_UPLOAD_WAKES 8
+
+// Readings kept until they've been uploaded, including while no collector can be reached.  The
+// oldest are dropped once it's full.
+#if defined(__AVR_ATmega328P__)
+#define READING_RING_SIZE 128
+#else
+#define READING_RING_SIZE 32
+#endif
+
+// Most frames sent in one burst, so a backlog after an outage drains over a few uploads
+#define BATCH_BURST_FRAMES 4
+
+// Our clock is scaled by this (in 1/1024ths) to match the collector's, within these limits
+#define CLOCK_SCALE_ONE 1024
+#define CLOCK_SCALE_MIN 768
+#define CLOCK_SCALE_MAX 1280
+// Least time between two syncs for working out the scale, in seconds
+#define CLOCK_SYNC_MIN_S 3600
+
+//-----------------
+// Change-driven reporting
+
+// A reading is only reported once it has moved more than its deadband away from the last one the
+// collector acknowledged, or once HEARTBEAT_WAKES wakes have gone by without a report.  The
+// collector fills the last reading forward in between.  A HEARTBEAT_WAKES of 1 reports every reading.
+#define DEADBAND_VCC_MV 50
+#define DEADBAND_MOISTURE 8
+#define DEADBAND_TEMPERATURE 1
+#define HEARTBEAT_WAKES 64
+
 //-----------------
 // Inline functions
 
@@ -138,23 +200,56 @@ RF24 radio(RAIDIO_CE_PIN, RAIDIO_CSN_PIN);
 // Used to keep track of how many times we've slept
 uint32_t sleep_cycles = 0;
 
-// Keep a count of messages. Used as a message/packet ID
+// Keep a count of status messages. Used as a message/packet ID, and skips no numbers so the
+// collector can tell a reading that went missing from one that wasn't sent.  Carries on
+// across restarts from the registry's saved counter.
 uint32_t message_counter = 0;
 
+// Whether the collector has had our first report since we started, which is flagged so it
+// knows a jump in the counter is a restart and not missing reports
+bool boot_reported = false;
+
+// Readings waiting to be uploaded, packed with framePackReading(), and a count of readings
+// taken so the collector can tell which it has
+uint32_t reading_ring[READING_RING_SIZE];
+uint8_t ring_head = 0;
+uint8_t ring_count = 0;
+uint32_t ring_first_counter = 0;
+uint32_t reading_counter = 0;
+uint8_t upload_wakes = 0;
+
+// Our clock, advanced by the watchdog period every wake.  Only differences are used, scaled
+// by clock_scale, which is worked out from the collector's time in its replies.
+uint32_t clock_ms = 0;
+uint16_t clock_scale = CLOCK_SCALE_ONE;
+uint32_t sync_time = 0;
+uint32_t sync_clock_ms = 0;
+uint32_t newest_reading_ms = 0;
+
+// Last reading the collector acknowledged, packed with framePackReading(), and wakes since then.
+// Starts out due so the first reading is always reported.
+uint32_t last_report = 0;
+uint16_t report_wakes = HEARTBEAT_WAKES;
+
+// Report slot the collector gave us: wakes until our next report, and wakes between
+// reports.  No interval means no slot, and we report on our own schedule.
+uint16_t slot_wakes = 0;
+uint16_t slot_interval_wakes = 0;
+// Extra sleep at the start of the next wake, to line it up with the slot
+uint16_t slot_shift_ms = 0;
+
 volatile boolean reset_watchdog = true;
 
-Registry registry;
+// While awake the watchdog times short waits instead, counting its ticks rather than
+// setting reset_watchdog
+volatile boolean short_wait = false;
+volatile uint8_t short_wait_ticks = 0;
+uint8_t short_wait_level = WDT_16ms;
+
+// Set when the radio's IRQ pin changes, meaning it has probably received something
+volatile boolean radio_irq = false;
 
-static const int8_t temp_range[RANGE_LEN] = {
-  -40, -35, -30, -25, -20, -15, -10, -5,  0,
-    5,  10,  15,  20,  25,  30,  35,  40, 45,
-   50,  55,  60,  65,  70,  75,  80,  85, 90,
-   95, 100, 105, 110, 115, 120, 125};
-static const float r_range[RANGE_LEN] = {
-  4397.119, 3088.599, 2197.225, 1581.881, 1151.037, 846.579, 628.988, 471.632, 357.012,
-   272.500,  209.710,  162.651,  127.080,  100.000,  79.222,  63.167,  50.677,  40.904, 
-    33.195,   27.091,   22.224,   18.323,   15.184,  12.635,  10.566,   8.873,   7.481, 
-     6.337,    5.384,    4.594,    3.934,    3.380,   2.916,   2.522};
+Registry registry;
 
 //--------- Functions
 
@@ -177,8 +272,13 @@ void setup() {
   Serial.println(__TIME_UNIX__);
   Serial.print(F("\Message ACK TTL (ms): "));
   Serial.println(MESSAGE_ACK_TTL/1000);
+  Serial.print(F("\tBoot: "));
+  Serial.println(registry.getBootCount());
 #endif
 
+  message_counter = registry.getCounter();
+  reading_counter = message_counter;
+
   pinMode(TEMP_ADC_PIN, INPUT);
   pinMode(SENSOR_ADC_PIN, INPUT);
   pinMode(SETUP_BUTTON_PIN, INPUT);
@@ -206,12 +306,31 @@ void initCollectorID() {
 }
 
 void refreshCollectorID() {
-  uint32_t id = findClosestCollector();
+  uint8_t pipe_addr = COLLECTOR_PIPE_NONE;
+  uint32_t id;
+
+  // Always look for a collector on its first pipe
+  openCollectorPipe(COLLECTOR_PIPE_NONE);
+  id = findClosestCollector(&pipe_addr);
   if (id) {
-    registry.setCollectorID(id);
+    registry.setCollector(id, pipe_addr);
+    openCollectorPipe(pipe_addr);
   }
 }
 
+// Send to the given collector pipe, or pipe 1 if there isn't one
+void openCollectorPipe(uint8_t pipe_addr) {
+  uint8_t address[FRAME_ADDR_LEN];
+
+  memcpy(address, HOST_RADIO_ADDR, FRAME_ADDR_LEN);
+#if FRAME_VERSION != FRAME_VERSION_LEGACY
+  if (pipe_addr != COLLECTOR_PIPE_NONE && pipe_addr != 0) {
+    address[0] = pipe_addr;
+  }
+#endif
+  radio.openWritingPipe(address);
+}
+
 void initRadio() {
   // Setup and configure rf radio
   radio.begin();
@@ -223,12 +342,34 @@ void initRadio() {
  
   radio.setAutoAck(1);
 
+#if FRAME_VERSION != FRAME_VERSION_LEGACY
+  // Only send as many bytes as the frame needs, and take a reply in the ACK if the
+  // collector sends one there
+  radio.enableDynamicPayloads();
+  radio.enableAckPayload();
+#endif
+
   // Max delay between retries & number of retries
   radio.setRetries(PACKET_RETRY_DELAY, PACKET_RETRIES);
 
-  // Open a writing and reading pipe on each radio, with opposite addresses
-  radio.openWritingPipe(HOST_RADIO_ADDR);
+#ifdef RADIO_IRQ_PIN
+  // Only a received packet pulls IRQ low.  write() waits on sends itself.
+  radio.maskIRQ(true, true, false);
+  pinMode(RADIO_IRQ_PIN, INPUT);
+  *digitalPinToPCMSK(RADIO_IRQ_PIN) |= _BV(digitalPinToPCMSKbit(RADIO_IRQ_PIN));
+  *digitalPinToPCICR(RADIO_IRQ_PIN) |= _BV(digitalPinToPCICRbit(RADIO_IRQ_PIN));
+#endif
+
+  // Send to our collector pipe, and only listen for replies meant for us so the radio
+  // drops everyone else's without waking us
+  openCollectorPipe(registry.hasCollectorID() ? registry.getCollectorPipe() : COLLECTOR_PIPE_NONE);
+#if FRAME_VERSION != FRAME_VERSION_LEGACY
+  uint8_t address[FRAME_ADDR_LEN];
+  frameSensorAddress(registry.getSelfID(), address);
+  radio.openReadingPipe(1, address);
+#else
   radio.openReadingPipe(1, SELF_RADIO_ADDR);
+#endif
 
   // Start listening
   radio.startListening();
@@ -296,81 +437,39 @@ uint16_t getAdcValue(void) {
   return (high << 8) | (low);
 }
 
-// ASSUMPTION: ADC is enabled AND refernece is set to Vcc AND input is set to 1.1v internal
-double getBatteryVoltage(void) {
-  uint16_t adc_result = getAdcValue();
-
-  // adc = 1024*vref/vcc, therefore vcc = 1024*vref/adc
-  return (1024 * 1.1) / adc_result;
+uint16_t getMoistureValue(uint16_t bandgap_adc) {
+  return measureMoisture(analogRead(SENSOR_ADC_PIN), bandgap_adc);
 }
 
-uint16_t getMoistureValue(double vcc) {
-  uint16_t sensor_reading = analogRead(SENSOR_ADC_PIN);
-
-  // This adc value calculated against a known but varible vcc that we've just measured.  Adjust
-  // it against the moisture max value that is contant.
-  return sensor_reading * (vcc / MOISTURE_MAX_VAL);
+int16_t getTemperatureValue() {
+  return measureTemperature(analogRead(TEMP_ADC_PIN));
 }
 
-uint16_t getTemperatureValue() {  
-  uint16_t adc_reading = analogRead(TEMP_ADC_PIN);
-  float r_temp = R_CONSTANT * (adc_reading/(1024.0-adc_reading));
-
-  // Edge case; too hot to handle
-  if (r_temp >= r_range[0]) {
-    return temp_range[0];
-  }
-  // Edge case; too cold to hold
-  if (r_temp < r_range[RANGE_LEN]) {
-    return temp_range[RANGE_LEN];
-  }
-
-  // Since the resistor and temp values are 34 discrete points in a range,
-  // use a linear fit to estimate the temperature value in between.
+// Measure everything and pack it with framePackReading()
+uint32_t takeReading(void) {
+  // ASSUMPTION: ADC is enabled AND refernece is set to Vcc AND input is set to 1.1v internal,
+  // so this reads the bandgap, which gives the battery voltage
+  uint16_t bandgap_adc = getAdcValue();
 
-  uint8_t idx = findClosestRVal(r_temp);
-
-  // From 0.0 to 1.0, how far r_temp is from the low range
-  float factor = (r_temp - r_range[idx])/(r_range[idx-1] - r_range[idx]);
-  int8_t temp_delta = temp_range[idx-1] - temp_range[idx];
-
-  return (int) (temp_delta * factor) + temp_range[idx];
+  return framePackReading(measureVcc(bandgap_adc), getMoistureValue(bandgap_adc), getTemperatureValue(), 0);
 }
 
-uint8_t findClosestRVal(float r_temp) {
-  uint8_t idx = 0;
-  while (idx < RANGE_LEN) {
-    // The r_range array is ordered big to small, so search from the front
-    // until we find the first value that is smaller or equal to ours.  Then we know our
-    // range is between this and the previous value.
-    if (r_temp >= r_range[idx]) {
-      break;
-    }
-    idx++;
-  }
-
-  // Even though we handled the edge cases in the function above, still handle it here
-  if (idx == RANGE_LEN) {
-    return idx - 1;
-  }
-  return idx;
-}
-
-uint32_t findClosestCollector(void) {
+uint32_t findClosestCollector(uint8_t *pipe_addr) {
   // Still need a payload to fill out the packet we send
   uint32_t payload[3] = {0, 0, 0};
-  uint32_t result;
+  uint32_t result[RESPONSE_PACKET_LEN - 1];
 
 #if defined(__AVR_ATmega328P__)
   Serial.println(F("Sending Find Collector command"));
 #endif
 
-  if (sendMessage(COMMAND_FIND_COLLECTOR, payload, &result)) {
+  if (sendMessage(COMMAND_FIND_COLLECTOR, payload, 0, result)) {
 #if defined(__AVR_ATmega328P__)
   Serial.print(F("\tfound collector: "));
-  Serial.println(result);
+  Serial.println(result[0]);
 #endif
-    return result;
+    *pipe_addr = result[FRAME_REPLY_IDX_PIPE_ADDR - 1];
+    return result[0];
   }
 
 #if defined(__AVR_ATmega328P__)
@@ -382,31 +481,70 @@ uint32_t findClosestCollector(void) {
   return 0;
 }
 
-bool sendStatus(void) {
-  double vcc_reading = getBatteryVoltage();
-  uint32_t moisture_reading = getMoistureValue(vcc_reading);
-  uint32_t temperature_reading = getTemperatureValue();
-  uint32_t payload[3], result;
+bool sendStatus(uint32_t reading, uint8_t flags) {
+  Frame values;
+  uint32_t payload[3], result[RESPONSE_PACKET_LEN - 1];
 
 #if defined(__AVR_ATmega328P__)
   Serial.println(F("Sending Status command"));
 #endif
 
-  payload[0] = (uint32_t) (vcc_reading * 1000);
-  payload[1] = moisture_reading;
-  payload[2] = temperature_reading;
+  frameUnpackReading(reading, &values);
+  payload[0] = values.vcc;
+  payload[1] = values.moisture;
+  payload[2] = (uint32_t) values.temperature;
 
   // If sending the message is successful and we get a successful response back, return success for
   // this command 
-  if (sendMessage(COMMAND_STATUS, payload, &result)) {
-    return result == 1;
+  if (sendMessage(COMMAND_STATUS, payload, flags, result)) {
+    return result[0] == 1;
   }
 
   return false;
 }
 
-bool sendMessage(uint8_t cmd, uint32_t *data, uint32_t *response) {
-  uint32_t payload[8];
+// Whether a packed reading has moved past any deadband from the last one reported
+bool readingChanged(uint32_t reading) {
+  Frame now, last;
+
+  frameUnpackReading(reading, &now);
+  frameUnpackReading(last_report, &last);
+  return abs((int16_t) now.vcc - (int16_t) last.vcc) > DEADBAND_VCC_MV ||
+    abs((int16_t) now.moisture - (int16_t) last.moisture) > DEADBAND_MOISTURE ||
+    abs(now.temperature - last.temperature) > DEADBAND_TEMPERATURE;
+}
+
+// Count a wake towards the heartbeat, returning whether it's due
+bool heartbeatDue(void) {
+  if (report_wakes < HEARTBEAT_WAKES) {
+    report_wakes++;
+  }
+  return report_wakes >= HEARTBEAT_WAKES;
+}
+
+// Take a reading and send it if it has changed or the heartbeat is due.  Most wakes on a stable
+// plant never power up the radio.
+void reportStatus(void) {
+  uint32_t reading = takeReading();
+
+  bool heartbeat = heartbeatDue();
+  bool changed = readingChanged(reading);
+  if (!heartbeat && !changed) {
+    return;
+  }
+
+  radio.powerUp();
+  if (sendStatus(reading, (changed ? 0 : FRAME_FLAG_HEARTBEAT) | (boot_reported ? 0 : FRAME_FLAG_BOOT))) {
+    last_report = reading;
+    report_wakes = 0;
+    boot_reported = true;
+  }
+}
+
+bool sendMessage(uint8_t cmd, uint32_t *data, uint8_t flags, uint32_t *response) {
+  Frame frame;
+  uint8_t payload[FRAME_MAX_LEN];
+  uint8_t len;
   bool success = false;
   uint8_t retry_count = 0;
 
@@ -419,18 +557,31 @@ bool sendMessage(uint8_t cmd, uint32_t *data, uint32_t *response) {
   Serial.println(id);
 #endif
 
-  payload[IDX_CMD] = cmd;
-  payload[IDX_SENSOR_ID] = registry.getSelfID();
-  payload[IDX_COLLECTOR_ID] = registry.getCollectorID();
-  payload[IDX_MESG_CNTR] = message_counter;
-  payload[IDX_RETRY_CNTR] = retry_count;
-  payload[IDX_DATA_1] = data[0];
-  payload[IDX_DATA_2] = data[1];
-  payload[IDX_DATA_3] = data[2];
+  frame.version = FRAME_VERSION;
+  frame.cmd = cmd;
+  frame.retries = retry_count;
+  frame.flags = flags;
+  frame.sensor_id = registry.getSelfID();
+  frame.collector_id = registry.getCollectorID();
+  frame.counter = message_counter;
+  if (cmd != COMMAND_FIND_COLLECTOR) {
+    registry.reserveCounter(message_counter);
+  }
+  frame.vcc = data[0];
+  frame.moisture = data[1];
+  frame.temperature = (int16_t) data[2];
+  len = frameEncode(&frame, payload);
 
   while (not success && retry_count <= MAX_RETRIES) {
     radio.stopListening();
-    if (radio.write(&payload, sizeof(payload))) {
+    // Anything left over is a late reply from an earlier exchange, not this one's ACK payload
+    radio.flush_rx();
+    if (radio.write(payload, len)) {
+      if (readAckPayload(response)) {
+        success = true;
+        break;
+      }
+
       radio.startListening();
 
       if (readResponse(response))  {
@@ -446,37 +597,90 @@ bool sendMessage(uint8_t cmd, uint32_t *data, uint32_t *response) {
   Serial.print(F("\tRetry: "));
   Serial.println(retry_count);
 #endif
-    payload[4] = retry_count;
+    frameSetRetries(payload, FRAME_VERSION, retry_count);
 
-    delay(random(250, 1250));
+    backoffSleep(random(RETRY_BACKOFF_MIN_MS, RETRY_BACKOFF_MAX_MS));
   }
 
-  // Increment every unique message sent
-  message_counter++;
+  // Increment every unique status message sent.  Finding a collector doesn't count, so the
+  // collector sees no gap in the status counters.
+  if (cmd != COMMAND_FIND_COLLECTOR) {
+    message_counter++;
+  }
 
   return success;
 }
 
-uint8_t readResponse(uint32_t *value) {
-  // Response is always the sensor ID and a value
-  uint32_t response[2];
+// Takes a reply the collector sent in the ACK to our last write, copying its words after
+// the sensor ID into values.  Replies queued for whichever sensor's frame comes next have
+// FRAME_REPLY_ANY_SENSOR in place of the ID.  Another collector on our channel ACKs our
+// frames too, so only a payload with our collector's ID is taken.  Flush RX before the
+// write, or a late reply left in the FIFO is taken for the ACK payload.
+bool readAckPayload(uint32_t *values) {
+#if FRAME_VERSION != FRAME_VERSION_LEGACY
+  uint32_t response[RESPONSE_PACKET_LEN];
+
+  if (!radio.isAckPayloadAvailable()) {
+    return false;
+  }
 
-  // Set up a timeout period, get the current microseconds
-  unsigned long started_micros = micros();
+  memset(response, 0, sizeof(response));
+  radio.read(&response, min(radio.getDynamicPayloadSize(), sizeof(response)));
+  if (response[FRAME_REPLY_IDX_SENSOR_ID] != registry.getSelfID() &&
+      response[FRAME_REPLY_IDX_SENSOR_ID] != FRAME_REPLY_ANY_SENSOR) {
+    return false;
+  }
+  if (response[FRAME_REPLY_IDX_COLLECTOR_ID] != registry.getCollectorID()) {
+    return false;
+  }
+  memcpy(values, response + 1, sizeof(response) - sizeof(response[0]));
+  syncClock(response[FRAME_REPLY_IDX_TIME]);
+  takeSlot(response[FRAME_REPLY_IDX_SLOT_DELAY], response[FRAME_REPLY_IDX_SLOT_INTERVAL]);
+  return true;
+#else
+  return false;
+#endif
+}
 
-  // Loop until we get a valid response or hit the TTL
-  while ((micros() - started_micros) < MESSAGE_ACK_TTL) {
-    if (radio.available()) {
+// Copies the reply's words after the sensor ID into values
+uint8_t readResponse(uint32_t *values) {
+  // Response is always the sensor ID and a value, maybe followed by more
+  uint32_t response[RESPONSE_PACKET_LEN];
+  uint8_t len = sizeof(response);
+  uint8_t ticks = 0;
+
+  // Sleep until the radio has something or we hit the TTL.  Anything not for us just means
+  // going back to sleep for what's left of it.
+  startShortWait(ACK_WAIT_WDT);
+  while (true) {
+    // Anything arriving after this wakes us straight away
+    radio_irq = false;
+    while (radio.available()) {
       // Read the message we got
-      radio.read(&response, sizeof(response));
+      memset(response, 0, sizeof(response));
+#if FRAME_VERSION != FRAME_VERSION_LEGACY
+      len = min(radio.getDynamicPayloadSize(), sizeof(response));
+#endif
+      radio.read(&response, len);
 
       // If its for us return success
-      if (response[0] == registry.getSelfID()) {
-        *value = response[1];
+      if (response[FRAME_REPLY_IDX_SENSOR_ID] == registry.getSelfID()) {
+        memcpy(values, response + 1, sizeof(response) - sizeof(response[0]));
+        endShortWait();
+        syncClock(response[FRAME_REPLY_IDX_TIME]);
+        takeSlot(response[FRAME_REPLY_IDX_SLOT_DELAY], response[FRAME_REPLY_IDX_SLOT_INTERVAL]);
         return 1;
       }
     }
+
+    if (ticks >= ACK_WAIT_TICKS) {
+      break;
+    }
+    if (sleepShortWait(ACK_WAKE_ON_RADIO)) {
+      ticks++;
+    }
   }
+  endShortWait();
 
 #if defined(__AVR_ATmega328P__)
   Serial.print(F("\t\ttimeout"));
@@ -506,14 +710,16 @@ void systemSleep() {
   sleep_disable();
 }
 
-void wakeSystem() {
+void wakeSystem(bool with_radio) {
   // Power on and startup.  The code following the delay takes
   // on order of a a few ms, so there's little use trying include that
   // time to reduce this delay.
   SENSOR_POWER_ON;
 
   // Start the radio
-  radio.powerUp();
+  if (with_radio) {
+    radio.powerUp();
+  }
 
   // Switch Analog to Digitalconverter ON
   sbi(ADCSRA, ADEN);
@@ -532,7 +738,85 @@ void wakeSystem() {
 
 // Watchdog Interrupt Service / is executed when watchdog times out
 ISR(WDT_vect) {
-  reset_watchdog = true;
+  if (short_wait) {
+    short_wait_ticks++;
+  } else {
+    reset_watchdog = true;
+  }
+}
+
+#ifdef RADIO_IRQ_PIN
+ISR(RADIO_IRQ_VECT) {
+  radio_irq = true;
+}
+#endif
+
+// Time short waits with the watchdog at the given WDT_ level, in place of the sleep cycle
+// timeout, until endShortWait()
+void startShortWait(uint8_t level) {
+  short_wait_level = level;
+  short_wait = true;
+  wdt_reset();
+  setupWatchdog(level);
+}
+
+// Power down until the next watchdog tick, or until the radio's IRQ if wake_on_radio, leaving
+// the radio as it is.  Returns whether the watchdog ticked, which our clock is advanced by.
+bool sleepShortWait(bool wake_on_radio) {
+  bool ticked;
+
+#if defined(__AVR_ATmega328P__)
+  Serial.flush();
+#endif
+
+  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+
+  // Interrupts are only enabled again right before sleeping, so an IRQ or tick can't slip in
+  // between checking for it and going to sleep
+  cli();
+  uint8_t ticks = short_wait_ticks;
+  while (short_wait_ticks == ticks && !(wake_on_radio && radio_irq)) {
+    sleep_enable();
+    sei();
+    sleep_cpu();
+    sleep_disable();
+    cli();
+  }
+  ticked = short_wait_ticks != ticks;
+  sei();
+
+  if (ticked) {
+    clock_ms += WDT_PERIOD_MS(short_wait_level);
+  }
+  return ticked;
+}
+
+// Back to the sleep cycle timeout, starting a full period from now
+void endShortWait(void) {
+  short_wait = false;
+  wdt_reset();
+  setupWatchdog(WDT_TIMEOUT);
+}
+
+// Sleep through a retry backoff with the radio in standby
+void backoffSleep(uint16_t ms) {
+  radio.stopListening();
+  shortSleep(ms);
+}
+
+// Sleep for ms, to the nearest watchdog tick below, in the longest ticks that fit
+void shortSleep(uint16_t ms) {
+  uint8_t level = WDT_8s;
+
+  while (ms >= WDT_PERIOD_MS(WDT_16ms)) {
+    while (WDT_PERIOD_MS(level) > ms) {
+      level--;
+    }
+    startShortWait(level);
+    sleepShortWait(false);
+    ms -= WDT_PERIOD_MS(level);
+  }
+  endShortWait();
 }
 
 void deepSleep(uint32_t cycles) {
@@ -542,7 +826,230 @@ void deepSleep(uint32_t cycles) {
     systemSleep();
     sleep_cycles--;
   }
-  wakeSystem();
+  wakeSystem(true);
+}
+
+// Collector time in seconds for a span of our clock
+uint32_t clockSeconds(uint32_t ms) {
+  uint32_t seconds = ms / 1000;
+  return seconds + (((int32_t) seconds * (int16_t) (clock_scale - CLOCK_SCALE_ONE)) >> 10);
+}
+
+// Work out how fast our clock runs compared to the collector's from the time in its replies
+void syncClock(uint32_t time) {
+  if (time == 0) {
+    return;
+  }
+  if (sync_time == 0 || time < sync_time) {
+    sync_time = time;
+    sync_clock_ms = clock_ms;
+    return;
+  }
+
+  uint32_t elapsed = (clock_ms - sync_clock_ms) / 1000;
+  uint32_t actual = time - sync_time;
+  if (elapsed < CLOCK_SYNC_MIN_S) {
+    return;
+  }
+  // Shifted up it still has to fit in 32 bits
+  if (actual < (1UL << 21)) {
+    clock_scale = constrain((actual << 10) / elapsed, CLOCK_SCALE_MIN, CLOCK_SCALE_MAX);
+  }
+  sync_time = time;
+  sync_clock_ms = clock_ms;
+
+#if defined(__AVR_ATmega328P__)
+  Serial.print(F("\tClock scale: "));
+  Serial.println(clock_scale);
+#endif
+}
+
+// Our time for a span of the collector's, the other way round to clockSeconds()
+uint32_t localMillis(uint32_t ms) {
+  return (ms / clock_scale) * CLOCK_SCALE_ONE + ((ms % clock_scale) * CLOCK_SCALE_ONE) / clock_scale;
+}
+
+// Move our reports to the slot in the collector's reply, delay_ms from now and every
+// interval_ms after that.  The delay is counted from now, so the watchdog starts its
+// period again.
+void takeSlot(uint32_t delay_ms, uint32_t interval_ms) {
+  uint32_t wake_ms = SLEEP_CYCLES * WDT_PERIOD_MS(WDT_TIMEOUT);
+
+  if (delay_ms == 0 || interval_ms == 0) {
+    return;
+  }
+  delay_ms = localMillis(delay_ms);
+  interval_ms = localMillis(interval_ms);
+
+  // Too soon for our next wake, so it's the turn after
+  if (delay_ms < wake_ms) {
+    delay_ms += interval_ms;
+  }
+
+  slot_interval_wakes = max(1, (interval_ms + wake_ms / 2) / wake_ms);
+  slot_wakes = max(1, delay_ms / wake_ms);
+  slot_shift_ms = delay_ms % wake_ms;
+  wdt_reset();
+}
+
+// Counts the wakes down to our slot.  True on the wake it comes round, when the count
+// starts again from the interval.
+bool slotDue(void) {
+  if (slot_wakes > 1) {
+    slot_wakes--;
+    return false;
+  }
+  slot_wakes = slot_interval_wakes;
+  return true;
+}
+
+// Take a reading and add it to the ring, dropping the oldest if it's full
+void storeReading(void) {
+  uint32_t reading = takeReading();
+
+  if (ring_count == READING_RING_SIZE) {
+    ring_head = (ring_head + 1) % READING_RING_SIZE;
+    ring_count--;
+    ring_first_counter++;
+  }
+  if (ring_count == 0) {
+    ring_first_counter = reading_counter;
+  }
+
+  registry.reserveCounter(reading_counter);
+  reading_ring[(ring_head + ring_count) % READING_RING_SIZE] = reading;
+  ring_count++;
+  reading_counter++;
+  newest_reading_ms = clock_ms;
+}
+
+// Whether any stored reading has changed since the last one reported
+bool ringChanged(void) {
+  for (uint8_t i = 0; i < ring_count; i++) {
+    if (readingChanged(reading_ring[(ring_head + i) % READING_RING_SIZE])) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Forget the stored readings without sending them, as none of them changed.  Their counters are
+// handed out again, so the collector sees no gap and fills the last reported reading forward.
+void dropUnchangedReadings(void) {
+  reading_counter -= ring_count;
+  ring_head = (ring_head + ring_count) % READING_RING_SIZE;
+  ring_count = 0;
+}
+
+// Send the oldest stored readings in a burst of batch frames, and drop them once the collector
+// replies to the last one.  A retry resends the whole burst; the collector drops the duplicates.
+bool uploadReadings(void) {
+  FrameBatch batch;
+  uint8_t payload[FRAME_MAX_LEN];
+  uint32_t result[RESPONSE_PACKET_LEN - 1];
+  uint8_t retry_count = 0;
+
+  uint8_t count = min(ring_count, BATCH_BURST_FRAMES * FRAME_BATCH_MAX);
+  uint8_t frames = (count + FRAME_BATCH_MAX - 1) / FRAME_BATCH_MAX;
+  uint16_t interval = clockSeconds(SLEEP_CYCLES * WDT_PERIOD_MS(WDT_TIMEOUT));
+  uint32_t newest_age = clockSeconds(clock_ms - newest_reading_ms);
+
+#if defined(__AVR_ATmega328P__)
+  Serial.print(F("Uploading readings: "));
+  Serial.println(count);
+#endif
+
+  batch.frame.version = FRAME_VERSION_COMPACT;
+  batch.frame.cmd = COMMAND_BATCH;
+  batch.frame.sensor_id = registry.getSelfID();
+  batch.frame.collector_id = registry.getCollectorID();
+  batch.interval = interval;
+
+  while (count > 0 && retry_count <= MAX_RETRIES) {
+    bool sent = true;
+    bool replied = false;
+
+    radio.stopListening();
+    for (uint8_t f = 0; f < frames && sent; f++) {
+      uint8_t first = f * FRAME_BATCH_MAX;
+
+      batch.count = min(count - first, FRAME_BATCH_MAX);
+      batch.more = f < frames - 1;
+      batch.frame.retries = retry_count;
+      batch.frame.counter = ring_first_counter + first;
+      // Age of the newest reading in this frame
+      batch.age = newest_age + (uint32_t) (ring_count - first - batch.count) * interval;
+      for (uint8_t i = 0; i < batch.count; i++) {
+        batch.readings[i] = reading_ring[(ring_head + first + i) % READING_RING_SIZE];
+      }
+      if (first == 0 && !boot_reported) {
+        batch.readings[0] |= FRAME_FLAG_BOOT;
+      }
+
+      radio.flush_rx();
+      sent = radio.write(payload, frameEncodeBatch(&batch, payload));
+
+      // Only the reply to the last frame counts, but an earlier one may have taken the
+      // collector's ACK payload
+      replied = sent && readAckPayload(result);
+    }
+
+    if (sent && !replied) {
+      radio.startListening();
+      replied = readResponse(result);
+    }
+
+    if (replied && result[0] == 1) {
+      last_report = reading_ring[(ring_head + count - 1) % READING_RING_SIZE];
+      report_wakes = 0;
+      ring_head = (ring_head + count) % READING_RING_SIZE;
+      ring_count -= count;
+      ring_first_counter += count;
+      boot_reported = true;
+      return true;
+    }
+
+    retry_count++;
+#if defined(__AVR_ATmega328P__)
+  Serial.print(F("\tRetry: "));
+  Serial.println(retry_count);
+#endif
+    backoffSleep(random(RETRY_BACKOFF_MIN_MS, RETRY_BACKOFF_MAX_MS));
+  }
+
+  return false;
+}
+
+// Store a reading, and every BATCH_UPLOAD_WAKES wakes upload what's stored if any of it has
+// changed or the heartbeat is due.  The radio stays powered down the rest of the time.
+void batchWake(void) {
+  bool upload = slot_interval_wakes > 0 ? slotDue() : ++upload_wakes >= BATCH_UPLOAD_WAKES;
+  bool heartbeat = heartbeatDue();
+
+  wakeSystem(false);
+  storeReading();
+
+  if (upload) {
+    upload_wakes = 0;
+
+    if (registry.hasCollectorID() && !heartbeat && !ringChanged()) {
+      dropUnchangedReadings();
+      return;
+    }
+    if (heartbeat && !ringChanged()) {
+      reading_ring[(ring_head + ring_count - 1) % READING_RING_SIZE] |= FRAME_FLAG_HEARTBEAT;
+    }
+
+    LED_ON;
+    radio.powerUp();
+    if (!registry.hasCollectorID()) {
+      refreshCollectorID();
+    }
+    if (registry.hasCollectorID()) {
+      uploadReadings();
+    }
+    LED_OFF;
+  }
 }
 
 void loop(void) {
@@ -551,19 +1058,33 @@ void loop(void) {
 
   if (reset_watchdog) {
     reset_watchdog = false;
+    clock_ms += WDT_PERIOD_MS(WDT_TIMEOUT);
+
+    // Still powered down, so line this wake up with our slot first
+    if (slot_shift_ms > 0) {
+      shortSleep(slot_shift_ms);
+      slot_shift_ms = 0;
+    }
 
     if (sleep_cycles <= 0) {
-      wakeSystem();
+#if BATCH_UPLOAD_WAKES > 0 && FRAME_VERSION != FRAME_VERSION_LEGACY
+      batchWake();
+#else
+      wakeSystem(false);
 
       LED_ON;
       if (registry.hasCollectorID()) {
-        sendStatus();
+        if (slot_interval_wakes == 0 || slotDue()) {
+          reportStatus();
+        }
       } else {
+        radio.powerUp();
         refreshCollectorID();
       }
+      LED_OFF;
+#endif
 
       sleep_cycles = SLEEP_CYCLES;
-      LED_OFF;
     }
 
     systemSleep();
@@ -1,6 +1,8 @@
 
 #include "stdio.h"
+#include <avr/interrupt.h>
 #include <avr/io.h>
+#include <avr/sleep.h>
 #include <stdint.h>
 #include <util/delay.h>
 
@@ -24,21 +26,76 @@ uint8_t rx_address[5] = {0x32,0x4e,0x6f,0x64,0x65};
 #define OK_LED 5
 #define ERR_LED 6
 
+// PB5 is SCK on the hardware SPI
+#if NRF24_SPI == NRF24_SPI_HW
+#define LED_DDR DDRD
+#define LED_PORT PORTD
+#else
+#define LED_DDR DDRB
+#define LED_PORT PORTB
+#endif
+
 void setup_leds(void) {
-    DDRB |= _BV(OK_LED) | _BV(ERR_LED);
+    LED_DDR |= _BV(OK_LED) | _BV(ERR_LED);
 }
 
 void ok_led(void) {
-    PORTB |= _BV(OK_LED);
+    LED_PORT |= _BV(OK_LED);
     _delay_ms(300);
-    PORTB &= ~_BV(OK_LED);
+    LED_PORT &= ~_BV(OK_LED);
 }
 
 void err_led(void) {
-    PORTB |= _BV(ERR_LED);
+    LED_PORT |= _BV(ERR_LED);
     _delay_ms(300);
-    PORTB &= ~_BV(ERR_LED);
+    LED_PORT &= ~_BV(ERR_LED);
+}
+
+// Powers down until the radio pulls its IRQ pin low.  Checked with interrupts off, and
+// sei() only takes effect after the next instruction, so an IRQ that comes in between
+// can't be missed.
+void sleep_until_irq(void) {
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+    cli();
+    if (nrf24_irq_digitalRead()) {
+        sleep_enable();
+        sei();
+        sleep_cpu();
+        sleep_disable();
+    }
+    sei();
+}
+
+#ifdef NRF24_MEASURE
+// Cycles the last nrf24_send() and nrf24_getData() took, less the cost of timing them,
+// to read with a debugger or simavr's gdb stub
+volatile uint16_t send_cycles;
+volatile uint16_t get_data_cycles;
+uint16_t timer_cycles;
+
+// A 16 bit timer counting every cycle: Timer1 on an ATmega, Timer0 in 16 bit mode on an
+// ATtiny861
+#if defined(TCNT1H)
+#define cycle_timer_start() do { TCCR1A = 0; TCCR1B = _BV(CS10); } while (0)
+#define cycle_timer_read() TCNT1
+#elif defined(TCW0)
+#define cycle_timer_start() do { TCCR0A = _BV(TCW0); TCCR0B = _BV(CS00); } while (0)
+static inline uint16_t cycle_timer_read(void) {
+    uint8_t low = TCNT0L;
+    return low | (uint16_t) TCNT0H << 8;
 }
+#else
+#error "No 16 bit timer to count cycles with"
+#endif
+
+#define measure(cycles, call) do {                              \
+        uint16_t start = cycle_timer_read();                    \
+        call;                                                   \
+        cycles = cycle_timer_read() - start - timer_cycles;     \
+    } while (0)
+#else
+#define measure(cycles, call) call
+#endif
 
 int main(void) {
     for (int x=0; x < 3; x ++) {
@@ -56,6 +113,14 @@ int main(void) {
     nrf24_tx_address(tx_address);
     nrf24_rx_address(rx_address);    
 
+    sei();
+
+#ifdef NRF24_MEASURE
+    cycle_timer_start();
+    // What timing costs by itself, taken off the rest
+    measure(timer_cycles, );
+#endif
+
     while (1) {
         /* Fill the data buffer */
         data_array[0] = 0x00;
@@ -64,13 +129,12 @@ int main(void) {
         data_array[3] = q++;                                    
 
         /* Automatically goes to TX mode */
-        nrf24_send(data_array);        
+        measure(send_cycles, nrf24_send(data_array));
         
-        /* Wait for transmission to end */
-        while (nrf24_isSending());
-
-        /* Make analysis on last transmission attempt */
-        temp = nrf24_lastMessageStatus();
+        /* Sleep until the transmission ends, and see how it went */
+        while ((temp = nrf24_txComplete()) == NRF24_SENDING) {
+            sleep_until_irq();
+        }
 
         if (temp == NRF24_TRANSMISSON_OK) {
             //xprintf("> Tranmission went OK\r\n");
@@ -87,6 +151,11 @@ int main(void) {
 		/* Optionally, go back to RX mode ... */
 		nrf24_powerUpRx();
 
+#ifdef NRF24_MEASURE
+		/* Takes as long with the FIFO empty */
+		measure(get_data_cycles, nrf24_getData(data_array));
+#endif
+
 		/* Or you might want to power down after TX */
 		// nrf24_powerDown();            
 
@@ -15,6 +15,11 @@
 #include "radioPinFunctions.h"
 
 uint8_t payload_len;
+uint8_t features;
+uint8_t tx_mode;
+
+static void nrf24_flushTx(void);
+static void nrf24_setFeatures(uint8_t value);
 
 /* init the hardware pins */
 void nrf24_init(void)
@@ -27,7 +32,7 @@ void nrf24_init(void)
 /* configure the module */
 void nrf24_config(uint8_t channel, uint8_t pay_length)
 {
-    /* Use static payload length ... */
+    /* Use static payload length, or dynamic if it's nrf24_DYNAMIC_PAYLOAD */
     payload_len = pay_length;
 
     // Set RF channel
@@ -56,8 +61,19 @@ void nrf24_config(uint8_t channel, uint8_t pay_length)
     // Auto retransmit delay: 1000 us and Up to 15 retransmit trials
     nrf24_configRegister(SETUP_RETR,(0x04<<ARD)|(0x0F<<ARC));
 
-    // Dynamic length configurations: No dynamic length
-    nrf24_configRegister(DYNPD,(0<<DPL_P0)|(0<<DPL_P1)|(0<<DPL_P2)|(0<<DPL_P3)|(0<<DPL_P4)|(0<<DPL_P5));
+    // Dynamic length configurations: on the data pipe and the ACK pipe, or none
+    if(payload_len == nrf24_DYNAMIC_PAYLOAD)
+    {
+        features = (1<<EN_DPL);
+        nrf24_setFeatures(features);
+        nrf24_configRegister(DYNPD,(1<<DPL_P0)|(1<<DPL_P1)|(0<<DPL_P2)|(0<<DPL_P3)|(0<<DPL_P4)|(0<<DPL_P5));
+    }
+    else
+    {
+        features = 0;
+        nrf24_configRegister(DYNPD,(0<<DPL_P0)|(0<<DPL_P1)|(0<<DPL_P2)|(0<<DPL_P3)|(0<<DPL_P4)|(0<<DPL_P5));
+        nrf24_setFeatures(features);
+    }
 
     // Start listening
     nrf24_powerUpRx();
@@ -126,6 +142,29 @@ uint8_t nrf24_payloadLength()
 /* Reads payload bytes into data array */
 void nrf24_getData(uint8_t* data) 
 {
+    nrf24_getPayload(data);
+}
+
+/* Reads payload bytes into data array, and returns how many */
+uint8_t nrf24_getPayload(uint8_t* data)
+{
+    uint8_t len = payload_len;
+
+    if(len == nrf24_DYNAMIC_PAYLOAD)
+    {
+        len = nrf24_payloadLength();
+
+        /* A width over 32 means the payload is corrupt, and has to be flushed */
+        if(len > nrf24_MAX_PAYLOAD)
+        {
+            nrf24_csn_digitalWrite(LOW);
+            spi_transfer(FLUSH_RX);
+            nrf24_csn_digitalWrite(HIGH);
+            nrf24_configRegister(STATUS,(1<<RX_DR));
+            return 0;
+        }
+    }
+
     /* Pull down chip select */
     nrf24_csn_digitalWrite(LOW);                               
 
@@ -133,13 +172,30 @@ void nrf24_getData(uint8_t* data)
     spi_transfer( R_RX_PAYLOAD );
     
     /* Read payload */
-    nrf24_transferSync(data,data,payload_len);
+    nrf24_transferSync(data,data,len);
     
     /* Pull up chip select */
     nrf24_csn_digitalWrite(HIGH);
 
     /* Reset status register */
     nrf24_configRegister(STATUS,(1<<RX_DR));   
+
+    return len;
+}
+
+void nrf24_enableAckPayload(void)
+{
+    features |= (1<<EN_ACK_PAY);
+    nrf24_setFeatures(features);
+}
+
+/* Load a payload to go back with the ACK to the next frame on pipe */
+void nrf24_writeAckPayload(uint8_t pipe, uint8_t* value, uint8_t len)
+{
+    nrf24_csn_digitalWrite(LOW);
+    spi_transfer(W_ACK_PAYLOAD | (pipe & 0x07));
+    nrf24_transmitSync(value,len);
+    nrf24_csn_digitalWrite(HIGH);
 }
 
 /* Returns the number of retransmissions occured for the last message */
@@ -152,26 +208,31 @@ uint8_t nrf24_retransmissionCount()
 }
 
 // Sends a data package to the default address. Be sure to send the correct
-// amount of bytes as configured as payload on the receiver.
+// amount of bytes as configured as payload on the receiver. With dynamic
+// payloads, use nrf24_queue() instead.
 void nrf24_send(uint8_t* value) 
 {    
-    /* Go to Standby-I first */
-    nrf24_ce_digitalWrite(LOW);
-     
-    /* Set to transmitter mode , Power up if needed */
-    nrf24_powerUpTx();
+    nrf24_queue(value,payload_len);
+}
 
-    /* Do we really need to flush TX fifo each time ? */
-    #if 1
-        /* Pull down chip select */
-        nrf24_csn_digitalWrite(LOW);           
+uint8_t nrf24_queue(uint8_t* value, uint8_t len)
+{
+    if(!tx_mode)
+    {
+        /* Go to Standby-I first */
+        nrf24_ce_digitalWrite(LOW);
 
-        /* Write cmd to flush transmit FIFO */
-        spi_transfer(FLUSH_TX);     
+        /* Set to transmitter mode , Power up if needed */
+        nrf24_powerUpTx();
 
-        /* Pull up chip select */
-        nrf24_csn_digitalWrite(HIGH);                    
-    #endif 
+        /* Anything still in the TX FIFO is a frame that was lost and never
+           flushed, which would go out ahead of this one */
+        nrf24_flushTx();
+    }
+    else if(nrf24_txFifoFull())
+    {
+        return 0;
+    }
 
     /* Pull down chip select */
     nrf24_csn_digitalWrite(LOW);
@@ -180,13 +241,51 @@ void nrf24_send(uint8_t* value)
     spi_transfer(W_TX_PAYLOAD);
 
     /* Write payload */
-    nrf24_transmitSync(value,payload_len);   
+    nrf24_transmitSync(value,len);   
 
     /* Pull up chip select */
     nrf24_csn_digitalWrite(HIGH);
 
-    /* Start the transmission */
+    /* Start the transmission. CE stays high, so the radio carries on through
+       the FIFO as more frames are queued. */
     nrf24_ce_digitalWrite(HIGH);    
+
+    return 1;
+}
+
+uint8_t nrf24_txFifoFull()
+{
+    return nrf24_getStatus() & (1 << TX_FULL);
+}
+
+uint8_t nrf24_txComplete()
+{
+    uint8_t status;
+    uint8_t fifoStatus;
+
+    status = nrf24_getStatus();
+
+    /* The radio stops with the lost frame at the head of the FIFO */
+    if(status & (1 << MAX_RT))
+    {
+        nrf24_flushTx();
+        nrf24_configRegister(STATUS,(1<<TX_DS)|(1<<MAX_RT));
+        return NRF24_MESSAGE_LOST;
+    }
+
+    /* Frames are only taken out of the FIFO once they're acknowledged */
+    if(status & (1 << TX_DS))
+    {
+        nrf24_configRegister(STATUS,(1<<TX_DS));
+    }
+
+    nrf24_readRegister(FIFO_STATUS,&fifoStatus,1);
+    if(fifoStatus & (1 << TX_EMPTY))
+    {
+        return NRF24_TRANSMISSON_OK;
+    }
+
+    return NRF24_SENDING;
 }
 
 uint8_t nrf24_isSending()
@@ -235,7 +334,7 @@ uint8_t nrf24_lastMessageStatus()
     /* Probably still sending ... */
     else
     {
-        return 0xFF;
+        return NRF24_SENDING;
     }
 }
 
@@ -250,6 +349,7 @@ void nrf24_powerUpRx()
     nrf24_ce_digitalWrite(LOW);    
     nrf24_configRegister(CONFIG,nrf24_CONFIG|((1<<PWR_UP)|(1<<PRIM_RX)));    
     nrf24_ce_digitalWrite(HIGH);
+    tx_mode = 0;
 }
 
 void nrf24_powerUpTx()
@@ -257,14 +357,146 @@ void nrf24_powerUpTx()
     nrf24_configRegister(STATUS,(1<<RX_DR)|(1<<TX_DS)|(1<<MAX_RT)); 
 
     nrf24_configRegister(CONFIG,nrf24_CONFIG|((1<<PWR_UP)|(0<<PRIM_RX)));
+    tx_mode = 1;
 }
 
 void nrf24_powerDown()
 {
     nrf24_ce_digitalWrite(LOW);
     nrf24_configRegister(CONFIG,nrf24_CONFIG);
+    tx_mode = 0;
 }
 
+static void nrf24_flushTx(void)
+{
+    nrf24_csn_digitalWrite(LOW);
+    spi_transfer(FLUSH_TX);
+    nrf24_csn_digitalWrite(HIGH);
+}
+
+/* An nRF24L01 (not +) reads FEATURE back as 0 until it's been activated */
+static void nrf24_setFeatures(uint8_t value)
+{
+    uint8_t readback;
+
+    nrf24_configRegister(FEATURE,value);
+    nrf24_readRegister(FEATURE,&readback,1);
+    if(readback != value)
+    {
+        nrf24_csn_digitalWrite(LOW);
+        spi_transfer(ACTIVATE);
+        spi_transfer(nrf24_ACTIVATE_FEATURES);
+        nrf24_csn_digitalWrite(HIGH);
+        nrf24_configRegister(FEATURE,value);
+    }
+}
+
+#if NRF24_SPI == NRF24_SPI_HW
+
+/* hardware spi routine */
+uint8_t spi_transfer(uint8_t tx)
+{
+    SPDR = tx;
+    while(!(SPSR & (1<<SPIF)));
+    return SPDR;
+}
+
+/* send and receive multiple bytes over SPI */
+/* Each byte goes into SPDR as soon as the last is out. The byte that came in
+   stays in the receive buffer until the next one is done, so it's read after. */
+void nrf24_transferSync(uint8_t* dataout,uint8_t* datain,uint8_t len)
+{
+    uint8_t next;
+
+    if(len == 0)
+    {
+        return;
+    }
+
+    SPDR = *dataout++;
+    while(--len)
+    {
+        next = *dataout++;
+        while(!(SPSR & (1<<SPIF)));
+        SPDR = next;
+        *datain++ = SPDR;
+    }
+    while(!(SPSR & (1<<SPIF)));
+    *datain = SPDR;
+}
+
+/* send multiple bytes over SPI */
+void nrf24_transmitSync(uint8_t* dataout,uint8_t len)
+{
+    uint8_t next;
+
+    if(len == 0)
+    {
+        return;
+    }
+
+    SPDR = *dataout++;
+    while(--len)
+    {
+        next = *dataout++;
+        while(!(SPSR & (1<<SPIF)));
+        SPDR = next;
+    }
+    while(!(SPSR & (1<<SPIF)));
+}
+
+#elif NRF24_SPI == NRF24_SPI_USI
+
+/* USICR values for the two halves of an SCK cycle: toggle USCK, then toggle it
+   back and shift */
+#define USI_SCK_HIGH ((1<<USIWM0)|(1<<USITC))
+#define USI_SCK_LOW  ((1<<USIWM0)|(1<<USITC)|(1<<USICLK))
+
+/* Sixteen single cycle writes to USICR, so SCK runs at F_CPU/2 */
+static inline uint8_t usi_transfer(uint8_t tx) __attribute__((always_inline));
+static inline uint8_t usi_transfer(uint8_t tx)
+{
+    const uint8_t high = USI_SCK_HIGH;
+    const uint8_t low = USI_SCK_LOW;
+
+    USIDR = tx;
+    USICR = high; USICR = low;
+    USICR = high; USICR = low;
+    USICR = high; USICR = low;
+    USICR = high; USICR = low;
+    USICR = high; USICR = low;
+    USICR = high; USICR = low;
+    USICR = high; USICR = low;
+    USICR = high; USICR = low;
+    return USIDR;
+}
+
+/* usi spi routine */
+uint8_t spi_transfer(uint8_t tx)
+{
+    return usi_transfer(tx);
+}
+
+/* send and receive multiple bytes over SPI, without a call per byte */
+void nrf24_transferSync(uint8_t* dataout,uint8_t* datain,uint8_t len)
+{
+    while(len--)
+    {
+        *datain++ = usi_transfer(*dataout++);
+    }
+}
+
+/* send multiple bytes over SPI */
+void nrf24_transmitSync(uint8_t* dataout,uint8_t len)
+{
+    while(len--)
+    {
+        usi_transfer(*dataout++);
+    }
+}
+
+#else
+
 /* software spi routine */
 uint8_t spi_transfer(uint8_t tx)
 {
@@ -324,6 +556,8 @@ void nrf24_transmitSync(uint8_t* dataout,uint8_t len)
 
 }
 
+#endif
+
 /* Clocks only one byte into the given nrf24 register */
 void nrf24_configRegister(uint8_t reg, uint8_t value)
 {
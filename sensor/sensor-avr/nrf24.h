@@ -25,6 +25,14 @@
 
 #define NRF24_TRANSMISSON_OK 0
 #define NRF24_MESSAGE_LOST   1
+#define NRF24_SENDING        0xFF
+
+/* pay_length for nrf24_config() to take payloads of any length up to this */
+#define nrf24_DYNAMIC_PAYLOAD 0
+#define nrf24_MAX_PAYLOAD 32
+
+/* ACTIVATE's argument, to make an nRF24L01 (not +) show its FEATURE register */
+#define nrf24_ACTIVATE_FEATURES 0x73
 
 /* adjustment functions */
 void    nrf24_init(void);
@@ -42,8 +50,34 @@ uint8_t nrf24_rxFifoEmpty(void);
 void    nrf24_send(uint8_t* value);
 void    nrf24_getData(uint8_t* data);
 
+/* Queue a frame of len bytes behind any still in the TX FIFO, which holds
+ * three, and start sending. Returns 0 if the FIFO is full. The radio stays
+ * in TX until nrf24_powerUpRx() or nrf24_powerDown(). */
+uint8_t nrf24_queue(uint8_t* value, uint8_t len);
+uint8_t nrf24_txFifoFull(void);
+
+/* Call once the IRQ pin goes low, or any time, to see how the queued frames
+ * went. Clears TX_DS and MAX_RT, so the IRQ pin goes high again. Returns
+ *    - NRF24_TRANSMISSON_OK once every queued frame has been acknowledged
+ *    - NRF24_MESSAGE_LOST if one ran out of retries. It and any behind it
+ *      are flushed.
+ *    - NRF24_SENDING while frames are still waiting to go
+ * The IRQ pin stays low while RX_DR is set, as it is when an ACK brings a
+ * payload back, until the payload is read. */
+uint8_t nrf24_txComplete(void);
+
 /* use in dynamic length mode */
 uint8_t nrf24_payloadLength(void);
+/* Reads a payload into data, which has room for nrf24_MAX_PAYLOAD bytes, and
+ * returns its length. 0 if it was corrupt and thrown away. */
+uint8_t nrf24_getPayload(uint8_t* data);
+
+/* ACK payloads, in dynamic length mode. As the receiver, load one for a pipe
+ * to go back with the ACK to its next frame. As the sender, ones that come
+ * back are read like any other payload, before nrf24_powerUpRx() flushes
+ * them. */
+void    nrf24_enableAckPayload(void);
+void    nrf24_writeAckPayload(uint8_t pipe, uint8_t* value, uint8_t len);
 
 /* post transmission analysis */
 uint8_t nrf24_lastMessageStatus(void);
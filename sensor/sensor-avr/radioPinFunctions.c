@@ -9,6 +9,7 @@
 * -----------------------------------------------------------------------------
 */
 
+#include <avr/interrupt.h>
 #include <avr/io.h>
 #include "radioPinFunctions.h"
 
@@ -17,51 +18,121 @@
 #define RF_PORT PORTB
 #define RF_PIN  PINB
 
+#if NRF24_SPI == NRF24_SPI_HW
+// The SPI's own pins on an ATmega48/88/168/328.  CSN goes on SS, which has to be an
+// output for the SPI to stay master.
+#define RF_MOSI 3
+#define RF_MISO 4
+#define RF_SCK  5
+#define RF_CE   1
+#define RF_CSN  2
+#elif NRF24_SPI == NRF24_SPI_USI
+// The USI's pins.  DO drives the radio's MOSI and DI reads its MISO, so those two are
+// swapped from the bit-banged wiring.
+#define RF_MOSI 1
+#define RF_MISO 0
+#define RF_SCK  2
+#define RF_CE   3
+#define RF_CSN  4
+#else
+#define RF_MOSI 0
+#define RF_MISO 1
+#define RF_SCK  2
+#define RF_CE   3
+#define RF_CSN  4
+#endif
+
+// The radio's IRQ pin, which wakes the MCU through a pin change interrupt.  Unlike INT0
+// on an ATmega, that works on any edge in power down.  Which pin depends on the MCU, not
+// the transport, as any of them can bit-bang.
+#if defined(__AVR_ATmega48__) || defined(__AVR_ATmega48A__) || defined(__AVR_ATmega48P__) || \
+    defined(__AVR_ATmega48PA__) || defined(__AVR_ATmega88__) || defined(__AVR_ATmega88A__) || \
+    defined(__AVR_ATmega88P__) || defined(__AVR_ATmega88PA__) || defined(__AVR_ATmega168__) || \
+    defined(__AVR_ATmega168A__) || defined(__AVR_ATmega168P__) || defined(__AVR_ATmega168PA__) || \
+    defined(__AVR_ATmega328__) || defined(__AVR_ATmega328P__)
+// PD2, INT0's pin
+#define RF_IRQ_DDR  DDRD
+#define RF_IRQ_PIN  PIND
+#define RF_IRQ      2
+#define RF_IRQ_VECT PCINT2_vect
+#define rf_irq_enable() do { PCMSK2 |= (1<<PCINT18); PCICR |= (1<<PCIE2); } while (0)
+#elif defined(__AVR_ATtiny261__) || defined(__AVR_ATtiny261A__) || defined(__AVR_ATtiny461__) || \
+    defined(__AVR_ATtiny461A__) || defined(__AVR_ATtiny861__) || defined(__AVR_ATtiny861A__)
+// PA0.  PCIE1 also takes in PCINT12-15 on port B, whose masks start out set, and those
+// would wake it on every SCK edge.
+#define RF_IRQ_DDR  DDRA
+#define RF_IRQ_PIN  PINA
+#define RF_IRQ      0
+#define RF_IRQ_VECT PCINT_vect
+#define rf_irq_enable() do { PCMSK0 = (1<<PCINT0); PCMSK1 = 0; GIMSK |= (1<<PCIE1); } while (0)
+#else
+#error "No IRQ pin set for this MCU"
+#endif
+
 #define set_bit(reg, bit) reg |= (1<<bit)
 #define clr_bit(reg, bit) reg &= ~(1<<bit)
 #define check_bit(reg, bit) (reg&(1<<bit))
 
 void nrf24_setupPins(void) {
-    set_bit(RF_DDR, 0); // MOSI output
-    clr_bit(RF_DDR, 1); // MISO input
-    set_bit(RF_DDR, 2); // SCK output
-    set_bit(RF_DDR, 3); // CE output
-    set_bit(RF_DDR, 4); // CSN output
+    set_bit(RF_DDR, RF_MOSI); // MOSI output
+    clr_bit(RF_DDR, RF_MISO); // MISO input
+    set_bit(RF_DDR, RF_SCK); // SCK output
+    set_bit(RF_DDR, RF_CE); // CE output
+    set_bit(RF_DDR, RF_CSN); // CSN output
+    clr_bit(RF_IRQ_DDR, RF_IRQ); // IRQ input
+    rf_irq_enable();
+
+#if NRF24_SPI == NRF24_SPI_HW
+    // Master, mode 0, F_CPU/2
+    SPCR = (1<<SPE)|(1<<MSTR);
+    SPSR = (1<<SPI2X);
+#elif NRF24_SPI == NRF24_SPI_USI
+    // Three-wire mode, clocked by software strobes
+    USICR = (1<<USIWM0);
+#endif
+}
+
+// Only there to wake the MCU, whoever's waiting checks the pin
+EMPTY_INTERRUPT(RF_IRQ_VECT)
 
+uint8_t nrf24_irq_digitalRead() {
+    return check_bit(RF_IRQ_PIN, RF_IRQ);
 }
 
 void nrf24_ce_digitalWrite(uint8_t state) {
     if (state) {
-        set_bit(RF_PORT, 3);
+        set_bit(RF_PORT, RF_CE);
     } else {
-        clr_bit(RF_PORT, 3);
+        clr_bit(RF_PORT, RF_CE);
     }
 }
 
 void nrf24_csn_digitalWrite(uint8_t state) {
     if (state) {
-        set_bit(RF_PORT, 4);
+        set_bit(RF_PORT, RF_CSN);
     } else {
-        clr_bit(RF_PORT, 4);
+        clr_bit(RF_PORT, RF_CSN);
     }
 }
 
+#if NRF24_SPI == NRF24_SPI_BITBANG
 void nrf24_sck_digitalWrite(uint8_t state) {
     if (state) {
-        set_bit(RF_PORT, 2);
+        set_bit(RF_PORT, RF_SCK);
     } else {
-        clr_bit(RF_PORT, 2);
+        clr_bit(RF_PORT, RF_SCK);
     }
 }
 
 void nrf24_mosi_digitalWrite(uint8_t state) {
     if (state) {
-        set_bit(RF_PORT, 0);
+        set_bit(RF_PORT, RF_MOSI);
     } else {
-        clr_bit(RF_PORT, 0);
+        clr_bit(RF_PORT, RF_MOSI);
     }
 }
 
 uint8_t nrf24_miso_digitalRead() {
-    return check_bit(RF_PIN, 1);
+    return check_bit(RF_PIN, RF_MISO);
 }
+#endif
@@ -5,15 +5,41 @@
 #ifndef PLANT_SENSOR_RADIOPINFUNCTIONS_H
 #define PLANT_SENSOR_RADIOPINFUNCTIONS_H
 
+#include <avr/io.h>
 #include <stdint.h>
 
+/* -------------------------------------------------------------------------- */
+/* SPI transport to the radio, chosen at compile time with -DNRF24_SPI=...
+ *    - NRF24_SPI_USI: the ATtiny USI in three-wire mode, clocked by strobing
+ *      USICR, so SCK runs at F_CPU/2
+ *    - NRF24_SPI_HW: the ATmega hardware SPI, master at F_CPU/2
+ *    - NRF24_SPI_BITBANG: any pins, through the digitalWrite functions below
+ * Left unset, it's the USI if the MCU has one, then the SPI, then bit-banging.
+ * Keep SCK at 10MHz or under for the radio: F_CPU of 20MHz at most.       */
+/* -------------------------------------------------------------------------- */
+#define NRF24_SPI_BITBANG 0
+#define NRF24_SPI_USI 1
+#define NRF24_SPI_HW 2
+
+#ifndef NRF24_SPI
+#if defined(USIDR)
+#define NRF24_SPI NRF24_SPI_USI
+#elif defined(SPDR)
+#define NRF24_SPI NRF24_SPI_HW
+#else
+#define NRF24_SPI NRF24_SPI_BITBANG
+#endif
+#endif
+
 /* -------------------------------------------------------------------------- */
 /* In this function you should do the following things:
  *    - Set MISO pin input
  *    - Set MOSI pin output
  *    - Set SCK pin output
  *    - Set CSN pin output
- *    - Set CE pin output     */
+ *    - Set CE pin output
+ *    - Set IRQ pin input, with a pin change interrupt to wake the MCU
+ *    - Set up the USI or SPI, if that's the transport */
 /* -------------------------------------------------------------------------- */
 void nrf24_setupPins(void);
 
@@ -31,6 +57,14 @@ void nrf24_ce_digitalWrite(uint8_t state);
 /* -------------------------------------------------------------------------- */
 void nrf24_csn_digitalWrite(uint8_t state);
 
+/* -------------------------------------------------------------------------- */
+/* nrf24 IRQ pin read function, low while the radio has something to say
+ * - returns: Non-zero if the pin is high */
+/* -------------------------------------------------------------------------- */
+uint8_t nrf24_irq_digitalRead(void);
+
+/* The rest are only used to bit-bang */
+
 /* -------------------------------------------------------------------------- */
 /* nrf24 SCK pin control function
  *    - state:1 => Pin HIGH